@@ -0,0 +1,80 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Symbol.hpp"
+#include "SymbolTable.hpp"
+#include "SyntaxParser.hpp"
+#include "TypePool.hpp"
+
+namespace semantic {
+    // dense storage of one value per node of a SyntaxTree, indexed by SyntaxNode::GetId
+    template <typename T>
+    class NodeTable final {
+    public:
+        explicit NodeTable(size_t size) : values_(size) {}
+
+        T &operator[](const SyntaxNode *node) {
+            return values_[node->GetId()];
+        }
+
+        const T &operator[](const SyntaxNode *node) const {
+            return values_[node->GetId()];
+        }
+
+        // the subtree at first_id was replaced by one of new_count nodes and the tree was renumbered, the new nodes get default values
+        void Splice(uint32_t first_id, size_t old_count, size_t new_count) {
+            const auto first = values_.begin() + first_id;
+            values_.erase(first, first + old_count);
+            values_.insert(values_.begin() + first_id, new_count, T());
+        }
+
+    private:
+        std::vector<T> values_;
+    };
+
+    // Everything the semantic analysis learns about a tree. The tree itself stays untouched,
+    // so one parsed tree can be analyzed several times at once, e.g. against different ImportExportTables.
+    class Annotations final {
+    public:
+        explicit Annotations(const SyntaxTree *tree)
+            : type_pool(std::make_unique<TypePool>()),
+              symbol_tables(tree->GetNodeCount()),
+              types(tree->GetNodeCount()),
+              symbols(tree->GetNodeCount()),
+              addresses(tree->GetNodeCount()),
+              break_nodes(tree->GetNodeCount()),
+              return_nodes(tree->GetNodeCount()) {}
+
+        // types of signatures and of everything outside function bodies, every function body gets its own pool on top of it
+        std::unique_ptr<TypePool> type_pool;
+        std::vector<std::unique_ptr<TypePool>> function_type_pools;
+        std::unique_ptr<SymbolTable> symbol_table;
+
+        // scope the node belongs to
+        NodeTable<SymbolTable *> symbol_tables;
+        // type of an expression or the type a TypeNode stands for
+        NodeTable<const ISymbolType *> types;
+        // symbol declared by a function, block, struct, named constant or identifier pattern,
+        // or referenced by an identifier expression, a call and an assignment
+        NodeTable<ISymbol *> symbols;
+        // where the symbol of an identifier expression or a shorthand field was found, relative to symbol_tables
+        NodeTable<ScopeAddress> addresses;
+        NodeTable<std::vector<const BreakNode *>> break_nodes;
+        NodeTable<std::vector<const ReturnNode *>> return_nodes;
+
+        // top-level functions reachable from the exports in tree order, the only ones type-checked and emitted
+        std::vector<const FunctionNode *> reachable_functions;
+
+        // keeps the values of all nodes outside of a replaced subtree, see NodeTable::Splice; QueryEngine::InvalidateBody uses it for a re-parsed body
+        void Splice(uint32_t first_id, size_t old_count, size_t new_count) {
+            symbol_tables.Splice(first_id, old_count, new_count);
+            types.Splice(first_id, old_count, new_count);
+            symbols.Splice(first_id, old_count, new_count);
+            addresses.Splice(first_id, old_count, new_count);
+            break_nodes.Splice(first_id, old_count, new_count);
+            return_nodes.Splice(first_id, old_count, new_count);
+        }
+    };
+}
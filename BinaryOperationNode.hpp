@@ -17,6 +17,9 @@ public:
     void Visit(ISyntaxTreeVisitor *visitor) const override;
 
 private:
+    // SyntaxParser::Reparse moves the token to its new position when an edit shifts it
+    friend class SyntaxParser;
+
     Token token_;
     std::unique_ptr<ExpressionNode> left_, right_;
 };
@@ -20,3 +20,8 @@ std::vector<const SyntaxNode *> BlockNode::GetStatements() const {
 const ExpressionNode *BlockNode::GetReturnExpression() const {
     return return_expression_.get();
 }
+
+void BlockNode::Replace(std::unique_ptr<BlockNode> &&block) {
+    statements_ = std::move(block->statements_);
+    return_expression_ = std::move(block->return_expression_);
+}
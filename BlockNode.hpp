@@ -13,7 +13,8 @@ public:
     std::vector<const SyntaxNode *> GetStatements() const;
     const ExpressionNode *GetReturnExpression() const;
 
-    semantic::BlockSymbol *symbol = nullptr;
+    // takes over the contents of a re-parsed block, the node itself stays in place
+    void Replace(std::unique_ptr<BlockNode> &&block);
 
 private:
     std::vector<std::unique_ptr<SyntaxNode>> statements_;
@@ -0,0 +1,537 @@
+#pragma once
+
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+
+#include "Annotations.hpp"
+#include "SpecificSyntaxTreeVisitor.hpp"
+
+#define NOT_CONSTANT(type)                  \
+    void PostVisit(const type *) override { \
+        throw std::exception();             \
+    }
+
+namespace semantic {
+    // Evaluates constant expressions of a type-checked tree to the values the generated wasm code would compute:
+    // integers wrap around, a division by zero or an overflowing division is an error as it traps in wasm
+    // and a shift takes its count modulo the width. A value is a TokenValue of type kBool, kI32, kI64, kF32 or kF64,
+    // an expression without a value gives kEmpty. Only functions marked `const` can be called.
+    class ConstEvaluator final : private SpecificSyntaxTreeVisitor {
+    public:
+        // the type-checked top-level function of the symbol, nullptr when there is none
+        using FunctionLookup = std::function<const FunctionNode *(const FuncSymbol *)>;
+
+        ConstEvaluator(const Annotations *annotations, FunctionLookup function_lookup) : annotations_(annotations), function_lookup_(std::move(function_lookup)) {}
+
+        // the value is computed once and kept in the symbol
+        const TokenValue &Evaluate(ConstSymbol *symbol) {
+            if (symbol->state == ConstSymbol::State::kEvaluated) {
+                return symbol->value;
+            }
+
+            // a constant depending on itself or one without an initializer has no value
+            if (symbol->state == ConstSymbol::State::kEvaluating || symbol->expression == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            symbol->state = ConstSymbol::State::kEvaluating;
+            symbol->value = EvaluateInFrame(symbol->expression);
+            symbol->state = ConstSymbol::State::kEvaluated;
+            return symbol->value;
+        }
+
+        // `const _` declares no symbol, it is evaluated every time
+        TokenValue Evaluate(const ConstantItemNode *node) {
+            if (auto symbol = dynamic_cast<ConstSymbol *>(annotations_->symbols[node]); symbol != nullptr) {
+                return Evaluate(symbol);
+            }
+
+            if (node->GetExpr() == nullptr) {
+                throw std::exception();  // todo
+            }
+            return EvaluateInFrame(node->GetExpr());
+        }
+
+    protected:
+        void PostVisit(const LiteralExpressionNode *node) override {
+            value_ = node->GetLiteral()->GetToken()->GetTokenValue();
+            if (!IsValue(value_) && value_.GetType() != TokenValue::Type::kBool) {
+                throw std::exception();  // todo
+            }
+        }
+
+        void PostVisit(const IdentifierExpressionNode *node) override {
+            ISymbol *symbol = annotations_->symbols[node];
+            if (auto const_symbol = dynamic_cast<ConstSymbol *>(symbol); const_symbol != nullptr) {
+                value_ = Evaluate(const_symbol);
+                return;
+            }
+
+            const auto it = locals_->find(symbol);
+            if (it == locals_->end()) {
+                throw std::exception();  // todo
+            }
+            value_ = it->second;
+        }
+
+        void PostVisit(const BinaryOperationNode *node) override {
+            Visit(node->GetLeft());
+            if (control_ != Control::kNone) {
+                return;
+            }
+            const TokenValue lhs = value_;
+
+            // && and || evaluate both sides like the generated code does
+            Visit(node->GetRight());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            value_ = Apply(node->GetToken()->GetType(), lhs, value_);
+        }
+
+        void PostVisit(const PrefixUnaryOperationNode *node) override {
+            if (node->IsException()) {
+                throw std::exception();  // todo
+            }
+
+            Visit(node->GetRight());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            switch (node->GetToken()->GetType()) {
+            case Token::Type::kMinus:
+                // the generated code subtracts from zero
+                value_ = Apply(Token::Type::kMinus, GetZero(value_.GetType()), value_);
+                break;
+            case Token::Type::kNot:
+                if (value_.GetType() != TokenValue::Type::kBool) {
+                    throw std::exception();  // todo
+                }
+                value_ = TokenValue(!static_cast<bool>(value_));
+                break;
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        void PostVisit(const BlockNode *node) override {
+            for (const SyntaxNode *statement : node->GetStatements()) {
+                Visit(statement);
+                if (control_ != Control::kNone) {
+                    return;
+                }
+            }
+
+            value_ = TokenValue();
+            Visit(node->GetReturnExpression());
+        }
+
+        void PostVisit(const LetNode *node) override {
+            if (node->GetExpression() == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            Visit(node->GetExpression());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            (*locals_)[annotations_->symbols[node->GetPattern()]] = value_;
+            value_ = TokenValue();
+        }
+
+        void PostVisit(const AssignmentNode *node) override {
+            // locals are primitive values, there are no fields to assign
+            if (dynamic_cast<const IdentifierExpressionNode *>(node->GetIdentifier()) == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            Visit(node->GetExpression());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            const auto it = locals_->find(annotations_->symbols[node]);
+            if (it == locals_->end()) {
+                throw std::exception();  // todo
+            }
+
+            const Token::Type operation = node->GetOperation().GetType();
+            it->second = operation == Token::Type::kEq ? value_ : Apply(GetAssignmentOperation(operation), it->second, value_);
+            value_ = TokenValue();
+        }
+
+        void PostVisit(const IfNode *node) override {
+            Visit(node->GetExpression());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            const bool condition = GetBool(value_);
+            value_ = TokenValue();
+            if (condition) {
+                Visit(node->GetIfBlock());
+            } else {
+                Visit(node->GetElseBlock());
+                Visit(node->GetElseIf());
+            }
+        }
+
+        void PostVisit(const PredicateLoopNode *node) override {
+            while (true) {
+                Step();
+
+                Visit(node->GetExpression());
+                if (control_ != Control::kNone || !GetBool(value_)) {
+                    break;
+                }
+
+                Visit(node->GetBlock());
+                if (!ContinueLoop()) {
+                    break;
+                }
+            }
+
+            if (control_ == Control::kNone) {
+                value_ = TokenValue();
+            }
+        }
+
+        void PostVisit(const InfiniteLoopNode *node) override {
+            while (true) {
+                Step();
+
+                Visit(node->GetBlock());
+                if (!ContinueLoop()) {
+                    break;
+                }
+            }
+
+            if (control_ == Control::kNone) {
+                value_ = break_value_;
+            }
+        }
+
+        void PostVisit(const BreakNode *node) override {
+            value_ = TokenValue();
+            Visit(node->GetExpression());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            break_value_ = value_;
+            control_ = Control::kBreak;
+        }
+
+        void PostVisit(const ContinueNode *) override {
+            control_ = Control::kContinue;
+        }
+
+        void PostVisit(const ReturnNode *node) override {
+            value_ = TokenValue();
+            Visit(node->GetExpression());
+            if (control_ != Control::kNone) {
+                return;
+            }
+
+            return_value_ = value_;
+            control_ = Control::kReturn;
+        }
+
+        void PostVisit(const CallOrInitTupleNode *node) override {
+            const auto symbol = dynamic_cast<const FuncSymbol *>(annotations_->symbols[node]);
+            if (symbol == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            const FunctionNode *function = function_lookup_(symbol);
+            if (function == nullptr || !function->IsConst() || depth_ == kDepthLimit) {
+                throw std::exception();  // todo
+            }
+
+            Locals locals;
+            const auto arguments = node->GetArguments();
+            for (size_t i = 0; i < arguments.size(); i++) {
+                Visit(arguments[i]);
+                if (control_ != Control::kNone) {
+                    return;
+                }
+                locals[symbol->locals[i]] = value_;
+            }
+
+            Step();
+
+            const auto saved_locals = locals_;
+            locals_ = &locals;
+            depth_++;
+
+            Visit(function->GetBlock());
+            if (control_ == Control::kReturn) {
+                value_ = return_value_;
+                control_ = Control::kNone;
+            }
+
+            depth_--;
+            locals_ = saved_locals;
+        }
+
+        // items in a block declare something, their constants are evaluated on use
+        void PostVisit(const FunctionNode *) override {}
+        void PostVisit(const StructNode *) override {}
+        void PostVisit(const ConstantItemNode *) override {}
+
+        NOT_CONSTANT(IteratorLoopNode)
+        NOT_CONSTANT(IndexNode)
+        NOT_CONSTANT(MemberAccessNode)
+        NOT_CONSTANT(ArrayExpressionNode)
+        NOT_CONSTANT(InitStructExpressionNode)
+        NOT_CONSTANT(ShorthandFieldInitStructExpressionNode)
+        NOT_CONSTANT(TupleIndexFieldInitStructExpressionNode)
+        NOT_CONSTANT(IdentifierFieldInitStructExpressionNode)
+        NOT_CONSTANT(TupleExpressionNode)
+
+    private:
+        using Locals = std::unordered_map<const ISymbol *, TokenValue>;
+
+        enum class Control
+        {
+            kNone,
+            kBreak,
+            kContinue,
+            kReturn
+        };
+
+        // bounds the work of a constant that never finishes
+        static constexpr uint64_t kStepLimit = 1000000;
+        static constexpr uint32_t kDepthLimit = 256;
+
+        const Annotations *annotations_;
+        FunctionLookup function_lookup_;
+
+        // values of the lets and parameters of the function being evaluated
+        Locals *locals_ = nullptr;
+        TokenValue value_;
+        Control control_ = Control::kNone;
+        TokenValue break_value_;
+        TokenValue return_value_;
+        uint64_t steps_ = 0;
+        uint32_t depth_ = 0;
+
+        // a constant initializer is evaluated apart from the function whose body it is in
+        TokenValue EvaluateInFrame(const ExpressionNode *node) {
+            Locals locals;
+            const auto saved_locals = locals_;
+            locals_ = &locals;
+
+            Visit(node);
+            if (control_ != Control::kNone) {
+                throw std::exception();  // todo
+            }
+
+            locals_ = saved_locals;
+            return value_;
+        }
+
+        void Step() {
+            if (++steps_ > kStepLimit) {
+                throw std::exception();  // todo
+            }
+        }
+
+        // after the body of a loop ran: whether to run it again, a break is consumed
+        bool ContinueLoop() {
+            switch (control_) {
+            case Control::kNone:
+                return true;
+            case Control::kContinue:
+                control_ = Control::kNone;
+                return true;
+            case Control::kBreak:
+                control_ = Control::kNone;
+                return false;
+            default:
+                return false;
+            }
+        }
+
+        static bool IsValue(const TokenValue &value) {
+            switch (value.GetType()) {
+            case TokenValue::Type::kI32:
+            case TokenValue::Type::kI64:
+            case TokenValue::Type::kF32:
+            case TokenValue::Type::kF64:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        static bool GetBool(const TokenValue &value) {
+            if (value.GetType() != TokenValue::Type::kBool) {
+                throw std::exception();  // todo
+            }
+            return static_cast<bool>(value);
+        }
+
+        static TokenValue GetZero(TokenValue::Type type) {
+            switch (type) {
+            case TokenValue::Type::kI32:
+                return TokenValue(static_cast<int32_t>(0));
+            case TokenValue::Type::kI64:
+                return TokenValue(static_cast<int64_t>(0));
+            case TokenValue::Type::kF32:
+                return TokenValue(0.0f);
+            case TokenValue::Type::kF64:
+                return TokenValue(0.0);
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        static Token::Type GetAssignmentOperation(Token::Type operation) {
+            switch (operation) {
+            case Token::Type::kPlusEq:
+                return Token::Type::kPlus;
+            case Token::Type::kMinusEq:
+                return Token::Type::kMinus;
+            case Token::Type::kStarEq:
+                return Token::Type::kStar;
+            case Token::Type::kSlashEq:
+                return Token::Type::kSlash;
+            case Token::Type::kPercentEq:
+                return Token::Type::kPercent;
+            case Token::Type::kCaretEq:
+                return Token::Type::kCaret;
+            case Token::Type::kAndEq:
+                return Token::Type::kAnd;
+            case Token::Type::kOrEq:
+                return Token::Type::kOr;
+            case Token::Type::kShlEq:
+                return Token::Type::kShl;
+            case Token::Type::kShrEq:
+                return Token::Type::kShr;
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        static TokenValue Apply(Token::Type operation, const TokenValue &lhs, const TokenValue &rhs) {
+            if (lhs.GetType() != rhs.GetType()) {
+                throw std::exception();  // todo
+            }
+
+            switch (lhs.GetType()) {
+            case TokenValue::Type::kBool:
+                return ApplyBool(operation, static_cast<bool>(lhs), static_cast<bool>(rhs));
+            case TokenValue::Type::kI32:
+                return ApplyInteger(operation, static_cast<int32_t>(lhs), static_cast<int32_t>(rhs));
+            case TokenValue::Type::kI64:
+                return ApplyInteger(operation, static_cast<int64_t>(lhs), static_cast<int64_t>(rhs));
+            case TokenValue::Type::kF32:
+                return ApplyFloat(operation, static_cast<float>(lhs), static_cast<float>(rhs));
+            case TokenValue::Type::kF64:
+                return ApplyFloat(operation, static_cast<double>(lhs), static_cast<double>(rhs));
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        static TokenValue ApplyBool(Token::Type operation, bool lhs, bool rhs) {
+            switch (operation) {
+            case Token::Type::kAnd:
+            case Token::Type::kAndAnd:
+                return TokenValue(lhs && rhs);
+            case Token::Type::kOr:
+            case Token::Type::kOrOr:
+                return TokenValue(lhs || rhs);
+            case Token::Type::kCaret:
+            case Token::Type::kNe:
+                return TokenValue(lhs != rhs);
+            case Token::Type::kEqEq:
+                return TokenValue(lhs == rhs);
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        // signed operations as the generated code uses them, the arithmetic is done on the unsigned type to wrap around
+        template <typename T>
+        static TokenValue ApplyInteger(Token::Type operation, T lhs, T rhs) {
+            using Unsigned = std::make_unsigned_t<T>;
+            constexpr Unsigned kShiftMask = sizeof(T) * 8 - 1;
+
+            switch (operation) {
+            case Token::Type::kPlus:
+                return TokenValue(static_cast<T>(static_cast<Unsigned>(lhs) + static_cast<Unsigned>(rhs)));
+            case Token::Type::kMinus:
+                return TokenValue(static_cast<T>(static_cast<Unsigned>(lhs) - static_cast<Unsigned>(rhs)));
+            case Token::Type::kStar:
+                return TokenValue(static_cast<T>(static_cast<Unsigned>(lhs) * static_cast<Unsigned>(rhs)));
+            case Token::Type::kSlash:
+                if (rhs == 0 || (lhs == std::numeric_limits<T>::min() && rhs == -1)) {
+                    throw std::exception();  // todo
+                }
+                return TokenValue(static_cast<T>(lhs / rhs));
+            case Token::Type::kPercent:
+                if (rhs == 0) {
+                    throw std::exception();  // todo
+                }
+                return TokenValue(static_cast<T>(rhs == -1 ? 0 : lhs % rhs));
+            case Token::Type::kAnd:
+                return TokenValue(static_cast<T>(lhs & rhs));
+            case Token::Type::kOr:
+                return TokenValue(static_cast<T>(lhs | rhs));
+            case Token::Type::kCaret:
+                return TokenValue(static_cast<T>(lhs ^ rhs));
+            case Token::Type::kShl:
+                return TokenValue(static_cast<T>(static_cast<Unsigned>(lhs) << (static_cast<Unsigned>(rhs) & kShiftMask)));
+            case Token::Type::kShr:
+                return TokenValue(static_cast<T>(lhs >> (static_cast<Unsigned>(rhs) & kShiftMask)));
+            default:
+                return Compare(operation, lhs, rhs);
+            }
+        }
+
+        template <typename T>
+        static TokenValue ApplyFloat(Token::Type operation, T lhs, T rhs) {
+            switch (operation) {
+            case Token::Type::kPlus:
+                return TokenValue(static_cast<T>(lhs + rhs));
+            case Token::Type::kMinus:
+                return TokenValue(static_cast<T>(lhs - rhs));
+            case Token::Type::kStar:
+                return TokenValue(static_cast<T>(lhs * rhs));
+            case Token::Type::kSlash:
+                return TokenValue(static_cast<T>(lhs / rhs));
+            default:
+                return Compare(operation, lhs, rhs);
+            }
+        }
+
+        template <typename T>
+        static TokenValue Compare(Token::Type operation, T lhs, T rhs) {
+            switch (operation) {
+            case Token::Type::kEqEq:
+                return TokenValue(lhs == rhs);
+            case Token::Type::kNe:
+                return TokenValue(lhs != rhs);
+            case Token::Type::kLt:
+                return TokenValue(lhs < rhs);
+            case Token::Type::kGt:
+                return TokenValue(lhs > rhs);
+            case Token::Type::kLe:
+                return TokenValue(lhs <= rhs);
+            case Token::Type::kGe:
+                return TokenValue(lhs >= rhs);
+            default:
+                throw std::exception();  // todo
+            }
+        }
+    };
+}
+
+#undef NOT_CONSTANT
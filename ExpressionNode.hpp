@@ -8,8 +8,6 @@ class ExpressionNode : public SyntaxNode {
 public:
     virtual ~ExpressionNode() = default;
 
-    const ISymbolType *type_of_expression;
-
 protected:
     ExpressionNode() = default;
 };
@@ -26,8 +24,6 @@ public:
         return identifier_.get();
     }
 
-    ISymbol *symbol;
-
 private:
     std::unique_ptr<IdentifierNode> identifier_;
 };
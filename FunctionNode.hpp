@@ -40,9 +40,6 @@ public:
 
     bool IsConst() const;
 
-    semantic::FuncSymbol *symbol = nullptr;
-    std::vector<ReturnNode *> return_nodes;
-
 private:
     std::unique_ptr<IdentifierNode> identifier_;
     std::vector<ParamFunctionNode> params_;
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "WasmTypes.hpp"
+
+// The mid-level representation between the semantic analysis and WasmGenerator. A function is a control flow graph of basic
+// blocks in SSA form: an instruction defines at most one value, and the values a variable takes on different paths meet in
+// phis at the start of a block. Blocks end with a terminator, the block/loop/if structure wasm needs is recovered from the
+// graph by the generator, so passes may change the graph as long as it stays reducible.
+namespace ir {
+    // the type of a value, ValueType::empty for an instruction without one; a bool is an i32
+    using Type = wasm::ValueType;
+
+    enum class Opcode {
+        kConst,
+        // the parameter with the number index, in the entry block
+        kParam,
+        // the address of the frame holding the structs of the function in linear memory, in the entry block
+        kFrame,
+        // one operand for every predecessor of the block, in the same order
+        kPhi,
+        // the operands and the result have the same type, an integer division, remainder and kShr are signed
+        kAdd,
+        kSub,
+        kMul,
+        kDiv,
+        kRem,
+        kAnd,
+        kOr,
+        kXor,
+        kShl,
+        kShr,
+        // the right shift filling in zeros
+        kShrU,
+        // an i32 of the comparison of two operands of the same type, integers are signed
+        kEq,
+        kNe,
+        kLt,
+        kGt,
+        kLe,
+        kGe,
+        // an i32 of whether an i32 is zero
+        kEqz,
+        // the operands are the arguments of callee
+        kCall,
+        // size bytes at the address operand plus index, a byte is zero extended to an i32
+        kLoad,
+        // the operands are the address and the value
+        kStore,
+        // terminators
+        kJump,
+        // goes to the first target if the operand is not zero, otherwise to the second one
+        kBranch,
+        // the operand is the result if the function has one
+        kReturn,
+        kUnreachable
+    };
+
+    class Block;
+    class Function;
+
+    class Instruction final {
+    public:
+        Instruction(Opcode opcode, Type type) : opcode(opcode), type(type) {}
+
+        Opcode opcode;
+        Type type;
+        std::vector<Instruction *> operands;
+        Block *block = nullptr;
+        // unique in the function
+        uint32_t id = 0;
+
+        // kConst: the bits of the value as wasm keeps them, an i32 or an f32 in the low half
+        uint64_t bits = 0;
+        // kParam: the number of the parameter; kLoad, kStore: the offset added to the address
+        uint32_t index = 0;
+        // kLoad, kStore: the number of bytes accessed, the access is aligned to it
+        uint32_t size = 0;
+        // kCall
+        Function *callee = nullptr;
+        // kJump, kBranch
+        std::vector<Block *> targets;
+
+        bool IsTerminator() const {
+            return opcode == Opcode::kJump || opcode == Opcode::kBranch || opcode == Opcode::kReturn || opcode == Opcode::kUnreachable;
+        }
+
+        bool IsBinary() const {
+            return opcode >= Opcode::kAdd && opcode <= Opcode::kGe;
+        }
+
+        bool IsComparison() const {
+            return opcode >= Opcode::kEq && opcode <= Opcode::kGe;
+        }
+
+        bool IsCommutative() const {
+            return opcode == Opcode::kAdd || opcode == Opcode::kMul || opcode == Opcode::kAnd || opcode == Opcode::kOr || opcode == Opcode::kXor || opcode == Opcode::kEq || opcode == Opcode::kNe;
+        }
+
+        // neither has an effect nor can trap, so it may be removed, moved or computed once for equal operands
+        bool IsPure() const {
+            switch (opcode) {
+            case Opcode::kDiv:
+            case Opcode::kRem:
+                return type == Type::f32 || type == Type::f64;
+            case Opcode::kCall:
+            case Opcode::kLoad:
+            case Opcode::kStore:
+                return false;
+            default:
+                return !IsTerminator();
+            }
+        }
+
+        int32_t GetI32() const {
+            return static_cast<int32_t>(static_cast<uint32_t>(bits));
+        }
+
+        int64_t GetI64() const {
+            return static_cast<int64_t>(bits);
+        }
+
+        float GetF32() const {
+            const auto value_bits = static_cast<uint32_t>(bits);
+            float value;
+            std::memcpy(&value, &value_bits, sizeof value);
+            return value;
+        }
+
+        double GetF64() const {
+            double value;
+            std::memcpy(&value, &bits, sizeof value);
+            return value;
+        }
+    };
+
+    class Block final {
+    public:
+        Block(Function *function, uint32_t id) : function(function), id(id) {}
+
+        Function *function;
+        // unique in the function
+        uint32_t id;
+        // the phis come first, the terminator is the last one
+        std::vector<std::unique_ptr<Instruction>> instructions;
+        std::vector<Block *> predecessors;
+
+        Instruction *GetTerminator() const {
+            return !instructions.empty() && instructions.back()->IsTerminator() ? instructions.back().get() : nullptr;
+        }
+
+        std::vector<Block *> GetSuccessors() const {
+            const Instruction *terminator = GetTerminator();
+            return terminator != nullptr ? terminator->targets : std::vector<Block *>();
+        }
+
+        Instruction *Insert(size_t position, std::unique_ptr<Instruction> instruction) {
+            instruction->block = this;
+            return instructions.insert(instructions.begin() + position, std::move(instruction))->get();
+        }
+
+        Instruction *Append(std::unique_ptr<Instruction> instruction) {
+            return Insert(instructions.size(), std::move(instruction));
+        }
+
+        // before the terminator
+        Instruction *InsertBeforeEnd(std::unique_ptr<Instruction> instruction) {
+            return Insert(instructions.size() - (GetTerminator() != nullptr ? 1 : 0), std::move(instruction));
+        }
+
+        // the instruction has to be in the block
+        size_t GetPosition(const Instruction *instruction) const {
+            const auto it = std::find_if(instructions.begin(), instructions.end(), [instruction](const std::unique_ptr<Instruction> &other) {
+                return other.get() == instruction;
+            });
+            assert(it != instructions.end());
+            return it - instructions.begin();
+        }
+
+        std::unique_ptr<Instruction> Remove(const Instruction *instruction) {
+            const size_t position = GetPosition(instruction);
+            std::unique_ptr<Instruction> result = std::move(instructions[position]);
+            instructions.erase(instructions.begin() + position);
+            result->block = nullptr;
+            return result;
+        }
+
+        size_t GetPhiCount() const {
+            size_t count = 0;
+            while (count < instructions.size() && instructions[count]->opcode == Opcode::kPhi) {
+                count++;
+            }
+            return count;
+        }
+
+        size_t GetPredecessorIndex(const Block *predecessor) const {
+            const auto it = std::find(predecessors.begin(), predecessors.end(), predecessor);
+            assert(it != predecessors.end());
+            return it - predecessors.begin();
+        }
+
+        // drops the edge from the predecessor together with the operands of the phis for it
+        void RemovePredecessor(const Block *predecessor) {
+            const size_t index = GetPredecessorIndex(predecessor);
+            predecessors.erase(predecessors.begin() + index);
+            for (size_t i = 0; i < GetPhiCount(); i++) {
+                instructions[i]->operands.erase(instructions[i]->operands.begin() + index);
+            }
+        }
+    };
+
+    class Function final {
+    public:
+        std::string name;
+        std::vector<Type> params;
+        Type result = Type::empty;
+
+        // an imported function has no blocks
+        bool imported = false;
+        std::string import_module;
+        std::string import_field;
+        // empty when the function is not exported
+        std::string export_field;
+
+        // bytes the function takes on the stack in linear memory for its structs
+        uint32_t frame_size = 0;
+        // the first one is the entry
+        std::vector<std::unique_ptr<Block>> blocks;
+
+        Block *AddBlock() {
+            blocks.push_back(std::make_unique<Block>(this, next_block_id_++));
+            return blocks.back().get();
+        }
+
+        Block *GetEntry() const {
+            return blocks.front().get();
+        }
+
+        std::unique_ptr<Instruction> Create(Opcode opcode, Type type, std::vector<Instruction *> operands = {}) {
+            auto instruction = std::make_unique<Instruction>(opcode, type);
+            instruction->id = next_value_id_++;
+            instruction->operands = std::move(operands);
+            return instruction;
+        }
+
+        std::unique_ptr<Instruction> CreateConst(Type type, uint64_t bits) {
+            auto instruction = Create(Opcode::kConst, type);
+            instruction->bits = type == Type::i32 || type == Type::f32 ? static_cast<uint32_t>(bits) : bits;
+            return instruction;
+        }
+
+    private:
+        uint32_t next_block_id_ = 0;
+        uint32_t next_value_id_ = 0;
+    };
+
+    class Module final {
+    public:
+        // the imported functions first, then the defined ones in the order of the wasm module
+        std::vector<std::unique_ptr<Function>> functions;
+
+        bool UsesMemory() const {
+            for (const auto &function : functions) {
+                if (function->frame_size != 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // a terminator going to the targets, the edges are added to their predecessors
+    inline Instruction *AddTerminator(Block *block, std::unique_ptr<Instruction> terminator) {
+        for (Block *target : terminator->targets) {
+            target->predecessors.push_back(block);
+        }
+        return block->Append(std::move(terminator));
+    }
+
+    // the operands are replaced by the values they map to, following chains of replacements
+    inline void ReplaceUses(Function *function, const std::unordered_map<const Instruction *, Instruction *> &replacements) {
+        if (replacements.empty()) {
+            return;
+        }
+
+        for (const auto &block : function->blocks) {
+            for (const auto &instruction : block->instructions) {
+                for (Instruction *&operand : instruction->operands) {
+                    for (auto it = replacements.find(operand); it != replacements.end(); it = replacements.find(operand)) {
+                        operand = it->second;
+                    }
+                }
+            }
+        }
+    }
+
+    inline std::unordered_map<const Instruction *, uint32_t> CountUses(const Function *function) {
+        std::unordered_map<const Instruction *, uint32_t> result;
+        for (const auto &block : function->blocks) {
+            for (const auto &instruction : block->instructions) {
+                for (const Instruction *operand : instruction->operands) {
+                    result[operand]++;
+                }
+            }
+        }
+        return result;
+    }
+
+    inline const char *ToString(Type type) {
+        switch (type) {
+        case Type::i32:
+            return "i32";
+        case Type::i64:
+            return "i64";
+        case Type::f32:
+            return "f32";
+        case Type::f64:
+            return "f64";
+        default:
+            return "void";
+        }
+    }
+
+    inline const char *ToString(Opcode opcode) {
+        static const char *const kNames[] = {"const", "param", "frame", "phi", "add", "sub", "mul", "div",  "rem",  "and",   "or",   "xor",    "shl",    "shr",        "shru",
+                                             "eq",    "ne",    "lt",    "gt",  "le",  "ge",  "eqz", "call", "load", "store", "jump", "branch", "return", "unreachable"};
+        return kNames[static_cast<size_t>(opcode)];
+    }
+
+    // a readable listing of the functions for debugging, every value is %id and every block is bid
+    inline void Print(std::ostream &os, const Function *function) {
+        os << (function->imported ? "import " : "func ") << function->name << '(';
+        for (size_t i = 0; i < function->params.size(); i++) {
+            os << (i != 0 ? ", " : "") << ToString(function->params[i]);
+        }
+        os << ") -> " << ToString(function->result);
+        if (function->imported) {
+            os << " from " << function->import_module << '.' << function->import_field << '\n';
+            return;
+        }
+        if (!function->export_field.empty()) {
+            os << " export " << function->export_field;
+        }
+        if (function->frame_size != 0) {
+            os << " frame " << function->frame_size;
+        }
+        os << '\n';
+
+        for (const auto &block : function->blocks) {
+            os << "  b" << block->id << ':';
+            if (!block->predecessors.empty()) {
+                os << "  ; preds";
+                for (const Block *predecessor : block->predecessors) {
+                    os << " b" << predecessor->id;
+                }
+            }
+            os << '\n';
+
+            for (const auto &instruction : block->instructions) {
+                os << "    ";
+                if (instruction->type != Type::empty) {
+                    os << '%' << instruction->id << " = " << ToString(instruction->type) << ' ';
+                }
+                os << ToString(instruction->opcode);
+
+                switch (instruction->opcode) {
+                case Opcode::kConst:
+                    switch (instruction->type) {
+                    case Type::i32:
+                        os << ' ' << instruction->GetI32();
+                        break;
+                    case Type::i64:
+                        os << ' ' << instruction->GetI64();
+                        break;
+                    case Type::f32:
+                        os << ' ' << instruction->GetF32();
+                        break;
+                    default:
+                        os << ' ' << instruction->GetF64();
+                        break;
+                    }
+                    break;
+                case Opcode::kParam:
+                    os << ' ' << instruction->index;
+                    break;
+                case Opcode::kCall:
+                    os << ' ' << instruction->callee->name;
+                    break;
+                case Opcode::kLoad:
+                case Opcode::kStore:
+                    os << " size " << instruction->size << " offset " << instruction->index;
+                    break;
+                default:
+                    break;
+                }
+
+                for (size_t i = 0; i < instruction->operands.size(); i++) {
+                    os << (i == 0 ? " " : ", ") << '%' << instruction->operands[i]->id;
+                    if (instruction->opcode == Opcode::kPhi) {
+                        os << " b" << block->predecessors[i]->id;
+                    }
+                }
+                for (const Block *target : instruction->targets) {
+                    os << " b" << target->id;
+                }
+                os << '\n';
+            }
+        }
+    }
+
+    inline void Print(std::ostream &os, const Module &module) {
+        for (const auto &function : module.functions) {
+            Print(os, function.get());
+        }
+    }
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cassert>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IR.hpp"
+
+namespace ir {
+    // The blocks reachable from the entry in reverse postorder and their dominator tree,
+    // computed as in "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy.
+    class DominatorTree final {
+    public:
+        explicit DominatorTree(const Function *function) {
+            std::vector<Block *> postorder;
+            std::unordered_map<const Block *, bool> visited;
+            std::vector<std::pair<Block *, size_t>> stack{{function->GetEntry(), 0}};
+            visited[function->GetEntry()] = true;
+            while (!stack.empty()) {
+                auto &[block, next] = stack.back();
+                const std::vector<Block *> successors = block->GetSuccessors();
+                if (next < successors.size()) {
+                    Block *successor = successors[next++];
+                    if (!visited[successor]) {
+                        visited[successor] = true;
+                        stack.emplace_back(successor, 0);
+                    }
+                } else {
+                    postorder.push_back(block);
+                    stack.pop_back();
+                }
+            }
+
+            order_.assign(postorder.rbegin(), postorder.rend());
+            for (size_t i = 0; i < order_.size(); i++) {
+                numbers_[order_[i]] = i;
+            }
+
+            idoms_[order_.front()] = order_.front();
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (size_t i = 1; i < order_.size(); i++) {
+                    Block *idom = nullptr;
+                    for (Block *predecessor : order_[i]->predecessors) {
+                        if (idoms_.count(predecessor) != 0) {
+                            idom = idom == nullptr ? predecessor : Intersect(predecessor, idom);
+                        }
+                    }
+                    if (idoms_[order_[i]] != idom) {
+                        idoms_[order_[i]] = idom;
+                        changed = true;
+                    }
+                }
+            }
+
+            for (size_t i = 1; i < order_.size(); i++) {
+                children_[idoms_[order_[i]]].push_back(order_[i]);
+            }
+        }
+
+        // the reachable blocks, every block comes before its successors except along back edges
+        const std::vector<Block *> &GetOrder() const {
+            return order_;
+        }
+
+        bool IsReachable(const Block *block) const {
+            return numbers_.count(block) != 0;
+        }
+
+        size_t GetNumber(const Block *block) const {
+            return numbers_.at(block);
+        }
+
+        // the entry is its own immediate dominator
+        Block *GetIdom(const Block *block) const {
+            return idoms_.at(block);
+        }
+
+        // in reverse postorder
+        const std::vector<Block *> &GetChildren(const Block *block) const {
+            static const std::vector<Block *> kNone;
+            const auto it = children_.find(block);
+            return it != children_.end() ? it->second : kNone;
+        }
+
+        bool Dominates(const Block *dominator, const Block *block) const {
+            while (block != dominator) {
+                const Block *idom = GetIdom(block);
+                if (idom == block) {
+                    return false;
+                }
+                block = idom;
+            }
+            return true;
+        }
+
+        // an edge to a block that comes no later in the order, in a reducible graph the target dominates the source
+        bool IsBackEdge(const Block *from, const Block *to) const {
+            return GetNumber(to) <= GetNumber(from);
+        }
+
+        bool IsLoopHeader(const Block *block) const {
+            for (const Block *predecessor : block->predecessors) {
+                if (IsReachable(predecessor) && IsBackEdge(predecessor, block)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        size_t GetForwardPredecessorCount(const Block *block) const {
+            size_t count = 0;
+            for (const Block *predecessor : block->predecessors) {
+                if (IsReachable(predecessor) && !IsBackEdge(predecessor, block)) {
+                    count++;
+                }
+            }
+            return count;
+        }
+
+    private:
+        std::vector<Block *> order_;
+        std::unordered_map<const Block *, size_t> numbers_;
+        std::unordered_map<const Block *, Block *> idoms_;
+        std::unordered_map<const Block *, std::vector<Block *>> children_;
+
+        Block *Intersect(Block *lhs, Block *rhs) const {
+            while (lhs != rhs) {
+                while (numbers_.at(lhs) > numbers_.at(rhs)) {
+                    lhs = idoms_.at(lhs);
+                }
+                while (numbers_.at(rhs) > numbers_.at(lhs)) {
+                    rhs = idoms_.at(rhs);
+                }
+            }
+            return lhs;
+        }
+    };
+
+    // The natural loops of a reducible graph: the header and the blocks a back edge to it can be reached from without passing it.
+    class LoopInfo final {
+    public:
+        explicit LoopInfo(const DominatorTree &tree) {
+            for (Block *header : tree.GetOrder()) {
+                std::vector<Block *> stack;
+                for (Block *predecessor : header->predecessors) {
+                    if (tree.IsReachable(predecessor) && tree.IsBackEdge(predecessor, header)) {
+                        // the header of an irreducible loop would not dominate all of it, the lowering only builds reducible ones
+                        assert(tree.Dominates(header, predecessor));
+                        stack.push_back(predecessor);
+                    }
+                }
+                if (stack.empty()) {
+                    continue;
+                }
+
+                headers_.push_back(header);
+                std::unordered_set<const Block *> &body = bodies_[header];
+                body.insert(header);
+                while (!stack.empty()) {
+                    Block *block = stack.back();
+                    stack.pop_back();
+                    if (body.insert(block).second) {
+                        for (Block *predecessor : block->predecessors) {
+                            if (tree.IsReachable(predecessor)) {
+                                stack.push_back(predecessor);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // in reverse postorder, so an outer loop comes before the loops inside it
+        const std::vector<Block *> &GetHeaders() const {
+            return headers_;
+        }
+
+        bool Contains(const Block *header, const Block *block) const {
+            const auto it = bodies_.find(header);
+            return it != bodies_.end() && it->second.count(block) != 0;
+        }
+
+    private:
+        std::vector<Block *> headers_;
+        std::unordered_map<const Block *, std::unordered_set<const Block *>> bodies_;
+    };
+
+    // The values live at the end of every reachable block, among the ones the predicate tracks: a value is live where a
+    // path to a use of it starts that does not pass its definition. A phi uses its operand at the end of the predecessor
+    // the operand comes from, so it is live out of that block and not into the block of the phi.
+    class Liveness final {
+    public:
+        Liveness(const DominatorTree &tree, const std::function<bool(const Instruction *)> &is_tracked) {
+            const std::vector<Block *> &order = tree.GetOrder();
+            std::unordered_map<const Block *, std::unordered_set<const Instruction *>> live_in;
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                    const Block *block = *it;
+                    std::unordered_set<const Instruction *> live;
+                    for (const Block *successor : block->GetSuccessors()) {
+                        live.insert(live_in[successor].begin(), live_in[successor].end());
+                        const size_t index = successor->GetPredecessorIndex(block);
+                        for (size_t i = 0; i < successor->GetPhiCount(); i++) {
+                            const Instruction *operand = successor->instructions[i]->operands[index];
+                            if (is_tracked(operand)) {
+                                live.insert(operand);
+                            }
+                        }
+                    }
+
+                    // a block is visited at least once for the uses in it
+                    const auto [live_out, first] = live_out_.try_emplace(block);
+                    if (!first && live == live_out->second) {
+                        continue;
+                    }
+                    live_out->second = live;
+                    changed = true;
+
+                    for (auto instruction = block->instructions.rbegin(); instruction != block->instructions.rend(); ++instruction) {
+                        live.erase(instruction->get());
+                        if ((*instruction)->opcode == Opcode::kPhi) {
+                            continue;
+                        }
+                        for (const Instruction *operand : (*instruction)->operands) {
+                            if (is_tracked(operand)) {
+                                live.insert(operand);
+                            }
+                        }
+                    }
+                    live_in[block] = std::move(live);
+                }
+            }
+        }
+
+        const std::unordered_set<const Instruction *> &GetLiveOut(const Block *block) const {
+            return live_out_.at(block);
+        }
+
+    private:
+        std::unordered_map<const Block *, std::unordered_set<const Instruction *>> live_out_;
+    };
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <cstring>
+#include <limits>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IR.hpp"
+
+namespace ir {
+    // Sparse conditional constant propagation as in "Constant Propagation with Conditional Branches" by Wegman and Zadeck:
+    // a value starts unknown and may only become a constant and then varying, and only the edges a branch can take are
+    // followed, so a value coming along an edge that is never taken does not spoil the phi it reaches.
+    // Constants are folded as the wasm instructions compute them: integers wrap around, floats are rounded to the type
+    // of the operands as IEEE 754 requires, and an operation that traps is kept to trap at run time.
+    // A branch on a constant becomes a jump, the blocks it no longer goes to are left unreachable.
+    class ConstantPropagation final {
+    public:
+        explicit ConstantPropagation(Function *function) : function_(function) {}
+
+        // returns whether the function changed
+        bool Run() {
+            for (const auto &block : function_->blocks) {
+                for (const auto &instruction : block->instructions) {
+                    for (const Instruction *operand : instruction->operands) {
+                        users_[operand].push_back(instruction.get());
+                    }
+                }
+            }
+
+            MarkEdge(nullptr, function_->GetEntry());
+            while (!block_worklist_.empty() || !instruction_worklist_.empty()) {
+                if (!block_worklist_.empty()) {
+                    const Block *block = block_worklist_.back();
+                    block_worklist_.pop_back();
+                    for (const auto &instruction : block->instructions) {
+                        Evaluate(instruction.get());
+                    }
+                } else {
+                    const Instruction *instruction = instruction_worklist_.back();
+                    instruction_worklist_.pop_back();
+                    if (executable_.count(instruction->block) != 0) {
+                        Evaluate(instruction);
+                    }
+                }
+            }
+
+            return Rewrite();
+        }
+
+    private:
+        struct Value {
+            enum class State { kUnknown, kConstant, kVarying };
+
+            State state = State::kUnknown;
+            // the bits as Instruction::bits keeps them
+            uint64_t bits = 0;
+        };
+
+        Function *function_;
+        std::unordered_map<const Instruction *, std::vector<const Instruction *>> users_;
+        std::unordered_map<const Instruction *, Value> values_;
+        std::set<std::pair<const Block *, const Block *>> edges_;
+        std::unordered_set<const Block *> executable_;
+        std::vector<const Block *> block_worklist_;
+        std::vector<const Instruction *> instruction_worklist_;
+
+        void MarkEdge(const Block *from, const Block *to) {
+            if (!edges_.emplace(from, to).second) {
+                return;
+            }
+
+            if (executable_.insert(to).second) {
+                block_worklist_.push_back(to);
+                return;
+            }
+
+            // the phis take the value along the new edge
+            for (size_t i = 0; i < to->GetPhiCount(); i++) {
+                Evaluate(to->instructions[i].get());
+            }
+        }
+
+        bool IsExecutable(const Block *from, const Block *to) const {
+            return edges_.count(std::make_pair(from, to)) != 0;
+        }
+
+        void Evaluate(const Instruction *instruction) {
+            if (instruction->IsTerminator()) {
+                EvaluateTerminator(instruction);
+                return;
+            }
+
+            Value &current = values_[instruction];
+            if (current.state == Value::State::kVarying) {
+                return;
+            }
+
+            const Value value = Compute(instruction);
+            if (value.state != current.state || value.bits != current.bits) {
+                current = value;
+                for (const Instruction *user : users_[instruction]) {
+                    instruction_worklist_.push_back(user);
+                }
+            }
+        }
+
+        void EvaluateTerminator(const Instruction *terminator) {
+            const Block *block = terminator->block;
+            switch (terminator->opcode) {
+            case Opcode::kJump:
+                MarkEdge(block, terminator->targets[0]);
+                break;
+            case Opcode::kBranch: {
+                const Value condition = values_[terminator->operands[0]];
+                if (condition.state == Value::State::kConstant) {
+                    MarkEdge(block, terminator->targets[condition.bits != 0 ? 0 : 1]);
+                } else if (condition.state == Value::State::kVarying) {
+                    MarkEdge(block, terminator->targets[0]);
+                    MarkEdge(block, terminator->targets[1]);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        Value Compute(const Instruction *instruction) {
+            switch (instruction->opcode) {
+            case Opcode::kConst:
+                return Value{Value::State::kConstant, instruction->bits};
+            case Opcode::kPhi: {
+                Value result;
+                for (size_t i = 0; i < instruction->operands.size(); i++) {
+                    if (!IsExecutable(instruction->block->predecessors[i], instruction->block)) {
+                        continue;
+                    }
+
+                    const Value operand = values_[instruction->operands[i]];
+                    if (operand.state == Value::State::kUnknown) {
+                        continue;
+                    }
+                    if (operand.state == Value::State::kVarying || (result.state == Value::State::kConstant && result.bits != operand.bits)) {
+                        return Value{Value::State::kVarying, 0};
+                    }
+                    result = operand;
+                }
+                return result;
+            }
+            default:
+                break;
+            }
+
+            if (!instruction->IsBinary() && instruction->opcode != Opcode::kEqz) {
+                return Value{Value::State::kVarying, 0};
+            }
+
+            std::vector<uint64_t> operands;
+            bool unknown = false;
+            for (const Instruction *operand : instruction->operands) {
+                const Value value = values_[operand];
+                if (value.state == Value::State::kVarying) {
+                    return Value{Value::State::kVarying, 0};
+                }
+                unknown = unknown || value.state == Value::State::kUnknown;
+                operands.push_back(value.bits);
+            }
+            if (unknown) {
+                return Value{};
+            }
+
+            uint64_t bits = 0;
+            if (instruction->opcode == Opcode::kEqz) {
+                bits = static_cast<uint32_t>(operands[0]) == 0 ? 1 : 0;
+            } else if (!Fold(instruction->opcode, instruction->operands[0]->type, operands[0], operands[1], &bits)) {
+                return Value{Value::State::kVarying, 0};
+            }
+            return Value{Value::State::kConstant, bits};
+        }
+
+        // replaces the constant values by consts and the branches on them by jumps
+        bool Rewrite() {
+            bool changed = false;
+            std::unordered_map<const Instruction *, Instruction *> replacements;
+
+            for (const auto &block : function_->blocks) {
+                if (executable_.count(block.get()) == 0) {
+                    continue;
+                }
+
+                for (size_t i = 0; i < block->instructions.size(); i++) {
+                    Instruction *instruction = block->instructions[i].get();
+                    const Value value = values_[instruction];
+                    if (value.state != Value::State::kConstant || instruction->opcode == Opcode::kConst) {
+                        continue;
+                    }
+
+                    // a phi gives way to a const after the phis of its block
+                    if (instruction->opcode == Opcode::kPhi) {
+                        replacements[instruction] = block->Insert(block->GetPhiCount(), function_->CreateConst(instruction->type, value.bits));
+                    } else {
+                        instruction->opcode = Opcode::kConst;
+                        instruction->operands.clear();
+                        instruction->bits = value.bits;
+                    }
+                    changed = true;
+                }
+
+                Instruction *terminator = block->GetTerminator();
+                if (terminator != nullptr && terminator->opcode == Opcode::kBranch && values_[terminator->operands[0]].state == Value::State::kConstant) {
+                    const bool condition = values_[terminator->operands[0]].bits != 0;
+                    Block *taken = terminator->targets[condition ? 0 : 1];
+                    terminator->targets[condition ? 1 : 0]->RemovePredecessor(block.get());
+
+                    terminator->opcode = Opcode::kJump;
+                    terminator->operands.clear();
+                    terminator->targets = {taken};
+                    changed = true;
+                }
+            }
+
+            ReplaceUses(function_, replacements);
+            for (const auto &[phi, constant] : replacements) {
+                phi->block->Remove(phi);
+            }
+            return changed;
+        }
+
+        // false when the instruction traps for the operands
+        static bool Fold(Opcode opcode, Type type, uint64_t lhs, uint64_t rhs, uint64_t *result) {
+            switch (type) {
+            case Type::i32:
+                return FoldInteger<int32_t>(opcode, lhs, rhs, result);
+            case Type::i64:
+                return FoldInteger<int64_t>(opcode, lhs, rhs, result);
+            case Type::f32:
+                return FoldFloat<float>(opcode, lhs, rhs, result);
+            case Type::f64:
+                return FoldFloat<double>(opcode, lhs, rhs, result);
+            default:
+                return false;
+            }
+        }
+
+        // division and kShr are signed, the arithmetic is done on the unsigned type to wrap around
+        template <typename T>
+        static bool FoldInteger(Opcode opcode, uint64_t lhs_bits, uint64_t rhs_bits, uint64_t *result) {
+            using Unsigned = std::make_unsigned_t<T>;
+            constexpr Unsigned kShiftMask = sizeof(T) * 8 - 1;
+
+            const auto lhs = static_cast<Unsigned>(lhs_bits);
+            const auto rhs = static_cast<Unsigned>(rhs_bits);
+            const auto signed_lhs = static_cast<T>(lhs);
+            const auto signed_rhs = static_cast<T>(rhs);
+
+            Unsigned value;
+            switch (opcode) {
+            case Opcode::kAdd:
+                value = lhs + rhs;
+                break;
+            case Opcode::kSub:
+                value = lhs - rhs;
+                break;
+            case Opcode::kMul:
+                value = lhs * rhs;
+                break;
+            case Opcode::kDiv:
+                if (signed_rhs == 0 || (signed_lhs == std::numeric_limits<T>::min() && signed_rhs == -1)) {
+                    return false;
+                }
+                value = static_cast<Unsigned>(signed_lhs / signed_rhs);
+                break;
+            case Opcode::kRem:
+                if (signed_rhs == 0) {
+                    return false;
+                }
+                value = signed_rhs == -1 ? 0 : static_cast<Unsigned>(signed_lhs % signed_rhs);
+                break;
+            case Opcode::kAnd:
+                value = lhs & rhs;
+                break;
+            case Opcode::kOr:
+                value = lhs | rhs;
+                break;
+            case Opcode::kXor:
+                value = lhs ^ rhs;
+                break;
+            case Opcode::kShl:
+                value = lhs << (rhs & kShiftMask);
+                break;
+            case Opcode::kShr:
+                value = static_cast<Unsigned>(signed_lhs >> (rhs & kShiftMask));
+                break;
+            case Opcode::kShrU:
+                value = lhs >> (rhs & kShiftMask);
+                break;
+            default:
+                return Compare(opcode, signed_lhs, signed_rhs, result);
+            }
+
+            *result = value;
+            return true;
+        }
+
+        template <typename T>
+        static bool FoldFloat(Opcode opcode, uint64_t lhs_bits, uint64_t rhs_bits, uint64_t *result) {
+            const T lhs = FromBits<T>(lhs_bits);
+            const T rhs = FromBits<T>(rhs_bits);
+
+            switch (opcode) {
+            case Opcode::kAdd:
+                *result = ToBits<T>(lhs + rhs);
+                return true;
+            case Opcode::kSub:
+                *result = ToBits<T>(lhs - rhs);
+                return true;
+            case Opcode::kMul:
+                *result = ToBits<T>(lhs * rhs);
+                return true;
+            case Opcode::kDiv:
+                *result = ToBits<T>(lhs / rhs);
+                return true;
+            default:
+                return Compare(opcode, lhs, rhs, result);
+            }
+        }
+
+        // an i32 of 1 or 0, a comparison with a NaN is false except for kNe
+        template <typename T>
+        static bool Compare(Opcode opcode, T lhs, T rhs, uint64_t *result) {
+            bool value;
+            switch (opcode) {
+            case Opcode::kEq:
+                value = lhs == rhs;
+                break;
+            case Opcode::kNe:
+                value = lhs != rhs;
+                break;
+            case Opcode::kLt:
+                value = lhs < rhs;
+                break;
+            case Opcode::kGt:
+                value = lhs > rhs;
+                break;
+            case Opcode::kLe:
+                value = lhs <= rhs;
+                break;
+            case Opcode::kGe:
+                value = lhs >= rhs;
+                break;
+            default:
+                return false;
+            }
+
+            *result = value ? 1 : 0;
+            return true;
+        }
+
+        template <typename T>
+        using Bits = std::conditional_t<sizeof(T) == sizeof(uint32_t), uint32_t, uint64_t>;
+
+        template <typename T>
+        static T FromBits(uint64_t bits) {
+            const auto value_bits = static_cast<Bits<T>>(bits);
+            T value;
+            std::memcpy(&value, &value_bits, sizeof value);
+            return value;
+        }
+
+        template <typename T>
+        static uint64_t ToBits(T value) {
+            Bits<T> bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            return bits;
+        }
+    };
+}
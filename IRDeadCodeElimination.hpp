@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IR.hpp"
+
+namespace ir {
+    // Removes the blocks no path from the entry reaches, such as the code after a return, break or continue and the arms
+    // ConstantPropagation decided against, and the values nothing needs: an instruction is kept when it is not pure or
+    // a kept one uses it, so unused lets, pure expression statements and cycles of phis only using each other go away.
+    // A phi left with one distinct operand by the removed edges is replaced by it, and the straight runs of blocks the
+    // removed branches leave behind become single blocks.
+    class DeadCodeElimination final {
+    public:
+        struct Stats {
+            uint32_t blocks = 0;
+            uint32_t instructions = 0;
+        };
+
+        explicit DeadCodeElimination(Function *function) : function_(function) {}
+
+        Stats Run() {
+            RemoveUnreachableBlocks();
+            RemoveTrivialPhis();
+            MergeBlocks();
+            RemoveDeadInstructions();
+            return stats_;
+        }
+
+    private:
+        Function *function_;
+        Stats stats_;
+
+        void RemoveUnreachableBlocks() {
+            std::unordered_set<const Block *> reachable{function_->GetEntry()};
+            std::vector<const Block *> stack{function_->GetEntry()};
+            while (!stack.empty()) {
+                const Block *block = stack.back();
+                stack.pop_back();
+                for (const Block *successor : block->GetSuccessors()) {
+                    if (reachable.insert(successor).second) {
+                        stack.push_back(successor);
+                    }
+                }
+            }
+
+            std::vector<std::unique_ptr<Block>> blocks;
+            for (auto &block : function_->blocks) {
+                if (reachable.count(block.get()) != 0) {
+                    blocks.push_back(std::move(block));
+                    continue;
+                }
+
+                for (Block *successor : block->GetSuccessors()) {
+                    if (reachable.count(successor) != 0) {
+                        successor->RemovePredecessor(block.get());
+                    }
+                }
+                stats_.blocks++;
+                stats_.instructions += block->instructions.size();
+            }
+            function_->blocks = std::move(blocks);
+        }
+
+        void RemoveTrivialPhis() {
+            std::unordered_map<const Instruction *, Instruction *> replacements;
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (const auto &block : function_->blocks) {
+                    for (size_t i = 0; i < block->GetPhiCount(); i++) {
+                        Instruction *phi = block->instructions[i].get();
+                        if (replacements.count(phi) != 0) {
+                            continue;
+                        }
+
+                        Instruction *same = nullptr;
+                        bool trivial = true;
+                        for (Instruction *operand : phi->operands) {
+                            while (replacements.count(operand) != 0) {
+                                operand = replacements.at(operand);
+                            }
+                            if (operand != phi && operand != same) {
+                                trivial = same == nullptr;
+                                same = operand;
+                            }
+                            if (!trivial) {
+                                break;
+                            }
+                        }
+
+                        if (trivial && same != nullptr) {
+                            replacements[phi] = same;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+
+            ReplaceUses(function_, replacements);
+            for (const auto &[phi, value] : replacements) {
+                phi->block->Remove(phi);
+                stats_.instructions++;
+            }
+        }
+
+        // a block that is the only successor of its only predecessor is appended to it
+        void MergeBlocks() {
+            std::unordered_set<const Block *> merged;
+            for (const auto &block : function_->blocks) {
+                if (merged.count(block.get()) != 0) {
+                    continue;
+                }
+
+                for (Instruction *terminator = block->GetTerminator(); terminator != nullptr && terminator->opcode == Opcode::kJump; terminator = block->GetTerminator()) {
+                    Block *successor = terminator->targets[0];
+                    if (successor == block.get() || successor == function_->GetEntry() || successor->predecessors.size() != 1) {
+                        break;
+                    }
+
+                    block->instructions.pop_back();
+                    for (auto &instruction : successor->instructions) {
+                        instruction->block = block.get();
+                        block->instructions.push_back(std::move(instruction));
+                    }
+                    successor->instructions.clear();
+                    for (Block *target : block->GetSuccessors()) {
+                        std::replace(target->predecessors.begin(), target->predecessors.end(), successor, block.get());
+                    }
+                    merged.insert(successor);
+                }
+            }
+
+            function_->blocks.erase(std::remove_if(function_->blocks.begin(), function_->blocks.end(), [&merged](const std::unique_ptr<Block> &block) {
+                                        return merged.count(block.get()) != 0;
+                                    }),
+                                    function_->blocks.end());
+        }
+
+        void RemoveDeadInstructions() {
+            std::unordered_set<const Instruction *> live;
+            std::vector<const Instruction *> stack;
+            for (const auto &block : function_->blocks) {
+                for (const auto &instruction : block->instructions) {
+                    if (!instruction->IsPure() && live.insert(instruction.get()).second) {
+                        stack.push_back(instruction.get());
+                    }
+                }
+            }
+
+            while (!stack.empty()) {
+                const Instruction *instruction = stack.back();
+                stack.pop_back();
+                for (const Instruction *operand : instruction->operands) {
+                    if (live.insert(operand).second) {
+                        stack.push_back(operand);
+                    }
+                }
+            }
+
+            for (const auto &block : function_->blocks) {
+                auto &instructions = block->instructions;
+                const size_t size = instructions.size();
+                instructions.erase(std::remove_if(instructions.begin(), instructions.end(), [&live](const std::unique_ptr<Instruction> &instruction) {
+                                       return live.count(instruction.get()) == 0;
+                                   }),
+                                   instructions.end());
+                stats_.instructions += size - instructions.size();
+            }
+        }
+    };
+}
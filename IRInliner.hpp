@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IR.hpp"
+
+namespace ir {
+    // Replaces calls by copies of the called functions. A function is inlined when it is small, when the call is the only
+    // one left and nothing outside the module can call it, so the function goes away with it, or when the copy folds into
+    // a constant as every argument is one and the function neither branches nor has effects; recursive functions
+    // and functions with a frame keep their calls. The callers are visited bottom-up in the call graph, so a callee has
+    // already taken in its own callees when it is copied. The instructions added by copies of small functions are paid
+    // from the budget. The arguments become the values of the parameters in the copy, so they live in the locals of
+    // the caller the generator groups by type. Defined functions nobody calls and nobody outside can call are removed.
+    class Inliner final {
+    public:
+        struct Options {
+            // instructions of a callee that is always worth inlining
+            uint32_t small_size = 12;
+            // instructions the whole module may grow by
+            uint32_t budget = 256;
+        };
+
+        // a decision in the style of the -Rpass remarks of clang
+        struct Remark {
+            bool inlined;
+            std::string callee;
+            std::string caller;
+            std::string reason;
+
+            std::string ToString() const {
+                if (inlined) {
+                    return "remark: " + callee + " inlined into " + caller + " (" + reason + ") [-Rpass=inline]";
+                }
+                if (caller.empty()) {
+                    return "remark: " + callee + " removed (" + reason + ") [-Rpass=inline]";
+                }
+                return "remark: " + callee + " not inlined into " + caller + " (" + reason + ") [-Rpass-missed=inline]";
+            }
+        };
+
+        Inliner(Module *module, Options options) : module_(module), options_(options) {}
+
+        std::vector<Remark> Run() {
+            budget_ = options_.budget;
+            for (const auto &function : module_->functions) {
+                for (const Instruction *call : GetCalls(function.get())) {
+                    call_counts_[call->callee]++;
+                }
+            }
+            FindRecursive();
+
+            for (Function *caller : GetBottomUpOrder()) {
+                for (Instruction *call : GetCalls(caller)) {
+                    Function *callee = call->callee;
+                    const std::string reason = GetMissedReason(call);
+                    if (!reason.empty()) {
+                        remarks_.push_back(Remark{false, callee->name, caller->name, reason});
+                        continue;
+                    }
+
+                    const uint32_t size = GetSize(callee);
+                    const bool removed = call_counts_[callee] == 1 && callee->export_field.empty();
+                    if (removed) {
+                        remarks_.push_back(Remark{true, callee->name, caller->name, "only call, size " + std::to_string(size)});
+                    } else if (FoldsToConstant(call)) {
+                        remarks_.push_back(Remark{true, callee->name, caller->name, "constant arguments, size " + std::to_string(size)});
+                    } else {
+                        budget_ -= size;
+                        remarks_.push_back(Remark{true, callee->name, caller->name, "size " + std::to_string(size) + ", budget " + std::to_string(budget_) + " left"});
+                    }
+                    Inline(call);
+                }
+            }
+
+            RemoveUncalled();
+            return remarks_;
+        }
+
+        // the instructions wasm code is emitted for
+        static uint32_t GetSize(const Function *function) {
+            uint32_t size = 0;
+            for (const auto &block : function->blocks) {
+                for (const auto &instruction : block->instructions) {
+                    if (instruction->opcode != Opcode::kConst && instruction->opcode != Opcode::kParam && instruction->opcode != Opcode::kPhi) {
+                        size++;
+                    }
+                }
+            }
+            return size;
+        }
+
+    private:
+        Module *module_;
+        Options options_;
+        uint32_t budget_ = 0;
+        std::unordered_map<const Function *, uint32_t> call_counts_;
+        std::unordered_set<const Function *> recursive_;
+        std::vector<Remark> remarks_;
+
+        static std::vector<Instruction *> GetCalls(const Function *function) {
+            std::vector<Instruction *> result;
+            for (const auto &block : function->blocks) {
+                for (const auto &instruction : block->instructions) {
+                    if (instruction->opcode == Opcode::kCall) {
+                        result.push_back(instruction.get());
+                    }
+                }
+            }
+            return result;
+        }
+
+        // empty when the call is inlined
+        std::string GetMissedReason(const Instruction *call) const {
+            const Function *callee = call->callee;
+            if (callee->imported) {
+                return "imported";
+            }
+            if (recursive_.count(callee) != 0) {
+                return "recursive";
+            }
+            if (callee->frame_size != 0) {
+                return "has a frame";
+            }
+            if ((call_counts_.at(callee) == 1 && callee->export_field.empty()) || FoldsToConstant(call)) {
+                return "";
+            }
+
+            const uint32_t size = GetSize(callee);
+            if (size > options_.small_size) {
+                return "size " + std::to_string(size) + " over " + std::to_string(options_.small_size);
+            }
+            if (size > budget_) {
+                return "size " + std::to_string(size) + " over the budget " + std::to_string(budget_) + " left";
+            }
+            return "";
+        }
+
+        // a division by a constant may still trap and stays, but then the call would have trapped too
+        static bool FoldsToConstant(const Instruction *call) {
+            const Function *callee = call->callee;
+            if (callee->result == Type::empty || callee->blocks.size() != 1) {
+                return false;
+            }
+            for (const Instruction *argument : call->operands) {
+                if (argument->opcode != Opcode::kConst) {
+                    return false;
+                }
+            }
+            for (const auto &instruction : callee->GetEntry()->instructions) {
+                if (instruction->opcode == Opcode::kCall || instruction->opcode == Opcode::kLoad || instruction->opcode == Opcode::kStore) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // the functions on a cycle of calls
+        void FindRecursive() {
+            for (const auto &function : module_->functions) {
+                std::unordered_set<const Function *> visited;
+                std::vector<const Function *> stack{function.get()};
+                while (!stack.empty()) {
+                    const Function *current = stack.back();
+                    stack.pop_back();
+                    for (const Instruction *call : GetCalls(current)) {
+                        if (call->callee == function.get()) {
+                            recursive_.insert(function.get());
+                        }
+                        if (visited.insert(call->callee).second) {
+                            stack.push_back(call->callee);
+                        }
+                    }
+                }
+            }
+        }
+
+        // the defined functions, each one after the functions it calls unless they call it too
+        std::vector<Function *> GetBottomUpOrder() const {
+            std::vector<Function *> result;
+            std::unordered_set<const Function *> visited;
+            for (const auto &root : module_->functions) {
+                if (root->imported || !visited.insert(root.get()).second) {
+                    continue;
+                }
+
+                std::vector<std::pair<Function *, std::vector<Instruction *>>> stack;
+                stack.emplace_back(root.get(), GetCalls(root.get()));
+                while (!stack.empty()) {
+                    auto &[function, calls] = stack.back();
+                    if (calls.empty()) {
+                        result.push_back(function);
+                        stack.pop_back();
+                        continue;
+                    }
+
+                    Function *callee = calls.back()->callee;
+                    calls.pop_back();
+                    if (!callee->imported && visited.insert(callee).second) {
+                        stack.emplace_back(callee, GetCalls(callee));
+                    }
+                }
+            }
+            return result;
+        }
+
+        // the block of the call is split after it, the copy of the callee goes in between and its returns go to the rest
+        void Inline(Instruction *call) {
+            Block *block = call->block;
+            Function *caller = block->function;
+            const Function *callee = call->callee;
+
+            Block *rest = caller->AddBlock();
+            const size_t position = block->GetPosition(call);
+            for (size_t i = position + 1; i < block->instructions.size(); i++) {
+                block->instructions[i]->block = rest;
+                rest->instructions.push_back(std::move(block->instructions[i]));
+            }
+            block->instructions.resize(position + 1);
+            for (Block *successor : rest->GetSuccessors()) {
+                std::replace(successor->predecessors.begin(), successor->predecessors.end(), block, rest);
+            }
+
+            std::unordered_map<const Block *, Block *> blocks;
+            std::unordered_map<const Instruction *, Instruction *> values;
+            for (const auto &callee_block : callee->blocks) {
+                blocks[callee_block.get()] = caller->AddBlock();
+            }
+
+            std::vector<std::pair<Block *, Instruction *>> returns;
+            for (const auto &callee_block : callee->blocks) {
+                Block *copy = blocks.at(callee_block.get());
+                for (const Block *predecessor : callee_block->predecessors) {
+                    copy->predecessors.push_back(blocks.at(predecessor));
+                }
+
+                for (const auto &instruction : callee_block->instructions) {
+                    if (instruction->opcode == Opcode::kParam) {
+                        values[instruction.get()] = call->operands[instruction->index];
+                        continue;
+                    }
+                    if (instruction->opcode == Opcode::kReturn) {
+                        returns.emplace_back(copy, instruction->operands.empty() ? nullptr : instruction->operands[0]);
+                        continue;
+                    }
+
+                    auto clone = caller->Create(instruction->opcode, instruction->type, instruction->operands);
+                    clone->bits = instruction->bits;
+                    clone->index = instruction->index;
+                    clone->size = instruction->size;
+                    clone->callee = instruction->callee;
+                    for (const Block *target : instruction->targets) {
+                        clone->targets.push_back(blocks.at(target));
+                    }
+                    values[instruction.get()] = copy->Append(std::move(clone));
+                }
+            }
+
+            for (const auto &callee_block : callee->blocks) {
+                for (const auto &instruction : blocks.at(callee_block.get())->instructions) {
+                    for (Instruction *&operand : instruction->operands) {
+                        operand = values.at(operand);
+                    }
+                }
+            }
+
+            // the returned values meet in the rest of the block
+            Instruction *result = nullptr;
+            std::unique_ptr<Instruction> phi = caller->Create(Opcode::kPhi, callee->result);
+            for (const auto &[copy, value] : returns) {
+                auto jump = caller->Create(Opcode::kJump, Type::empty);
+                jump->targets = {rest};
+                AddTerminator(copy, std::move(jump));
+                if (value != nullptr) {
+                    phi->operands.push_back(values.at(value));
+                }
+            }
+            if (callee->result != Type::empty) {
+                if (returns.size() == 1) {
+                    result = phi->operands[0];
+                } else if (returns.empty()) {
+                    result = rest->Insert(0, caller->CreateConst(callee->result, 0));
+                } else {
+                    result = rest->Insert(0, std::move(phi));
+                }
+            }
+
+            block->Remove(call);
+            auto jump = caller->Create(Opcode::kJump, Type::empty);
+            jump->targets = {blocks.at(callee->GetEntry())};
+            AddTerminator(block, std::move(jump));
+
+            if (result != nullptr) {
+                ReplaceUses(caller, {{call, result}});
+            }
+
+            call_counts_[callee]--;
+            for (const auto &callee_block : callee->blocks) {
+                for (const auto &instruction : callee_block->instructions) {
+                    if (instruction->opcode == Opcode::kCall) {
+                        call_counts_[instruction->callee]++;
+                    }
+                }
+            }
+        }
+
+        // removing a function may leave the ones it calls without calls
+        void RemoveUncalled() {
+            auto &functions = module_->functions;
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (auto it = functions.begin(); it != functions.end(); ++it) {
+                    const Function *function = it->get();
+                    if (function->imported || !function->export_field.empty() || call_counts_[function] != 0) {
+                        continue;
+                    }
+
+                    for (const Instruction *call : GetCalls(function)) {
+                        call_counts_[call->callee]--;
+                    }
+                    remarks_.push_back(Remark{false, function->name, "", "no calls left"});
+                    functions.erase(it);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    };
+}
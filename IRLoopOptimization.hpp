@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IRAnalysis.hpp"
+
+namespace ir {
+    // Rotates while loops and hoists loop-invariant code out of loops.
+    //
+    // A while loop is lowered as a header computing the condition and branching into the body or out of the loop, with the
+    // body jumping back to the header, so each iteration takes the branch out and the jump back. Rotation copies the
+    // header in front of the loop as a guard and at the end of every jump back, where the copy branches back into the body
+    // or out of the loop; the header itself goes away and an iteration takes a single branch back. Values of the header
+    // get a definition in every copy, and their uses read the one reaching them through phis placed where the copies meet
+    // as in "Simple and Efficient Construction of Static Single Assignment Form" by Braun et al.
+    // Only a header made of pure instructions that is small enough to be copied is rotated.
+    //
+    // Invariant code motion then moves the pure instructions of a loop whose operands are all computed outside of it into
+    // the preheader, the block entering the loop, created on the edge into it when there is none. The inner loops are
+    // visited first, so their invariants may leave the outer loops too.
+    class LoopOptimization final {
+    public:
+        struct Stats {
+            uint32_t rotated = 0;
+            uint32_t hoisted = 0;
+        };
+
+        struct Options {
+            // rotation copies the header once for every jump back and once in front of the loop
+            bool rotate = true;
+            // the instructions besides the phis and the branch of a header that is rotated
+            uint32_t max_header_size = 16;
+        };
+
+        explicit LoopOptimization(Function *function) : LoopOptimization(function, Options()) {}
+
+        LoopOptimization(Function *function, Options options) : function_(function), options_(options) {}
+
+        Stats Run() {
+            if (options_.rotate) {
+                RotateLoops();
+            }
+            HoistInvariants();
+            return stats_;
+        }
+
+    private:
+        Function *function_;
+        Options options_;
+        Stats stats_;
+
+        // the definitions of the values of a rotated header in its copies, by block
+        std::unordered_map<const Instruction *, std::unordered_map<const Block *, Instruction *>> definitions_;
+        // the value a header value has at the start of a block
+        std::map<std::pair<const Instruction *, const Block *>, Instruction *> values_at_start_;
+
+        void RotateLoops() {
+            std::unordered_set<const Block *> visited;
+            for (bool changed = true; changed;) {
+                changed = false;
+                const DominatorTree tree(function_);
+                const LoopInfo loops(tree);
+                for (Block *header : loops.GetHeaders()) {
+                    if (visited.insert(header).second && Rotate(header, tree, loops, &visited)) {
+                        stats_.rotated++;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool Rotate(Block *header, const DominatorTree &tree, const LoopInfo &loops, std::unordered_set<const Block *> *visited) {
+            Instruction *branch = header->GetTerminator();
+            if (branch == nullptr || branch->opcode != Opcode::kBranch) {
+                return false;
+            }
+
+            const bool exits_on_true = !loops.Contains(header, branch->targets[0]);
+            Block *body = branch->targets[exits_on_true ? 1 : 0];
+            Block *exit = branch->targets[exits_on_true ? 0 : 1];
+            if (loops.Contains(header, exit) == loops.Contains(header, body) || body == header || body->predecessors.size() != 1 || body->GetPhiCount() != 0) {
+                return false;
+            }
+
+            std::vector<Block *> entries;
+            std::vector<Block *> latches;
+            for (Block *predecessor : header->predecessors) {
+                if (!tree.IsReachable(predecessor)) {
+                    return false;
+                }
+                (tree.IsBackEdge(predecessor, header) ? latches : entries).push_back(predecessor);
+            }
+            if (entries.size() != 1) {
+                return false;
+            }
+            const std::vector<Block *> successors = entries[0]->GetSuccessors();
+            if (std::count(successors.begin(), successors.end(), header) != 1) {
+                return false;
+            }
+            for (const Block *latch : latches) {
+                if (latch->GetTerminator()->opcode != Opcode::kJump) {
+                    return false;
+                }
+            }
+
+            // a phi taking another value of the header along a back edge would need the copy at the latch to read the previous one
+            for (size_t i = 0; i < header->GetPhiCount(); i++) {
+                const Instruction *phi = header->instructions[i].get();
+                for (const Instruction *operand : phi->operands) {
+                    if (operand->block == header && operand != phi) {
+                        return false;
+                    }
+                }
+            }
+
+            uint32_t size = 0;
+            for (const auto &instruction : header->instructions) {
+                if (instruction->opcode == Opcode::kPhi || instruction->IsTerminator()) {
+                    continue;
+                }
+                if (!instruction->IsPure() || ++size > options_.max_header_size) {
+                    return false;
+                }
+            }
+
+            // the entry goes to the guard, whose branch into the loop goes through the preheader
+            Block *entry = entries[0];
+            Block *guard = function_->AddBlock();
+            Block *preheader = function_->AddBlock();
+            Instruction *entry_terminator = entry->GetTerminator();
+            std::replace(entry_terminator->targets.begin(), entry_terminator->targets.end(), header, guard);
+            guard->predecessors.push_back(entry);
+
+            // the values the phis of the exit take from the header, the edges from the copies bring them instead
+            std::vector<Instruction *> exit_values;
+            const size_t exit_index = exit->GetPredecessorIndex(header);
+            for (size_t i = 0; i < exit->GetPhiCount(); i++) {
+                exit_values.push_back(exit->instructions[i]->operands[exit_index]);
+            }
+            exit->RemovePredecessor(header);
+            body->predecessors.clear();
+
+            definitions_.clear();
+            values_at_start_.clear();
+            CopyHeader(header, entry, guard, exits_on_true, preheader, exit, exit_values);
+            for (Block *latch : latches) {
+                latch->instructions.pop_back();
+                CopyHeader(header, latch, latch, exits_on_true, body, exit, exit_values);
+            }
+
+            auto jump = function_->Create(Opcode::kJump, Type::empty);
+            jump->targets = {body};
+            AddTerminator(preheader, std::move(jump));
+
+            // the uses of the header values outside of the copies read the definition reaching them
+            std::vector<std::pair<Instruction *, size_t>> uses;
+            for (const auto &block : function_->blocks) {
+                if (block.get() == header) {
+                    continue;
+                }
+                for (const auto &instruction : block->instructions) {
+                    for (size_t i = 0; i < instruction->operands.size(); i++) {
+                        if (instruction->operands[i]->block == header) {
+                            uses.emplace_back(instruction.get(), i);
+                        }
+                    }
+                }
+            }
+            for (const auto &[user, index] : uses) {
+                const Instruction *value = user->operands[index];
+                user->operands[index] = user->opcode == Opcode::kPhi ? ReadAtEnd(value, user->block->predecessors[index]) : ReadAtStart(value, user->block);
+            }
+
+            visited->insert(body);
+            function_->blocks.erase(std::find_if(function_->blocks.begin(), function_->blocks.end(), [header](const std::unique_ptr<Block> &block) {
+                return block.get() == header;
+            }));
+            return true;
+        }
+
+        // appends to the block a copy of the header coming from the predecessor, branching into the loop through into
+        void CopyHeader(const Block *header, const Block *predecessor, Block *block, bool exits_on_true, Block *into, Block *exit, const std::vector<Instruction *> &exit_values) {
+            const size_t index = header->GetPredecessorIndex(predecessor);
+            std::unordered_map<const Instruction *, Instruction *> copies;
+            for (const auto &instruction : header->instructions) {
+                if (instruction->opcode == Opcode::kPhi) {
+                    // a value the edge leaves as it is has no definition in the copy, its uses read the one reaching it
+                    if (instruction->operands[index] != instruction.get()) {
+                        copies[instruction.get()] = instruction->operands[index];
+                    }
+                } else if (!instruction->IsTerminator()) {
+                    auto copy = function_->Create(instruction->opcode, instruction->type);
+                    copy->bits = instruction->bits;
+                    copy->index = instruction->index;
+                    copy->size = instruction->size;
+                    for (Instruction *operand : instruction->operands) {
+                        copy->operands.push_back(copies.count(operand) != 0 ? copies.at(operand) : operand);
+                    }
+                    copies[instruction.get()] = block->Append(std::move(copy));
+                } else {
+                    Instruction *condition = instruction->operands[0];
+                    auto branch = function_->Create(Opcode::kBranch, Type::empty, {copies.count(condition) != 0 ? copies.at(condition) : condition});
+                    branch->targets = exits_on_true ? std::vector<Block *>{exit, into} : std::vector<Block *>{into, exit};
+                    AddTerminator(block, std::move(branch));
+                }
+            }
+
+            for (size_t i = 0; i < exit_values.size(); i++) {
+                exit->instructions[i]->operands.push_back(exit_values[i]);
+            }
+            for (const auto &[value, copy] : copies) {
+                definitions_[value][block] = copy;
+            }
+        }
+
+        Instruction *ReadAtEnd(const Instruction *value, Block *block) {
+            const auto it = definitions_.find(value);
+            if (it != definitions_.end() && it->second.count(block) != 0) {
+                return it->second.at(block);
+            }
+            return ReadAtStart(value, block);
+        }
+
+        Instruction *ReadAtStart(const Instruction *value, Block *block) {
+            const auto key = std::make_pair(value, block);
+            if (const auto it = values_at_start_.find(key); it != values_at_start_.end()) {
+                return it->second;
+            }
+
+            if (block->predecessors.size() == 1) {
+                return values_at_start_[key] = ReadAtEnd(value, block->predecessors[0]);
+            }
+            // the definition dominates the block, so the walk stops before the entry, the only block without predecessors
+            assert(!block->predecessors.empty());
+
+            // the phi is known before its operands are looked for, so a cycle through the loop ends at it
+            Instruction *phi = block->Insert(0, function_->Create(Opcode::kPhi, value->type));
+            values_at_start_[key] = phi;
+            for (Block *predecessor : block->predecessors) {
+                phi->operands.push_back(ReadAtEnd(value, predecessor));
+            }
+            return phi;
+        }
+
+        void HoistInvariants() {
+            std::vector<Block *> headers;
+            {
+                const DominatorTree tree(function_);
+                const LoopInfo loops(tree);
+                headers.assign(loops.GetHeaders().rbegin(), loops.GetHeaders().rend());
+            }
+
+            for (Block *header : headers) {
+                const DominatorTree tree(function_);
+                const LoopInfo loops(tree);
+                Block *preheader = GetPreheader(header, tree);
+                if (preheader == nullptr) {
+                    continue;
+                }
+
+                for (Block *block : tree.GetOrder()) {
+                    if (!loops.Contains(header, block)) {
+                        continue;
+                    }
+
+                    for (size_t i = block->GetPhiCount(); i < block->instructions.size();) {
+                        const Instruction *instruction = block->instructions[i].get();
+                        const bool invariant = instruction->IsPure() && std::none_of(instruction->operands.begin(), instruction->operands.end(), [&](const Instruction *operand) {
+                                                   return loops.Contains(header, operand->block);
+                                               });
+                        if (!invariant) {
+                            i++;
+                            continue;
+                        }
+
+                        preheader->InsertBeforeEnd(block->Remove(instruction));
+                        if (instruction->opcode != Opcode::kConst) {
+                            stats_.hoisted++;
+                        }
+                    }
+                }
+            }
+        }
+
+        // the only block entering the loop, going nowhere else; nullptr when the loop is entered from several blocks or none
+        Block *GetPreheader(Block *header, const DominatorTree &tree) {
+            Block *entry = nullptr;
+            for (Block *predecessor : header->predecessors) {
+                if (tree.IsBackEdge(predecessor, header)) {
+                    continue;
+                }
+                if (entry != nullptr) {
+                    return nullptr;
+                }
+                entry = predecessor;
+            }
+
+            if (entry == nullptr) {
+                return nullptr;
+            }
+
+            const std::vector<Block *> successors = entry->GetSuccessors();
+            if (successors.size() == 1) {
+                return entry;
+            }
+            if (std::count(successors.begin(), successors.end(), header) != 1) {
+                return nullptr;
+            }
+
+            // the edge is split, the phis of the header keep their operands for it
+            Block *preheader = function_->AddBlock();
+            Instruction *terminator = entry->GetTerminator();
+            std::replace(terminator->targets.begin(), terminator->targets.end(), header, preheader);
+            preheader->predecessors.push_back(entry);
+
+            std::replace(header->predecessors.begin(), header->predecessors.end(), entry, preheader);
+            auto jump = function_->Create(Opcode::kJump, Type::empty);
+            jump->targets = {header};
+            preheader->Append(std::move(jump));
+            return preheader;
+        }
+    };
+}
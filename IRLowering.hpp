@@ -0,0 +1,869 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IR.hpp"
+#include "ImportExportTable.hpp"
+#include "SemanticAnalyzer.hpp"
+#include "StructLayout.hpp"
+
+#define UNUSED(type) \
+    void PostVisit(const type *) override {}
+#define NOT_IMPLEMENTED(type, what)             \
+    void PostVisit(const type *node) override { \
+        Error(node, what " are not supported"); \
+    }
+
+namespace ir {
+    // Builds the IR of the reachable functions of a type-checked tree. A variable becomes the SSA values assigned to it
+    // as in "Simple and Efficient Construction of Static Single Assignment Form" by Braun et al.: a read looks for the value
+    // in the block and then in its predecessors, placing phis where they meet, and the phis of a block whose predecessors
+    // are not all known yet get their operands when it is sealed. Structs are built in the frame of the function in linear memory.
+    // What cannot be lowered is a SemanticError at the first token of the construct.
+    class Lowering final : private ISyntaxTreeVisitor {
+    public:
+        // without reordering struct fields keep their declaration order, see semantic::LayoutEngine
+        Lowering(const ImportExportTable *import_export_table, const semantic::Annotations *annotations, bool reorder_fields = true)
+            : iet_(import_export_table), annotations_(annotations), layouts_(reorder_fields) {}
+
+        // every function becomes the one at its func_iet in the module
+        Module Lower(std::vector<const FunctionNode *> functions) {
+            Module module;
+
+            for (const ImportExportTable::Import &import : iet_->imports) {
+                auto function = std::make_unique<Function>();
+                function->name = import.associate;
+                function->params = import.type.GetWasmParams();
+                const std::vector<Type> result = import.type.GetWasmReturn();
+                function->result = result.empty() ? Type::empty : result.front();
+                function->imported = true;
+                function->import_module = import.module;
+                function->import_field = import.field;
+                module.functions.push_back(std::move(function));
+            }
+
+            std::sort(functions.begin(), functions.end(), [this](const FunctionNode *lhs, const FunctionNode *rhs) {
+                return GetFuncSymbol(lhs)->func_iet < GetFuncSymbol(rhs)->func_iet;
+            });
+
+            for (const FunctionNode *node : functions) {
+                const semantic::FuncSymbol *symbol = GetFuncSymbol(node);
+                // the exports come first, a missing one leaves a gap
+                if (symbol->func_iet != module.functions.size()) {
+                    Error(node, "export `" + iet_->exports.at(module.functions.size() - iet_->imports.size()).field + "` has no function");
+                }
+
+                auto function = std::make_unique<Function>();
+                function->name = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
+
+                const auto type = BrutalCast<const semantic::FuncType *>(symbol->type);
+                for (const auto &[identifier, argument_type] : type->argument_types) {
+                    function->params.push_back(ToSignatureType(argument_type, node));
+                }
+                function->result = type->return_type != nullptr ? ToSignatureType(type->return_type, node) : Type::empty;
+
+                const size_t export_index = symbol->func_iet - iet_->imports.size();
+                if (export_index < iet_->exports.size()) {
+                    function->export_field = iet_->exports[export_index].field;
+                }
+
+                module.functions.push_back(std::move(function));
+            }
+
+            if (module.functions.size() < iet_->imports.size() + iet_->exports.size()) {
+                Error(nullptr, "export `" + iet_->exports[module.functions.size() - iet_->imports.size()].field + "` has no function");
+            }
+
+            module_ = &module;
+            for (const FunctionNode *node : functions) {
+                LowerFunction(node, module.functions[GetFuncSymbol(node)->func_iet].get());
+            }
+            module_ = nullptr;
+
+            return module;
+        }
+
+    protected:
+        void Visit(const SyntaxNode *node) override {
+            nodes_.push_back(node);
+            ISyntaxTreeVisitor::Visit(node);
+            nodes_.pop_back();
+        }
+
+        void PostVisit(const LetNode *node) override {
+            if (node->GetExpression() == nullptr) {
+                Error(node, "variables without an initializer are not supported");
+            }
+
+            const auto pattern = BrutalCast<const IdentifierPatternNode *>(node->GetPattern());
+            Instruction *value = Lower(node->GetExpression());
+            // a struct the variable does not build itself gets copied, so that assigning its fields changes no other variable
+            if (const auto it = frame_slots_.find(node); it != frame_slots_.end()) {
+                CopyStruct(BrutalCast<const semantic::SubsetStructType *>(GetLetSymbol(pattern)->type), value, 0, frame_, it->second);
+                value = GetStructAddress(it->second);
+            }
+            WriteVariable(GetLetSymbol(pattern), value);
+            value_ = nullptr;
+        }
+
+        void PostVisit(const IdentifierExpressionNode *node) override {
+            if (auto p = dynamic_cast<const semantic::LetSymbol *>(annotations_->symbols[node]); p != nullptr) {
+                value_ = ReadVariable(p, current_);
+            } else if (auto p = dynamic_cast<const semantic::ConstSymbol *>(annotations_->symbols[node]); p != nullptr) {
+                // constants are evaluated during the analysis
+                if (p->state != semantic::ConstSymbol::State::kEvaluated) {
+                    Error(node, "the value of the constant is unknown");
+                }
+                value_ = EmitConst(p->value.GetType(), p->value);
+            } else {
+                Error(node, "`" + node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString() + "` is neither a variable nor a constant");
+            }
+        }
+
+        void PostVisit(const LiteralExpressionNode *node) override {
+            const auto type = BrutalCast<const semantic::DefaultType *>(annotations_->types[node]);
+            value_ = EmitConst(type->type, node->GetLiteral()->GetToken()->GetTokenValue());
+        }
+
+        void PostVisit(const BinaryOperationNode *node) override {
+            Instruction *left = Lower(node->GetLeft());
+            Instruction *right = Lower(node->GetRight());
+            value_ = EmitBinary(GetOpcode(node->GetToken()->GetType()), left, right);
+        }
+
+        void PostVisit(const PrefixUnaryOperationNode *node) override {
+            if (node->IsException()) {
+                Error(node, "references are not supported");
+            }
+
+            switch (node->GetToken()->GetType()) {
+            case Token::Type::kMinus: {
+                // subtracts from zero, so -0.0 is 0.0
+                Instruction *zero = EmitConst(ToType(annotations_->types[node]), 0);
+                value_ = EmitBinary(Opcode::kSub, zero, Lower(node->GetRight()));
+                break;
+            }
+            case Token::Type::kNot: {
+                Instruction *operand = Lower(node->GetRight());
+                if (operand->type != Type::i32) {
+                    Error(node, "`!` is supported for bool and i32 only");
+                }
+                value_ = Emit(Opcode::kEqz, Type::i32, {operand});
+                break;
+            }
+            default:
+                Error(node, "the operator is not supported");
+            }
+        }
+
+        void PostVisit(const CallOrInitTupleNode *node) override {
+            if (dynamic_cast<const semantic::StructSymbol *>(annotations_->symbols[node]) != nullptr) {
+                const auto type = BrutalCast<const semantic::TupleStructType *>(annotations_->types[node]);
+                const semantic::StructLayout &layout = layouts_.GetLayout(type);
+                const uint32_t slot = frame_slots_.at(node);
+
+                const auto arguments = node->GetArguments();
+                for (size_t i = 0; i < arguments.size(); i++) {
+                    StoreField(type->types[i], Lower(arguments[i]), frame_, slot + layout.fields[i].offset);
+                }
+
+                value_ = GetStructAddress(slot);
+                return;
+            }
+
+            const auto symbol = dynamic_cast<const semantic::FuncSymbol *>(annotations_->symbols[node]);
+            if (symbol == nullptr || symbol->func_iet >= module_->functions.size()) {
+                Error(node, "only functions can be called");
+            }
+
+            std::vector<Instruction *> arguments;
+            for (const ExpressionNode *argument : node->GetArguments()) {
+                arguments.push_back(Lower(argument));
+            }
+
+            Function *callee = module_->functions[symbol->func_iet].get();
+            value_ = Emit(Opcode::kCall, callee->result, std::move(arguments));
+            value_->callee = callee;
+            if (callee->result == Type::empty) {
+                value_ = nullptr;
+            }
+        }
+
+        // The value is computed before the place is read, as Rust does for primitive types. A field is stored at its offset
+        // from the outermost struct, and a struct is copied into the one the place holds, as a struct variable is its address.
+        void PostVisit(const AssignmentNode *node) override {
+            const semantic::LetSymbol *variable = GetLetSymbol(node);
+            const bool is_compound = node->GetOperation().GetType() != Token::Type::kEq;
+            const auto struct_type = dynamic_cast<const semantic::SubsetStructType *>(annotations_->types[node->GetIdentifier()]);
+            if (struct_type != nullptr && is_compound) {
+                Error(node, "operators on structs are not supported");
+            }
+
+            Instruction *value = Lower(node->GetExpression());
+            if (auto target = dynamic_cast<const MemberAccessNode *>(node->GetIdentifier()); target != nullptr) {
+                Instruction *address = nullptr;
+                uint32_t offset = 0;
+                const semantic::FieldLayout &field = LowerField(target, &address, &offset);
+                if (is_compound) {
+                    value = EmitBinary(GetOpcode(GetAssignmentOperation(node->GetOperation().GetType())), EmitLoad(field.type, address, offset), value);
+                }
+                StoreField(field.type, value, address, offset);
+            } else if (struct_type != nullptr) {
+                CopyStruct(struct_type, value, 0, ReadVariable(variable, current_), 0);
+            } else {
+                if (is_compound) {
+                    value = EmitBinary(GetOpcode(GetAssignmentOperation(node->GetOperation().GetType())), ReadVariable(variable, current_), value);
+                }
+                WriteVariable(variable, value);
+            }
+
+            value_ = nullptr;
+        }
+
+        void PostVisit(const BlockNode *node) override {
+            for (const SyntaxNode *statement : node->GetStatements()) {
+                Visit(statement);
+            }
+
+            value_ = nullptr;
+            Visit(node->GetReturnExpression());
+        }
+
+        void PostVisit(const IfNode *node) override {
+            Instruction *condition = Lower(node->GetExpression());
+
+            const bool has_else = node->GetElseBlock() != nullptr || node->GetElseIf() != nullptr;
+            Block *then_block = function_->AddBlock();
+            Block *else_block = has_else ? function_->AddBlock() : nullptr;
+            Block *merge = function_->AddBlock();
+
+            Terminate(Opcode::kBranch, {condition}, {then_block, has_else ? else_block : merge});
+            Seal(then_block);
+            if (has_else) {
+                Seal(else_block);
+            }
+
+            const Type type = ToType(annotations_->types[node]);
+
+            current_ = then_block;
+            Instruction *then_value = Lower(node->GetIfBlock());
+            if (type != Type::empty && then_value == nullptr) {
+                then_value = EmitConst(type, 0);
+            }
+            Block *then_end = current_;
+            Terminate(Opcode::kJump, {}, {merge});
+
+            // the merge is reached from the end of the then branch and the end of the else branch
+            Instruction *else_value = nullptr;
+            if (has_else) {
+                current_ = else_block;
+                else_value = node->GetElseBlock() != nullptr ? Lower(node->GetElseBlock()) : Lower(node->GetElseIf());
+                if (type != Type::empty && else_value == nullptr) {
+                    else_value = EmitConst(type, 0);
+                }
+                Terminate(Opcode::kJump, {}, {merge});
+            }
+
+            Seal(merge);
+            current_ = merge;
+
+            value_ = nullptr;
+            if (type != Type::empty && has_else) {
+                value_ = AddPhi(merge, type);
+                for (const Block *predecessor : merge->predecessors) {
+                    value_->operands.push_back(predecessor == then_end ? then_value : else_value);
+                }
+            }
+        }
+
+        void PostVisit(const PredicateLoopNode *node) override {
+            Block *header = function_->AddBlock();
+            Block *body = function_->AddBlock();
+            Block *exit = function_->AddBlock();
+
+            Terminate(Opcode::kJump, {}, {header});
+            current_ = header;
+            Terminate(Opcode::kBranch, {Lower(node->GetExpression())}, {body, exit});
+            Seal(body);
+
+            LowerLoopBody(node->GetBlock(), header, body, exit);
+            value_ = nullptr;
+        }
+
+        void PostVisit(const InfiniteLoopNode *node) override {
+            Block *header = function_->AddBlock();
+            Block *exit = function_->AddBlock();
+
+            Terminate(Opcode::kJump, {}, {header});
+            const std::vector<std::pair<Block *, Instruction *>> breaks = LowerLoopBody(node->GetBlock(), header, header, exit);
+
+            // the value of the loop is the one of the break leaving it
+            value_ = nullptr;
+            const Type type = ToType(annotations_->types[node]);
+            if (type != Type::empty && !exit->predecessors.empty()) {
+                value_ = AddPhi(exit, type);
+                for (Block *predecessor : exit->predecessors) {
+                    const auto it = std::find_if(breaks.begin(), breaks.end(), [predecessor](const auto &it) { return it.first == predecessor; });
+                    value_->operands.push_back(it->second != nullptr ? it->second : predecessor->InsertBeforeEnd(function_->CreateConst(type, 0)));
+                }
+            }
+        }
+
+        void PostVisit(const BreakNode *node) override {
+            if (loops_.empty()) {
+                Error(node, "`break` outside of a loop");
+            }
+
+            Instruction *value = node->GetExpression() != nullptr ? Lower(node->GetExpression()) : nullptr;
+            loops_.back().breaks.emplace_back(current_, value);
+            Terminate(Opcode::kJump, {}, {loops_.back().exit});
+            StartUnreachable();
+        }
+
+        void PostVisit(const ContinueNode *node) override {
+            if (loops_.empty()) {
+                Error(node, "`continue` outside of a loop");
+            }
+
+            Terminate(Opcode::kJump, {}, {loops_.back().header});
+            StartUnreachable();
+        }
+
+        void PostVisit(const ReturnNode *node) override {
+            if (node->GetExpression() != nullptr) {
+                Terminate(Opcode::kReturn, {Lower(node->GetExpression())}, {});
+            } else {
+                Terminate(Opcode::kReturn, {}, {});
+            }
+            StartUnreachable();
+        }
+
+        void PostVisit(const MemberAccessNode *node) override {
+            Instruction *address = nullptr;
+            uint32_t offset = 0;
+            const semantic::FieldLayout &field = LowerField(node, &address, &offset);
+
+            // a struct field is its address
+            if (dynamic_cast<const semantic::SubsetStructType *>(field.type) != nullptr) {
+                value_ = offset != 0 ? EmitBinary(Opcode::kAdd, address, EmitConst(Type::i32, offset)) : address;
+            } else {
+                value_ = EmitLoad(field.type, address, offset);
+            }
+        }
+
+        void PostVisit(const InitStructExpressionNode *node) override {
+            if (node->GetDotDotExpression() != nullptr) {
+                Error(node, "struct update syntax is not supported");
+            }
+
+            for (const FieldInitStructExpressionNode *field : node->GetFields()) {
+                Visit(field);
+            }
+
+            value_ = GetStructAddress(frame_slots_.at(node));
+        }
+
+        void PostVisit(const IdentifierFieldInitStructExpressionNode *node) override {
+            const auto type = BrutalCast<const semantic::StructType *>(annotations_->types[node->init_struct_expression_node]);
+            const size_t index = semantic::LayoutEngine::GetFieldIndex(type, node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString());
+            const semantic::FieldLayout &field = layouts_.GetLayout(type).fields[index];
+
+            StoreField(field.type, Lower(node->GetExpression()), frame_, frame_slots_.at(node->init_struct_expression_node) + field.offset);
+        }
+
+        void PostVisit(const TupleIndexFieldInitStructExpressionNode *node) override {
+            const auto type = BrutalCast<const semantic::TupleStructType *>(annotations_->types[node->init_struct_expression_node]);
+            const size_t index = node->GetLiteral()->GetToken()->GetTokenValue().GetUnsignedInt();
+            const semantic::FieldLayout &field = layouts_.GetLayout(type).fields.at(index);
+
+            StoreField(field.type, Lower(node->GetExpression()), frame_, frame_slots_.at(node->init_struct_expression_node) + field.offset);
+        }
+
+        void PostVisit(const ShorthandFieldInitStructExpressionNode *node) override {
+            const auto type = BrutalCast<const semantic::StructType *>(annotations_->types[node->init_struct_expression_node]);
+            const size_t index = semantic::LayoutEngine::GetFieldIndex(type, node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString());
+            const semantic::FieldLayout &field = layouts_.GetLayout(type).fields[index];
+
+            StoreField(field.type, ReadVariable(GetLetSymbol(node), current_), frame_, frame_slots_.at(node->init_struct_expression_node) + field.offset);
+        }
+
+        UNUSED(IdentifierTypeNode)
+        UNUSED(IdentifierPatternNode)
+        // a constant in a body is used as an immediate
+        UNUSED(ConstantItemNode)
+        // a struct in a body declares a type only
+        UNUSED(StructNode)
+
+        NOT_IMPLEMENTED(SyntaxTree, "nested syntax trees")
+        NOT_IMPLEMENTED(FunctionNode, "nested functions")
+        NOT_IMPLEMENTED(TupleExpressionNode, "tuples")
+        NOT_IMPLEMENTED(ArrayExpressionNode, "arrays")
+        NOT_IMPLEMENTED(GroupedPatternNode, "grouped patterns")
+        NOT_IMPLEMENTED(IndexNode, "index expressions")
+        NOT_IMPLEMENTED(TuplePatternNode, "tuple patterns")
+        NOT_IMPLEMENTED(TupleStructPatternNode, "tuple struct patterns")
+        NOT_IMPLEMENTED(StructPatternNode, "struct patterns")
+        NOT_IMPLEMENTED(ReferencePatternNode, "reference patterns")
+        NOT_IMPLEMENTED(RestPatternNode, "rest patterns")
+        NOT_IMPLEMENTED(WildcardPatternNode, "wildcard patterns")
+        NOT_IMPLEMENTED(LiteralPatternNode, "literal patterns")
+        NOT_IMPLEMENTED(RefMutIdentifierFieldNode, "ref and mut field patterns")
+        NOT_IMPLEMENTED(IdentifierFieldNode, "field patterns")
+        NOT_IMPLEMENTED(TupleIndexFieldNode, "tuple index field patterns")
+        NOT_IMPLEMENTED(ArrayTypeNode, "array types")
+        NOT_IMPLEMENTED(ReferenceTypeNode, "reference types")
+        NOT_IMPLEMENTED(TupleTypeNode, "tuple types")
+        NOT_IMPLEMENTED(ParenthesizedTypeNode, "parenthesized types")
+        NOT_IMPLEMENTED(ParamStructNode, "field declarations in expressions")
+        NOT_IMPLEMENTED(ParamFunctionNode, "parameters in expressions")
+        NOT_IMPLEMENTED(LiteralNode, "bare literals")
+        NOT_IMPLEMENTED(IdentifierNode, "bare identifiers")
+        NOT_IMPLEMENTED(IteratorLoopNode, "`for` loops")
+
+    private:
+        struct Loop {
+            Block *header;
+            Block *exit;
+            // the blocks ending with a break and the values they leave the loop with
+            std::vector<std::pair<Block *, Instruction *>> breaks;
+        };
+
+        const ImportExportTable *iet_;
+        const semantic::Annotations *annotations_;
+        semantic::LayoutEngine layouts_;
+        Module *module_ = nullptr;
+
+        Function *function_ = nullptr;
+        Block *current_ = nullptr;
+        // the value of the last lowered expression, nullptr when it has none
+        Instruction *value_ = nullptr;
+        std::vector<Loop> loops_;
+
+        std::unordered_map<const Block *, std::unordered_map<const semantic::LetSymbol *, Instruction *>> definitions_;
+        std::unordered_map<const Block *, std::vector<std::pair<const semantic::LetSymbol *, Instruction *>>> incomplete_phis_;
+        std::unordered_set<const Block *> sealed_;
+
+        // the nodes being lowered, the innermost last
+        std::vector<const SyntaxNode *> nodes_;
+
+        // offsets of the structs built by the current function in its frame, by the node building them
+        std::unordered_map<const SyntaxNode *, uint32_t> frame_slots_;
+        Instruction *frame_ = nullptr;
+
+        // at the first token of node, or of the innermost node being lowered that has one when node has none
+        [[noreturn]] void Error(const SyntaxNode *node, const std::string &message) const {
+            std::optional<Token::Position> position = SyntaxTree::GetPosition(node);
+            for (auto it = nodes_.rbegin(); it != nodes_.rend() && !position.has_value(); ++it) {
+                position = SyntaxTree::GetPosition(*it);
+            }
+            throw semantic::SemanticError(position.value_or(Token::Position(1, 1, 0, 1, 1, 0)), message);
+        }
+
+        [[noreturn]] void Error(const std::string &message) const {
+            Error(nullptr, message);
+        }
+
+        void LowerFunction(const FunctionNode *node, Function *function) {
+            function_ = function;
+            definitions_.clear();
+            incomplete_phis_.clear();
+            sealed_.clear();
+
+            current_ = function->AddBlock();
+            Seal(current_);
+
+            AllocateFrame(node);
+            frame_ = function->frame_size != 0 ? Emit(Opcode::kFrame, Type::i32) : nullptr;
+
+            const std::vector<semantic::LetSymbol *> &locals = GetFuncSymbol(node)->locals;
+            for (size_t i = 0; i < function->params.size(); i++) {
+                Instruction *param = Emit(Opcode::kParam, function->params[i]);
+                param->index = i;
+                WriteVariable(locals[i], param);
+            }
+
+            Instruction *result = Lower(node->GetBlock());
+            if (function->result == Type::empty) {
+                Terminate(Opcode::kReturn, {}, {});
+            } else if (result != nullptr) {
+                Terminate(Opcode::kReturn, {result}, {});
+            } else {
+                // every path returns before the end
+                Terminate(Opcode::kUnreachable, {}, {});
+            }
+
+            RemoveTrivialPhis();
+            function_ = nullptr;
+        }
+
+        // the value of the expression, nullptr when it has none
+        Instruction *Lower(const SyntaxNode *node) {
+            value_ = nullptr;
+            Visit(node);
+            return value_;
+        }
+
+        // the loop goes back to the header and leaves through exit; returns the breaks leaving it
+        std::vector<std::pair<Block *, Instruction *>> LowerLoopBody(const BlockNode *block, Block *header, Block *body, Block *exit) {
+            current_ = body;
+            loops_.push_back(Loop{header, exit, {}});
+            Lower(block);
+            std::vector<std::pair<Block *, Instruction *>> breaks = std::move(loops_.back().breaks);
+            loops_.pop_back();
+            Terminate(Opcode::kJump, {}, {header});
+
+            Seal(header);
+            Seal(exit);
+            current_ = exit;
+            return breaks;
+        }
+
+        // what follows a return, break or continue goes to a block no edge leads to
+        void StartUnreachable() {
+            current_ = function_->AddBlock();
+            Seal(current_);
+            value_ = nullptr;
+        }
+
+        Instruction *Emit(Opcode opcode, Type type, std::vector<Instruction *> operands = {}) {
+            return current_->Append(function_->Create(opcode, type, std::move(operands)));
+        }
+
+        Instruction *EmitConst(Type type, uint64_t bits) {
+            return current_->Append(function_->CreateConst(type, bits));
+        }
+
+        // the value read as the type, a bool is an i32
+        Instruction *EmitConst(TokenValue::Type type, const TokenValue &value) {
+            switch (type) {
+            case TokenValue::Type::kI32:
+                return EmitConst(Type::i32, static_cast<uint32_t>(static_cast<int32_t>(value)));
+            case TokenValue::Type::kI64:
+                return EmitConst(Type::i64, static_cast<uint64_t>(static_cast<int64_t>(value)));
+            case TokenValue::Type::kF32:
+                return EmitConst(Type::f32, static_cast<uint32_t>(value));
+            case TokenValue::Type::kF64:
+                return EmitConst(Type::f64, static_cast<uint64_t>(value));
+            case TokenValue::Type::kBool:
+                return EmitConst(Type::i32, static_cast<bool>(value) ? 1 : 0);
+            default:
+                Error("values of this type are not supported");
+            }
+        }
+
+        Instruction *EmitBinary(Opcode opcode, Instruction *left, Instruction *right) {
+            const bool is_float = left->type == Type::f32 || left->type == Type::f64;
+            const bool integer_only = opcode == Opcode::kRem || opcode == Opcode::kAnd || opcode == Opcode::kOr || opcode == Opcode::kXor || opcode == Opcode::kShl || opcode == Opcode::kShr;
+            if (left->type != right->type || left->type == Type::empty || (is_float && integer_only)) {
+                Error("the operator is not supported for these operands");
+            }
+
+            const bool is_comparison = opcode >= Opcode::kEq && opcode <= Opcode::kGe;
+            return Emit(opcode, is_comparison ? Type::i32 : left->type, {left, right});
+        }
+
+        void Terminate(Opcode opcode, std::vector<Instruction *> operands, std::vector<Block *> targets) {
+            auto terminator = function_->Create(opcode, Type::empty, std::move(operands));
+            terminator->targets = std::move(targets);
+            AddTerminator(current_, std::move(terminator));
+        }
+
+        Instruction *AddPhi(Block *block, Type type) {
+            return block->Insert(block->GetPhiCount(), function_->Create(Opcode::kPhi, type));
+        }
+
+        void WriteVariable(const semantic::LetSymbol *variable, Instruction *value) {
+            definitions_[current_][variable] = value;
+        }
+
+        Instruction *ReadVariable(const semantic::LetSymbol *variable, Block *block) {
+            const auto &definitions = definitions_[block];
+            if (const auto it = definitions.find(variable); it != definitions.end()) {
+                return it->second;
+            }
+
+            Instruction *value;
+            const Type type = ToType(variable->type);
+            if (sealed_.count(block) == 0) {
+                value = AddPhi(block, type);
+                incomplete_phis_[block].emplace_back(variable, value);
+            } else if (block->predecessors.empty()) {
+                // the block cannot be reached, any value does
+                value = block->Insert(block->GetPhiCount(), function_->CreateConst(type, 0));
+            } else if (block->predecessors.size() == 1) {
+                value = ReadVariable(variable, block->predecessors.front());
+            } else {
+                // the phi is the value before its operands are read, so a loop finds it
+                value = AddPhi(block, type);
+                definitions_[block][variable] = value;
+                AddPhiOperands(variable, value);
+            }
+
+            definitions_[block][variable] = value;
+            return value;
+        }
+
+        void AddPhiOperands(const semantic::LetSymbol *variable, Instruction *phi) {
+            for (Block *predecessor : phi->block->predecessors) {
+                phi->operands.push_back(ReadVariable(variable, predecessor));
+            }
+        }
+
+        // all the predecessors of the block are known
+        void Seal(Block *block) {
+            if (const auto it = incomplete_phis_.find(block); it != incomplete_phis_.end()) {
+                for (const auto &[variable, phi] : it->second) {
+                    AddPhiOperands(variable, phi);
+                }
+                incomplete_phis_.erase(it);
+            }
+            sealed_.insert(block);
+        }
+
+        // a phi whose operands are all one value or the phi itself stands for that value
+        void RemoveTrivialPhis() {
+            for (bool changed = true; changed;) {
+                changed = false;
+
+                std::unordered_map<const Instruction *, Instruction *> replacements;
+                std::vector<Instruction *> removed;
+                for (const auto &block : function_->blocks) {
+                    for (size_t i = 0; i < block->GetPhiCount(); i++) {
+                        Instruction *phi = block->instructions[i].get();
+
+                        Instruction *same = nullptr;
+                        bool is_trivial = true;
+                        for (Instruction *operand : phi->operands) {
+                            for (auto it = replacements.find(operand); it != replacements.end(); it = replacements.find(operand)) {
+                                operand = it->second;
+                            }
+                            if (operand == phi || operand == same) {
+                                continue;
+                            }
+                            if (same != nullptr) {
+                                is_trivial = false;
+                                break;
+                            }
+                            same = operand;
+                        }
+
+                        if (is_trivial && same != nullptr) {
+                            replacements[phi] = same;
+                            removed.push_back(phi);
+                        }
+                    }
+                }
+
+                ReplaceUses(function_, replacements);
+                for (Instruction *phi : removed) {
+                    phi->block->Remove(phi);
+                    changed = true;
+                }
+            }
+        }
+
+        void AllocateFrame(const FunctionNode *node) {
+            frame_slots_.clear();
+            uint32_t frame_size = 0;
+
+            for (const SyntaxNode *it : SyntaxTree::CollectNodes(node->GetBlock())) {
+                const semantic::SubsetStructType *type = nullptr;
+                if (BuildsStruct(it)) {
+                    type = BrutalCast<const semantic::SubsetStructType *>(annotations_->types[it]);
+                } else if (auto let = dynamic_cast<const LetNode *>(it); let != nullptr && !BuildsStruct(let->GetExpression())) {
+                    type = dynamic_cast<const semantic::SubsetStructType *>(annotations_->symbols[let->GetPattern()]->type);
+                }
+
+                if (type != nullptr) {
+                    const uint32_t slot = semantic::LayoutEngine::AlignUp(frame_size, layouts_.GetAlignment(type));
+                    frame_slots_[it] = slot;
+                    frame_size = slot + layouts_.GetSize(type);
+                }
+            }
+
+            // keeps the stack pointer aligned for every type
+            function_->frame_size = semantic::LayoutEngine::AlignUp(frame_size, 8);
+        }
+
+        bool BuildsStruct(const SyntaxNode *node) const {
+            return dynamic_cast<const InitStructExpressionNode *>(node) != nullptr ||
+                   (dynamic_cast<const CallOrInitTupleNode *>(node) != nullptr && dynamic_cast<const semantic::StructSymbol *>(annotations_->symbols[node]) != nullptr);
+        }
+
+        Instruction *GetStructAddress(uint32_t slot) {
+            return slot != 0 ? EmitBinary(Opcode::kAdd, frame_, EmitConst(Type::i32, slot)) : frame_;
+        }
+
+        // the address of the outermost struct of a chain of member accesses and the offset of the field from it,
+        // q.p.c is read at the address of q with the offsets of p and c added up
+        const semantic::FieldLayout &LowerField(const MemberAccessNode *node, Instruction **address, uint32_t *offset) {
+            if (auto inner = dynamic_cast<const MemberAccessNode *>(node->GetIdentifier()); inner != nullptr) {
+                LowerField(inner, address, offset);
+            } else {
+                *address = Lower(node->GetIdentifier());
+            }
+
+            const auto type = BrutalCast<const semantic::SubsetStructType *>(annotations_->types[node->GetIdentifier()]);
+            size_t index;
+            if (auto struct_type = dynamic_cast<const semantic::StructType *>(type); struct_type != nullptr) {
+                const auto field = BrutalCast<const IdentifierExpressionNode *>(node->GetExpression());
+                index = semantic::LayoutEngine::GetFieldIndex(struct_type, field->GetIdentifier()->GetToken()->GetTokenValue().ValueToString());
+            } else {
+                index = BrutalCast<const LiteralExpressionNode *>(node->GetExpression())->GetLiteral()->GetToken()->GetTokenValue().GetUnsignedInt();
+            }
+
+            const semantic::FieldLayout &field = layouts_.GetLayout(type).fields.at(index);
+            *offset += field.offset;
+            return field;
+        }
+
+        Instruction *EmitLoad(const ISymbolType *type, Instruction *address, uint32_t offset) {
+            Instruction *load = Emit(Opcode::kLoad, ToType(type), {address});
+            load->index = offset;
+            load->size = layouts_.GetSize(type);
+            return load;
+        }
+
+        // a struct value is its address and gets copied
+        void StoreField(const ISymbolType *type, Instruction *value, Instruction *address, uint32_t offset) {
+            if (auto struct_type = dynamic_cast<const semantic::SubsetStructType *>(type); struct_type != nullptr) {
+                CopyStruct(struct_type, value, 0, address, offset);
+                return;
+            }
+
+            Instruction *store = Emit(Opcode::kStore, Type::empty, {address, value});
+            store->index = offset;
+            store->size = layouts_.GetSize(type);
+        }
+
+        void CopyStruct(const semantic::SubsetStructType *type, Instruction *source, uint32_t source_offset, Instruction *address, uint32_t offset) {
+            for (const semantic::FieldLayout &field : layouts_.GetLayout(type).fields) {
+                if (auto struct_type = dynamic_cast<const semantic::SubsetStructType *>(field.type); struct_type != nullptr) {
+                    CopyStruct(struct_type, source, source_offset + field.offset, address, offset + field.offset);
+                    continue;
+                }
+
+                StoreField(field.type, EmitLoad(field.type, source, source_offset + field.offset), address, offset + field.offset);
+            }
+        }
+
+        const semantic::LetSymbol *GetLetSymbol(const SyntaxNode *node) const {
+            return BrutalCast<const semantic::LetSymbol *>(annotations_->symbols[node]);
+        }
+
+        const semantic::FuncSymbol *GetFuncSymbol(const FunctionNode *node) const {
+            return static_cast<const semantic::FuncSymbol *>(annotations_->symbols[node]);
+        }
+
+        // a struct is its address, a bool is an i32
+        Type ToType(const ISymbolType *type) const {
+            if (dynamic_cast<const semantic::SubsetStructType *>(type) != nullptr) {
+                return Type::i32;
+            }
+
+            const auto default_type = dynamic_cast<const semantic::DefaultType *>(type);
+            if (default_type == nullptr) {
+                return Type::empty;
+            }
+
+            switch (default_type->type) {
+            case TokenValue::Type::kBool:
+            case TokenValue::Type::kI32:
+                return Type::i32;
+            case TokenValue::Type::kI64:
+                return Type::i64;
+            case TokenValue::Type::kF32:
+                return Type::f32;
+            case TokenValue::Type::kF64:
+                return Type::f64;
+            case TokenValue::Type::kVoid:
+                return Type::empty;
+            default:
+                Error("values of this type are not supported");
+            }
+        }
+
+        // structs are not passed to and returned from functions yet
+        Type ToSignatureType(const ISymbolType *type, const FunctionNode *node) const {
+            if (dynamic_cast<const semantic::SubsetStructType *>(type) != nullptr) {
+                Error(node->GetIdentifier(), "struct parameters and return values are not supported");
+            }
+            return ToType(type);
+        }
+
+        Opcode GetOpcode(Token::Type operation) const {
+            switch (operation) {
+            case Token::Type::kPlus:
+                return Opcode::kAdd;
+            case Token::Type::kMinus:
+                return Opcode::kSub;
+            case Token::Type::kStar:
+                return Opcode::kMul;
+            case Token::Type::kSlash:
+                return Opcode::kDiv;
+            case Token::Type::kPercent:
+                return Opcode::kRem;
+            // both sides are evaluated
+            case Token::Type::kAnd:
+            case Token::Type::kAndAnd:
+                return Opcode::kAnd;
+            case Token::Type::kOr:
+            case Token::Type::kOrOr:
+                return Opcode::kOr;
+            case Token::Type::kCaret:
+                return Opcode::kXor;
+            case Token::Type::kShl:
+                return Opcode::kShl;
+            case Token::Type::kShr:
+                return Opcode::kShr;
+            case Token::Type::kEqEq:
+                return Opcode::kEq;
+            case Token::Type::kNe:
+                return Opcode::kNe;
+            case Token::Type::kLt:
+                return Opcode::kLt;
+            case Token::Type::kGt:
+                return Opcode::kGt;
+            case Token::Type::kLe:
+                return Opcode::kLe;
+            case Token::Type::kGe:
+                return Opcode::kGe;
+            default:
+                Error("the operator is not supported");
+            }
+        }
+
+        Token::Type GetAssignmentOperation(Token::Type operation) const {
+            switch (operation) {
+            case Token::Type::kPlusEq:
+                return Token::Type::kPlus;
+            case Token::Type::kMinusEq:
+                return Token::Type::kMinus;
+            case Token::Type::kStarEq:
+                return Token::Type::kStar;
+            case Token::Type::kSlashEq:
+                return Token::Type::kSlash;
+            case Token::Type::kPercentEq:
+                return Token::Type::kPercent;
+            case Token::Type::kCaretEq:
+                return Token::Type::kCaret;
+            case Token::Type::kAndEq:
+                return Token::Type::kAnd;
+            case Token::Type::kOrEq:
+                return Token::Type::kOr;
+            case Token::Type::kShlEq:
+                return Token::Type::kShl;
+            case Token::Type::kShrEq:
+                return Token::Type::kShr;
+            default:
+                Error("the operator is not supported");
+            }
+        }
+    };
+}
+
+#undef NOT_IMPLEMENTED
+#undef UNUSED
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IRConstantPropagation.hpp"
+#include "IRDeadCodeElimination.hpp"
+#include "IRInliner.hpp"
+#include "IRLoopOptimization.hpp"
+#include "IRStrengthReduction.hpp"
+#include "IRValueNumbering.hpp"
+
+namespace ir {
+    // Runs the passes an optimization level selects over a module, in the style of -O0 to -O3 and -Os of clang.
+    //
+    // Constant folding and dead code elimination go first and run again after every pass leaving work for them: the
+    // copies of inlined functions see their constant arguments, and the rotation leaves phis where a value does not change.
+    // Then every function gets value numbering, strength reduction, whose products of the step are loop invariant, and
+    // the loop optimization hoisting them. -O3 inlines and rotates more, and -Os leaves out whatever makes the code larger:
+    // the induction variables and divisions of the strength reduction, and the rotation of all but the smallest headers.
+    // It inlines as -O2 does since the only calls and the small functions shrink the code once folded. The options of
+    // the generator are chosen here but applied by WasmGenerator.
+    class PassManager final {
+    public:
+        enum class Level { kO0, kO1, kO2, kO3, kOs };
+
+        struct Options {
+            bool fold_constants = false;
+            bool eliminate_dead_code = false;
+            bool inline_calls = false;
+            Inliner::Options inliner;
+            bool number_values = false;
+            bool reduce_strength = false;
+            StrengthReduction::Options reduction;
+            bool optimize_loops = false;
+            LoopOptimization::Options loops;
+            bool coalesce_locals = false;
+            bool peephole = false;
+        };
+
+        // the time taken by every run of a pass
+        struct Timing {
+            std::string pass;
+            uint32_t runs = 0;
+            std::chrono::steady_clock::duration time{};
+        };
+
+        // the changes of the passes to a function summed over their runs
+        struct Stats {
+            DeadCodeElimination::Stats dead_code;
+            ValueNumbering::Stats numbering;
+            StrengthReduction::Stats reduction;
+            LoopOptimization::Stats loops;
+        };
+
+        // the level of the name after -O, false for an unknown one
+        static bool ParseLevel(const std::string &name, Level *level) {
+            static const std::unordered_map<std::string, Level> kLevels{
+                {"0", Level::kO0}, {"1", Level::kO1}, {"2", Level::kO2}, {"3", Level::kO3}, {"s", Level::kOs},
+            };
+            const auto it = kLevels.find(name);
+            if (it == kLevels.end()) {
+                return false;
+            }
+            *level = it->second;
+            return true;
+        }
+
+        // the budget of the inliner after --inline-budget=, false unless it is a number that fits
+        static bool ParseBudget(const std::string &value, uint32_t *budget) {
+            const char *end = value.data() + value.size();
+            const auto [ptr, error] = std::from_chars(value.data(), end, *budget);
+            return !value.empty() && error == std::errc() && ptr == end;
+        }
+
+        static Options GetOptions(Level level) {
+            Options options;
+            if (level == Level::kO0) {
+                return options;
+            }
+
+            options.fold_constants = true;
+            options.eliminate_dead_code = true;
+            options.coalesce_locals = true;
+            options.peephole = true;
+            if (level == Level::kO1) {
+                return options;
+            }
+
+            options.inline_calls = true;
+            options.number_values = true;
+            options.reduce_strength = true;
+            options.optimize_loops = true;
+            if (level == Level::kO3) {
+                options.inliner.small_size = 24;
+                options.inliner.budget = 1024;
+                options.loops.max_header_size = 32;
+            } else if (level == Level::kOs) {
+                options.reduction.reduce_inductions = false;
+                options.reduction.expand_divisions = false;
+                // a copy of a header this small takes no more than the branch it saves
+                options.loops.max_header_size = 2;
+            }
+            return options;
+        }
+
+        PassManager(Module *module, Options options) : module_(module), options_(options) {}
+
+        void Run() {
+            Simplify();
+            if (options_.inline_calls) {
+                Time("inliner", [this]() {
+                    remarks_ = Inliner(module_, options_.inliner).Run();
+                });
+                Simplify();
+            }
+
+            if (!options_.number_values && !options_.reduce_strength && !options_.optimize_loops) {
+                return;
+            }
+            std::unordered_set<const Function *> pure_functions;
+            if (options_.number_values) {
+                Time("purity-analysis", [this, &pure_functions]() {
+                    pure_functions = ValueNumbering::FindPureFunctions(module_);
+                });
+            }
+            for (const auto &function : module_->functions) {
+                if (function->imported) {
+                    continue;
+                }
+                Stats &stats = stats_[function->name];
+                if (options_.number_values) {
+                    Time("value-numbering", [&]() {
+                        stats.numbering = ValueNumbering(function.get(), pure_functions).Run();
+                    });
+                }
+                if (options_.reduce_strength) {
+                    Time("strength-reduction", [&]() {
+                        stats.reduction = StrengthReduction(function.get(), options_.reduction).Run();
+                    });
+                }
+                if (options_.optimize_loops) {
+                    Time("loop-optimization", [&]() {
+                        stats.loops = LoopOptimization(function.get(), options_.loops).Run();
+                    });
+                }
+            }
+            Simplify();
+        }
+
+        // the decisions of the inliner, empty when it did not run
+        const std::vector<Inliner::Remark> &GetRemarks() const {
+            return remarks_;
+        }
+
+        // by function name
+        const std::unordered_map<std::string, Stats> &GetStats() const {
+            return stats_;
+        }
+
+        // in the order the passes first ran
+        const std::vector<Timing> &GetTimings() const {
+            return timings_;
+        }
+
+    private:
+        Module *module_;
+        Options options_;
+        std::vector<Inliner::Remark> remarks_;
+        std::unordered_map<std::string, Stats> stats_;
+        std::vector<Timing> timings_;
+
+        void Simplify() {
+            for (const auto &function : module_->functions) {
+                if (function->imported) {
+                    continue;
+                }
+                if (options_.fold_constants) {
+                    Time("constant-propagation", [&]() {
+                        ConstantPropagation(function.get()).Run();
+                    });
+                }
+                if (options_.eliminate_dead_code) {
+                    Time("dead-code-elimination", [&]() {
+                        const DeadCodeElimination::Stats stats = DeadCodeElimination(function.get()).Run();
+                        stats_[function->name].dead_code.instructions += stats.instructions;
+                        stats_[function->name].dead_code.blocks += stats.blocks;
+                    });
+                }
+            }
+        }
+
+        template <typename Pass>
+        void Time(const std::string &name, Pass pass) {
+            auto it = std::find_if(timings_.begin(), timings_.end(), [&name](const Timing &timing) {
+                return timing.pass == name;
+            });
+            if (it == timings_.end()) {
+                it = timings_.insert(timings_.end(), Timing{name});
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            pass();
+            it->time += std::chrono::steady_clock::now() - start;
+            it->runs++;
+        }
+    };
+}
@@ -0,0 +1,414 @@
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "IRAnalysis.hpp"
+
+namespace ir {
+    // Replaces integer operations by cheaper ones computing the same value.
+    //
+    // A multiplication of an induction variable, a phi of a loop header that every jump back adds a loop-invariant step
+    // to, by a loop-invariant factor becomes a phi of its own starting at the product of the initial value and adding the
+    // product of the step on every jump back, so the loop adds instead of multiplying.
+    //
+    // Then the operations with a constant operand, moved to the right of a commutative operation, are simplified:
+    // x + 0, x - 0, x * 1, x / 1, x & -1, x | 0, x ^ 0 and shifts by 0 are x, x * 0, x & 0 and x % 1 are 0, a chain of
+    // additions, multiplications or bitwise operations of constants on a value becomes one, and a multiplication by a
+    // power of two becomes a left shift. A division by a power of two becomes an arithmetic right shift of the dividend
+    // with 2^k - 1 added to a negative one, so it still rounds toward zero, and the remainder subtracts the multiple of the
+    // power of two this division leaves, so it takes the sign of the dividend. The same value on both sides makes x - x
+    // and x ^ x 0, x & x and x | x x, and the comparisons known. Floats are left as they are, where x + 0 is not x for -0.
+    class StrengthReduction final {
+    public:
+        struct Stats {
+            uint32_t simplified = 0;
+            uint32_t reduced = 0;
+        };
+
+        struct Options {
+            // the multiplications of induction variables, each one adds a phi and an addition to the loop
+            bool reduce_inductions = true;
+            // the divisions and remainders by powers of two, which take more instructions than they save time
+            bool expand_divisions = true;
+        };
+
+        explicit StrengthReduction(Function *function) : StrengthReduction(function, Options()) {}
+
+        StrengthReduction(Function *function, Options options) : function_(function), options_(options) {}
+
+        Stats Run() {
+            if (options_.reduce_inductions) {
+                ReduceInductionMultiplications();
+            }
+
+            const DominatorTree tree(function_);
+            for (Block *block : tree.GetOrder()) {
+                // the operands come before their users except for the phis, whose operands get replaced at the end
+                const std::vector<Instruction *> instructions = GetInstructions(block);
+                for (Instruction *instruction : instructions) {
+                    Simplify(instruction);
+                }
+            }
+
+            ReplaceUses(function_, replacements_);
+            for (const auto &[instruction, value] : replacements_) {
+                instruction->block->Remove(instruction);
+            }
+            return stats_;
+        }
+
+    private:
+        Function *function_;
+        Options options_;
+        Stats stats_;
+        // the instructions whose value another one has, removed at the end so no new instruction takes their address
+        std::unordered_map<const Instruction *, Instruction *> replacements_;
+
+        static std::vector<Instruction *> GetInstructions(const Block *block) {
+            std::vector<Instruction *> result;
+            for (const auto &instruction : block->instructions) {
+                result.push_back(instruction.get());
+            }
+            return result;
+        }
+
+        static bool IsInteger(Type type) {
+            return type == Type::i32 || type == Type::i64;
+        }
+
+        static bool GetConstant(const Instruction *value, int64_t *result) {
+            if (value->opcode != Opcode::kConst || !IsInteger(value->type)) {
+                return false;
+            }
+            *result = value->type == Type::i32 ? value->GetI32() : value->GetI64();
+            return true;
+        }
+
+        // k for a positive 2^k, -1 for anything else
+        static int GetLog2(int64_t value) {
+            if (value <= 0 || (value & (value - 1)) != 0) {
+                return -1;
+            }
+            int result = 0;
+            while (value >> result != 1) {
+                result++;
+            }
+            return result;
+        }
+
+        static int GetWidth(Type type) {
+            return type == Type::i32 ? 32 : 64;
+        }
+
+        // the value wrapped around to the type as the wasm instruction computes it
+        static int64_t Wrap(Type type, uint64_t value) {
+            return type == Type::i32 ? static_cast<int32_t>(static_cast<uint32_t>(value)) : static_cast<int64_t>(value);
+        }
+
+        Instruction *Resolve(Instruction *value) const {
+            for (auto it = replacements_.find(value); it != replacements_.end(); it = replacements_.find(value)) {
+                value = it->second;
+            }
+            return value;
+        }
+
+        Instruction *InsertBefore(Instruction *before, std::unique_ptr<Instruction> instruction) {
+            Block *block = before->block;
+            return block->Insert(block->GetPosition(before), std::move(instruction));
+        }
+
+        Instruction *CreateConstant(Instruction *before, Type type, int64_t value) {
+            return InsertBefore(before, function_->CreateConst(type, type == Type::i32 ? static_cast<uint32_t>(value) : static_cast<uint64_t>(value)));
+        }
+
+        void Replace(Instruction *instruction, Instruction *value) {
+            replacements_[instruction] = value;
+            stats_.simplified++;
+        }
+
+        void MakeConstant(Instruction *instruction, int64_t value) {
+            instruction->opcode = Opcode::kConst;
+            instruction->operands.clear();
+            instruction->bits = instruction->type == Type::i32 ? static_cast<uint32_t>(value) : static_cast<uint64_t>(value);
+            stats_.simplified++;
+        }
+
+        void Simplify(Instruction *instruction) {
+            if (replacements_.count(instruction) != 0) {
+                return;
+            }
+            for (Instruction *&operand : instruction->operands) {
+                operand = Resolve(operand);
+            }
+            if (!instruction->IsBinary() || !IsInteger(instruction->operands[0]->type)) {
+                return;
+            }
+
+            int64_t constant;
+            auto &operands = instruction->operands;
+            if (instruction->IsCommutative() && GetConstant(operands[0], &constant) && !GetConstant(operands[1], &constant)) {
+                std::swap(operands[0], operands[1]);
+            }
+
+            if (operands[0] == operands[1]) {
+                SimplifySameOperands(instruction);
+            } else if (GetConstant(operands[1], &constant)) {
+                SimplifyConstantOperand(instruction, constant);
+            }
+        }
+
+        void SimplifySameOperands(Instruction *instruction) {
+            switch (instruction->opcode) {
+            case Opcode::kSub:
+            case Opcode::kXor:
+            case Opcode::kNe:
+            case Opcode::kLt:
+            case Opcode::kGt:
+                MakeConstant(instruction, 0);
+                break;
+            case Opcode::kEq:
+            case Opcode::kLe:
+            case Opcode::kGe:
+                MakeConstant(instruction, 1);
+                break;
+            case Opcode::kAnd:
+            case Opcode::kOr:
+                Replace(instruction, instruction->operands[0]);
+                break;
+            default:
+                break;
+            }
+        }
+
+        void SimplifyConstantOperand(Instruction *instruction, int64_t constant) {
+            const Type type = instruction->type;
+            Instruction *value = instruction->operands[0];
+            int64_t inner;
+
+            switch (instruction->opcode) {
+            case Opcode::kAdd:
+            case Opcode::kSub: {
+                // the chain adds up to a single offset
+                int64_t offset = instruction->opcode == Opcode::kAdd ? constant : Wrap(type, 0 - static_cast<uint64_t>(constant));
+                if ((value->opcode == Opcode::kAdd || value->opcode == Opcode::kSub) && GetConstant(value->operands[1], &inner)) {
+                    offset = Wrap(type, static_cast<uint64_t>(offset) + (value->opcode == Opcode::kAdd ? static_cast<uint64_t>(inner) : 0 - static_cast<uint64_t>(inner)));
+                    value = value->operands[0];
+                    if (offset != 0) {
+                        instruction->opcode = Opcode::kAdd;
+                        instruction->operands = {value, CreateConstant(instruction, type, offset)};
+                        stats_.simplified++;
+                    }
+                }
+                if (offset == 0) {
+                    Replace(instruction, value);
+                }
+                break;
+            }
+            case Opcode::kMul: {
+                if (value->opcode == Opcode::kMul && GetConstant(value->operands[1], &inner)) {
+                    constant = Wrap(type, static_cast<uint64_t>(constant) * static_cast<uint64_t>(inner));
+                    value = value->operands[0];
+                    instruction->operands = {value, CreateConstant(instruction, type, constant)};
+                    stats_.simplified++;
+                }
+
+                const int shift = GetLog2(constant);
+                if (constant == 0) {
+                    MakeConstant(instruction, 0);
+                } else if (constant == 1) {
+                    Replace(instruction, value);
+                } else if (shift > 0) {
+                    instruction->opcode = Opcode::kShl;
+                    instruction->operands[1] = CreateConstant(instruction, type, shift);
+                    stats_.simplified++;
+                }
+                break;
+            }
+            case Opcode::kDiv: {
+                const int shift = GetLog2(constant);
+                if (constant == 1) {
+                    Replace(instruction, value);
+                } else if (shift > 0 && options_.expand_divisions) {
+                    Instruction *rounded = InsertBefore(instruction, function_->Create(Opcode::kAdd, type, {value, CreateBias(instruction, value, shift)}));
+                    instruction->opcode = Opcode::kShr;
+                    instruction->operands = {rounded, CreateConstant(instruction, type, shift)};
+                    stats_.simplified++;
+                }
+                break;
+            }
+            case Opcode::kRem: {
+                const int shift = GetLog2(constant);
+                if (constant == 1 || constant == -1) {
+                    MakeConstant(instruction, 0);
+                } else if (shift > 0 && options_.expand_divisions) {
+                    Instruction *rounded = InsertBefore(instruction, function_->Create(Opcode::kAdd, type, {value, CreateBias(instruction, value, shift)}));
+                    Instruction *multiple = InsertBefore(instruction, function_->Create(Opcode::kAnd, type, {rounded, CreateConstant(instruction, type, -constant)}));
+                    instruction->opcode = Opcode::kSub;
+                    instruction->operands = {value, multiple};
+                    stats_.simplified++;
+                }
+                break;
+            }
+            case Opcode::kAnd:
+            case Opcode::kOr:
+            case Opcode::kXor: {
+                if (value->opcode == instruction->opcode && GetConstant(value->operands[1], &inner)) {
+                    constant = instruction->opcode == Opcode::kAnd ? constant & inner : instruction->opcode == Opcode::kOr ? constant | inner : constant ^ inner;
+                    value = value->operands[0];
+                    instruction->operands = {value, CreateConstant(instruction, type, constant)};
+                    stats_.simplified++;
+                }
+
+                // the constant that leaves the value as it is and the one that decides the result
+                const int64_t neutral = instruction->opcode == Opcode::kAnd ? -1 : 0;
+                if (constant == neutral) {
+                    Replace(instruction, value);
+                } else if (instruction->opcode != Opcode::kXor && constant == ~neutral) {
+                    MakeConstant(instruction, constant);
+                }
+                break;
+            }
+            case Opcode::kShl:
+            case Opcode::kShr:
+            case Opcode::kShrU:
+                if ((constant & (GetWidth(type) - 1)) == 0) {
+                    Replace(instruction, value);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        // 2^shift - 1 for a negative value and 0 otherwise
+        Instruction *CreateBias(Instruction *before, Instruction *value, int shift) {
+            const Type type = value->type;
+            const int width = GetWidth(type);
+            if (shift == 1) {
+                return InsertBefore(before, function_->Create(Opcode::kShrU, type, {value, CreateConstant(before, type, width - 1)}));
+            }
+            Instruction *sign = InsertBefore(before, function_->Create(Opcode::kShr, type, {value, CreateConstant(before, type, width - 1)}));
+            return InsertBefore(before, function_->Create(Opcode::kShrU, type, {sign, CreateConstant(before, type, width - shift)}));
+        }
+
+        void ReduceInductionMultiplications() {
+            const DominatorTree tree(function_);
+            const LoopInfo loops(tree);
+
+            std::unordered_map<const Instruction *, std::vector<Instruction *>> users;
+            for (const auto &block : function_->blocks) {
+                for (const auto &instruction : block->instructions) {
+                    for (const Instruction *operand : instruction->operands) {
+                        users[operand].push_back(instruction.get());
+                    }
+                }
+            }
+
+            // the phi of the product of an induction variable and a factor
+            std::map<std::pair<const Instruction *, const Instruction *>, Instruction *> products;
+            for (Block *header : loops.GetHeaders()) {
+                std::vector<Instruction *> phis = GetInstructions(header);
+                phis.resize(header->GetPhiCount());
+
+                for (Instruction *phi : phis) {
+                    if (!IsInteger(phi->type) || !IsInductionVariable(phi, tree, loops)) {
+                        continue;
+                    }
+
+                    for (Instruction *user : users[phi]) {
+                        if (user->opcode != Opcode::kMul || !loops.Contains(header, user->block) || user->operands[0] == user->operands[1]) {
+                            continue;
+                        }
+
+                        Instruction *factor = user->operands[user->operands[0] == phi ? 1 : 0];
+                        int64_t constant;
+                        const bool cheap = GetConstant(factor, &constant) && (constant == 0 || constant == 1 || GetLog2(constant) > 0);
+                        if (cheap || !IsInvariant(factor, header, loops)) {
+                            continue;
+                        }
+
+                        Instruction *&product = products[std::make_pair(phi, factor)];
+                        if (product == nullptr) {
+                            product = CreateProduct(phi, factor, tree);
+                        }
+                        replacements_[user] = product;
+                        stats_.reduced++;
+                    }
+                }
+            }
+
+            ReplaceUses(function_, replacements_);
+        }
+
+        // every jump back leaves the phi as it is or adds a loop-invariant step to it
+        static bool IsInductionVariable(const Instruction *phi, const DominatorTree &tree, const LoopInfo &loops) {
+            const Block *header = phi->block;
+            for (size_t i = 0; i < phi->operands.size(); i++) {
+                const Instruction *operand = phi->operands[i];
+                if (!tree.IsBackEdge(header->predecessors[i], header) || operand == phi) {
+                    continue;
+                }
+                if (operand->opcode != Opcode::kAdd || operand->operands[0] == operand->operands[1]) {
+                    return false;
+                }
+
+                const Instruction *step = operand->operands[operand->operands[0] == phi ? 1 : 0];
+                if ((operand->operands[0] != phi && operand->operands[1] != phi) || !IsInvariant(step, header, loops)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // a constant is, wherever it is
+        static bool IsInvariant(const Instruction *value, const Block *header, const LoopInfo &loops) {
+            return value->opcode == Opcode::kConst || !loops.Contains(header, value->block);
+        }
+
+        // the initial product is computed on the way into the loop and the product of the step next to the addition of it
+        Instruction *CreateProduct(Instruction *phi, Instruction *factor, const DominatorTree &tree) {
+            Block *header = phi->block;
+            Instruction *result = header->Insert(0, function_->Create(Opcode::kPhi, phi->type));
+
+            std::unordered_map<const Instruction *, Instruction *> next_values;
+            for (size_t i = 0; i < phi->operands.size(); i++) {
+                Block *predecessor = header->predecessors[i];
+                Instruction *operand = phi->operands[i];
+                if (operand == phi) {
+                    result->operands.push_back(result);
+                    continue;
+                }
+                if (!tree.IsBackEdge(predecessor, header)) {
+                    result->operands.push_back(CreateMultiplication(predecessor->GetTerminator(), operand, factor));
+                    continue;
+                }
+
+                Instruction *&next = next_values[operand];
+                if (next == nullptr) {
+                    Block *block = operand->block;
+                    Instruction *after = block->instructions[block->GetPosition(operand) + 1].get();
+                    Instruction *step = operand->operands[operand->operands[0] == phi ? 1 : 0];
+                    next = InsertBefore(after, function_->Create(Opcode::kAdd, phi->type, {result, CreateMultiplication(after, step, factor)}));
+                }
+                result->operands.push_back(next);
+            }
+            return result;
+        }
+
+        // a constant operand may be in the loop, so it is copied
+        Instruction *CreateMultiplication(Instruction *before, Instruction *lhs, Instruction *rhs) {
+            int64_t lhs_constant;
+            int64_t rhs_constant;
+            const bool lhs_known = GetConstant(lhs, &lhs_constant);
+            const bool rhs_known = GetConstant(rhs, &rhs_constant);
+            if (lhs_known && rhs_known) {
+                return CreateConstant(before, lhs->type, Wrap(lhs->type, static_cast<uint64_t>(lhs_constant) * static_cast<uint64_t>(rhs_constant)));
+            }
+            lhs = lhs_known ? CreateConstant(before, lhs->type, lhs_constant) : lhs;
+            rhs = rhs_known ? CreateConstant(before, rhs->type, rhs_constant) : rhs;
+            return InsertBefore(before, function_->Create(Opcode::kMul, lhs->type, {lhs, rhs}));
+        }
+    };
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IRAnalysis.hpp"
+
+namespace ir {
+    // Global value numbering over the dominator tree as in "Value Numbering" by Briggs, Cooper and Simpson: the blocks are
+    // visited from the entry down the tree with a table of the values computed in the blocks dominating the current one,
+    // and an instruction computing what the table already has is replaced by the value found there. The values meet in
+    // the same way the generator puts any value used more than once in a local, which it shares with the values not
+    // live at the same time.
+    //
+    // Besides the pure instructions, an integer division and remainder are reused as the first one traps if the second
+    // would, a load as long as no store or call may have written the memory since it in the same block or on the edge
+    // from the only predecessor, and a call to a function computing its result from the arguments alone.
+    class ValueNumbering final {
+    public:
+        struct Stats {
+            uint32_t values = 0;
+            uint32_t calls = 0;
+        };
+
+        ValueNumbering(Function *function, const std::unordered_set<const Function *> &pure_functions) : function_(function), pure_functions_(pure_functions) {}
+
+        // the defined functions without a frame, loads or stores that only call such functions
+        static std::unordered_set<const Function *> FindPureFunctions(const Module *module) {
+            std::unordered_set<const Function *> result;
+            for (const auto &function : module->functions) {
+                if (function->imported || function->frame_size != 0) {
+                    continue;
+                }
+                bool accesses_memory = false;
+                for (const auto &block : function->blocks) {
+                    for (const auto &instruction : block->instructions) {
+                        accesses_memory = accesses_memory || instruction->opcode == Opcode::kLoad || instruction->opcode == Opcode::kStore;
+                    }
+                }
+                if (!accesses_memory) {
+                    result.insert(function.get());
+                }
+            }
+
+            // a function calling one that is not pure is not pure either, recursive calls keep a function pure
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (const auto &function : module->functions) {
+                    if (result.count(function.get()) == 0) {
+                        continue;
+                    }
+                    for (const auto &block : function->blocks) {
+                        for (const auto &instruction : block->instructions) {
+                            if (instruction->opcode == Opcode::kCall && result.count(instruction->callee) == 0 && result.erase(function.get()) != 0) {
+                                changed = true;
+                            }
+                        }
+                    }
+                }
+            }
+            return result;
+        }
+
+        Stats Run() {
+            const DominatorTree tree(function_);
+
+            // the keys added by a block are removed again when the walk leaves it
+            struct Scope {
+                const Block *block;
+                size_t next_child;
+                size_t added;
+            };
+            Visit(tree.GetOrder().front());
+            std::vector<Scope> stack{{tree.GetOrder().front(), 0, 0}};
+            while (!stack.empty()) {
+                Scope &scope = stack.back();
+                const std::vector<Block *> &children = tree.GetChildren(scope.block);
+                if (scope.next_child < children.size()) {
+                    Block *child = children[scope.next_child++];
+                    const size_t added = added_.size();
+                    Visit(child);
+                    stack.push_back(Scope{child, 0, added});
+                    continue;
+                }
+
+                for (size_t i = scope.added; i < added_.size(); i++) {
+                    available_.erase(added_[i]);
+                }
+                added_.resize(scope.added);
+                stack.pop_back();
+            }
+
+            ReplaceUses(function_, replacements_);
+            for (const auto &block : function_->blocks) {
+                auto &instructions = block->instructions;
+                instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                                  [this](const std::unique_ptr<Instruction> &instruction) {
+                                                      return replacements_.count(instruction.get()) != 0;
+                                                  }),
+                                   instructions.end());
+            }
+            return stats_;
+        }
+
+    private:
+        using Key = std::vector<uint64_t>;
+
+        Function *function_;
+        const std::unordered_set<const Function *> &pure_functions_;
+        Stats stats_;
+
+        std::map<Key, Instruction *> available_;
+        std::vector<Key> added_;
+        std::unordered_map<const Instruction *, Instruction *> replacements_;
+
+        // the state of the memory a load reads, changed by every store or call that may write it
+        uint64_t memory_ = 0;
+        uint64_t next_memory_ = 0;
+        std::unordered_map<const Block *, uint64_t> memory_at_end_;
+
+        void Visit(const Block *block) {
+            memory_ = block->predecessors.size() == 1 && memory_at_end_.count(block->predecessors[0]) != 0 ? memory_at_end_.at(block->predecessors[0]) : ++next_memory_;
+
+            for (const auto &instruction : block->instructions) {
+                if (instruction->opcode == Opcode::kStore || (instruction->opcode == Opcode::kCall && pure_functions_.count(instruction->callee) == 0)) {
+                    memory_ = ++next_memory_;
+                    continue;
+                }
+                if (!IsNumbered(instruction.get())) {
+                    continue;
+                }
+
+                Key key = GetKey(instruction.get());
+                const auto [it, inserted] = available_.try_emplace(key, instruction.get());
+                if (inserted) {
+                    added_.push_back(std::move(key));
+                    continue;
+                }
+
+                replacements_[instruction.get()] = it->second;
+                if (instruction->opcode == Opcode::kCall) {
+                    stats_.calls++;
+                } else {
+                    stats_.values++;
+                }
+            }
+            memory_at_end_[block] = memory_;
+        }
+
+        bool IsNumbered(const Instruction *instruction) const {
+            switch (instruction->opcode) {
+            case Opcode::kConst:
+            case Opcode::kParam:
+            case Opcode::kFrame:
+                // the generator emits them at every use
+                return false;
+            case Opcode::kDiv:
+            case Opcode::kRem:
+            case Opcode::kLoad:
+                return true;
+            case Opcode::kCall:
+                return instruction->type != Type::empty && pure_functions_.count(instruction->callee) != 0;
+            default:
+                return instruction->IsPure();
+            }
+        }
+
+        Instruction *Resolve(Instruction *value) const {
+            const auto it = replacements_.find(value);
+            return it != replacements_.end() ? it->second : value;
+        }
+
+        // equal for instructions computing the same value, a constant operand is identified by its value
+        Key GetKey(const Instruction *instruction) const {
+            Key key{static_cast<uint64_t>(instruction->opcode), static_cast<uint64_t>(instruction->type), instruction->index, instruction->size,
+                    reinterpret_cast<uintptr_t>(instruction->callee)};
+            if (instruction->opcode == Opcode::kPhi) {
+                key.push_back(instruction->block->id);
+            } else if (instruction->opcode == Opcode::kLoad) {
+                key.push_back(memory_);
+            }
+
+            std::vector<std::pair<uint64_t, uint64_t>> operands;
+            for (Instruction *operand : instruction->operands) {
+                const Instruction *value = Resolve(operand);
+                operands.emplace_back(value->opcode == Opcode::kConst ? 1 + static_cast<uint64_t>(value->type) : 0, value->opcode == Opcode::kConst ? value->bits : value->id);
+            }
+            if (instruction->IsCommutative()) {
+                std::sort(operands.begin(), operands.end());
+            }
+            for (const auto &[kind, value] : operands) {
+                key.push_back(kind);
+                key.push_back(value);
+            }
+            return key;
+        }
+    };
+}
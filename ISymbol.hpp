@@ -1,19 +1,35 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <iostream>
 
+namespace semantic {
+    class TypePool;
+}
+
 class ISymbolType {
 public:
     virtual ~ISymbolType() = default;
 
-    virtual bool Equals(const ISymbolType &other) const {
-        return this == &other;
+    // types are interned, so equal types always share one id
+    bool Equals(const ISymbolType &other) const {
+        return id_ == other.id_;
+    }
+
+    uint32_t GetId() const {
+        return id_;
     }
 
 protected:
     ISymbolType() = default;
+    explicit ISymbolType(uint32_t id) : id_(id) {}
+
+private:
+    friend class semantic::TypePool;
+
+    uint32_t id_ = 0;
 };
 
 class ISymbol {
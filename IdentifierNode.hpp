@@ -17,5 +17,8 @@ public:
     }
 
 private:
+    // SyntaxParser::Reparse moves the token to its new position when an edit shifts it
+    friend class SyntaxParser;
+
     Token token_;
 };
@@ -10,8 +10,6 @@ public:
 
     const BlockNode *GetBlock() const;
 
-    std::vector<BreakNode *> break_nodes;
-
 private:
     std::unique_ptr<BlockNode> block_;
 };
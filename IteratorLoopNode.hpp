@@ -13,8 +13,6 @@ public:
     const ExpressionNode *GetExpression() const;
     const BlockNode *GetBlock() const;
 
-    std::vector<BreakNode *> break_nodes;
-
 private:
     std::unique_ptr<PatternNode> pattern_;
     std::unique_ptr<ExpressionNode> expression_;
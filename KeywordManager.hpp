@@ -8,11 +8,6 @@
 
 class KeywordManager {
 public:
-    static KeywordManager &GetInstance() {
-        static KeywordManager manager;
-        return manager;
-    }
-
     bool IsKeyword(const std::string &it) const {
         return (this->Find(it) != nullptr);
     }
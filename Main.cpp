@@ -1,12 +1,19 @@
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <thread>
 
+#include "IRPassManager.hpp"
 #include "SemanticAnalyzer.hpp"
 #include "SpecificSyntaxTreeVisitor.hpp"
 #include "SyntaxParser.hpp"
+#include "SyntaxTreeSerializer.hpp"
+#include "ThreadPool.hpp"
 #include "Tokenizer.hpp"
 #include "WasmGenerator.hpp"
+#include "Workspace.hpp"
 
 class MyVisitor : public SpecificSyntaxTreeVisitor {
 protected:
@@ -560,6 +567,19 @@ int main(int argc, char **argv) {
     bool print_tokenizer = false;
     bool print_syntax = false;
     bool print_semantic = false;
+    bool print_ir = false;
+    bool print_stats = false;
+    bool print_inlined = false;
+    bool print_not_inlined = false;
+    bool print_passes = false;
+    ir::PassManager::Level level = ir::PassManager::Level::kO2;
+    std::string level_name = "2";
+    uint32_t inline_budget = 0;
+    bool inline_budget_found = false;
+    bool use_cache = false;
+    bool parallel = false;
+    bool reorder_fields = true;
+    bool watch = false;
 
     std::string filename;
     bool filename_found = false;
@@ -573,6 +593,37 @@ int main(int argc, char **argv) {
             print_syntax = true;
         } else if (arg == "-m") {
             print_semantic = true;
+        } else if (arg == "-i") {
+            print_ir = true;
+        } else if (arg == "--stats") {
+            print_stats = true;
+        } else if (arg == "-Rpass=inline") {
+            print_inlined = true;
+        } else if (arg == "-Rpass-missed=inline") {
+            print_not_inlined = true;
+        } else if (arg.rfind("--inline-budget=", 0) == 0) {
+            if (!ir::PassManager::ParseBudget(arg.substr(arg.find('=') + 1), &inline_budget)) {
+                std::cerr << "invalid value for --inline-budget" << std::endl;
+                return 0;
+            }
+            inline_budget_found = true;
+        } else if (arg.rfind("-O", 0) == 0) {
+            level_name = arg.substr(2);
+            if (!ir::PassManager::ParseLevel(level_name, &level)) {
+                std::cerr << "invalid optimization level" << std::endl;
+                return 0;
+            }
+        } else if (arg == "--print-passes") {
+            print_passes = true;
+        } else if (arg == "-c") {
+            use_cache = true;
+        } else if (arg == "-p") {
+            parallel = true;
+        } else if (arg == "-r") {
+            // struct fields in declaration order
+            reorder_fields = false;
+        } else if (arg == "-w") {
+            watch = true;
         } else if (filename_found) {
             std::cerr << "invalid arguments" << std::endl;
             return 0;
@@ -594,6 +645,26 @@ int main(int argc, char **argv) {
 
     ImportExportTable import_export_table(p1.string());
 
+    if (watch) {
+        // checks the file again whenever it is written, only the item or block an edit touches is parsed again
+        Workspace workspace(filename, &import_export_table);
+        std::filesystem::file_time_type last_write_time;
+        while (true) {
+            std::error_code error;
+            const std::filesystem::file_time_type write_time = std::filesystem::last_write_time(filename, error);
+            if (!error && write_time != last_write_time) {
+                last_write_time = write_time;
+                if (workspace.Update()) {
+                    std::cout << filename << ": ok" << std::endl;
+                }
+                for (const std::string &diagnostic : workspace.GetDiagnostics()) {
+                    std::cerr << filename << ':' << diagnostic << std::endl;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    }
+
     std::ifstream ifs(filename);
 
     Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
@@ -611,23 +682,152 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    SyntaxParser parser(&tokenizer);
-    std::unique_ptr<SyntaxTree> syntax_tree = parser.ParseItems();
+    std::vector<SyntaxDiagnostic> diagnostics;
+    auto parse = [&]() -> std::unique_ptr<SyntaxTree> {
+        if (parallel) {
+            const std::vector<Token> tokens = SyntaxParser::Tokenize(&tokenizer);
+            return SyntaxParser::ParseItemsParallel(tokens, ThreadPool::GetDefaultThreadCount(), &diagnostics);
+        }
+
+        SyntaxParser parser(&tokenizer);
+        auto tree = parser.ParseItems();
+        diagnostics = parser.GetDiagnostics();
+        return tree;
+    };
+
+    std::unique_ptr<SyntaxTree> syntax_tree;
+    if (use_cache) {
+        const std::string cache_filename = filename + ".ast";
+
+        std::ifstream source_ifs(filename, std::ios::in | std::ios::binary);
+        const uint64_t source_hash = SyntaxTreeSerializer::HashSource(&source_ifs);
+
+        syntax_tree = SyntaxTreeSerializer::Load(cache_filename, source_hash);
+        if (syntax_tree == nullptr) {
+            syntax_tree = parse();
+            if (diagnostics.empty()) {
+                SyntaxTreeSerializer::Save(cache_filename, syntax_tree.get(), source_hash);
+            }
+        }
+    } else {
+        syntax_tree = parse();
+    }
+
+    if (!diagnostics.empty()) {
+        for (const auto &diagnostic : diagnostics) {
+            std::cerr << filename << ':' << diagnostic.ToString() << std::endl;
+        }
+
+        ifs.close();
+        return 1;
+    }
 
     if (print_syntax) {
         MyVisitor visitor;
         visitor.Visit(syntax_tree.get());
     }
 
-    semantic::SemanticAnalyzer analyzer;
-    analyzer.Analyze(syntax_tree.get(), &import_export_table);
+    semantic::QueryEngine queries(syntax_tree.get(), &import_export_table);
+    std::unique_ptr<semantic::SemanticCache> semantic_cache;
+    if (use_cache) {
+        const uint64_t environment_hash = semantic::SemanticCache::HashEnvironment(syntax_tree.get(), &import_export_table);
+        semantic_cache = semantic::SemanticCache::Load(filename + ".sem", environment_hash);
+        queries.UseCache(semantic_cache.get());
+    }
+
+    ir::Module module;
+    try {
+        if (parallel) {
+            ThreadPool thread_pool(ThreadPool::GetDefaultThreadCount());
+            queries.CheckReachable(&thread_pool);
+        }
 
-    if (print_semantic) {
-        syntax_tree->symbol_table->Print();
+        if (print_semantic) {
+            queries.CheckReachable(nullptr);
+            queries.GetAnnotations().symbol_table->Print();
+        }
+
+        module = ir::Lowering(&import_export_table, &queries.GetAnnotations(), reorder_fields).Lower(queries.CheckReachable(nullptr));
+    } catch (const semantic::SemanticError &error) {
+        std::cerr << filename << ':' << error.ToString() << std::endl;
+
+        ifs.close();
+        return 1;
+    }
+    ir::PassManager::Options options = ir::PassManager::GetOptions(level);
+    if (inline_budget_found) {
+        options.inliner.budget = inline_budget;
+    }
+    ir::PassManager pass_manager(&module, options);
+    pass_manager.Run();
+    for (const ir::Inliner::Remark &remark : pass_manager.GetRemarks()) {
+        if (remark.inlined || remark.caller.empty() ? print_inlined : print_not_inlined) {
+            std::cerr << remark.ToString() << std::endl;
+        }
+    }
+
+    if (print_stats) {
+        for (const auto &function : module.functions) {
+            if (function->imported) {
+                continue;
+            }
+
+            const auto it = pass_manager.GetStats().find(function->name);
+            const ir::PassManager::Stats stats = it != pass_manager.GetStats().end() ? it->second : ir::PassManager::Stats();
+            if (options.eliminate_dead_code) {
+                std::cout << "dead-code-elimination: " << function->name << ": " << stats.dead_code.instructions << " instructions and " << stats.dead_code.blocks << " blocks removed"
+                          << std::endl;
+            }
+            if (options.number_values) {
+                std::cout << "value-numbering: " << function->name << ": " << stats.numbering.values << " values and " << stats.numbering.calls << " calls reused" << std::endl;
+            }
+            if (options.reduce_strength) {
+                std::cout << "strength-reduction: " << function->name << ": " << stats.reduction.simplified << " instructions simplified and " << stats.reduction.reduced
+                          << " multiplications reduced" << std::endl;
+            }
+            if (options.optimize_loops) {
+                std::cout << "loop-optimization: " << function->name << ": " << stats.loops.rotated << " loops rotated and " << stats.loops.hoisted << " instructions hoisted" << std::endl;
+            }
+        }
+    }
+    if (print_ir) {
+        ir::Print(std::cout, module);
+    }
+
+    WasmGenerator generator(reorder_fields, WasmGenerator::Options{options.coalesce_locals, options.peephole});
+    const auto generation_start = std::chrono::steady_clock::now();
+    generator.Generate(module);
+    const std::chrono::steady_clock::duration generation_time = std::chrono::steady_clock::now() - generation_start;
+    if (print_passes) {
+        const auto print_pass = [](const std::string &pass, uint32_t runs, std::chrono::steady_clock::duration time) {
+            std::cout << "pass: " << pass << ": " << runs << (runs == 1 ? " run, " : " runs, ") << std::fixed << std::setprecision(3)
+                      << std::chrono::duration<double, std::milli>(time).count() << " ms" << std::endl;
+        };
+        std::cout << "pipeline: -O" << level_name << std::endl;
+        for (const ir::PassManager::Timing &timing : pass_manager.GetTimings()) {
+            print_pass(timing.pass, timing.runs, timing.time);
+        }
+
+        // the passes of the generator run once for every function, their time is part of the generation
+        const auto function_count = static_cast<uint32_t>(std::count_if(module.functions.begin(), module.functions.end(), [](const std::unique_ptr<ir::Function> &function) {
+            return !function->imported;
+        }));
+        print_pass(options.coalesce_locals ? "local-coalescing" : "local-assignment", function_count, generator.GetLocalsTime());
+        if (options.peephole) {
+            print_pass("peephole", function_count, generator.GetPeepholeTime());
+        }
+        print_pass("wasm-generation", 1, generation_time);
+    }
+    if (print_stats && options.peephole) {
+        const std::vector<wasm::Peephole::Rule> &rules = wasm::Peephole::GetRules();
+        for (size_t i = 0; i < rules.size(); i++) {
+            std::cout << "peephole: " << rules[i].name << ": " << generator.GetPeephole().GetHits()[i] << " hits" << std::endl;
+        }
+    }
+    if (semantic_cache != nullptr) {
+        semantic_cache->Save(filename + ".sem");
     }
 
-    WasmGenerator generator;
-    generator.Generate(syntax_tree.get(), &import_export_table);
     ByteArray::FileStream fs("index.wasm", std::ios::out | std::ios::binary);
     fs << generator.GetResult();
 
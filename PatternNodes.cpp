@@ -89,7 +89,7 @@ const IdentifierNode *StructPatternNode::GetIdentifier() const {
     return identifier_.get();
 }
 
-bool StructPatternNode::IsEtc() {
+bool StructPatternNode::IsEtc() const {
     return is_etc_;
 }
 
@@ -42,8 +42,6 @@ public:
     bool IsRef() const;
     bool IsMut() const;
 
-    const semantic::LetSymbol *let_node = nullptr;
-
 private:
     bool is_ref_;
     bool is_mut_;
@@ -153,7 +151,7 @@ public:
 
     const IdentifierNode *GetIdentifier() const;
 
-    bool IsEtc();
+    bool IsEtc() const;
 
     std::vector<const FieldNode *> GetFields() const;
 
@@ -12,8 +12,6 @@ public:
     const ExpressionNode *GetExpression() const;
     const BlockNode *GetBlock() const;
 
-    std::vector<BreakNode *> break_nodes;
-
 private:
     std::unique_ptr<ExpressionNode> expression_;
     std::unique_ptr<BlockNode> block_;
@@ -21,6 +21,9 @@ public:
     void Visit(ISyntaxTreeVisitor *visitor) const override;
 
 private:
+    // SyntaxParser::Reparse moves the token to its new position when an edit shifts it
+    friend class SyntaxParser;
+
     bool is_exception_ = false;
     Exception exception_;
     Token token_;
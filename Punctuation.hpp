@@ -55,7 +55,6 @@ private:
         if (start_symbol_ != c)
             return;
 
-        bool is_child = false;
         for (const Punctuation &child : children_) {
             child.TryTokenize(stream, punctuation, offset + 1, max_offset);
         }
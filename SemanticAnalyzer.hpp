@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+
+#include "Annotations.hpp"
+#include "ConstEvaluator.hpp"
 #include "ImportExportTable.hpp"
+#include "SemanticCache.hpp"
 #include "SpecificSyntaxTreeVisitor.hpp"
 #include "Symbol.hpp"
 #include "SymbolTable.hpp"
 #include "SyntaxParser.hpp"
+#include "ThreadPool.hpp"
 #include "TypesHelper.hpp"
 
 template <class... Ts>
@@ -25,12 +31,36 @@ T BrutalCast(G ptr) {
 }
 
 namespace semantic {
+    // an error the driver reports with its position instead of failing the whole compilation
+    class SemanticError : public std::exception {
+    public:
+        SemanticError(const Token::Position &position, std::string message) : position_(position), message_(std::move(message)) {}
+
+        const char *what() const noexcept override {
+            return message_.c_str();
+        }
+
+        std::string ToString() const {
+            std::ostringstream oss;
+            oss << position_.start_line << ':' << position_.start_column << ": error: " << message_;
+            return oss.str();
+        }
+
+    private:
+        Token::Position position_;
+        std::string message_;
+    };
+
+    // creates the scopes, the symbols of items and blocks and collects the break and return nodes;
+    // visiting the tree leaves the blocks of top-level functions out, VisitBody fills them in one at a time
     class BaseStructVisitor final : private SpecificSyntaxTreeVisitor {
     public:
+        BaseStructVisitor(Annotations *annotations, TypePool *type_pool) : annotations_(annotations), type_pool_(type_pool) {}
+
         void Visit(const SyntaxNode *syntaxNode) override {
             SpecificSyntaxTreeVisitor::Visit(syntaxNode);
             if (syntaxNode != nullptr) {
-                const_cast<SyntaxNode *>(syntaxNode)->symbol_table = current_;  // todo refactor
+                annotations_->symbol_tables[syntaxNode] = current_;
             }
         }
 
@@ -39,76 +69,74 @@ namespace semantic {
             Visit(syntaxNode);
         }
 
-    protected:
-        void PostVisit(const InfiniteLoopNode *const_node) override {
-            auto node = const_cast<InfiniteLoopNode *>(const_node);  // todo refactor
+        // the body interns its names apart from the other bodies
+        void VisitBody(const FunctionNode *node) {
+            current_ = static_cast<FuncSymbol *>(annotations_->symbols[node])->symbol_table.get();
+            current_->UseOwnNames();
+            current_return_nodes_ = &annotations_->return_nodes[node];
+            visit_bodies_ = true;
+            Visit(node->GetBlock());
+        }
 
+    protected:
+        void PostVisit(const InfiniteLoopNode *node) override {
             auto saved_break_nodes = current_break_nodes_;
-            current_break_nodes_ = &node->break_nodes;
+            current_break_nodes_ = &annotations_->break_nodes[node];
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
             current_break_nodes_ = saved_break_nodes;
         }
 
-        void PostVisit(const PredicateLoopNode *const_node) override {
-            auto node = const_cast<PredicateLoopNode *>(const_node);  // todo refactor
-
+        void PostVisit(const PredicateLoopNode *node) override {
             auto saved_break_nodes = current_break_nodes_;
-            current_break_nodes_ = &node->break_nodes;
+            current_break_nodes_ = &annotations_->break_nodes[node];
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
             current_break_nodes_ = saved_break_nodes;
         }
 
-        void PostVisit(const IteratorLoopNode *const_node) override {
-            auto node = const_cast<IteratorLoopNode *>(const_node);  // todo refactor
-
+        void PostVisit(const IteratorLoopNode *node) override {
             auto saved_break_nodes = current_break_nodes_;
-            current_break_nodes_ = &node->break_nodes;
+            current_break_nodes_ = &annotations_->break_nodes[node];
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
             current_break_nodes_ = saved_break_nodes;
         }
 
-        void PostVisit(const BreakNode *const_node) override {
-            auto node = const_cast<BreakNode *>(const_node);  // todo refactor
+        void PostVisit(const BreakNode *node) override {
             if (current_break_nodes_ == nullptr) {
                 throw std::exception();  // todo
             }
 
             (*current_break_nodes_).push_back(node);
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
-        void PostVisit(const ContinueNode *const_node) override {
-            auto node = const_cast<ContinueNode *>(const_node);  // todo refactor
+        void PostVisit(const ContinueNode *node) override {
             if (current_break_nodes_ == nullptr) {
                 throw std::exception();  // todo
             }
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
-        void PostVisit(const ReturnNode *const_node) override {
-            auto node = const_cast<ReturnNode *>(const_node);  // todo refactor
+        void PostVisit(const ReturnNode *node) override {
             if (current_return_nodes_ == nullptr) {
                 throw std::exception();  // todo
             }
 
             (*current_return_nodes_).push_back(node);
 
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
-        void PostVisit(const FunctionNode *const_node) override {
-            auto node = const_cast<FunctionNode *>(const_node);  // todo refactor
-
+        void PostVisit(const FunctionNode *node) override {
             auto saved_return_nodes = current_return_nodes_;
-            current_return_nodes_ = &node->return_nodes;
+            current_return_nodes_ = &annotations_->return_nodes[node];
 
             SymbolTable *saved_prev = current_;
 
@@ -116,12 +144,16 @@ namespace semantic {
 
             auto symbol = std::make_unique<FuncSymbol>(current_);
             symbol->type = type.get();
-            current_->types.push_back(std::move(type));
-            node->symbol = symbol.get();
+            type_pool_->Add(std::move(type));
+            annotations_->symbols[node] = symbol.get();
             symbol->identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
 
             current_ = symbol->symbol_table.get();
-            SpecificSyntaxTreeVisitor::PostVisit(node);
+            if (visit_bodies_) {
+                SpecificSyntaxTreeVisitor::PostVisit(node);
+            } else {
+                VisitSignature(node);
+            }
             current_ = saved_prev;
 
             current_->Add(std::move(symbol));
@@ -129,16 +161,12 @@ namespace semantic {
             current_return_nodes_ = saved_return_nodes;
         }
 
-        void PostVisit(const BlockNode *const_node) override {
-            static int block_idx = 0;
-
-            auto node = const_cast<BlockNode *>(const_node);  // todo refactor
-
+        void PostVisit(const BlockNode *node) override {
             SymbolTable *saved_prev = current_;
 
             auto symbol = std::make_unique<BlockSymbol>(current_);
-            node->symbol = symbol.get();
-            symbol->identifier = "__block" + std::to_string(block_idx);
+            annotations_->symbols[node] = symbol.get();
+            symbol->identifier = "__block" + std::to_string(block_idx_);
 
             current_ = symbol->symbol_table.get();
             SpecificSyntaxTreeVisitor::PostVisit(node);
@@ -146,34 +174,33 @@ namespace semantic {
 
             current_->Add(std::move(symbol));
 
-            block_idx++;
+            block_idx_++;
         }
 
-        void PostVisit(const StructNode *const_node) override {
-            auto node = const_cast<StructNode *>(const_node);  // todo refactor
+        void PostVisit(const StructNode *node) override {
             const auto identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
             if (node->IsTuple()) {
                 auto type = std::make_unique<TupleStructType>();
-                node->type = type.get();
                 type->identifier = identifier;
 
                 auto symbol = std::make_unique<StructSymbol>();
                 symbol->identifier = type->identifier;
                 symbol->type = type.get();
+                annotations_->symbols[node] = symbol.get();
 
-                current_->types.push_back(std::move(type));
+                type_pool_->Add(std::move(type));
 
                 current_->Add(std::move(symbol));
             } else {
                 auto type = std::make_unique<StructType>();
-                node->type = type.get();
                 type->identifier = identifier;
 
                 auto symbol = std::make_unique<StructSymbol>();
                 symbol->identifier = type->identifier;
                 symbol->type = type.get();
+                annotations_->symbols[node] = symbol.get();
 
-                current_->types.push_back(std::move(type));
+                type_pool_->Add(std::move(type));
 
                 current_->Add(std::move(symbol));
             }
@@ -181,13 +208,27 @@ namespace semantic {
             SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
-        void PostVisit(const SyntaxTree *const_node) override {
-            auto node = const_cast<SyntaxTree *>(const_node);
+        void PostVisit(const ConstantItemNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            // `const _` declares nothing
+            if (node->GetIdentifier() == nullptr) {
+                return;
+            }
+
+            auto symbol = std::make_unique<ConstSymbol>();
+            symbol->identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
+            symbol->expression = node->GetExpr();
+            annotations_->symbols[node] = symbol.get();
+
+            current_->Add(std::move(symbol));
+        }
 
-            node->symbol_table = std::make_unique<SymbolTable>();
-            current_ = node->symbol_table.get();
+        void PostVisit(const SyntaxTree *node) override {
+            annotations_->symbol_table = std::make_unique<SymbolTable>();
+            current_ = annotations_->symbol_table.get();
 
-            for (int import_idx = 0; import_idx < iet_->imports.size(); import_idx++) {
+            for (size_t import_idx = 0; import_idx < iet_->imports.size(); import_idx++) {
                 const auto &it = iet_->imports[import_idx];
                 auto func_type = std::make_unique<FuncType>();
 
@@ -195,53 +236,72 @@ namespace semantic {
                     if (it.type.ret.size() != 1) {
                         throw std::exception();  // todo
                     }
-                    func_type->return_type = &TypesHelper::ConvertToDefaultType(it.type.ret.front());
+                    func_type->return_type = type_pool_->GetDefaultType(it.type.ret.front());
                 }
 
                 for (size_t i = 0; i < it.type.params.size(); i++) {
-                    func_type->argument_types.emplace_back("arg" + std::to_string(i), &TypesHelper::ConvertToDefaultType(it.type.params[i]));
+                    func_type->argument_types.emplace_back("arg" + std::to_string(i), type_pool_->GetDefaultType(it.type.params[i]));
                 }
 
-                auto func_symbol = std::make_unique<FuncSymbol>(node->symbol_table.get());
+                auto func_symbol = std::make_unique<FuncSymbol>(current_);
                 func_symbol->identifier = it.associate;
                 func_symbol->type = func_type.get();
                 func_symbol->func_iet = import_idx;
-                node->symbol_table->types.push_back(std::move(func_type));
+                type_pool_->Add(std::move(func_type));
 
-                node->symbol_table->Add(std::move(func_symbol));
+                current_->Add(std::move(func_symbol));
             }
 
             SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
     private:
+        Annotations *annotations_;
+        TypePool *type_pool_;
         SymbolTable *current_ = nullptr;
-        std::vector<ReturnNode *> *current_return_nodes_ = nullptr;
-        std::vector<BreakNode *> *current_break_nodes_ = nullptr;
+        std::vector<const ReturnNode *> *current_return_nodes_ = nullptr;
+        std::vector<const BreakNode *> *current_break_nodes_ = nullptr;
         const ImportExportTable *iet_ = nullptr;
-        bool nested_func_ = false;
+        bool visit_bodies_ = false;
+        int block_idx_ = 0;
+
+        void VisitSignature(const FunctionNode *node) {
+            Visit(node->GetIdentifier());
+            Visit(node->GetReturnType());
+            for (const ParamFunctionNode *param : node->GetParams()) {
+                Visit(param);
+            }
+        }
     };
 
+    // resolves type nodes, fills the item types in and numbers the exported functions, skips the same blocks as BaseStructVisitor
     class StructFuncVisitor final : private SpecificSyntaxTreeVisitor {
     public:
+        StructFuncVisitor(Annotations *annotations, TypePool *type_pool) : annotations_(annotations), type_pool_(type_pool) {}
+
         void Visit(const SyntaxNode *syntaxNode, const ImportExportTable *iet) {
             iet_ = iet;
             SpecificSyntaxTreeVisitor::Visit(syntaxNode);
         }
 
-    protected:
-        void PostVisit(const IdentifierTypeNode *const_node) override {
-            auto node = const_cast<IdentifierTypeNode *>(const_node);  // TODO refactor
+        // items declared in a body are nested and never exported
+        void VisitBody(const FunctionNode *node, const ImportExportTable *iet) {
+            iet_ = iet;
+            nested_func_ = true;
+            visit_bodies_ = true;
+            SpecificSyntaxTreeVisitor::Visit(node->GetBlock());
+        }
 
+    protected:
+        void PostVisit(const IdentifierTypeNode *node) override {
             const auto identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
 
-            const auto it = TypesHelper::kDefaultTypes.find(identifier);
-            if (it != TypesHelper::kDefaultTypes.end()) {
-                node->type = &it->second;
+            if (const auto default_type = type_pool_->FindDefaultType(identifier); default_type != nullptr) {
+                annotations_->types[node] = default_type;
             } else {
-                if (auto symbol = dynamic_cast<const StructSymbol *>(node->symbol_table->Find(identifier)); symbol != nullptr) {
+                if (auto symbol = dynamic_cast<const StructSymbol *>(annotations_->symbol_tables[node]->Find(identifier)); symbol != nullptr) {
                     if (auto type = dynamic_cast<const SubsetStructType *>(symbol->type); type != nullptr) {
-                        node->type = type;
+                        annotations_->types[node] = type;
                     } else {
                         throw std::exception();  // todo
                     }
@@ -251,55 +311,102 @@ namespace semantic {
             }
         }
 
+        void PostVisit(const ParenthesizedTypeNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            annotations_->types[node] = annotations_->types[node->GetType()];
+        }
+
+        void PostVisit(const TupleTypeNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            std::vector<const ISymbolType *> types;
+            for (const TypeNode *it : node->GetTypes()) {
+                types.push_back(annotations_->types[it]);
+            }
+            annotations_->types[node] = type_pool_->GetTupleType(types);
+        }
+
+        void PostVisit(const ReferenceTypeNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            annotations_->types[node] = type_pool_->GetReferenceType(node->IsMut(), annotations_->types[node->GetType()]);
+        }
+
+        void PostVisit(const ArrayTypeNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            annotations_->types[node] = type_pool_->GetArrayType(annotations_->types[node->GetType()]);
+        }
+
         void PostVisit(const ParamFunctionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
             auto pattern = dynamic_cast<const IdentifierPatternNode *>(node->GetPattern());
             if (pattern == nullptr || pattern->IsRef() || pattern->GetPattern() != nullptr) {
                 throw std::exception();  // todo
             }
 
             const auto identifier = pattern->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
+            const auto type = annotations_->types[node->GetType()];
+            // a struct would have to be copied into the frame of the callee
+            if (dynamic_cast<const SubsetStructType *>(type) != nullptr) {
+                throw SemanticError(pattern->GetIdentifier()->GetToken()->GetPosition(), "struct parameters are not supported");
+            }
 
-            func_type_->argument_types.emplace_back(identifier, node->GetType());
+            func_type_->argument_types.emplace_back(identifier, type);
 
             auto let_symbol = std::make_unique<LetSymbol>();
             let_symbol->identifier = identifier;
             let_symbol->is_mut_ = pattern->IsMut();
-            let_symbol->type = const_cast<TypeNode *>(node->GetType());  // todo refactor
-            const_cast<IdentifierPatternNode *>(pattern)->let_node = let_symbol.get();
-            node->symbol_table->Add(std::move(let_symbol));
-
-            SpecificSyntaxTreeVisitor::PostVisit(node);
+            let_symbol->type = const_cast<ISymbolType *>(type);  // todo refactor
+            let_symbol->value_type = TypesHelper::ToLocalType(type);
+            annotations_->symbols[pattern] = let_symbol.get();
+            func_symbol_->locals.push_back(let_symbol.get());
+            annotations_->symbol_tables[node]->Add(std::move(let_symbol));
         }
 
         void PostVisit(const ParamStructNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
             if (struct_type_) {
                 const auto identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
-                struct_type_->types[identifier] = node->GetType();
+                if (!struct_type_->types.emplace(identifier, annotations_->types[node->GetType()]).second) {
+                    throw std::exception();  // todo
+                }
+                struct_type_->field_order.push_back(identifier);
             } else if (tuple_type_) {
-                tuple_type_->types.push_back(node->GetType());
+                tuple_type_->types.push_back(annotations_->types[node->GetType()]);
             }
-
-            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
         void PostVisit(const FunctionNode *node) override {
-            const auto identifier = node->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
-            const auto symbol = node->symbol;
+            const auto symbol = static_cast<FuncSymbol *>(annotations_->symbols[node]);
 
+            const auto old_func_symbol = func_symbol_;
             const auto old_func_type = func_type_;
+            func_symbol_ = symbol;
             func_type_ = dynamic_cast<FuncType *>(symbol->type);
 
-            func_type_->return_type = node->GetReturnType();
-
             const auto saved_nested_func = nested_func_;
             nested_func_ = true;
 
-            SpecificSyntaxTreeVisitor::PostVisit(node);
+            if (visit_bodies_) {
+                SpecificSyntaxTreeVisitor::PostVisit(node);
+            } else {
+                VisitSignature(node);
+            }
 
             nested_func_ = saved_nested_func;
 
+            func_type_->return_type = node->GetReturnType() != nullptr ? annotations_->types[node->GetReturnType()] : nullptr;
+            // the frame holding it is released by the return
+            if (dynamic_cast<const SubsetStructType *>(func_type_->return_type) != nullptr) {
+                throw SemanticError(node->GetIdentifier()->GetToken()->GetPosition(), "struct return values are not supported");
+            }
+
             if (!nested_func_) {
-                for (int export_idx = 0; export_idx < iet_->exports.size(); export_idx++) {
+                for (size_t export_idx = 0; export_idx < iet_->exports.size(); export_idx++) {
                     const auto &it = iet_->exports[export_idx];
 
                     if (it.associate == symbol->identifier) {
@@ -307,13 +414,13 @@ namespace semantic {
                             throw std::exception();  // todo
                         }
 
-                        if (it.type.ret.empty() && func_type_->return_type == nullptr ||
-                            it.type.ret.size() == 1 && TypesHelper::ConvertToDefaultType(it.type.ret.front()).Equals(*func_type_->return_type)) {
+                        if ((it.type.ret.empty() && func_type_->return_type == nullptr) ||
+                            (it.type.ret.size() == 1 && type_pool_->GetDefaultType(it.type.ret.front())->Equals(*func_type_->return_type))) {
                             if (func_type_->argument_types.size() == it.type.params.size()) {
                                 bool found = true;
 
                                 for (size_t i = 0; i < it.type.params.size(); i++) {
-                                    if (!TypesHelper::ConvertToDefaultType(it.type.params[i]).Equals(*func_type_->argument_types[i].second)) {
+                                    if (!type_pool_->GetDefaultType(it.type.params[i])->Equals(*func_type_->argument_types[i].second)) {
                                         found = false;
                                     }
                                 }
@@ -328,11 +435,7 @@ namespace semantic {
                 }
             }
 
-            if (symbol->func_iet == std::numeric_limits<uint32_t>::max()) {
-                symbol->func_iet = iet_->imports.size() + iet_->exports.size() + func_inner_idx_;
-                func_inner_idx_++;
-            }
-
+            func_symbol_ = old_func_symbol;
             func_type_ = old_func_type;
         }
 
@@ -340,16 +443,9 @@ namespace semantic {
             const auto old_struct_type = struct_type_;
             const auto old_tuple_type = tuple_type_;
 
-            // clang-format off
-            std::visit(overloaded{
-                [this](StructType *type) {
-                    struct_type_ = type;
-                },
-                [this](TupleStructType *type) {
-                    tuple_type_ = type;
-                }
-            }, node->type);
-            // clang-format on
+            const auto symbol = annotations_->symbols[node];
+            struct_type_ = dynamic_cast<StructType *>(symbol->type);
+            tuple_type_ = dynamic_cast<TupleStructType *>(symbol->type);
 
             SpecificSyntaxTreeVisitor::PostVisit(node);
 
@@ -357,28 +453,121 @@ namespace semantic {
             tuple_type_ = old_tuple_type;
         }
 
+        void PostVisit(const ConstantItemNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            if (auto symbol = annotations_->symbols[node]; symbol != nullptr) {
+                symbol->type = const_cast<ISymbolType *>(annotations_->types[node->GetType()]);  // todo refactor
+            }
+        }
+
     private:
+        Annotations *annotations_;
+        TypePool *type_pool_;
         StructType *struct_type_ = nullptr;
         TupleStructType *tuple_type_ = nullptr;
+        FuncSymbol *func_symbol_ = nullptr;
         FuncType *func_type_ = nullptr;
         const ImportExportTable *iet_ = nullptr;
         bool nested_func_ = false;
-        int func_inner_idx_ = 0;
+        bool visit_bodies_ = false;
+
+        void VisitSignature(const FunctionNode *node) {
+            SpecificSyntaxTreeVisitor::Visit(node->GetIdentifier());
+            SpecificSyntaxTreeVisitor::Visit(node->GetReturnType());
+            for (const ParamFunctionNode *param : node->GetParams()) {
+                SpecificSyntaxTreeVisitor::Visit(param);
+            }
+        }
+    };
+
+    // declares let bindings in statement order and binds every identifier expression to its symbol,
+    // the passes after it never search a SymbolTable by name
+    class NameResolutionVisitor final : private SpecificSyntaxTreeVisitor {
+    public:
+        explicit NameResolutionVisitor(Annotations *annotations) : annotations_(annotations) {}
+
+        void Visit(const SyntaxNode *syntaxNode) override {
+            SpecificSyntaxTreeVisitor::Visit(syntaxNode);
+        }
+
+        // the lets of the body become locals of the function
+        void VisitBody(const FunctionNode *node) {
+            function_ = static_cast<FuncSymbol *>(annotations_->symbols[node]);
+            SpecificSyntaxTreeVisitor::Visit(node->GetBlock());
+        }
+
+    protected:
+        void PostVisit(const IdentifierExpressionNode *node) override {
+            Resolve(node, node->GetIdentifier());
+        }
+
+        void PostVisit(const ShorthandFieldInitStructExpressionNode *node) override {
+            Resolve(node, node->GetIdentifier());
+        }
+
+        // the field is looked up in the struct type by ExpressionVisitor
+        void PostVisit(const MemberAccessNode *node) override {
+            Visit(node->GetIdentifier());
+        }
+
+        void PostVisit(const LetNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            auto pattern = dynamic_cast<const IdentifierPatternNode *>(node->GetPattern());
+            if (pattern == nullptr || pattern->IsRef() || pattern->GetPattern() != nullptr) {
+                throw std::exception();  // todo
+            }
+
+            // the type is known once ExpressionVisitor reaches the initializer
+            auto let_symbol = std::make_unique<LetSymbol>();
+            let_symbol->is_mut_ = pattern->IsMut();
+            let_symbol->identifier = pattern->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
+            annotations_->symbols[pattern] = let_symbol.get();
+            if (function_ != nullptr) {
+                function_->locals.push_back(let_symbol.get());
+            }
+            annotations_->symbol_tables[node]->Add(std::move(let_symbol));
+        }
+
+        void PostVisit(const FunctionNode *node) override {
+            const auto saved_function = function_;
+            function_ = static_cast<FuncSymbol *>(annotations_->symbols[node]);
+
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            function_ = saved_function;
+        }
+
+    private:
+        Annotations *annotations_;
+        // function the lets are local to, none outside of function bodies
+        FuncSymbol *function_ = nullptr;
+
+        // unresolved names are left to the pass that needs them, so it can report them
+        void Resolve(const SyntaxNode *node, const IdentifierNode *identifier) {
+            const SymbolTable *symbol_table = annotations_->symbol_tables[node];
+            const ScopeAddress address = symbol_table->FindAddress(identifier->GetToken()->GetTokenValue().ValueToString());
+
+            annotations_->addresses[node] = address;
+            annotations_->symbols[node] = const_cast<ISymbol *>(symbol_table->Get(address));
+        }
     };
 
+    // Types the expressions of the visited subtree, new types are created in type_pool.
+    // Only the nodes and the scopes of the subtree are written, so disjoint function bodies can be visited concurrently.
     class ExpressionVisitor final : public SpecificSyntaxTreeVisitor {
     public:
-        void PostVisit(const CallOrInitTupleNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+        ExpressionVisitor(Annotations *annotations, TypePool *type_pool) : annotations_(annotations), type_pool_(type_pool) {}
 
-            auto node = const_cast<CallOrInitTupleNode *>(const_node);  // todo refactor
+        void PostVisit(const CallOrInitTupleNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
             const auto arguments = node->GetArguments();
 
-            auto symbol = node->symbol_table->Find(identifier);
+            auto symbol = GetSymbol(node->GetIdentifier());
             if (auto func_symbol = dynamic_cast<const FuncSymbol *>(symbol); func_symbol != nullptr) {
-                node->type = func_symbol;
+                annotations_->symbols[node] = const_cast<FuncSymbol *>(func_symbol);
 
                 auto tmp = BrutalCast<const FuncType *>(func_symbol->type);
 
@@ -387,23 +576,23 @@ namespace semantic {
                 }
 
                 for (size_t i = 0; i < arguments.size(); i++) {
-                    if (!tmp->argument_types[i].second->Equals(*arguments[i]->type_of_expression)) {
+                    if (!tmp->argument_types[i].second->Equals(*GetType(arguments[i]))) {
                         throw std::exception();
                     }
                 }
 
-                node->type_of_expression = tmp->return_type;
+                annotations_->types[node] = tmp->return_type;
             } else if (auto struct_symbol = dynamic_cast<const StructSymbol *>(symbol); struct_symbol != nullptr) {
                 auto tmp = BrutalCast<const TupleStructType *>(struct_symbol->type);
-                node->type = tmp;
-                node->type_of_expression = tmp;
+                annotations_->symbols[node] = const_cast<StructSymbol *>(struct_symbol);
+                annotations_->types[node] = tmp;
 
                 if (tmp->types.size() != arguments.size()) {
                     throw std::exception();
                 }
 
                 for (size_t i = 0; i < arguments.size(); i++) {
-                    if (!tmp->types[i]->Equals(*arguments[i]->type_of_expression)) {
+                    if (!tmp->types[i]->Equals(*GetType(arguments[i]))) {
                         throw std::exception();
                     }
                 }
@@ -412,78 +601,63 @@ namespace semantic {
             }
         }
 
-        void PostVisit(const IndexNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<IndexNode *>(const_node);  // todo refactor
+        void PostVisit(const IndexNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
-            auto symbol = BrutalCast<const LetSymbol *>(node->symbol_table->Find(identifier));
-            auto type = BrutalCast<const ArrayTypeNode *>(symbol->type);
+            auto symbol = BrutalCast<const LetSymbol *>(GetSymbol(node->GetIdentifier()));
+            auto type = BrutalCast<const ArrayType *>(symbol->type);
 
-            node->type_of_expression = type->GetType();
+            annotations_->types[node] = type->type;
         }
 
-        void PostVisit(const LiteralExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+        void PostVisit(const LiteralExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            auto node = const_cast<LiteralExpressionNode *>(const_node);  // todo refactor
-            node->type_of_expression = &TypesHelper::kDefaultTypes.at(TypesHelper::kRawTypeToStr.at(node->GetLiteral()->GetToken()->GetTokenValue().GetType()));
+            annotations_->types[node] = type_pool_->GetDefaultType(node->GetLiteral()->GetToken()->GetTokenValue().GetType());
         }
 
-        void PostVisit(const IdentifierExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<IdentifierExpressionNode *>(const_node);  // todo refactor
+        void PostVisit(const IdentifierExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
-            auto symbol = node->symbol_table->Find(identifier);
+            const auto symbol = annotations_->symbols[node];
             if (symbol == nullptr) {
                 throw std::exception();
             }
 
-            node->type_of_expression = symbol->type;
-            node->symbol = const_cast<ISymbol *>(symbol);
-            ;
+            annotations_->types[node] = symbol->type;
         }
 
-        void PostVisit(const BinaryOperationNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<BinaryOperationNode *>(const_node);  // todo refactor
+        void PostVisit(const BinaryOperationNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            if (!node->GetLeft()->type_of_expression->Equals(*node->GetRight()->type_of_expression)) {
+            if (!GetType(node->GetLeft())->Equals(*GetType(node->GetRight()))) {
                 throw std::exception();
             }
 
             auto check = [this](const ISymbolType *lhs, TokenValue::Type rhs) {
-                return lhs->Equals(TypesHelper::kDefaultTypes.at(TypesHelper::kRawTypeToStr.at(rhs)));
+                return lhs->Equals(*type_pool_->GetDefaultType(rhs));
             };
 
-            const ISymbolType *p1 = node->GetLeft()->type_of_expression;
+            const ISymbolType *p1 = GetType(node->GetLeft());
             if (p1 == nullptr || /*check(p1, TokenValue::Type::kByteString) || check(p1, TokenValue::Type::kEmpty) ||*/ check(p1, TokenValue::Type::kText) || check(p1, TokenValue::Type::kVoid)) {
                 throw std::exception();  // todo
             }
 
             if (kBoolOperations.count(node->GetToken()->GetType()) != 0) {
-                node->type_of_expression = &TypesHelper::kDefaultTypes.at("bool");
+                annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kBool);
             } else {
                 if (check(p1, TokenValue::Type::kBool) || check(p1, TokenValue::Type::kChar)) {
                     throw std::exception();  // todo
                 }
-                node->type_of_expression = node->GetLeft()->type_of_expression;
+                annotations_->types[node] = GetType(node->GetLeft());
             }
         }
 
-        void PostVisit(const PrefixUnaryOperationNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<PrefixUnaryOperationNode *>(const_node);  // todo refactor
+        void PostVisit(const PrefixUnaryOperationNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            auto process_get_ref = [&node](bool is_mut) {
-                auto type = std::make_unique<ReferenceTypeNode>(is_mut, node->GetRight()->type_of_expression);
-                node->type_of_expression = type.get();
-                node->symbol_table->types.push_back(std::move(type));
+            auto process_get_ref = [this, node](bool is_mut) {
+                annotations_->types[node] = type_pool_->GetReferenceType(is_mut, GetType(node->GetRight()));
             };
 
             if (node->IsException()) {
@@ -500,35 +674,28 @@ namespace semantic {
                     process_get_ref(false);
                     break;
                 case Token::Type::kMinus: {
-                    const auto *p1 = dynamic_cast<const DefaultType *>(node->GetRight()->type_of_expression);
-                    if (p1 == nullptr) {
-                        auto p2 = BrutalCast<const IdentifierTypeNode *>(node->GetRight()->type_of_expression);
-                        if (auto p3 = std::get_if<const DefaultType *>(&p2->type); p3 != nullptr) {
-                            p1 = *p3;
-                        }
-                    }
-
+                    const auto *p1 = dynamic_cast<const DefaultType *>(GetType(node->GetRight()));
                     if (p1 == nullptr || p1->type == TokenValue::Type::kBool || p1->type == TokenValue::Type::kByteString || p1->type == TokenValue::Type::kChar ||
                         p1->type == TokenValue::Type::kEmpty || p1->type == TokenValue::Type::kText || p1->type == TokenValue::Type::kVoid)
                     {
                         throw std::exception();  // todo
                     }
-                    node->type_of_expression = const_node->GetRight()->type_of_expression;
+                    annotations_->types[node] = GetType(node->GetRight());
                     break;
                 }
                 case Token::Type::kStar: {
-                    const ReferenceTypeNode *p2 = dynamic_cast<const ReferenceTypeNode *>(node->GetRight()->type_of_expression);
+                    const ReferenceType *p2 = dynamic_cast<const ReferenceType *>(GetType(node->GetRight()));
                     if (p2 == nullptr) {
                         throw std::exception();  // todo
                     }
-                    node->type_of_expression = p2->GetRawType();
+                    annotations_->types[node] = p2->type;
                     break;
                 }
                 case Token::Type::kNot:
-                    if (!node->GetRight()->type_of_expression->Equals(TypesHelper::kDefaultTypes.at("bool"))) {
+                    if (!GetType(node->GetRight())->Equals(*type_pool_->GetDefaultType(TokenValue::Type::kBool))) {
                         throw std::exception();  // todo
                     }
-                    node->type_of_expression = &TypesHelper::kDefaultTypes.at("bool");
+                    annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kBool);
                     break;
                 default:
                     throw std::exception();  // todo
@@ -536,25 +703,25 @@ namespace semantic {
             }
         }
 
-        void PostVisit(const InfiniteLoopNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<InfiniteLoopNode *>(const_node);  // todo refactor
+        void PostVisit(const InfiniteLoopNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            if (!node->GetBlock()->type_of_expression->Equals(TypesHelper::kDefaultTypes.at("void"))) {
+            if (!GetType(node->GetBlock())->Equals(*type_pool_->GetDefaultType(TokenValue::Type::kVoid))) {
                 throw std::exception();  // todo
             }
 
-            if (!node->break_nodes.empty()) {
-                if (node->break_nodes.front()->GetExpression() != nullptr) {
-                    node->type_of_expression = node->break_nodes.front()->GetExpression()->type_of_expression;
+            const auto &break_nodes = annotations_->break_nodes[node];
+
+            if (!break_nodes.empty()) {
+                if (break_nodes.front()->GetExpression() != nullptr) {
+                    annotations_->types[node] = GetType(break_nodes.front()->GetExpression());
                 } else {
-                    node->type_of_expression = nullptr;
+                    annotations_->types[node] = nullptr;
                 }
             }
 
-            for (BreakNode *break_node : node->break_nodes) {
-                if (node->type_of_expression == nullptr) {
+            for (const BreakNode *break_node : break_nodes) {
+                if (GetType(node) == nullptr) {
                     if (break_node->GetExpression() == nullptr) {
                         continue;
                     } else {
@@ -562,36 +729,36 @@ namespace semantic {
                     }
                 }
 
-                if (!break_node->GetExpression()->type_of_expression->Equals(*node->type_of_expression)) {
+                if (!GetType(break_node->GetExpression())->Equals(*GetType(node))) {
                     throw std::exception();
                 }
             }
         }
 
-        void PostVisit(const PredicateLoopNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<PredicateLoopNode *>(const_node);  // todo refactor
+        void PostVisit(const PredicateLoopNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            if (!node->GetBlock()->type_of_expression->Equals(TypesHelper::kDefaultTypes.at("void"))) {
+            if (!GetType(node->GetBlock())->Equals(*type_pool_->GetDefaultType(TokenValue::Type::kVoid))) {
                 throw std::exception();  // todo
             }
 
-            auto default_type = BrutalCast<const DefaultType *>(node->GetExpression()->type_of_expression);
+            auto default_type = BrutalCast<const DefaultType *>(GetType(node->GetExpression()));
             if (default_type->type != TokenValue::Type::kBool) {
                 throw std::exception();  // todo
             }
 
-            if (!node->break_nodes.empty()) {
-                if (node->break_nodes.front()->GetExpression() != nullptr) {
-                    node->type_of_expression = node->break_nodes.front()->GetExpression()->type_of_expression;
+            const auto &break_nodes = annotations_->break_nodes[node];
+
+            if (!break_nodes.empty()) {
+                if (break_nodes.front()->GetExpression() != nullptr) {
+                    annotations_->types[node] = GetType(break_nodes.front()->GetExpression());
                 } else {
-                    node->type_of_expression = nullptr;
+                    annotations_->types[node] = nullptr;
                 }
             }
 
-            for (BreakNode *break_node : node->break_nodes) {
-                if (node->type_of_expression == nullptr) {
+            for (const BreakNode *break_node : break_nodes) {
+                if (GetType(node) == nullptr) {
                     if (break_node->GetExpression() == nullptr) {
                         continue;
                     } else {
@@ -599,31 +766,31 @@ namespace semantic {
                     }
                 }
 
-                if (!break_node->GetExpression()->type_of_expression->Equals(*node->type_of_expression)) {
+                if (!GetType(break_node->GetExpression())->Equals(*GetType(node))) {
                     throw std::exception();
                 }
             }
         }
 
-        void PostVisit(const IteratorLoopNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<IteratorLoopNode *>(const_node);  // todo refactor
+        void PostVisit(const IteratorLoopNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            if (!node->GetBlock()->type_of_expression->Equals(TypesHelper::kDefaultTypes.at("void"))) {
+            if (!GetType(node->GetBlock())->Equals(*type_pool_->GetDefaultType(TokenValue::Type::kVoid))) {
                 throw std::exception();  // todo
             }
 
-            if (!node->break_nodes.empty()) {
-                if (node->break_nodes.front()->GetExpression() != nullptr) {
-                    node->type_of_expression = node->break_nodes.front()->GetExpression()->type_of_expression;
+            const auto &break_nodes = annotations_->break_nodes[node];
+
+            if (!break_nodes.empty()) {
+                if (break_nodes.front()->GetExpression() != nullptr) {
+                    annotations_->types[node] = GetType(break_nodes.front()->GetExpression());
                 } else {
-                    node->type_of_expression = nullptr;
+                    annotations_->types[node] = nullptr;
                 }
             }
 
-            for (BreakNode *break_node : node->break_nodes) {
-                if (node->type_of_expression == nullptr) {
+            for (const BreakNode *break_node : break_nodes) {
+                if (GetType(node) == nullptr) {
                     if (break_node->GetExpression() == nullptr) {
                         continue;
                     } else {
@@ -631,81 +798,64 @@ namespace semantic {
                     }
                 }
 
-                if (!break_node->GetExpression()->type_of_expression->Equals(*node->type_of_expression)) {
+                if (!GetType(break_node->GetExpression())->Equals(*GetType(node))) {
                     throw std::exception();
                 }
             }
         }
 
-        void PostVisit(const IfNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<IfNode *>(const_node);  // todo refactor
+        void PostVisit(const IfNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            node->type_of_expression = node->GetIfBlock()->type_of_expression;
+            annotations_->types[node] = GetType(node->GetIfBlock());
 
-            if (node->GetElseBlock() != nullptr && !node->GetElseBlock()->type_of_expression->Equals(*node->type_of_expression)) {
+            if (node->GetElseBlock() != nullptr && !GetType(node->GetElseBlock())->Equals(*GetType(node))) {
                 throw std::exception();  // todo
             }
 
-            if (node->GetElseIf() != nullptr && !node->GetElseIf()->type_of_expression->Equals(*node->type_of_expression)) {
+            if (node->GetElseIf() != nullptr && !GetType(node->GetElseIf())->Equals(*GetType(node))) {
                 throw std::exception();  // todo
             }
 
-            auto default_type = BrutalCast<const DefaultType *>(node->GetExpression()->type_of_expression);
+            auto default_type = BrutalCast<const DefaultType *>(GetType(node->GetExpression()));
             if (default_type->type != TokenValue::Type::kBool) {
                 throw std::exception();  // todo
             }
         }
 
-        void PostVisit(const BlockNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+        void PostVisit(const BlockNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            auto node = const_cast<BlockNode *>(const_node);  // todo refactor
             if (node->GetReturnExpression()) {
-                node->type_of_expression = node->GetReturnExpression()->type_of_expression;
+                annotations_->types[node] = GetType(node->GetReturnExpression());
             } else {
-                node->type_of_expression = &TypesHelper::kDefaultTypes.at("void");
+                annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kVoid);
             }
         }
 
-        void PostVisit(const BreakNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<BreakNode *>(const_node);  // todo refactor
+        void PostVisit(const BreakNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            node->type_of_expression = &TypesHelper::kDefaultTypes.at("void");
+            annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kVoid);
         }
 
-        void PostVisit(const ContinueNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<ContinueNode *>(const_node);  // todo refactor
+        void PostVisit(const ContinueNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            node->type_of_expression = &TypesHelper::kDefaultTypes.at("void");
+            annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kVoid);
         }
 
-        void PostVisit(const ReturnNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<ReturnNode *>(const_node);  // todo refactor
+        void PostVisit(const ReturnNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            node->type_of_expression = &TypesHelper::kDefaultTypes.at("void");
+            annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kVoid);
         }
 
-        void PostVisit(const MemberAccessNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<MemberAccessNode *>(const_node);  // todo refactor
-
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
-            auto symbol = node->symbol_table->Find(identifier);
-            auto identifier_type = BrutalCast<const IdentifierTypeNode *>(symbol->type);
-            const SubsetStructType *type = nullptr;
-            if (auto p = std::get_if<const SubsetStructType *>(&identifier_type->type)) {
-                type = *p;
-            }
+        void PostVisit(const MemberAccessNode *node) override {
+            Visit(node->GetIdentifier());
 
+            // any struct valued expression, a variable as well as a field of another struct
+            const SubsetStructType *type = dynamic_cast<const SubsetStructType *>(GetType(node->GetIdentifier()));
             if (type == nullptr) {
                 throw std::exception();
             }
@@ -722,7 +872,7 @@ namespace semantic {
                     throw std::exception();  // todo
                 }
 
-                node->type_of_expression = tuple_type->types[index];
+                annotations_->types[node] = tuple_type->types[index];
             } else if (auto struct_type = dynamic_cast<const StructType *>(type); struct_type != nullptr) {
                 auto identifier_expression_node = BrutalCast<const IdentifierExpressionNode *>(node->GetExpression());
                 auto identifier = GetIdentifier(identifier_expression_node);
@@ -732,16 +882,14 @@ namespace semantic {
                     throw std::exception();  // todo
                 }
 
-                node->type_of_expression = struct_type->types.at(identifier);
+                annotations_->types[node] = struct_type->types.at(identifier);
             } else {
                 throw std::exception();  // todo
             }
         }
 
-        void PostVisit(const ArrayExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<ArrayExpressionNode *>(const_node);  // todo refactor
+        void PostVisit(const ArrayExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
             auto expressions = node->GetExpressions();
 
@@ -751,50 +899,47 @@ namespace semantic {
                 }
 
                 auto repeat_operand = expressions[0];
-                if (repeat_operand->type_of_expression == nullptr) {
+                if (GetType(repeat_operand) == nullptr) {
                     throw std::exception();  // todo
                 }
-                auto default_type = dynamic_cast<const DefaultType *>(repeat_operand->type_of_expression);
+                auto default_type = dynamic_cast<const DefaultType *>(GetType(repeat_operand));
                 if (default_type != nullptr && default_type->type == TokenValue::Type::kVoid) {
                     throw std::exception();  // todo
                 }
-                node->type_of_expression = repeat_operand->type_of_expression;
+                annotations_->types[node] = GetType(repeat_operand);
 
                 auto length_operand = expressions[1];
-                default_type = BrutalCast<const DefaultType *>(length_operand->type_of_expression);
-                if (default_type != &TypesHelper::kDefaultTypes.at("usize")) {
+                default_type = BrutalCast<const DefaultType *>(GetType(length_operand));
+                if (default_type != type_pool_->GetUSizeType()) {
                     throw std::exception();  // todo
                 }
             } else if (!expressions.empty()) {
-                const auto target_type = expressions.front()->type_of_expression;
+                const auto target_type = GetType(expressions.front());
                 for (const auto &it : expressions) {
-                    if (it->type_of_expression != target_type) {
+                    if (GetType(it) != target_type) {
                         throw std::exception();  // todo
                     }
                 }
             } else {
-                node->type_of_expression = &TypesHelper::kDefaultTypes.at("void");
+                annotations_->types[node] = type_pool_->GetDefaultType(TokenValue::Type::kVoid);
             }
         }
 
-        void PostVisit(const InitStructExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            const auto node = const_cast<InitStructExpressionNode *>(const_node);  // todo refactor
-
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
-            const auto symbol = BrutalCast<const StructSymbol *>(const_node->symbol_table->Find(identifier));
-            node->type_of_expression = BrutalCast<const SubsetStructType *>(symbol->type);
+        void PostVisit(const InitStructExpressionNode *node) override {
+            init_struct_fields_.emplace_back();
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+            const InitStructFields fields = std::move(init_struct_fields_.back());
+            init_struct_fields_.pop_back();
 
-            const auto struct_identifier = GetIdentifier(const_node->GetIdentifier());
-            const auto struct_symbol = BrutalCast<const StructSymbol *>(const_node->symbol_table->Find(struct_identifier));
+            const auto struct_symbol = BrutalCast<const StructSymbol *>(GetSymbol(node->GetIdentifier()));
+            annotations_->types[node] = BrutalCast<const SubsetStructType *>(struct_symbol->type);
 
             if (auto p = dynamic_cast<const TupleStructType *>(struct_symbol->type); p != nullptr) {
-                if (node->tuple_identifiers.size() != p->types.size() || !node->struct_identifiers.empty()) {
+                if (fields.tuple_identifiers.size() != p->types.size() || !fields.struct_identifiers.empty()) {
                     throw std::exception();
                 }
             } else if (auto p = dynamic_cast<const StructType *>(struct_symbol->type); p != nullptr) {
-                if (node->struct_identifiers.size() != p->types.size() || !node->tuple_identifiers.empty()) {
+                if (fields.struct_identifiers.size() != p->types.size() || !fields.tuple_identifiers.empty()) {
                     throw std::exception();
                 }
             } else {
@@ -802,22 +947,20 @@ namespace semantic {
             }
         }
 
-        void PostVisit(const ShorthandFieldInitStructExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            const auto node = const_cast<ShorthandFieldInitStructExpressionNode *>(const_node);  // todo refactor
+        void PostVisit(const ShorthandFieldInitStructExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto field_identifier = GetIdentifier(const_node->GetIdentifier());
-            const auto field_symbol = BrutalCast<const LetSymbol *>(const_node->symbol_table->Find(field_identifier));
+            const auto field_identifier = GetIdentifier(node->GetIdentifier());
+            const auto field_symbol = BrutalCast<const LetSymbol *>(annotations_->symbols[node]);
             const auto field_type = field_symbol->type;
 
-            if (node->init_struct_expression_node->struct_identifiers.count(field_identifier) != 0) {
+            auto &fields = init_struct_fields_.back();
+            if (fields.struct_identifiers.count(field_identifier) != 0) {
                 throw std::exception();
             }
-            node->init_struct_expression_node->struct_identifiers.insert(field_identifier);
+            fields.struct_identifiers.insert(field_identifier);
 
-            const auto struct_identifier = GetIdentifier(const_node->init_struct_expression_node->GetIdentifier());
-            const auto struct_symbol = BrutalCast<const StructSymbol *>(const_node->symbol_table->Find(struct_identifier));
+            const auto struct_symbol = BrutalCast<const StructSymbol *>(GetSymbol(node->init_struct_expression_node->GetIdentifier()));
             const auto struct_type = BrutalCast<const StructType *>(struct_symbol->type);
 
             auto it = struct_type->types.find(field_identifier);
@@ -826,118 +969,127 @@ namespace semantic {
             }
         }
 
-        void PostVisit(const TupleIndexFieldInitStructExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            const auto node = const_cast<TupleIndexFieldInitStructExpressionNode *>(const_node);  // todo refactor
+        void PostVisit(const TupleIndexFieldInitStructExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            if (!const_node->GetLiteral()->GetToken()->GetTokenValue().IsUnsignedInteger()) {
+            if (!node->GetLiteral()->GetToken()->GetTokenValue().IsUnsignedInteger()) {
                 throw std::exception();
             }
 
-            const auto field_idx = const_node->GetLiteral()->GetToken()->GetTokenValue().GetUnsignedInt();
+            const auto field_idx = node->GetLiteral()->GetToken()->GetTokenValue().GetUnsignedInt();
 
-            if (node->init_struct_expression_node->tuple_identifiers.count(field_idx) != 0) {
+            auto &fields = init_struct_fields_.back();
+            if (fields.tuple_identifiers.count(field_idx) != 0) {
                 throw std::exception();
             }
-            node->init_struct_expression_node->tuple_identifiers.insert(field_idx);
+            fields.tuple_identifiers.insert(field_idx);
 
-            const auto tuple_identifier = GetIdentifier(const_node->init_struct_expression_node->GetIdentifier());
-            const auto tuple_symbol = BrutalCast<const StructSymbol *>(const_node->symbol_table->Find(tuple_identifier));
+            const auto tuple_symbol = BrutalCast<const StructSymbol *>(GetSymbol(node->init_struct_expression_node->GetIdentifier()));
             const auto tuple_type = BrutalCast<const TupleStructType *>(tuple_symbol->type);
 
-            if (field_idx >= tuple_type->types.size() || !tuple_type->types[field_idx]->Equals(*const_node->GetExpression()->type_of_expression)) {
+            if (field_idx >= tuple_type->types.size() || !tuple_type->types[field_idx]->Equals(*GetType(node->GetExpression()))) {
                 throw std::exception();
             }
         }
 
-        void PostVisit(const IdentifierFieldInitStructExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            const auto node = const_cast<IdentifierFieldInitStructExpressionNode *>(const_node);  // todo refactor
+        void PostVisit(const IdentifierFieldInitStructExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto field_identifier = GetIdentifier(const_node->GetIdentifier());
+            const auto field_identifier = GetIdentifier(node->GetIdentifier());
 
-            if (node->init_struct_expression_node->struct_identifiers.count(field_identifier) != 0) {
+            auto &fields = init_struct_fields_.back();
+            if (fields.struct_identifiers.count(field_identifier) != 0) {
                 throw std::exception();
             }
-            node->init_struct_expression_node->struct_identifiers.insert(field_identifier);
+            fields.struct_identifiers.insert(field_identifier);
 
-            const auto struct_identifier = GetIdentifier(const_node->init_struct_expression_node->GetIdentifier());
-            const auto struct_symbol = BrutalCast<const StructSymbol *>(const_node->symbol_table->Find(struct_identifier));
+            const auto struct_symbol = BrutalCast<const StructSymbol *>(GetSymbol(node->init_struct_expression_node->GetIdentifier()));
             const auto struct_type = BrutalCast<const StructType *>(struct_symbol->type);
 
             auto it = struct_type->types.find(field_identifier);
-            if (it == struct_type->types.end() || !const_node->GetExpression()->type_of_expression->Equals(*it->second)) {
+            if (it == struct_type->types.end() || !GetType(node->GetExpression())->Equals(*it->second)) {
                 throw std::exception();  // todo
             }
         }
 
-        void PostVisit(const TupleExpressionNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<TupleExpressionNode *>(const_node);  // todo refactor
-
-            auto expressions = node->GetExpressions();
-
-            node->symbol_table->types.push_back(std::make_unique<TupleType>());
-            auto tuple_type = BrutalCast<TupleType *>(node->symbol_table->types.back().get());
+        void PostVisit(const TupleExpressionNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            for (const auto &it : expressions) {
-                tuple_type->types.push_back(it->type_of_expression);
+            std::vector<const ISymbolType *> types;
+            for (const auto &it : node->GetExpressions()) {
+                types.push_back(GetType(it));
             }
-        }
 
-        void PostVisit(const AssignmentNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
+            annotations_->types[node] = type_pool_->GetTupleType(types);
+        }
 
-            auto node = const_cast<AssignmentNode *>(const_node);  // todo refactor
+        void PostVisit(const AssignmentNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            const auto identifier = GetIdentifier(const_node->GetIdentifier());
-            auto symbol = BrutalCast<const LetSymbol *>(node->symbol_table->Find(identifier));
+            // a field is assigned through the variable holding the outermost struct, which is the symbol of the node
+            const ExpressionNode *place = node->GetIdentifier();
+            while (auto member_access = dynamic_cast<const MemberAccessNode *>(place)) {
+                place = member_access->GetIdentifier();
+            }
+            auto symbol = BrutalCast<const LetSymbol *>(GetSymbol(place));
 
-            if (!symbol->type->Equals(*node->GetExpression()->type_of_expression)) {
+            if (!GetType(node->GetIdentifier())->Equals(*GetType(node->GetExpression()))) {
                 throw std::exception();
             }
 
-            node->let_symbol = symbol;
+            annotations_->symbols[node] = const_cast<LetSymbol *>(symbol);
 
-            if (!const_node->let_symbol->is_mut_) {
+            if (!symbol->is_mut_) {
                 throw std::exception();
             }
         }
 
-        void PostVisit(const LetNode *const_node) override {
-            SpecificSyntaxTreeVisitor::PostVisit(const_node);
-
-            auto node = const_cast<LetNode *>(const_node);  // todo refactor
+        void PostVisit(const LetNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
 
-            auto pattern = dynamic_cast<const IdentifierPatternNode *>(node->GetPattern());
-            if (pattern == nullptr || pattern->IsRef() || pattern->GetPattern() != nullptr) {
+            if (node->GetType() != nullptr && !GetType(node->GetExpression())->Equals(*GetType(node->GetType()))) {
                 throw std::exception();  // todo
             }
 
-            const auto identifier = pattern->GetIdentifier()->GetToken()->GetTokenValue().ValueToString();
+            auto let_symbol = static_cast<LetSymbol *>(annotations_->symbols[node->GetPattern()]);
+            let_symbol->type = const_cast<ISymbolType *>(GetType(node->GetExpression()));
+            let_symbol->value_type = TypesHelper::ToLocalType(let_symbol->type);
+        }
 
-            if (node->GetType() != nullptr && !node->GetExpression()->type_of_expression->Equals(*node->GetType())) {
+        void PostVisit(const ConstantItemNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            if (node->GetExpr() == nullptr || GetType(node->GetExpr()) == nullptr || !GetType(node->GetExpr())->Equals(*GetType(node->GetType()))) {
                 throw std::exception();  // todo
             }
-
-            auto let_symbol = std::make_unique<LetSymbol>();
-            let_symbol->is_mut_ = pattern->IsMut();
-            let_symbol->identifier = identifier;
-            let_symbol->type = const_cast<ISymbolType *>(node->GetExpression()->type_of_expression);
-            const_cast<IdentifierPatternNode *>(pattern)->let_node = let_symbol.get();
-            node->symbol_table->Add(std::move(let_symbol));
         }
 
     private:
-        static std::string GetIdentifier(const ExpressionNode *node) {
+        struct InitStructFields {
+            std::unordered_set<std::string> struct_identifiers;
+            std::unordered_set<uint64_t> tuple_identifiers;
+        };
+
+        Annotations *annotations_;
+        TypePool *type_pool_;
+        // fields seen so far by every InitStructExpressionNode being visited, innermost last
+        std::vector<InitStructFields> init_struct_fields_;
+
+        const ISymbolType *GetType(const SyntaxNode *node) const {
+            return annotations_->types[node];
+        }
+
+        SymbolTable *GetSymbolTable(const SyntaxNode *node) const {
+            return annotations_->symbol_tables[node];
+        }
+
+        // symbol bound by NameResolutionVisitor, the node has to be an identifier expression
+        const ISymbol *GetSymbol(const ExpressionNode *node) const {
             const auto expression_identifier = dynamic_cast<const IdentifierExpressionNode *>(node);
             if (expression_identifier == nullptr) {
                 throw std::exception();  // todo
             }
-            return GetIdentifier(expression_identifier);
+            return annotations_->symbols[expression_identifier];
         }
 
         static std::string GetIdentifier(const IdentifierExpressionNode *node) {
@@ -954,17 +1106,440 @@ namespace semantic {
     const std::unordered_set<Token::Type> ExpressionVisitor::kBoolOperations{Token::Type::kOrOr, Token::Type::kAndAnd, Token::Type::kEqEq, Token::Type::kNe,
                                                                              Token::Type::kLt,   Token::Type::kGt,     Token::Type::kLe,   Token::Type::kGe};
 
+    // functions called in the visited subtree in the order of their first call, ExpressionVisitor has to have visited it
+    class CallCollector final : private SpecificSyntaxTreeVisitor {
+    public:
+        explicit CallCollector(const Annotations *annotations) : annotations_(annotations) {}
+
+        std::vector<const FuncSymbol *> Collect(const SyntaxNode *node) {
+            calls_.clear();
+            Visit(node);
+            return calls_;
+        }
+
+    protected:
+        void PostVisit(const CallOrInitTupleNode *node) override {
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+
+            const auto symbol = dynamic_cast<const FuncSymbol *>(annotations_->symbols[node]);
+            if (symbol != nullptr && std::find(calls_.begin(), calls_.end(), symbol) == calls_.end()) {
+                calls_.push_back(symbol);
+            }
+        }
+
+    private:
+        const Annotations *annotations_;
+        std::vector<const FuncSymbol *> calls_;
+    };
+
+    // Demand-driven semantic analysis of one tree, every query is answered once and memoized.
+    // The first query collects the declarations: scopes, symbols and signatures of all items and everything outside of function bodies.
+    // The body of a top-level function is resolved and type-checked only when a query about it comes, in its own type pool.
+    // Bodies depend on signatures only, so queries about different functions may run concurrently once the declarations exist.
+    class QueryEngine final {
+    public:
+        QueryEngine(const SyntaxTree *tree, const ImportExportTable *import_export_table) : tree_(tree), iet_(import_export_table), annotations_(tree) {
+            for (const SyntaxNode *item : tree->GetNodes()) {
+                if (auto function = dynamic_cast<const FunctionNode *>(item); function != nullptr) {
+                    function_indexes_[function] = functions_.size();
+                    functions_.push_back(FunctionState{function, Stage::kNone, SyntaxTree::CountNodes(function->GetBlock()), {}});
+                }
+            }
+        }
+
+        // bodies the cache has a result for are not type-checked, the others are stored in it; has to be set before the first query
+        void UseCache(SemanticCache *cache) {
+            cache_ = cache;
+        }
+
+        // signature of a function, nested ones included
+        const FuncType *SignatureOf(const FunctionNode *node) {
+            Prepare(node, Stage::kResolved);
+            return BrutalCast<const FuncType *>(annotations_.symbols[node]->type);
+        }
+
+        // symbol an identifier refers to, nullptr for an unknown name
+        const ISymbol *Resolve(const IdentifierExpressionNode *node) {
+            Prepare(node, Stage::kResolved);
+            return annotations_.symbols[node];
+        }
+
+        const ISymbolType *TypeOf(const ExpressionNode *node) {
+            Prepare(node, Stage::kChecked);
+            return annotations_.types[node];
+        }
+
+        // value of a constant item, the const functions it calls are type-checked on the way
+        TokenValue ValueOf(const ConstantItemNode *node) {
+            Prepare(node, Stage::kChecked);
+            return MakeConstEvaluator().Evaluate(node);
+        }
+
+        // type-checks the body of a top-level function
+        void CheckFunction(const FunctionNode *node) {
+            CollectDeclarations();
+            Advance(GetFunctionIndex(node), Stage::kChecked);
+        }
+
+        // top-level functions called by the body of node in the order of their first call
+        const std::vector<const FunctionNode *> &GetCallees(const FunctionNode *node) {
+            const size_t idx = GetFunctionIndex(node);
+            CollectDeclarations();
+            Advance(idx, Stage::kChecked);
+            return functions_[idx].callees;
+        }
+
+        // checked bodies that call node, they have to be checked again when its signature changes
+        std::vector<const FunctionNode *> GetDependents(const FunctionNode *node) const {
+            std::vector<const FunctionNode *> result;
+            for (const FunctionState &state : functions_) {
+                if (std::find(state.callees.begin(), state.callees.end(), node) != state.callees.end()) {
+                    result.push_back(state.node);
+                }
+            }
+            return result;
+        }
+
+        // type-checks every body, on the thread pool when there is one; the result does not depend on it
+        void CheckAll(ThreadPool *thread_pool) {
+            CollectDeclarations();
+
+            std::vector<size_t> indexes(functions_.size());
+            for (size_t i = 0; i < indexes.size(); i++) {
+                indexes[i] = i;
+            }
+            CheckFunctions(indexes, thread_pool);
+        }
+
+        // Type-checks the top-level functions transitively called from the exported ones and returns them in tree order,
+        // the bodies of all others are only parsed. The reachable functions that are not exported get the numbers after the exports
+        // in this order, so func_iet is the index of the function in the generated module; unreachable ones get none.
+        const std::vector<const FunctionNode *> &CheckReachable(ThreadPool *thread_pool) {
+            CollectDeclarations();
+            if (has_reachable_) {
+                return annotations_.reachable_functions;
+            }
+
+            // a call graph layer is checked at once, its callees make up the next one
+            std::vector<bool> reached(functions_.size(), false);
+            std::vector<size_t> layer;
+            for (size_t i = 0; i < functions_.size(); i++) {
+                if (IsExported(GetFuncSymbol(i))) {
+                    reached[i] = true;
+                    layer.push_back(i);
+                }
+            }
+
+            while (!layer.empty()) {
+                CheckFunctions(layer, thread_pool);
+
+                std::vector<size_t> next_layer;
+                for (size_t idx : layer) {
+                    for (const FunctionNode *callee : functions_[idx].callees) {
+                        const size_t callee_idx = GetFunctionIndex(callee);
+                        if (!reached[callee_idx]) {
+                            reached[callee_idx] = true;
+                            next_layer.push_back(callee_idx);
+                        }
+                    }
+                }
+                layer = std::move(next_layer);
+            }
+
+            EvaluateConstants(reached);
+
+            annotations_.reachable_functions.clear();
+            auto func_iet = static_cast<uint32_t>(iet_->imports.size() + iet_->exports.size());
+            for (size_t i = 0; i < functions_.size(); i++) {
+                FuncSymbol *symbol = GetFuncSymbol(i);
+                if (IsExported(symbol)) {
+                    annotations_.reachable_functions.push_back(functions_[i].node);
+                } else if (reached[i]) {
+                    annotations_.reachable_functions.push_back(functions_[i].node);
+                    symbol->func_iet = func_iet++;
+                } else {
+                    symbol->func_iet = std::numeric_limits<uint32_t>::max();
+                }
+            }
+
+            has_reachable_ = true;
+            return annotations_.reachable_functions;
+        }
+
+        // The block of node was changed in place and the tree renumbered, as SyntaxParser::Reparse does for an edit inside a body.
+        // Only the queries about this body are dropped, a body edit keeps the signature, which is all other bodies depend on.
+        // A replaced item or a changed signature needs a new QueryEngine.
+        void InvalidateBody(const FunctionNode *node) {
+            const size_t idx = GetFunctionIndex(node);
+            FunctionState &state = functions_[idx];
+            if (node->GetBlock() == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            if (state.stage != Stage::kNone) {
+                FuncSymbol *symbol = GetFuncSymbol(idx);
+                symbol->locals.resize(node->GetParams().size());
+
+                auto symbol_table = symbol->symbol_table.get();
+                auto body_symbol = static_cast<const BlockSymbol *>(annotations_.symbols[node->GetBlock()]);
+
+                auto &children = symbol_table->children;
+                children.erase(std::remove(children.begin(), children.end(), body_symbol->symbol_table.get()), children.end());
+                symbol_table->Remove(body_symbol);
+
+                annotations_.return_nodes[node].clear();
+                annotations_.function_type_pools[idx] = std::make_unique<TypePool>(annotations_.type_pool.get());
+                state.callees.clear();
+                state.stage = Stage::kNone;
+            }
+
+            // the nodes after the body have new ids
+            const size_t body_node_count = SyntaxTree::CountNodes(node->GetBlock());
+            annotations_.Splice(node->GetBlock()->GetId(), state.body_node_count, body_node_count);
+            state.body_node_count = body_node_count;
+
+            // the body may call other functions now, a const one may give any constant another value
+            has_reachable_ = false;
+            for (const SyntaxNode *item : SyntaxTree::CollectNodes(tree_)) {
+                if (dynamic_cast<const ConstantItemNode *>(item) != nullptr) {
+                    if (auto symbol = dynamic_cast<ConstSymbol *>(annotations_.symbols[item]); symbol != nullptr) {
+                        symbol->state = ConstSymbol::State::kNone;
+                    }
+                }
+            }
+        }
+
+        // bodies type-checked so far, the ones restored from the cache are not counted
+        size_t GetCheckedBodyCount() const {
+            return checked_body_count_;
+        }
+
+        const Annotations &GetAnnotations() const {
+            return annotations_;
+        }
+
+        Annotations TakeAnnotations() {
+            return std::move(annotations_);
+        }
+
+    private:
+        enum class Stage
+        {
+            kNone,
+            kResolved,
+            kChecked
+        };
+
+        struct FunctionState {
+            const FunctionNode *node;
+            Stage stage;
+            size_t body_node_count;
+            std::vector<const FunctionNode *> callees;
+        };
+
+        const SyntaxTree *tree_;
+        const ImportExportTable *iet_;
+        SemanticCache *cache_ = nullptr;
+        Annotations annotations_;
+        bool has_declarations_ = false;
+        bool has_reachable_ = false;
+        // bodies are checked on the thread pool
+        std::atomic<size_t> checked_body_count_{0};
+
+        // top-level functions in tree order, so in the order of their ids
+        std::vector<FunctionState> functions_;
+        std::unordered_map<const FunctionNode *, size_t> function_indexes_;
+        std::unordered_map<const FuncSymbol *, size_t> function_symbols_;
+
+        void CollectDeclarations() {
+            if (has_declarations_) {
+                return;
+            }
+
+            BaseStructVisitor base_struct_visitor(&annotations_, annotations_.type_pool.get());
+            base_struct_visitor.Visit(tree_, iet_);
+
+            StructFuncVisitor struct_func_visitor(&annotations_, annotations_.type_pool.get());
+            struct_func_visitor.Visit(tree_, iet_);
+
+            NameResolutionVisitor name_resolution_visitor(&annotations_);
+            ExpressionVisitor expression_visitor(&annotations_, annotations_.type_pool.get());
+            for (const SyntaxNode *item : tree_->GetNodes()) {
+                if (dynamic_cast<const FunctionNode *>(item) == nullptr) {
+                    name_resolution_visitor.Visit(item);
+                    expression_visitor.Visit(item);
+                }
+            }
+
+            for (size_t i = 0; i < functions_.size(); i++) {
+                annotations_.function_type_pools.push_back(std::make_unique<TypePool>(annotations_.type_pool.get()));
+                function_symbols_[static_cast<const FuncSymbol *>(annotations_.symbols[functions_[i].node])] = i;
+            }
+
+            has_declarations_ = true;
+        }
+
+        void Advance(size_t idx, Stage stage) {
+            FunctionState &state = functions_[idx];
+            TypePool *type_pool = annotations_.function_type_pools[idx].get();
+
+            if (state.stage == Stage::kNone) {
+                BaseStructVisitor base_struct_visitor(&annotations_, type_pool);
+                base_struct_visitor.VisitBody(state.node);
+
+                StructFuncVisitor struct_func_visitor(&annotations_, type_pool);
+                struct_func_visitor.VisitBody(state.node, iet_);
+
+                NameResolutionVisitor name_resolution_visitor(&annotations_);
+                name_resolution_visitor.VisitBody(state.node);
+
+                state.stage = Stage::kResolved;
+            }
+
+            if (state.stage == Stage::kResolved && stage == Stage::kChecked) {
+                std::vector<std::string> callee_names;
+                if (cache_ != nullptr && cache_->Restore(&annotations_, type_pool, state.node, &callee_names)) {
+                    for (const std::string &name : callee_names) {
+                        state.callees.push_back(functions_[GetFunctionIndex(annotations_.symbol_table->Find(name))].node);
+                    }
+                } else {
+                    ExpressionVisitor expression_visitor(&annotations_, type_pool);
+                    expression_visitor.Visit(state.node->GetBlock());
+                    checked_body_count_++;
+
+                    CallCollector call_collector(&annotations_);
+                    for (const FuncSymbol *symbol : call_collector.Collect(state.node->GetBlock())) {
+                        if (const auto it = function_symbols_.find(symbol); it != function_symbols_.end()) {
+                            state.callees.push_back(functions_[it->second].node);
+                        }
+                    }
+
+                    if (cache_ != nullptr) {
+                        cache_->Store(annotations_, state.node, state.callees);
+                    }
+                }
+
+                state.stage = Stage::kChecked;
+            }
+        }
+
+        void CheckFunctions(const std::vector<size_t> &indexes, ThreadPool *thread_pool) {
+            auto check_function = [this, &indexes](size_t i) {
+                Advance(indexes[i], Stage::kChecked);
+            };
+
+            if (thread_pool != nullptr) {
+                thread_pool->ParallelFor(indexes.size(), check_function);
+            } else {
+                for (size_t i = 0; i < indexes.size(); i++) {
+                    check_function(i);
+                }
+            }
+        }
+
+        // a call is evaluated in the type-checked body of the top-level function
+        ConstEvaluator MakeConstEvaluator() {
+            return ConstEvaluator(&annotations_, [this](const FuncSymbol *symbol) -> const FunctionNode * {
+                const auto it = function_symbols_.find(symbol);
+                if (it == function_symbols_.end()) {
+                    return nullptr;
+                }
+
+                Advance(it->second, Stage::kChecked);
+                return functions_[it->second].node;
+            });
+        }
+
+        // the top-level constants and the ones in reachable bodies get their values, the generated code uses them as immediates
+        void EvaluateConstants(const std::vector<bool> &reached) {
+            ConstEvaluator evaluator = MakeConstEvaluator();
+            for (const SyntaxNode *item : tree_->GetNodes()) {
+                if (auto constant = dynamic_cast<const ConstantItemNode *>(item); constant != nullptr) {
+                    evaluator.Evaluate(constant);
+                }
+            }
+
+            for (size_t i = 0; i < functions_.size(); i++) {
+                if (!reached[i]) {
+                    continue;
+                }
+                for (const SyntaxNode *node : SyntaxTree::CollectNodes(functions_[i].node->GetBlock())) {
+                    if (auto constant = dynamic_cast<const ConstantItemNode *>(node); constant != nullptr) {
+                        evaluator.Evaluate(constant);
+                    }
+                }
+            }
+        }
+
+        FuncSymbol *GetFuncSymbol(size_t idx) const {
+            return static_cast<FuncSymbol *>(annotations_.symbols[functions_[idx].node]);
+        }
+
+        bool IsExported(const FuncSymbol *symbol) const {
+            return symbol->func_iet >= iet_->imports.size() && symbol->func_iet < iet_->imports.size() + iet_->exports.size();
+        }
+
+        // brings the body containing node to the stage, nodes outside of bodies are covered by the declarations
+        void Prepare(const SyntaxNode *node, Stage stage) {
+            CollectDeclarations();
+
+            const uint32_t id = node->GetId();
+            const auto it = std::upper_bound(functions_.begin(), functions_.end(), id, [](uint32_t id, const FunctionState &state) { return id < state.node->GetId(); });
+            if (it == functions_.begin()) {
+                return;
+            }
+
+            const FunctionState &state = *std::prev(it);
+            if (state.node->GetBlock() == nullptr) {
+                return;
+            }
+
+            const uint32_t body_id = state.node->GetBlock()->GetId();
+            if (body_id <= id && id < body_id + state.body_node_count) {
+                Advance(std::prev(it) - functions_.begin(), stage);
+            }
+        }
+
+        size_t GetFunctionIndex(const FunctionNode *node) const {
+            const auto it = function_indexes_.find(node);
+            if (it == function_indexes_.end()) {
+                throw std::exception();  // todo
+            }
+            return it->second;
+        }
+
+        size_t GetFunctionIndex(const ISymbol *symbol) const {
+            const auto it = function_symbols_.find(dynamic_cast<const FuncSymbol *>(symbol));
+            if (it == function_symbols_.end()) {
+                throw std::exception();  // todo
+            }
+            return it->second;
+        }
+    };
+
     class SemanticAnalyzer final {
     public:
-        void Analyze(const SyntaxTree *node, const ImportExportTable *import_export_table) const {
-            BaseStructVisitor base_struct_visitor;
-            base_struct_visitor.Visit(node, import_export_table);
+        // Only the functions reachable from the exports are analyzed, see QueryEngine::CheckReachable.
+        // The tree is only read, several analyses of the same tree may run concurrently.
+        Annotations Analyze(const SyntaxTree *node, const ImportExportTable *import_export_table) const {
+            return Analyze(node, import_export_table, nullptr);
+        }
 
-            StructFuncVisitor struct_func_visitor;
-            struct_func_visitor.Visit(node, import_export_table);
+        // type-checks the function bodies on a thread pool, the result is identical to Analyze
+        Annotations AnalyzeParallel(const SyntaxTree *node, const ImportExportTable *import_export_table, size_t thread_count) const {
+            if (thread_count < 2) {
+                return Analyze(node, import_export_table, nullptr);
+            }
 
-            ExpressionVisitor expression_visitor;
-            expression_visitor.Visit(node);
+            ThreadPool thread_pool(thread_count);
+            return Analyze(node, import_export_table, &thread_pool);
+        }
+
+    private:
+        static Annotations Analyze(const SyntaxTree *node, const ImportExportTable *import_export_table, ThreadPool *thread_pool) {
+            QueryEngine queries(node, import_export_table);
+            queries.CheckReachable(thread_pool);
+            return queries.TakeAnnotations();
         }
     };
-}
\ No newline at end of file
+}
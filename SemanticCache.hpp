@@ -0,0 +1,527 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Annotations.hpp"
+#include "ImportExportTable.hpp"
+#include "SyntaxTreeSerializer.hpp"
+
+namespace semantic {
+    // What type-checking the bodies of top-level functions produced, kept on disk so an unchanged body skips ExpressionVisitor.
+    //
+    // An entry is found by SyntaxTreeSerializer::HashContent of its function. The file as a whole belongs to one environment:
+    // the signatures, structs and constants of the tree and the ImportExportTable. A body is checked against nothing else,
+    // so a changed declaration drops every entry while a changed body only misses its own.
+    //
+    // Layout (integers are unsigned LEB128 unless stated otherwise):
+    //   magic (4 bytes), version (4 bytes), environment hash (8 bytes), all little endian
+    //   entry count, then for every entry: function hash (8 bytes, little endian), size, result
+    //   result: node count of the function, callee names, then (offset, type) of the typed body nodes,
+    //   (offset, symbol) of the body nodes bound to a symbol and (offset, type) of the let patterns
+    // Offsets are relative to the function node. A symbol of the global scope is stored by name, one declared in the function
+    // by the offset of its declaration; references, arrays and tuples are stored by structure, structs and functions as the type of their symbol.
+    class SemanticCache final {
+    public:
+        static constexpr uint32_t kMagic = 0x4D455352;  // "RSEM"
+        // bumped whenever what an entry stores changes, so that older files are dropped instead of misread
+        static constexpr uint32_t kVersion = 2;
+
+        explicit SemanticCache(uint64_t environment_hash) : environment_hash_(environment_hash) {}
+
+        static uint64_t HashEnvironment(const SyntaxTree *tree, const ImportExportTable *iet) {
+            uint64_t hash = kHashSeed;
+            for (const SyntaxNode *item : tree->GetNodes()) {
+                if (auto function = dynamic_cast<const FunctionNode *>(item); function != nullptr) {
+                    hash = Mix(hash, function->IsConst() ? 1 : 0);
+                    hash = Mix(hash, SyntaxTreeSerializer::HashContent(function->GetIdentifier()));
+                    for (const ParamFunctionNode *param : function->GetParams()) {
+                        hash = Mix(hash, SyntaxTreeSerializer::HashContent(param));
+                    }
+                    hash = Mix(hash, SyntaxTreeSerializer::HashContent(function->GetReturnType()));
+                } else {
+                    hash = Mix(hash, SyntaxTreeSerializer::HashContent(item));
+                }
+            }
+
+            for (const auto &it : iet->imports) {
+                hash = Mix(Mix(Mix(hash, it.module), it.field), it.associate);
+                hash = Mix(hash, it.type);
+            }
+            for (const auto &it : iet->exports) {
+                hash = Mix(Mix(hash, it.field), it.associate);
+                hash = Mix(hash, it.type);
+            }
+            return hash;
+        }
+
+        // an empty cache when the file is missing, stale or corrupted
+        static std::unique_ptr<SemanticCache> Load(const std::string &filename, uint64_t environment_hash) {
+            auto cache = std::make_unique<SemanticCache>(environment_hash);
+
+            std::ifstream ifs(filename, std::ios::in | std::ios::binary | std::ios::ate);
+            if (!ifs) {
+                return cache;
+            }
+
+            const auto size = static_cast<size_t>(ifs.tellg());
+            std::vector<uint8_t> data(size);
+            ifs.seekg(0);
+            if (!ifs.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(size))) {
+                return cache;
+            }
+
+            try {
+                Reader reader(data.data(), data.data() + data.size());
+                if (reader.ReadFixed(4) != kMagic || reader.ReadFixed(4) != kVersion || reader.ReadFixed(8) != environment_hash) {
+                    return cache;
+                }
+
+                const uint64_t count = reader.ReadUnsigned();
+                for (uint64_t i = 0; i < count; i++) {
+                    const uint64_t function_hash = reader.ReadFixed(8);
+                    cache->entries_[function_hash].result = reader.ReadBytes(reader.ReadUnsigned());
+                }
+            } catch (const std::exception &) {
+                cache->entries_.clear();
+            }
+            return cache;
+        }
+
+        // keeps only the entries this compilation stored or restored
+        void Save(const std::string &filename) const {
+            std::vector<uint8_t> data;
+            WriteFixed(&data, kMagic, 4);
+            WriteFixed(&data, kVersion, 4);
+            WriteFixed(&data, environment_hash_, 8);
+
+            std::vector<std::pair<uint64_t, const std::vector<uint8_t> *>> used;
+            for (const auto &[function_hash, entry] : entries_) {
+                if (entry.used) {
+                    used.emplace_back(function_hash, &entry.result);
+                }
+            }
+            std::sort(used.begin(), used.end());
+
+            WriteUnsigned(&data, used.size());
+            for (const auto &[function_hash, result] : used) {
+                WriteFixed(&data, function_hash, 8);
+                WriteUnsigned(&data, result->size());
+                data.insert(data.end(), result->begin(), result->end());
+            }
+
+            std::ofstream ofs(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        }
+
+        // Stores the result of the type-checked body of node. A body with a type the format has no name for is left out.
+        // Store and Restore may be called concurrently for different functions.
+        void Store(const Annotations &annotations, const FunctionNode *node, const std::vector<const FunctionNode *> &callees) {
+            std::vector<uint8_t> result;
+            if (!Encode(annotations, node, callees, &result)) {
+                return;
+            }
+
+            const uint64_t function_hash = SyntaxTreeSerializer::HashContent(node);
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry &entry = entries_[function_hash];
+            entry.result = std::move(result);
+            entry.used = true;
+        }
+
+        // Fills in what ExpressionVisitor would for the resolved body of node and returns the names of the top-level functions it calls,
+        // false when there is no usable entry.
+        bool Restore(Annotations *annotations, TypePool *type_pool, const FunctionNode *node, std::vector<std::string> *callee_names) {
+            const uint64_t function_hash = SyntaxTreeSerializer::HashContent(node);
+
+            Entry *entry;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                const auto it = entries_.find(function_hash);
+                if (it == entries_.end()) {
+                    return false;
+                }
+                entry = &it->second;
+            }
+
+            // a result that does not fit the body is ignored, ExpressionVisitor then overwrites whatever was restored
+            try {
+                Decode(entry->result, annotations, type_pool, node, callee_names);
+            } catch (const std::exception &) {
+                return false;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            entry->used = true;
+            return true;
+        }
+
+    private:
+        enum class Code : uint8_t
+        {
+            kDefault,
+            kReference,
+            kArray,
+            kTuple,
+            kGlobal,
+            kDeclared
+        };
+
+        struct Entry {
+            std::vector<uint8_t> result;
+            bool used = false;
+        };
+
+        class Reader final {
+        public:
+            Reader(const uint8_t *begin, const uint8_t *end) : current_(begin), end_(end) {}
+
+            uint64_t ReadFixed(size_t size) {
+                Require(size);
+                uint64_t value = 0;
+                for (size_t i = 0; i < size; i++) {
+                    value |= static_cast<uint64_t>(current_[i]) << (8 * i);
+                }
+                current_ += size;
+                return value;
+            }
+
+            uint64_t ReadUnsigned() {
+                uint64_t value = 0;
+                for (uint32_t shift = 0;; shift += 7) {
+                    Require(1);
+                    const uint8_t byte = *current_++;
+                    if (shift >= 64) {
+                        throw std::exception();  // todo
+                    }
+                    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                    if ((byte & 0x80) == 0) {
+                        return value;
+                    }
+                }
+            }
+
+            std::vector<uint8_t> ReadBytes(uint64_t size) {
+                Require(size);
+                std::vector<uint8_t> result(current_, current_ + size);
+                current_ += size;
+                return result;
+            }
+
+            std::string ReadString() {
+                const auto bytes = ReadBytes(ReadUnsigned());
+                return std::string(bytes.begin(), bytes.end());
+            }
+
+        private:
+            const uint8_t *current_;
+            const uint8_t *end_;
+
+            void Require(uint64_t size) const {
+                if (static_cast<uint64_t>(end_ - current_) < size) {
+                    throw std::exception();  // todo
+                }
+            }
+        };
+
+        // the symbols and the struct and function types declared in one function, by offset
+        struct Declarations {
+            std::unordered_map<const ISymbol *, uint32_t> symbols;
+            std::unordered_map<const ISymbolType *, uint32_t> types;
+        };
+
+        static constexpr uint64_t kHashSeed = 14695981039346656037ULL;
+
+        const uint64_t environment_hash_;
+        std::mutex mutex_;
+        std::unordered_map<uint64_t, Entry> entries_;
+
+        static uint64_t Mix(uint64_t hash, uint64_t value) {
+            // FNV-1a over the bytes of the value
+            for (size_t i = 0; i < sizeof value; i++) {
+                hash ^= static_cast<uint8_t>(value >> (8 * i));
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        static uint64_t Mix(uint64_t hash, const std::string &value) {
+            hash = Mix(hash, value.size());
+            for (char ch : value) {
+                hash = Mix(hash, static_cast<uint8_t>(ch));
+            }
+            return hash;
+        }
+
+        static uint64_t Mix(uint64_t hash, const ImportExportTable::Type &type) {
+            hash = Mix(hash, type.params.size());
+            for (TokenValue::Type param : type.params) {
+                hash = Mix(hash, static_cast<uint64_t>(param));
+            }
+            hash = Mix(hash, type.ret.size());
+            for (TokenValue::Type ret : type.ret) {
+                hash = Mix(hash, static_cast<uint64_t>(ret));
+            }
+            return hash;
+        }
+
+        static void WriteFixed(std::vector<uint8_t> *out, uint64_t value, size_t size) {
+            for (size_t i = 0; i < size; i++) {
+                out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        static void WriteUnsigned(std::vector<uint8_t> *out, uint64_t value) {
+            do {
+                uint8_t byte = value & 0x7F;
+                value >>= 7;
+                if (value != 0) {
+                    byte |= 0x80;
+                }
+                out->push_back(byte);
+            } while (value != 0);
+        }
+
+        static void WriteString(std::vector<uint8_t> *out, const std::string &value) {
+            WriteUnsigned(out, value.size());
+            out->insert(out->end(), value.begin(), value.end());
+        }
+
+        static bool IsGlobal(const Annotations &annotations, const ISymbol *symbol) {
+            return annotations.symbol_table->Find(symbol->identifier) == symbol;
+        }
+
+        static bool EncodeSymbol(const Annotations &annotations, const Declarations &declarations, const ISymbol *symbol, std::vector<uint8_t> *out) {
+            if (const auto it = declarations.symbols.find(symbol); it != declarations.symbols.end()) {
+                out->push_back(static_cast<uint8_t>(Code::kDeclared));
+                WriteUnsigned(out, it->second);
+                return true;
+            }
+
+            if (IsGlobal(annotations, symbol)) {
+                out->push_back(static_cast<uint8_t>(Code::kGlobal));
+                WriteString(out, symbol->identifier);
+                return true;
+            }
+            return false;
+        }
+
+        // symbol is the one of the node the type belongs to, a function type is found through it
+        static bool EncodeType(const Annotations &annotations, const Declarations &declarations, const ISymbolType *type, const ISymbol *symbol, std::vector<uint8_t> *out) {
+            if (auto default_type = dynamic_cast<const DefaultType *>(type); default_type != nullptr) {
+                out->push_back(static_cast<uint8_t>(Code::kDefault));
+                WriteUnsigned(out, default_type->GetId());
+                return true;
+            }
+
+            if (auto reference_type = dynamic_cast<const ReferenceType *>(type); reference_type != nullptr) {
+                out->push_back(static_cast<uint8_t>(Code::kReference));
+                out->push_back(reference_type->is_mut ? 1 : 0);
+                return EncodeType(annotations, declarations, reference_type->type, nullptr, out);
+            }
+
+            if (auto array_type = dynamic_cast<const ArrayType *>(type); array_type != nullptr) {
+                out->push_back(static_cast<uint8_t>(Code::kArray));
+                return EncodeType(annotations, declarations, array_type->type, nullptr, out);
+            }
+
+            if (auto tuple_type = dynamic_cast<const TupleType *>(type); tuple_type != nullptr) {
+                out->push_back(static_cast<uint8_t>(Code::kTuple));
+                WriteUnsigned(out, tuple_type->types.size());
+                for (const ISymbolType *it : tuple_type->types) {
+                    if (!EncodeType(annotations, declarations, it, nullptr, out)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            if (const auto it = declarations.types.find(type); it != declarations.types.end()) {
+                out->push_back(static_cast<uint8_t>(Code::kDeclared));
+                WriteUnsigned(out, it->second);
+                return true;
+            }
+
+            if (auto struct_type = dynamic_cast<const SubsetStructType *>(type); struct_type != nullptr) {
+                symbol = annotations.symbol_table->Find(struct_type->identifier);
+            }
+
+            if (symbol != nullptr && symbol->type == type && IsGlobal(annotations, symbol)) {
+                out->push_back(static_cast<uint8_t>(Code::kGlobal));
+                WriteString(out, symbol->identifier);
+                return true;
+            }
+            return false;
+        }
+
+        static bool Encode(const Annotations &annotations, const FunctionNode *node, const std::vector<const FunctionNode *> &callees, std::vector<uint8_t> *out) {
+            const uint32_t first_id = node->GetId();
+            const std::vector<const SyntaxNode *> nodes = SyntaxTree::CollectNodes(node);
+
+            Declarations declarations;
+            std::vector<const LetNode *> let_nodes;
+            for (const SyntaxNode *it : nodes) {
+                const ISymbol *symbol = annotations.symbols[it];
+                if (dynamic_cast<const FunctionNode *>(it) != nullptr || dynamic_cast<const StructNode *>(it) != nullptr) {
+                    declarations.symbols.emplace(symbol, it->GetId() - first_id);
+                    declarations.types.emplace(symbol->type, it->GetId() - first_id);
+                } else if (dynamic_cast<const BlockNode *>(it) != nullptr || dynamic_cast<const IdentifierPatternNode *>(it) != nullptr || dynamic_cast<const ConstantItemNode *>(it) != nullptr) {
+                    declarations.symbols.emplace(symbol, it->GetId() - first_id);
+                } else if (auto let_node = dynamic_cast<const LetNode *>(it); let_node != nullptr) {
+                    let_nodes.push_back(let_node);
+                }
+            }
+
+            WriteUnsigned(out, nodes.size());
+
+            WriteUnsigned(out, callees.size());
+            for (const FunctionNode *callee : callees) {
+                WriteString(out, annotations.symbols[callee]->identifier);
+            }
+
+            const uint32_t body_id = node->GetBlock()->GetId();
+            const auto body_end = static_cast<uint32_t>(first_id + nodes.size());
+
+            std::vector<uint8_t> types;
+            uint64_t type_count = 0;
+            std::vector<uint8_t> symbols;
+            uint64_t symbol_count = 0;
+            for (uint32_t id = body_id; id < body_end; id++) {
+                const SyntaxNode *it = nodes[id - first_id];
+                if (const ISymbolType *type = annotations.types[it]; type != nullptr) {
+                    WriteUnsigned(&types, id - first_id);
+                    if (!EncodeType(annotations, declarations, type, annotations.symbols[it], &types)) {
+                        return false;
+                    }
+                    type_count++;
+                }
+                if (const ISymbol *symbol = annotations.symbols[it]; symbol != nullptr) {
+                    WriteUnsigned(&symbols, id - first_id);
+                    if (!EncodeSymbol(annotations, declarations, symbol, &symbols)) {
+                        return false;
+                    }
+                    symbol_count++;
+                }
+            }
+
+            WriteUnsigned(out, type_count);
+            out->insert(out->end(), types.begin(), types.end());
+            WriteUnsigned(out, symbol_count);
+            out->insert(out->end(), symbols.begin(), symbols.end());
+
+            WriteUnsigned(out, let_nodes.size());
+            for (const LetNode *let_node : let_nodes) {
+                WriteUnsigned(out, let_node->GetPattern()->GetId() - first_id);
+                const ISymbolType *type = annotations.symbols[let_node->GetPattern()]->type;
+                if (!EncodeType(annotations, declarations, type, annotations.symbols[let_node->GetExpression()], out)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static ISymbol *DecodeSymbol(Annotations *annotations, const std::vector<const SyntaxNode *> &nodes, Reader *reader) {
+            return DecodeSymbol(annotations, nodes, static_cast<Code>(reader->ReadFixed(1)), reader);
+        }
+
+        static ISymbol *DecodeSymbol(Annotations *annotations, const std::vector<const SyntaxNode *> &nodes, Code code, Reader *reader) {
+            ISymbol *symbol;
+            switch (code) {
+            case Code::kGlobal:
+                symbol = const_cast<ISymbol *>(annotations->symbol_table->Find(reader->ReadString()));
+                break;
+            case Code::kDeclared:
+                symbol = annotations->symbols[GetNode(nodes, reader->ReadUnsigned())];
+                break;
+            default:
+                throw std::exception();  // todo
+            }
+
+            if (symbol == nullptr) {
+                throw std::exception();  // todo
+            }
+            return symbol;
+        }
+
+        static const ISymbolType *DecodeType(Annotations *annotations, TypePool *type_pool, const std::vector<const SyntaxNode *> &nodes, Reader *reader) {
+            const auto code = static_cast<Code>(reader->ReadFixed(1));
+            switch (code) {
+            case Code::kDefault: {
+                const DefaultType *type = type_pool->FindDefaultType(static_cast<uint32_t>(reader->ReadUnsigned()));
+                if (type == nullptr) {
+                    throw std::exception();  // todo
+                }
+                return type;
+            }
+            case Code::kReference: {
+                const bool is_mut = reader->ReadFixed(1) != 0;
+                return type_pool->GetReferenceType(is_mut, DecodeType(annotations, type_pool, nodes, reader));
+            }
+            case Code::kArray:
+                return type_pool->GetArrayType(DecodeType(annotations, type_pool, nodes, reader));
+            case Code::kTuple: {
+                std::vector<const ISymbolType *> types(reader->ReadUnsigned());
+                for (auto &type : types) {
+                    type = DecodeType(annotations, type_pool, nodes, reader);
+                }
+                return type_pool->GetTupleType(types);
+            }
+            case Code::kGlobal:
+            case Code::kDeclared: {
+                const ISymbolType *type = DecodeSymbol(annotations, nodes, code, reader)->type;
+                if (type == nullptr) {
+                    throw std::exception();  // todo
+                }
+                return type;
+            }
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        static void Decode(const std::vector<uint8_t> &result, Annotations *annotations, TypePool *type_pool, const FunctionNode *node, std::vector<std::string> *callee_names) {
+            const std::vector<const SyntaxNode *> nodes = SyntaxTree::CollectNodes(node);
+            Reader reader(result.data(), result.data() + result.size());
+
+            if (reader.ReadUnsigned() != nodes.size()) {
+                throw std::exception();  // todo
+            }
+
+            callee_names->resize(reader.ReadUnsigned());
+            for (std::string &name : *callee_names) {
+                name = reader.ReadString();
+            }
+
+            for (uint64_t count = reader.ReadUnsigned(); count > 0; count--) {
+                const SyntaxNode *it = GetNode(nodes, reader.ReadUnsigned());
+                annotations->types[it] = DecodeType(annotations, type_pool, nodes, &reader);
+            }
+
+            for (uint64_t count = reader.ReadUnsigned(); count > 0; count--) {
+                const SyntaxNode *it = GetNode(nodes, reader.ReadUnsigned());
+                annotations->symbols[it] = DecodeSymbol(annotations, nodes, &reader);
+            }
+
+            for (uint64_t count = reader.ReadUnsigned(); count > 0; count--) {
+                auto let_symbol = dynamic_cast<LetSymbol *>(annotations->symbols[GetNode(nodes, reader.ReadUnsigned())]);
+                if (let_symbol == nullptr) {
+                    throw std::exception();  // todo
+                }
+                let_symbol->type = const_cast<ISymbolType *>(DecodeType(annotations, type_pool, nodes, &reader));
+                let_symbol->value_type = TypesHelper::ToLocalType(let_symbol->type);
+            }
+        }
+
+        static const SyntaxNode *GetNode(const std::vector<const SyntaxNode *> &nodes, uint64_t offset) {
+            if (offset >= nodes.size()) {
+                throw std::exception();  // todo
+            }
+            return nodes[offset];
+        }
+    };
+}
@@ -92,9 +92,9 @@ protected:
         Visit(node->GetPattern());
     }
 
-    void PostVisit(const WildcardPatternNode *node) override {}
+    void PostVisit(const WildcardPatternNode *) override {}
 
-    void PostVisit(const RestPatternNode *node) override {}
+    void PostVisit(const RestPatternNode *) override {}
 
     void PostVisit(const ReferencePatternNode *node) override {
         Visit(node->GetPattern());
@@ -175,7 +175,7 @@ protected:
         Visit(node->GetExpression());
     }
 
-    void PostVisit(const ContinueNode *node) override {}
+    void PostVisit(const ContinueNode *) override {}
 
     void PostVisit(const ReturnNode *node) override {
         Visit(node->GetExpression());
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Symbol.hpp"
+
+namespace semantic {
+    struct FieldLayout {
+        const ISymbolType *type;
+        uint32_t offset;
+    };
+
+    struct StructLayout {
+        uint32_t size = 0;
+        uint32_t alignment = 1;
+        // in declaration order, see LayoutEngine::GetFieldIndex
+        std::vector<FieldLayout> fields;
+    };
+
+    // Places struct values in linear memory of wasm32: the size and alignment of every type and the offsets of struct fields.
+    // By default the fields are placed by decreasing alignment, so there is no padding between them as all alignments are powers of two,
+    // like Rust does for its default representation. Without reordering they keep the declaration order and are padded as in C.
+    // A struct is stored inline in the struct containing it.
+    class LayoutEngine final {
+    public:
+        explicit LayoutEngine(bool reorder_fields = true) : reorder_fields_(reorder_fields) {}
+
+        const StructLayout &GetLayout(const SubsetStructType *type) {
+            if (const auto it = layouts_.find(type); it != layouts_.end()) {
+                return it->second;
+            }
+
+            // a struct containing itself has no size
+            if (!in_progress_.insert(type).second) {
+                throw std::exception();  // todo
+            }
+
+            const std::vector<const ISymbolType *> types = GetFieldTypes(type);
+
+            std::vector<size_t> order(types.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+            if (reorder_fields_) {
+                std::stable_sort(order.begin(), order.end(), [this, &types](size_t lhs, size_t rhs) {
+                    return GetAlignment(types[lhs]) > GetAlignment(types[rhs]);
+                });
+            }
+
+            StructLayout layout;
+            layout.fields.resize(types.size());
+            for (size_t i : order) {
+                const uint32_t alignment = GetAlignment(types[i]);
+                const uint32_t offset = AlignUp(layout.size, alignment);
+
+                layout.fields[i] = FieldLayout{types[i], offset};
+                layout.size = offset + GetSize(types[i]);
+                layout.alignment = std::max(layout.alignment, alignment);
+            }
+            layout.size = AlignUp(layout.size, layout.alignment);
+
+            in_progress_.erase(type);
+            return layouts_[type] = std::move(layout);
+        }
+
+        uint32_t GetSize(const ISymbolType *type) {
+            if (auto struct_type = dynamic_cast<const SubsetStructType *>(type); struct_type != nullptr) {
+                return GetLayout(struct_type).size;
+            }
+            return GetScalarSize(type);
+        }
+
+        uint32_t GetAlignment(const ISymbolType *type) {
+            if (auto struct_type = dynamic_cast<const SubsetStructType *>(type); struct_type != nullptr) {
+                return GetLayout(struct_type).alignment;
+            }
+            return GetScalarSize(type);
+        }
+
+        // index of a field in StructLayout::fields, the one of a tuple struct is its number
+        static size_t GetFieldIndex(const StructType *type, const std::string &identifier) {
+            const auto it = std::find(type->field_order.begin(), type->field_order.end(), identifier);
+            if (it == type->field_order.end()) {
+                throw std::exception();  // todo
+            }
+            return it - type->field_order.begin();
+        }
+
+        static uint32_t AlignUp(uint32_t value, uint32_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+    private:
+        bool reorder_fields_;
+        std::unordered_map<const ISymbolType *, StructLayout> layouts_;
+        std::unordered_set<const ISymbolType *> in_progress_;
+
+        static std::vector<const ISymbolType *> GetFieldTypes(const SubsetStructType *type) {
+            if (auto tuple_type = dynamic_cast<const TupleStructType *>(type); tuple_type != nullptr) {
+                return tuple_type->types;
+            }
+
+            auto struct_type = dynamic_cast<const StructType *>(type);
+            if (struct_type == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            std::vector<const ISymbolType *> result;
+            for (const std::string &identifier : struct_type->field_order) {
+                result.push_back(struct_type->types.at(identifier));
+            }
+            return result;
+        }
+
+        // a scalar is aligned to its size, a reference is a 32-bit address
+        static uint32_t GetScalarSize(const ISymbolType *type) {
+            if (dynamic_cast<const ReferenceType *>(type) != nullptr) {
+                return 4;
+            }
+
+            auto default_type = dynamic_cast<const DefaultType *>(type);
+            if (default_type == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            switch (default_type->type) {
+            case TokenValue::Type::kBool:
+            case TokenValue::Type::kU8:
+            case TokenValue::Type::kI8:
+                return 1;
+            case TokenValue::Type::kU16:
+            case TokenValue::Type::kI16:
+                return 2;
+            case TokenValue::Type::kChar:
+            case TokenValue::Type::kU32:
+            case TokenValue::Type::kI32:
+            case TokenValue::Type::kF32:
+                return 4;
+            case TokenValue::Type::kU64:
+            case TokenValue::Type::kI64:
+            case TokenValue::Type::kF64:
+                return 8;
+            default:
+                throw std::exception();  // todo
+            }
+        }
+    };
+}
@@ -35,8 +35,6 @@ public:
 
     bool IsTuple() const;
 
-    std::variant<semantic::StructType *, semantic::TupleStructType *> type;
-
 private:
     std::unique_ptr<IdentifierNode> identifier_;
     std::vector<ParamStructNode> params_;
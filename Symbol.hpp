@@ -7,20 +7,22 @@
 #include "ISymbol.hpp"
 #include "SymbolTable.hpp"
 #include "TokenValue.hpp"
+#include "WasmTypes.hpp"
+
+class ExpressionNode;
 
 namespace semantic {
+    // ids of default types are their TokenValue::Type, followed by usize and isize
     class DefaultType final : public ISymbolType {
     public:
-        DefaultType(TokenValue::Type type) : type(type) {}
-        TokenValue::Type type;
+        static constexpr uint32_t kUSizeId = static_cast<uint32_t>(TokenValue::Type::kVoid) + 1;
+        static constexpr uint32_t kISizeId = kUSizeId + 1;
+        static constexpr uint32_t kIdCount = kISizeId + 1;
 
-        bool Equals(const ISymbolType &other) const override {
-            if (auto type = dynamic_cast<const DefaultType *>(&other); type == nullptr) {
-                return other.Equals(*this);
-            }
+        DefaultType(TokenValue::Type type) : DefaultType(type, static_cast<uint32_t>(type)) {}
+        DefaultType(TokenValue::Type type, uint32_t id) : ISymbolType(id), type(type) {}
 
-            return &other == this;
-        }
+        TokenValue::Type type;
     };
 
     class FuncType final : public ISymbolType {
@@ -29,43 +31,38 @@ namespace semantic {
         std::vector<std::pair<std::string, const ISymbolType *>> argument_types;
     };
 
-    class TupleType : public ISymbolType {
+    class TupleType final : public ISymbolType {
     public:
-        std::vector<const ISymbolType *> types;
+        explicit TupleType(const std::vector<const ISymbolType *> &types) : types(types) {}
 
-        bool Equals(const ISymbolType &other) const override {
-            auto default_other = dynamic_cast<const TupleType *>(&other);
+        const std::vector<const ISymbolType *> types;
+    };
+
+    class ReferenceType final : public ISymbolType {
+    public:
+        ReferenceType(bool is_mut, const ISymbolType *type) : is_mut(is_mut), type(type) {}
 
-            if (types.size() != default_other->types.size()) {
-                return false;
-            }
+        const bool is_mut;
+        const ISymbolType *const type;
+    };
 
-            for (size_t i = 0; i < types.size(); i++) {
-                if (!types[i]->Equals(*default_other->types[i])) {
-                    return false;
-                }
-            }
+    class ArrayType final : public ISymbolType {
+    public:
+        explicit ArrayType(const ISymbolType *type) : type(type) {}
 
-            return true;
-        }
+        const ISymbolType *const type;
     };
 
     class SubsetStructType : public ISymbolType {
     public:
         std::string identifier;
-
-        bool Equals(const ISymbolType &other) const override {
-            if (auto type = dynamic_cast<const SubsetStructType *>(&other); type == nullptr) {
-                return other.Equals(*this);
-            }
-
-            return &other == this;
-        }
     };
 
     class StructType final : public SubsetStructType {
     public:
         std::map<std::string, const ISymbolType *> types;
+        // names of the fields in declaration order
+        std::vector<std::string> field_order;
     };
 
     class TupleStructType final : public SubsetStructType {
@@ -75,7 +72,8 @@ namespace semantic {
 
     class LetSymbol : public ISymbol {
     public:
-        std::vector<uint32_t> local_indexes;
+        // wasm::ValueType::empty when no local can hold the type
+        wasm::ValueType value_type = wasm::ValueType::empty;
         bool is_mut_;
     };
 
@@ -91,7 +89,25 @@ namespace semantic {
         FuncSymbol(SymbolTable *parent) : BlockSymbol(parent) {}
 
         uint32_t func_iet = std::numeric_limits<uint32_t>::max();
+        // the parameters in order, then the lets of the body in declaration order; a nested function has its own
+        std::vector<LetSymbol *> locals;
     };
 
     class StructSymbol : public ISymbol {};
+
+    // a named constant item, its value is computed by ConstEvaluator on first use
+    class ConstSymbol : public ISymbol {
+    public:
+        enum class State
+        {
+            kNone,
+            kEvaluating,
+            kEvaluated
+        };
+
+        // initializer, nullptr for a constant without one
+        const ExpressionNode *expression = nullptr;
+        State state = State::kNone;
+        TokenValue value;
+    };
 }
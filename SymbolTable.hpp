@@ -1,40 +1,146 @@
 #pragma once
 
+#include <algorithm>
+#include <limits>
 #include <map>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
 #include "ISymbol.hpp"
 
 namespace semantic {
+    // Maps every identifier of one analysis to a small integer, equal names share one id.
+    // An interner on top of a parent keeps the ids of the parent's names and never changes the parent,
+    // the parent must not get new names while it is used.
+    class NameInterner final {
+    public:
+        static constexpr uint32_t kUnknown = std::numeric_limits<uint32_t>::max();
+
+        NameInterner() = default;
+        explicit NameInterner(const NameInterner *parent) : parent_(parent), first_id_(parent->GetNextId()) {}
+
+        uint32_t Intern(const std::string &name) {
+            if (parent_ != nullptr) {
+                if (const uint32_t id = parent_->Find(name); id != kUnknown) {
+                    return id;
+                }
+            }
+
+            const auto it = ids_.emplace(name, first_id_ + static_cast<uint32_t>(ids_.size()));
+            return it.first->second;
+        }
+
+        // kUnknown when the name was never interned, hence no symbol can be declared with it
+        uint32_t Find(const std::string &name) const {
+            const auto it = ids_.find(name);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+            return parent_ != nullptr ? parent_->Find(name) : kUnknown;
+        }
+
+    private:
+        const NameInterner *parent_ = nullptr;
+        uint32_t first_id_ = 0;
+        std::unordered_map<std::string, uint32_t> ids_;
+
+        uint32_t GetNextId() const {
+            return first_id_ + static_cast<uint32_t>(ids_.size());
+        }
+    };
+
+    // position of a symbol relative to the scope it is referenced from:
+    // the number of parent links to follow and the index of the symbol in that scope
+    struct ScopeAddress {
+        static constexpr uint32_t kUnresolved = std::numeric_limits<uint32_t>::max();
+
+        uint32_t depth = kUnresolved;
+        uint32_t slot = 0;
+
+        bool IsResolved() const {
+            return depth != kUnresolved;
+        }
+    };
+
     class SymbolTable {
     public:
-        SymbolTable() : parent_(nullptr) {}
-        explicit SymbolTable(SymbolTable *parent) : parent_(parent) {
+        SymbolTable() : parent_(nullptr), own_names_(std::make_unique<NameInterner>()), names_(own_names_.get()) {}
+        explicit SymbolTable(SymbolTable *parent) : parent_(parent), names_(parent != nullptr ? parent->names_ : nullptr) {
             if (parent != nullptr) {
                 parent->children.push_back(this);
             }
         }
 
         void Add(std::unique_ptr<ISymbol> &&symbol) {
-            if (symbols_.count(symbol->identifier) != 0) {
+            const uint32_t name = names_->Intern(symbol->identifier);
+            if (FindSlot(name) != ScopeAddress::kUnresolved) {
                 throw std::exception();  // todo
             }
-            symbols_[symbol->identifier] = std::move(symbol);
+
+            if ((symbols_.size() + 1) * 2 > buckets_.size()) {
+                Rehash(std::max<size_t>(8, buckets_.size() * 2));
+            }
+
+            const auto slot = static_cast<uint32_t>(symbols_.size());
+            symbols_.push_back(std::move(symbol));
+            slot_names_.push_back(name);
+            Insert(name, slot);
+        }
+
+        // addresses of the symbols declared after it in this scope become stale
+        std::unique_ptr<ISymbol> Remove(const ISymbol *symbol) {
+            const auto it = std::find_if(symbols_.begin(), symbols_.end(), [symbol](const std::unique_ptr<ISymbol> &p) { return p.get() == symbol; });
+            if (it == symbols_.end()) {
+                throw std::exception();  // todo
+            }
+
+            auto result = std::move(*it);
+            slot_names_.erase(slot_names_.begin() + (it - symbols_.begin()));
+            symbols_.erase(it);
+            Rehash(buckets_.size());
+            return result;
         }
 
         [[nodiscard]] const ISymbol *Find(const std::string &identifier) const {
-            auto current = this;
-            while (current != nullptr) {
-                const auto it = current->symbols_.find(identifier);
-                if (it != current->symbols_.end()) {
-                    return it->second.get();
+            return Get(FindAddress(identifier));
+        }
+
+        [[nodiscard]] ScopeAddress FindAddress(const std::string &identifier) const {
+            const uint32_t name = names_->Find(identifier);
+            if (name == NameInterner::kUnknown) {
+                return ScopeAddress();
+            }
+
+            uint32_t depth = 0;
+            for (auto current = this; current != nullptr; current = current->parent_, depth++) {
+                const uint32_t slot = current->FindSlot(name);
+                if (slot != ScopeAddress::kUnresolved) {
+                    return ScopeAddress{depth, slot};
                 }
+            }
+
+            return ScopeAddress();
+        }
 
+        [[nodiscard]] const ISymbol *Get(ScopeAddress address) const {
+            if (!address.IsResolved()) {
+                return nullptr;
+            }
+
+            auto current = this;
+            for (uint32_t i = 0; i < address.depth; i++) {
                 current = current->parent_;
             }
+            return current->symbols_[address.slot].get();
+        }
 
-            return nullptr;
+        // New names of this scope and of the scopes created below it from now on are interned apart from the parent scopes,
+        // which keeps the parents unchanged, so sibling subtrees can be filled concurrently.
+        // Names already declared here have to be known to the parent's interner.
+        void UseOwnNames() {
+            own_names_ = std::make_unique<NameInterner>(parent_->names_);
+            names_ = own_names_.get();
         }
 
         const SymbolTable *GetParent() const {
@@ -45,14 +151,13 @@ namespace semantic {
             return parent_;
         }
 
-        std::vector<std::unique_ptr<ISymbolType>> types;
-
         std::vector<const SymbolTable *> children;
 
+        // symbols of every scope are listed by identifier, so the result does not depend on declaration order
         template <typename T>
         void GetAllSymbols(std::vector<T> &result) const {
-            for (auto &[key, value] : symbols_) {
-                if (auto p = dynamic_cast<T>(value.get()); p != nullptr) {
+            for (uint32_t slot : GetSlotsByIdentifier()) {
+                if (auto p = dynamic_cast<T>(symbols_[slot].get()); p != nullptr) {
                     result.push_back(p);
                 }
             }
@@ -63,14 +168,14 @@ namespace semantic {
 
         void Print(int depth_ = 0) const {
             depth_++;
-            for (auto &[key, value] : symbols_) {
+            for (uint32_t slot : GetSlotsByIdentifier()) {
                 std::cout << '[' << depth_ << "] ";
-                value->Print();
+                symbols_[slot]->Print();
                 std::cout << std::endl;
             }
 
             for (auto child : children) {
-                
+
                 child->Print(depth_);
             }
             depth_--;
@@ -79,7 +184,59 @@ namespace semantic {
     private:
         SymbolTable *parent_;
 
-        std::map<std::string, std::unique_ptr<ISymbol>> symbols_;
+        std::unique_ptr<NameInterner> own_names_;
+        NameInterner *names_;
+
+        // slots in declaration order
+        std::vector<std::unique_ptr<ISymbol>> symbols_;
+        std::vector<uint32_t> slot_names_;
+        // open addressing with linear probing, a bucket holds slot + 1 and 0 marks an empty one
+        std::vector<uint32_t> buckets_;
+
+        static size_t Hash(uint32_t name) {
+            uint32_t hash = name * 0x9e3779b1u;
+            return hash ^ (hash >> 16);
+        }
+
+        uint32_t FindSlot(uint32_t name) const {
+            if (buckets_.empty()) {
+                return ScopeAddress::kUnresolved;
+            }
+
+            const size_t mask = buckets_.size() - 1;
+            for (size_t i = Hash(name) & mask; buckets_[i] != 0; i = (i + 1) & mask) {
+                if (slot_names_[buckets_[i] - 1] == name) {
+                    return buckets_[i] - 1;
+                }
+            }
+            return ScopeAddress::kUnresolved;
+        }
 
+        void Insert(uint32_t name, uint32_t slot) {
+            const size_t mask = buckets_.size() - 1;
+            size_t i = Hash(name) & mask;
+            while (buckets_[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            buckets_[i] = slot + 1;
+        }
+
+        void Rehash(size_t bucket_count) {
+            buckets_.assign(bucket_count, 0);
+            for (uint32_t slot = 0; slot < slot_names_.size(); slot++) {
+                Insert(slot_names_[slot], slot);
+            }
+        }
+
+        std::vector<uint32_t> GetSlotsByIdentifier() const {
+            std::vector<uint32_t> slots(symbols_.size());
+            for (uint32_t slot = 0; slot < slots.size(); slot++) {
+                slots[slot] = slot;
+            }
+            std::sort(slots.begin(), slots.end(), [this](uint32_t lhs, uint32_t rhs) {
+                return symbols_[lhs]->identifier < symbols_[rhs]->identifier;
+            });
+            return slots;
+        }
     };
 }
@@ -1,15 +1,30 @@
 #pragma once
 
-#include "SymbolTable.hpp"
+#include <cstddef>
+#include <cstdint>
 
 class ISyntaxTreeVisitor;
 
+// [begin, end) indexes in the token buffer a node was parsed from
+struct TokenSpan {
+    size_t begin = 0;
+    size_t end = 0;
+};
+
 class SyntaxNode {
 public:
     virtual void Visit(ISyntaxTreeVisitor *visitor) const = 0;
 
-    semantic::SymbolTable *symbol_table = nullptr;
+    // preorder index of the node in its SyntaxTree, used to look up per-analysis data
+    uint32_t GetId() const {
+        return id_;
+    }
 
 protected:
     SyntaxNode() = default;
+
+private:
+    friend class SyntaxTree;
+
+    uint32_t id_ = 0;
 };
@@ -1,27 +1,443 @@
 #include "SyntaxParser.hpp"
 
+#include "SpecificSyntaxTreeVisitor.hpp"
+#include "ThreadPool.hpp"
+
 SyntaxParser::SyntaxParser(Tokenizer *tokenizer) : tokenizer_(tokenizer) {
     current_token_ = NextToken();
 }
 
+SyntaxParser::SyntaxParser(const std::vector<Token> *tokens, size_t begin, size_t end) : tokens_(tokens), tokens_idx_(begin), tokens_end_(end) {
+    current_token_ = NextToken();
+}
+
 std::unique_ptr<SyntaxTree> SyntaxParser::ParseItems() {
     std::vector<std::unique_ptr<SyntaxNode>> statements;
 
-    Result<SyntaxNode> item_result = ParseItem();
-    if (item_result.status) {
-        while (item_result.status) {
+    do {
+        try {
+            const Token first = current_token_;
+            Result<SyntaxNode> item_result = ParseItem();
+            if (!item_result.status) {
+                Error("expected item");
+            }
             statements.push_back(std::move(item_result.node));
-            item_result = ParseItem();
+            source_map_.items.push_back(MakeSpan(first, previous_token_));
+        } catch (SyntaxError &error) {
+            Recover(error, true);
+        }
+    } while (current_token_.GetType() != Token::Type::kEndOfFile);
+
+    auto tree = std::make_unique<SyntaxTree>(std::move(statements));
+    // recovery drops nodes that may already be in source_map_
+    if (tokens_ != nullptr && diagnostics_.empty()) {
+        tree->source_map_ = std::move(source_map_);
+    }
+    return tree;
+}
+
+std::unique_ptr<ExpressionNode> SyntaxParser::ParseExpr() {
+    try {
+        return ParseExpression().node;
+    } catch (const SyntaxError &error) {
+        diagnostics_.push_back(error.GetDiagnostic());
+        return nullptr;
+    }
+}
+
+void SyntaxParser::Error(const std::string &message) const {
+    // the tokenizer already describes its own errors
+    if (current_token_.GetType() == Token::Type::kError) {
+        throw SyntaxError(SyntaxDiagnostic{current_token_.GetPosition(), current_token_.GetTokenValue().ValueToString()});
+    }
+
+    throw SyntaxError(SyntaxDiagnostic{current_token_.GetPosition(), message + ", found `" + Token::TypeToString(current_token_.GetType()) + "`"});
+}
+
+void SyntaxParser::Recover(SyntaxError &error, bool is_item_level) {
+    if (!error.is_reported) {
+        diagnostics_.push_back(error.GetDiagnostic());
+        error.is_reported = true;
+    }
+
+    // tokens of the failed construct are dropped, pending ones after the current token are kept
+    is_transaction_ = false;
+    std::queue<Token>().swap(transaction_buff_);
+    except_struct_expression_ = false;
+
+    if (current_token_.GetType() == Token::Type::kEndOfFile) {
+        if (is_item_level) {
+            return;
+        }
+        throw;
+    }
+
+    // a second failure at the same place would loop forever
+    const auto start_offset = static_cast<std::streamoff>(current_token_.GetPosition().start_offset);
+    if (start_offset == last_recover_offset_) {
+        previous_token_ = current_token_;
+        current_token_ = NextToken();
+    }
+
+    int depth = 0;
+    while (current_token_.GetType() != Token::Type::kEndOfFile) {
+        const auto type = current_token_.GetType();
+        if (depth == 0) {
+            if (type == Token::Type::kFn || type == Token::Type::kStruct || type == Token::Type::kConst) {
+                break;
+            }
+            if (!is_item_level && (type == Token::Type::kLet || type == Token::Type::kCloseCurlyBr)) {
+                break;
+            }
+            if (!is_item_level && type == Token::Type::kSemi) {
+                Accept(Token::Type::kSemi);
+                break;
+            }
+        }
+
+        if (type == Token::Type::kOpenCurlyBr) {
+            depth++;
+        } else if (type == Token::Type::kCloseCurlyBr && depth > 0) {
+            depth--;
+        }
+
+        previous_token_ = current_token_;
+        current_token_ = NextToken();
+    }
+
+    last_recover_offset_ = static_cast<std::streamoff>(current_token_.GetPosition().start_offset);
+}
+
+std::vector<Token> SyntaxParser::Tokenize(Tokenizer *tokenizer) {
+    std::vector<Token> tokens;
+    while (true) {
+        Token token = tokenizer->Next();
+        if (token.GetType() == Token::Type::kEndOfFile) {
+            break;
+        }
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+std::vector<std::pair<size_t, size_t>> SyntaxParser::FindItemBoundaries(const std::vector<Token> &tokens) {
+    std::vector<std::pair<size_t, size_t>> boundaries;
+
+    size_t idx = 0;
+    while (idx < tokens.size()) {
+        const size_t begin = idx;
+
+        // `const fn` and `fn`/`struct` end with `;` or with the `}` closing their body,
+        // constant items may contain block expressions and end only with `;`
+        bool is_constant_item = false;
+        if (tokens[idx].GetType() == Token::Type::kConst) {
+            is_constant_item = idx + 1 >= tokens.size() || tokens[idx + 1].GetType() != Token::Type::kFn;
+        } else if (tokens[idx].GetType() != Token::Type::kFn && tokens[idx].GetType() != Token::Type::kStruct) {
+            return {};
+        }
+
+        int depth = 0;
+        bool is_found = false;
+        for (; idx < tokens.size() && !is_found; idx++) {
+            switch (tokens[idx].GetType()) {
+            case Token::Type::kOpenCurlyBr:
+            case Token::Type::kOpenRoundBr:
+            case Token::Type::kOpenSquareBr:
+                depth++;
+                break;
+            case Token::Type::kCloseCurlyBr:
+            case Token::Type::kCloseRoundBr:
+            case Token::Type::kCloseSquareBr:
+                if (--depth < 0) {
+                    return {};
+                }
+                is_found = depth == 0 && !is_constant_item && tokens[idx].GetType() == Token::Type::kCloseCurlyBr;
+                break;
+            case Token::Type::kSemi:
+                is_found = depth == 0;
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (!is_found) {
+            return {};
+        }
+
+        boundaries.emplace_back(begin, idx);
+    }
+
+    return boundaries;
+}
+
+std::unique_ptr<SyntaxTree> SyntaxParser::ParseItemsParallel(const std::vector<Token> &tokens, size_t thread_count, std::vector<SyntaxDiagnostic> *diagnostics) {
+    const auto parse_sequential = [&]() {
+        SyntaxParser parser(&tokens, 0, tokens.size());
+        auto tree = parser.ParseItems();
+        diagnostics->insert(diagnostics->end(), parser.GetDiagnostics().begin(), parser.GetDiagnostics().end());
+        return tree;
+    };
+
+    const auto boundaries = FindItemBoundaries(tokens);
+    if (boundaries.size() < 2 || thread_count < 2) {
+        return parse_sequential();
+    }
+
+    std::vector<std::unique_ptr<SyntaxNode>> items(boundaries.size());
+    std::vector<SourceMap> source_maps(boundaries.size());
+    std::vector<char> is_failed(boundaries.size(), false);
+
+    ThreadPool pool(std::min(thread_count, boundaries.size()));
+    pool.ParallelFor(boundaries.size(), [&](size_t idx) {
+        SyntaxParser parser(&tokens, boundaries[idx].first, boundaries[idx].second);
+
+        try {
+            Result<SyntaxNode> item_result = parser.ParseItem();
+            if (!item_result.status || parser.current_token_.GetType() != Token::Type::kEndOfFile || !parser.diagnostics_.empty()) {
+                is_failed[idx] = true;
+            }
+            items[idx] = std::move(item_result.node);
+            source_maps[idx] = std::move(parser.source_map_);
+        } catch (const SyntaxError &) {
+            is_failed[idx] = true;
+        }
+    });
+
+    // recovery may cross item boundaries, so erroneous sources get the exact sequential diagnostics
+    if (std::find(is_failed.begin(), is_failed.end(), true) != is_failed.end()) {
+        return parse_sequential();
+    }
+
+    auto tree = std::make_unique<SyntaxTree>(std::move(items));
+    for (size_t i = 0; i < boundaries.size(); i++) {
+        SourceMap &source_map = tree->source_map_;
+        source_map.items.push_back(TokenSpan{boundaries[i].first, boundaries[i].second});
+        source_map.blocks.insert(source_map.blocks.end(), source_maps[i].blocks.begin(), source_maps[i].blocks.end());
+        source_map.tokens.insert(source_map.tokens.end(), source_maps[i].tokens.begin(), source_maps[i].tokens.end());
+    }
+    return tree;
+}
+
+namespace {
+    class NodeCollector final : public SpecificSyntaxTreeVisitor {
+    public:
+        std::vector<const SyntaxNode *> nodes;
+
+        void Visit(const SyntaxNode *node) override {
+            if (node != nullptr) {
+                nodes.push_back(node);
+            }
+            SpecificSyntaxTreeVisitor::Visit(node);
+        }
+    };
+
+    // a node keeps the tokens of its names, literals and operators only, the first of them is the earliest in the source
+    class FirstTokenFinder final : public SpecificSyntaxTreeVisitor {
+    public:
+        std::optional<Token::Position> position;
+
+    protected:
+        void PostVisit(const IdentifierNode *node) override {
+            Add(node->GetToken());
+        }
+
+        void PostVisit(const LiteralNode *node) override {
+            Add(node->GetToken());
+        }
+
+        void PostVisit(const BinaryOperationNode *node) override {
+            Add(node->GetToken());
+            SpecificSyntaxTreeVisitor::PostVisit(node);
+        }
+
+        void PostVisit(const PrefixUnaryOperationNode *node) override {
+            if (!node->IsException()) {
+                Add(node->GetToken());
+            }
+            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
 
-        if (tokenizer_->HasNext()) {
-            throw std::exception(); // todo
+        void PostVisit(const AssignmentNode *node) override {
+            const Token operation = node->GetOperation();
+            Add(&operation);
+            SpecificSyntaxTreeVisitor::PostVisit(node);
         }
+
+    private:
+        void Add(const Token *token) {
+            if (!position.has_value() || token->GetPosition().start_offset < position->start_offset) {
+                position = token->GetPosition();
+            }
+        }
+    };
+}  // namespace
+
+void SyntaxTree::NumberNodes() {
+    NodeCollector collector;
+    collector.Visit(this);
+
+    for (size_t i = 0; i < collector.nodes.size(); i++) {
+        const_cast<SyntaxNode *>(collector.nodes[i])->id_ = static_cast<uint32_t>(i);
+    }
+    node_count_ = collector.nodes.size();
+}
+
+size_t SyntaxTree::CountNodes(const SyntaxNode *node) {
+    return CollectNodes(node).size();
+}
+
+std::vector<const SyntaxNode *> SyntaxTree::CollectNodes(const SyntaxNode *node) {
+    NodeCollector collector;
+    collector.Visit(node);
+    return std::move(collector.nodes);
+}
+
+std::optional<Token::Position> SyntaxTree::GetPosition(const SyntaxNode *node) {
+    FirstTokenFinder finder;
+    finder.Visit(node);
+    return finder.position;
+}
+
+SyntaxParser::ReparseResult SyntaxParser::Reparse(std::unique_ptr<SyntaxTree> *tree, const std::vector<Token> &tokens, const TokenEdit &edit, std::vector<SyntaxDiagnostic> *diagnostics) {
+    const auto full_reparse = [&]() {
+        SyntaxParser parser(&tokens, 0, tokens.size());
+        *tree = parser.ParseItems();
+        diagnostics->insert(diagnostics->end(), parser.GetDiagnostics().begin(), parser.GetDiagnostics().end());
+
+        ReparseResult result{{}, false, true};
+        for (size_t i = 0; i < (*tree)->GetNodes().size(); i++) {
+            result.replaced_items.push_back(i);
+        }
+        return result;
+    };
+
+    SourceMap &source_map = (*tree)->source_map_;
+    if (source_map.items.size() != (*tree)->nodes_.size()) {
+        return full_reparse();
+    }
+
+    // the opening token of the node and its closing `}` or `;` must survive the edit
+    const auto encloses = [&edit](const TokenSpan &span) {
+        return span.begin < edit.begin && edit.old_end < span.end;
+    };
+
+    const auto item_it = std::find_if(source_map.items.begin(), source_map.items.end(), encloses);
+    if (item_it == source_map.items.end()) {
+        return full_reparse();
+    }
+    const auto item_idx = static_cast<size_t>(item_it - source_map.items.begin());
+
+    // blocks enclosing the edit are inside the item
+    const SourceMap::BlockRef *block = nullptr;
+    for (const auto &ref : source_map.blocks) {
+        if (encloses(ref.span) && (block == nullptr || ref.span.end - ref.span.begin < block->span.end - block->span.begin)) {
+            block = &ref;
+        }
+    }
+
+    const auto delta = static_cast<std::ptrdiff_t>(edit.new_end) - static_cast<std::ptrdiff_t>(edit.old_end);
+    const TokenSpan old_span = block != nullptr ? block->span : *item_it;
+    const TokenSpan new_span{old_span.begin, old_span.end + delta};
+
+    // the parser of a block is positioned right after `{` as ParseBlockExpression expects
+    SyntaxParser parser(&tokens, block != nullptr ? new_span.begin + 1 : new_span.begin, new_span.end);
+    std::unique_ptr<SyntaxNode> new_item;
+    std::unique_ptr<BlockNode> new_block;
+    try {
+        if (block != nullptr) {
+            parser.previous_token_ = tokens.at(new_span.begin);
+            new_block = parser.ParseBlockExpression();
+        } else {
+            new_item = parser.ParseItem().node;
+        }
+    } catch (const std::exception &) {
+        return full_reparse();
+    }
+
+    if ((block == nullptr && new_item == nullptr) || parser.current_token_.GetType() != Token::Type::kEndOfFile || !parser.diagnostics_.empty()) {
+        return full_reparse();
+    }
+
+    // entries of the replaced node go, the kept ones follow the shifted tokens
+    const auto is_replaced = [&old_span](size_t idx) {
+        return old_span.begin <= idx && idx < old_span.end;
+    };
+    const auto shift = [&edit, delta](size_t idx) {
+        return idx >= edit.old_end ? idx + delta : idx;
+    };
+    const auto shift_span = [&edit, delta](TokenSpan *span) {
+        if (span->begin >= edit.old_end) {
+            span->begin += delta;
+        }
+        if (span->end > edit.old_end) {
+            span->end += delta;
+        }
+    };
+
+    auto &token_refs = source_map.tokens;
+    token_refs.erase(std::remove_if(token_refs.begin(), token_refs.end(), [&is_replaced](const SourceMap::TokenRef &ref) { return is_replaced(ref.idx); }), token_refs.end());
+    for (auto &ref : token_refs) {
+        ref.idx = shift(ref.idx);
+        // type and value are the same, the position may not be
+        *ref.token = tokens.at(ref.idx);
+    }
+
+    BlockNode *block_node = block != nullptr ? block->node : nullptr;
+    auto &block_refs = source_map.blocks;
+    block_refs.erase(std::remove_if(block_refs.begin(), block_refs.end(), [&is_replaced](const SourceMap::BlockRef &ref) { return is_replaced(ref.span.begin); }), block_refs.end());
+    for (auto &ref : block_refs) {
+        shift_span(&ref.span);
+    }
+
+    for (TokenSpan &span : source_map.items) {
+        shift_span(&span);
+    }
+
+    token_refs.insert(token_refs.end(), parser.source_map_.tokens.begin(), parser.source_map_.tokens.end());
+    block_refs.insert(block_refs.end(), parser.source_map_.blocks.begin(), parser.source_map_.blocks.end());
+
+    if (block_node != nullptr) {
+        // ParseBlockExpression adds the re-parsed block itself last, its contents move into the kept node
+        block_refs.back().node = block_node;
+        block_node->Replace(std::move(new_block));
     } else {
-        throw std::exception(); // todo
+        (*tree)->nodes_[item_idx] = std::move(new_item);
     }
+    (*tree)->NumberNodes();
+
+    return ReparseResult{{item_idx}, block_node != nullptr, false};
+}
 
-    return std::make_unique<SyntaxTree>(std::move(statements));
+size_t SyntaxParser::FindToken(const Token &token) const {
+    // tokens are ordered by their offsets, so the index is found by binary search
+    const auto offset = static_cast<std::streamoff>(token.GetPosition().start_offset);
+    const auto it = std::lower_bound(tokens_->begin(), tokens_->end(), offset, [](const Token &lhs, std::streamoff rhs) {
+        return static_cast<std::streamoff>(lhs.GetPosition().start_offset) < rhs;
+    });
+    return static_cast<size_t>(it - tokens_->begin());
+}
+
+TokenSpan SyntaxParser::MakeSpan(const Token &first, const Token &last) const {
+    if (tokens_ == nullptr) {
+        return TokenSpan();
+    }
+
+    return TokenSpan{FindToken(first), FindToken(last) + 1};
+}
+
+void SyntaxParser::TrackToken(Token *token) {
+    if (tokens_ != nullptr) {
+        source_map_.tokens.push_back(SourceMap::TokenRef{token, FindToken(*token)});
+    }
+}
+
+bool SyntaxParser::HasNextToken() const {
+    if (tokens_ != nullptr) {
+        return tokens_idx_ < tokens_end_;
+    }
+
+    return tokenizer_->HasNext();
 }
 
 Token SyntaxParser::NextToken() {
@@ -36,7 +452,7 @@ Token SyntaxParser::NextToken() {
         return result;
     }
 
-    Token result = tokenizer_->Next();
+    Token result = tokens_ != nullptr ? NextBufferedToken() : NextTokenizerToken();
 
     if (is_transaction_) {
         transaction_buff_.push(result);
@@ -50,15 +466,49 @@ Token SyntaxParser::GetToken() {
         return post_transaction_buff_.front();
     }
 
+    if (tokens_ != nullptr) {
+        return tokens_idx_ < tokens_end_ ? (*tokens_)[tokens_idx_] : MakeEndOfFile();
+    }
+
     return tokenizer_->Get();
 }
 
+Token SyntaxParser::NextBufferedToken() {
+    if (tokens_idx_ < tokens_end_) {
+        return (*tokens_)[tokens_idx_++];
+    }
+
+    return MakeEndOfFile();
+}
+
+Token SyntaxParser::NextTokenizerToken() {
+    const Token result = tokenizer_->Next();
+    if (result.GetType() == Token::Type::kEndOfFile) {
+        return MakeEndOfFile();
+    }
+
+    last_position_ = result.GetPosition();
+    return result;
+}
+
+// right after the last token in both modes, so that the diagnostics at the end of a source do not depend on it
+Token SyntaxParser::MakeEndOfFile() const {
+    const bool is_empty = tokens_ != nullptr ? tokens_end_ == 0 : !last_position_.has_value();
+    if (is_empty) {
+        return Token(Token::Type::kEndOfFile, Token::Position(1, 1, 0, 1, 1, 0));
+    }
+
+    const auto last = tokens_ != nullptr ? (*tokens_)[tokens_end_ - 1].GetPosition() : *last_position_;
+    return Token(Token::Type::kEndOfFile, Token::Position(last.end_line, last.end_column, last.end_offset, last.end_line, last.end_column, last.end_offset));
+}
+
 bool SyntaxParser::Accept(Token::Type type, Token *out) {
     if (out != nullptr) {
         *out = current_token_;
     }
 
     if (current_token_.GetType() == type) {
+        previous_token_ = current_token_;
         current_token_ = NextToken();
         return true;
     }
@@ -68,7 +518,7 @@ bool SyntaxParser::Accept(Token::Type type, Token *out) {
 
 void SyntaxParser::Expect(Token::Type type, Token *out) {
     if (!Accept(type, out)) {
-        throw std::exception();
+        Error("expected `" + Token::TypeToString(type) + "`");
     }
 }
 
@@ -197,7 +647,7 @@ std::unique_ptr<FunctionNode> SyntaxParser::ParseFunction(bool is_const) {
         block_node = ParseBlockExpression();
     }
 
-    return std::make_unique<FunctionNode>(std::make_unique<IdentifierNode>(std::move(identifier)), std::move(params), std::move(return_type_node), std::move(block_node), is_const);
+    return std::make_unique<FunctionNode>(MakeTokenNode<IdentifierNode>(std::move(identifier)), std::move(params), std::move(return_type_node), std::move(block_node), is_const);
 }
 
 // `struct` already process
@@ -226,7 +676,7 @@ std::unique_ptr<StructNode> SyntaxParser::ParseStruct() {
                 Expect(Token::Type::kColon);
                 std::unique_ptr<TypeNode> param_type_node = ParseType();
 
-                params.emplace_back(std::make_unique<IdentifierNode>(std::move(param_identifier_token)), std::move(param_type_node));
+                params.emplace_back(MakeTokenNode<IdentifierNode>(std::move(param_identifier_token)), std::move(param_type_node));
             } else {
                 break;
             }
@@ -241,7 +691,7 @@ std::unique_ptr<StructNode> SyntaxParser::ParseStruct() {
         Expect(Token::Type::kSemi);  // StructStruct
     }
 
-    return std::make_unique<StructNode>(std::make_unique<IdentifierNode>(std::move(struct_identifier_token)), std::move(params));
+    return std::make_unique<StructNode>(MakeTokenNode<IdentifierNode>(std::move(struct_identifier_token)), std::move(params));
 }
 
 // `const` already process
@@ -249,7 +699,7 @@ std::unique_ptr<ConstantItemNode> SyntaxParser::ParseConstantItem() {
     std::unique_ptr<IdentifierNode> identifier_node;
     Token identifier_token;
     if (Accept(Token::Type::kIdentifier, &identifier_token)) {
-        identifier_node = std::make_unique<IdentifierNode>(std::move(identifier_token));
+        identifier_node = MakeTokenNode<IdentifierNode>(std::move(identifier_token));
     } else {
         Expect(Token::Type::kUnderscore);
     }
@@ -259,7 +709,11 @@ std::unique_ptr<ConstantItemNode> SyntaxParser::ParseConstantItem() {
     std::unique_ptr<ExpressionNode> expr_node;
 
     if (Accept(Token::Type::kEq)) {
-        expr_node = ParseExpression().node;
+        auto result = ParseExpression();
+        if (!result.status) {
+            Error("expected expression");
+        }
+        expr_node = std::move(result.node);
     }
 
     Expect(Token::Type::kSemi);
@@ -278,7 +732,11 @@ std::unique_ptr<LetNode> SyntaxParser::ParseLetStatement() {
     }
 
     if (Accept(Token::Type::kEq)) {
-        expr = ParseExpression().node;
+        auto result = ParseExpression();
+        if (!result.status) {
+            Error("expected expression");
+        }
+        expr = std::move(result.node);
     }
 
     Expect(Token::Type::kSemi);
@@ -325,7 +783,7 @@ std::unique_ptr<PatternNode> SyntaxParser::ParsePattern() {
     Token literal;
     Token identifier;
     if (Accept(Token::Type::kLiteral, &literal)) {
-        return std::make_unique<LiteralPatternNode>(std::make_unique<LiteralNode>(std::move(literal)));
+        return std::make_unique<LiteralPatternNode>(MakeTokenNode<LiteralNode>(std::move(literal)));
     } else if (Accept(Token::Type::kUnderscore)) {
         return std::make_unique<WildcardPatternNode>();
     } else if (Accept(Token::Type::kDotDot)) {
@@ -342,13 +800,13 @@ std::unique_ptr<PatternNode> SyntaxParser::ParsePattern() {
                 if (Accept(Token::Type::kLiteral, &literal)) {
                     Expect(Token::Type::kColon);
                     std::unique_ptr<PatternNode> pattern = ParsePattern();
-                    fields.push_back(std::make_unique<TupleIndexFieldNode>(std::make_unique<LiteralNode>(std::move(literal)), std::move(pattern)));
+                    fields.push_back(std::make_unique<TupleIndexFieldNode>(MakeTokenNode<LiteralNode>(std::move(literal)), std::move(pattern)));
                 } else if (Accept(Token::Type::kIdentifier, &param_identifier)) {
                     if (Accept(Token::Type::kColon)) {
                         std::unique_ptr<PatternNode> pattern = ParsePattern();
-                        fields.push_back(std::make_unique<IdentifierFieldNode>(std::make_unique<IdentifierNode>(std::move(param_identifier)), std::move(pattern)));
+                        fields.push_back(std::make_unique<IdentifierFieldNode>(MakeTokenNode<IdentifierNode>(std::move(param_identifier)), std::move(pattern)));
                     } else {
-                        fields.push_back(std::make_unique<RefMutIdentifierFieldNode>(is_ref, is_mut, std::make_unique<IdentifierNode>(std::move(param_identifier))));
+                        fields.push_back(std::make_unique<RefMutIdentifierFieldNode>(is_ref, is_mut, MakeTokenNode<IdentifierNode>(std::move(param_identifier))));
                     }
                 } else if (Accept(Token::Type::kDotDot)) {
                     is_etc = true;
@@ -360,7 +818,7 @@ std::unique_ptr<PatternNode> SyntaxParser::ParsePattern() {
                     break;
                 }
             }
-            return std::make_unique<StructPatternNode>(std::make_unique<IdentifierNode>(std::move(identifier)), is_etc, std::move(fields));
+            return std::make_unique<StructPatternNode>(MakeTokenNode<IdentifierNode>(std::move(identifier)), is_etc, std::move(fields));
         } else if (Accept(Token::Type::kOpenRoundBr)) {
             std::vector<std::unique_ptr<PatternNode>> patterns;
             while (!Accept(Token::Type::kCloseRoundBr)) {
@@ -372,14 +830,14 @@ std::unique_ptr<PatternNode> SyntaxParser::ParsePattern() {
                 }
             }
 
-            return std::make_unique<TupleStructPatternNode>(std::make_unique<IdentifierNode>(std::move(identifier)), std::move(patterns));
+            return std::make_unique<TupleStructPatternNode>(MakeTokenNode<IdentifierNode>(std::move(identifier)), std::move(patterns));
         } else {
             std::unique_ptr<PatternNode> subpattern;
             if (Accept(Token::Type::kAt)) {
                 subpattern = ParsePattern();
             }
 
-            return std::make_unique<IdentifierPatternNode>(is_ref, is_mut, std::make_unique<IdentifierNode>(std::move(identifier)), std::move(subpattern));
+            return std::make_unique<IdentifierPatternNode>(is_ref, is_mut, MakeTokenNode<IdentifierNode>(std::move(identifier)), std::move(subpattern));
         }
     } else if (Accept(Token::Type::kOpenRoundBr)) {
         std::unique_ptr<PatternNode> pattern = ParsePattern();
@@ -415,7 +873,7 @@ std::unique_ptr<PatternNode> SyntaxParser::ParsePattern() {
         return std::make_unique<ReferencePatternNode>(is_single_ref, is_mut, std::move(pattern));
     }
 
-    throw std::exception();  // todo
+    Error("expected pattern");
 }
 
 // clang-format off
@@ -438,12 +896,15 @@ std::unique_ptr<TypeNode> SyntaxParser::ParseType() {
     } else if (Accept(Token::Type::kOpenSquareBr)) {
         std::unique_ptr<TypeNode> result = ParseType();
         Expect(Token::Type::kSemi);
-        std::unique_ptr<ExpressionNode> expr = ParseExpression().node;
+        auto expr = ParseExpression();
+        if (!expr.status) {
+            Error("expected expression");
+        }
         Expect(Token::Type::kCloseSquareBr);
 
-        return std::make_unique<ArrayTypeNode>(std::move(result), std::move(expr));
+        return std::make_unique<ArrayTypeNode>(std::move(result), std::move(expr.node));
     } else if (Accept(Token::Type::kIdentifier, &identifier)) {
-        return std::make_unique<IdentifierTypeNode>(std::make_unique<IdentifierNode>(std::move(identifier)));
+        return std::make_unique<IdentifierTypeNode>(MakeTokenNode<IdentifierNode>(std::move(identifier)));
     } else if (Accept(Token::Type::kOpenRoundBr)) {
         if (Accept(Token::Type::kCloseRoundBr)) {
             return std::make_unique<TupleTypeNode>();
@@ -472,7 +933,7 @@ std::unique_ptr<TypeNode> SyntaxParser::ParseType() {
         }
     }
 
-    throw std::exception();  // todo
+    Error("expected type");
 }
 
 // clang-format off
@@ -612,7 +1073,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParseExpressionWithoutBlock()
 }
 
 SyntaxParser::Result<ExpressionNode> SyntaxParser::ParseLeft(int priority) {
-    if (priority == kPriority.size()) {
+    if (priority == static_cast<int>(kPriority.size())) {
         return ParsePrefix();
     }
 
@@ -625,10 +1086,10 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParseLeft(int priority) {
     while (Accept(kPriority.at(priority).begin(), kPriority.at(priority).end(), &out)) {
         auto right = ParseLeft(priority + 1);
         if (!right.status) {
-            return Result<ExpressionNode>(false);
+            Error("expected expression");
         }
 
-        left = Result<ExpressionNode>(true, std::make_unique<BinaryOperationNode>(std::move(out), std::move(left.node), std::move(right.node)));
+        left = Result<ExpressionNode>(true, MakeTokenNode<BinaryOperationNode>(std::move(out), std::move(left.node), std::move(right.node)));
     }
 
     return left;
@@ -640,23 +1101,23 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePrefix() {
     if (Accept(kUnaryOperator.begin(), kUnaryOperator.end(), &out)) {
         auto right = ParsePrefix();
         if (!right.status) {
-            return Result<ExpressionNode>(false);
+            Error("expected expression");
         }
 
-        return Result<ExpressionNode>(true, std::make_unique<PrefixUnaryOperationNode>(std::move(out), std::move(right.node)));
+        return Result<ExpressionNode>(true, MakeTokenNode<PrefixUnaryOperationNode>(std::move(out), std::move(right.node)));
     } else if (Accept(Token::Type::kAnd, &out)) {
         if (Accept(Token::Type::kMut)) {
             auto right = ParsePrefix();
             if (!right.status) {
-                return Result<ExpressionNode>(false);
+                Error("expected expression");
             }
             return Result<ExpressionNode>(true, std::make_unique<PrefixUnaryOperationNode>(PrefixUnaryOperationNode::Exception::kAndMut, std::move(right.node)));
         } else {
             auto right = ParsePrefix();
             if (!right.status) {
-                return Result<ExpressionNode>(false);
+                Error("expected expression");
             }
-            return Result<ExpressionNode>(true, std::make_unique<PrefixUnaryOperationNode>(std::move(out), std::move(right.node)));
+            return Result<ExpressionNode>(true, MakeTokenNode<PrefixUnaryOperationNode>(std::move(out), std::move(right.node)));
         }
     }
 
@@ -676,10 +1137,10 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
             if (!Accept(Token::Type::kIdentifier, &out)) {
                 Expect(Token::Type::kLiteral, &out);
                 operand =
-                    Result<ExpressionNode>(true, std::make_unique<MemberAccessNode>(std::move(operand.node), std::make_unique<LiteralExpressionNode>(std::make_unique<LiteralNode>(std::move(out)))));
+                    Result<ExpressionNode>(true, std::make_unique<MemberAccessNode>(std::move(operand.node), std::make_unique<LiteralExpressionNode>(MakeTokenNode<LiteralNode>(std::move(out)))));
             } else {
                 operand = Result<ExpressionNode>(
-                    true, std::make_unique<MemberAccessNode>(std::move(operand.node), std::make_unique<IdentifierExpressionNode>(std::make_unique<IdentifierNode>(std::move(out)))));
+                    true, std::make_unique<MemberAccessNode>(std::move(operand.node), std::make_unique<IdentifierExpressionNode>(MakeTokenNode<IdentifierNode>(std::move(out)))));
             }
         } else if (Accept(Token::Type::kOpenRoundBr)) {
             std::vector<std::unique_ptr<ExpressionNode>> arguments;
@@ -687,7 +1148,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
             while (!Accept(Token::Type::kCloseRoundBr)) {
                 auto result = ParseExpression();
                 if (!result.status) {
-                    throw std::exception();  // todo
+                    Error("expected expression");
                 }
 
                 arguments.push_back(std::move(result.node));
@@ -702,7 +1163,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
         } else if (Accept(Token::Type::kOpenSquareBr)) {
             auto expression = ParseExpression();
             if (!expression.status) {
-                throw std::exception();
+                Error("expected expression");
             }
             Expect(Token::Type::kCloseSquareBr);
 
@@ -714,7 +1175,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
             if (Accept(Token::Type::kDotDot)) {
                 auto result = ParseExpression();
                 if (!result.status) {
-                    throw std::exception();
+                    Error("expected expression");
                 }
 
                 dot_dot_expression = std::move(result.node);
@@ -725,20 +1186,20 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
                         if (Accept(Token::Type::kColon)) {
                             auto result = ParseExpression();
                             if (!result.status) {
-                                throw std::exception();
+                                Error("expected expression");
                             }
 
-                            fields.push_back(std::make_unique<IdentifierFieldInitStructExpressionNode>(std::make_unique<IdentifierNode>(std::move(identifier)), std::move(result.node)));
+                            fields.push_back(std::make_unique<IdentifierFieldInitStructExpressionNode>(MakeTokenNode<IdentifierNode>(std::move(identifier)), std::move(result.node)));
                         } else {
-                            fields.push_back(std::make_unique<ShorthandFieldInitStructExpressionNode>(std::make_unique<IdentifierNode>(std::move(identifier))));
+                            fields.push_back(std::make_unique<ShorthandFieldInitStructExpressionNode>(MakeTokenNode<IdentifierNode>(std::move(identifier))));
                         }
                     } else if (Accept(Token::Type::kLiteral, &literal)) {
                         Expect(Token::Type::kColon);
                         auto result = ParseExpression();
                         if (!result.status) {
-                            throw std::exception();
+                            Error("expected expression");
                         }
-                        fields.push_back(std::make_unique<TupleIndexFieldInitStructExpressionNode>(std::make_unique<LiteralNode>(std::move(literal)), std::move(result.node)));
+                        fields.push_back(std::make_unique<TupleIndexFieldInitStructExpressionNode>(MakeTokenNode<LiteralNode>(std::move(literal)), std::move(result.node)));
                     } else {
                         break;
                     }
@@ -750,7 +1211,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
                     if (Accept(Token::Type::kDotDot)) {
                         auto result = ParseExpression();
                         if (!result.status) {
-                            throw std::exception();
+                            Error("expected expression");
                         }
 
                         dot_dot_expression = std::move(result.node);
@@ -765,10 +1226,12 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePostfix() {
         } else if (Accept(kAssignmentOperations.begin(), kAssignmentOperations.end(), &out)) {
             auto result = ParseExpression();
             if (!result.status) {
-                throw std::exception();
+                Error("expected expression");
             }
 
-            operand = Result<ExpressionNode>(true, std::make_unique<AssignmentNode>(std::move(out), std::move(operand.node), std::move(result.node)));
+            auto assignment_node = std::make_unique<AssignmentNode>(std::move(out), std::move(operand.node), std::move(result.node));
+            TrackToken(&assignment_node->operation_);
+            operand = Result<ExpressionNode>(true, std::move(assignment_node));
         } else {
             break;
         }
@@ -807,7 +1270,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePrimary() {
             while (!Accept(Token::Type::kCloseRoundBr)) {
                 result = ParseExpression();
                 if (!result.status) {
-                    throw std::exception();
+                    Error("expected expression");
                 }
 
                 expressions.push_back(std::move(result.node));
@@ -825,13 +1288,13 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePrimary() {
 
         return result;
     } else if (Accept(Token::Type::kIdentifier, &out)) {
-        return Result<ExpressionNode>(true, std::make_unique<IdentifierExpressionNode>(std::make_unique<IdentifierNode>(std::move(out))));
+        return Result<ExpressionNode>(true, std::make_unique<IdentifierExpressionNode>(MakeTokenNode<IdentifierNode>(std::move(out))));
     } else if (Accept(Token::Type::kLiteral, &out)) {
-        return Result<ExpressionNode>(true, std::make_unique<LiteralExpressionNode>(std::make_unique<LiteralNode>(std::move(out))));
+        return Result<ExpressionNode>(true, std::make_unique<LiteralExpressionNode>(MakeTokenNode<LiteralNode>(std::move(out))));
     } else if (Accept(Token::Type::kOpenSquareBr)) {
         auto result = ParseExpression();
         if (!result.status) {
-            throw std::exception();
+            Error("expected expression");
         }
 
         std::vector<std::unique_ptr<ExpressionNode>> expressions;
@@ -842,8 +1305,8 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePrimary() {
         if (Accept(Token::Type::kSemi)) {
             is_semi_mode = true;
             auto second_expression = ParseExpression();
-            if (!result.status) {
-                throw std::exception();
+            if (!second_expression.status) {
+                Error("expected expression");
             }
             expressions.push_back(std::move(second_expression.node));
             Expect(Token::Type::kCloseSquareBr);
@@ -852,7 +1315,7 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParsePrimary() {
                 while (!Accept(Token::Type::kCloseSquareBr)) {
                     result = ParseExpression();
                     if (!result.status) {
-                        throw std::exception();
+                        Error("expected expression");
                     }
 
                     expressions.push_back(std::move(result.node));
@@ -909,27 +1372,37 @@ SyntaxParser::Result<ExpressionNode> SyntaxParser::ParseExpressionWithBlock() {
 
 // `{` already process
 std::unique_ptr<BlockNode> SyntaxParser::ParseBlockExpression() {
+    const Token open = previous_token_;
+    // recovery resets it, a block inside a condition keeps it
+    const bool old_except_struct_expression = except_struct_expression_;
+
     std::vector<std::unique_ptr<SyntaxNode>> statements;
     std::unique_ptr<ExpressionNode> return_expression;
 
-    Result<SyntaxNode> statement_result = ParseStatement();
-    if (statement_result.status) {
-        while (statement_result.status) {
-            statements.push_back(std::move(statement_result.node));
-            statement_result = ParseStatement();
-        }
+    while (true) {
+        try {
+            Result<SyntaxNode> statement_result = ParseStatement();
+            if (statement_result.status) {
+                statements.push_back(std::move(statement_result.node));
+                continue;
+            }
 
-        Result<ExpressionNode> return_expression_result = ParseExpressionWithoutBlock();
-        if (return_expression_result.status) {
-            return_expression = std::move(return_expression_result.node);
+            return_expression = ParseExpressionWithoutBlock().node;
+            Expect(Token::Type::kCloseCurlyBr);
+            break;
+        } catch (SyntaxError &error) {
+            return_expression.reset();
+            Recover(error, false);
+            except_struct_expression_ = old_except_struct_expression;
         }
-    } else {
-        return_expression = ParseExpressionWithoutBlock().node;
     }
 
-    Expect(Token::Type::kCloseCurlyBr);
-
-    return std::make_unique<BlockNode>(std::move(statements), std::move(return_expression));
+    auto block_node = std::make_unique<BlockNode>(std::move(statements), std::move(return_expression));
+    // blocks inside conditions see except_struct_expression_, they cannot be parsed on their own
+    if (tokens_ != nullptr && !old_except_struct_expression) {
+        source_map_.blocks.push_back(SourceMap::BlockRef{block_node.get(), MakeSpan(open, previous_token_)});
+    }
+    return block_node;
 }
 
 // `loop` already process
@@ -944,8 +1417,12 @@ std::unique_ptr<InfiniteLoopNode> SyntaxParser::ParseInfiniteLoopExpression() {
 std::unique_ptr<PredicateLoopNode> SyntaxParser::ParsePredicateLoopExpression() {
     bool old_except_struct_expression = except_struct_expression_;
     except_struct_expression_ = true;
-    std::unique_ptr<ExpressionNode> expr_node = ParseExpression().node;
+    auto expr_result = ParseExpression();
     except_struct_expression_ = old_except_struct_expression;
+    if (!expr_result.status) {
+        Error("expected expression");
+    }
+    std::unique_ptr<ExpressionNode> expr_node = std::move(expr_result.node);
 
     Expect(Token::Type::kOpenCurlyBr);
     std::unique_ptr<BlockNode> block_node = ParseBlockExpression();
@@ -960,8 +1437,12 @@ std::unique_ptr<IteratorLoopNode> SyntaxParser::ParseIteratorLoopExpression() {
 
     bool old_except_struct_expression = except_struct_expression_;
     except_struct_expression_ = true;
-    std::unique_ptr<ExpressionNode> expr_node = ParseExpression().node;
+    auto expr_result = ParseExpression();
     except_struct_expression_ = old_except_struct_expression;
+    if (!expr_result.status) {
+        Error("expected expression");
+    }
+    std::unique_ptr<ExpressionNode> expr_node = std::move(expr_result.node);
 
     Expect(Token::Type::kOpenCurlyBr);
     std::unique_ptr<BlockNode> block_node = ParseBlockExpression();
@@ -973,8 +1454,12 @@ std::unique_ptr<IteratorLoopNode> SyntaxParser::ParseIteratorLoopExpression() {
 std::unique_ptr<IfNode> SyntaxParser::ParseIfExpression() {
     bool old_except_struct_expression = except_struct_expression_;
     except_struct_expression_ = true;
-    std::unique_ptr<ExpressionNode> expression = ParseExpression().node;
+    auto expression_result = ParseExpression();
     except_struct_expression_ = old_except_struct_expression;
+    if (!expression_result.status) {
+        Error("expected expression");
+    }
+    std::unique_ptr<ExpressionNode> expression = std::move(expression_result.node);
 
     Expect(Token::Type::kOpenCurlyBr);
     std::unique_ptr<BlockNode> if_block_node = ParseBlockExpression();
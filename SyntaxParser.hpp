@@ -2,6 +2,7 @@
 
 #include <array>
 #include <memory>
+#include <optional>
 #include <queue>
 #include <unordered_set>
 
@@ -19,13 +20,35 @@
 #include "PredicateLoopNode.hpp"
 #include "PrefixUnaryOperationNode.hpp"
 #include "StructNode.hpp"
-#include "SymbolTable.hpp"
 #include "Tokenizer.hpp"
 #include "TypeNodes.hpp"
 
+// Where the nodes of a tree are in the token buffer it was parsed from, SyntaxParser::Reparse keeps the subtrees an edit does not touch with it.
+// The pointers are the ones the parser created the nodes with, so the tree stays const for everybody else.
+struct SourceMap {
+    struct TokenRef {
+        Token *token;
+        size_t idx;
+    };
+
+    struct BlockRef {
+        BlockNode *node;
+        TokenSpan span;
+    };
+
+    // of the items in the order of SyntaxTree::GetNodes()
+    std::vector<TokenSpan> items;
+    // blocks that can be parsed on their own, so all but the ones inside conditions
+    std::vector<BlockRef> blocks;
+    // tokens kept by the nodes
+    std::vector<TokenRef> tokens;
+};
+
 class SyntaxTree final : public SyntaxNode {
 public:
-    explicit SyntaxTree(std::vector<std::unique_ptr<SyntaxNode>> &&nodes) : nodes_(std::move(nodes)) {}
+    explicit SyntaxTree(std::vector<std::unique_ptr<SyntaxNode>> &&nodes) : nodes_(std::move(nodes)) {
+        NumberNodes();
+    }
 
     void Visit(ISyntaxTreeVisitor *visitor) const override {
         visitor->PostVisit(this);
@@ -40,10 +63,28 @@ public:
         return nodes;
     }
 
-    std::unique_ptr<semantic::SymbolTable> symbol_table;
+    // ids of all nodes are below this value
+    size_t GetNodeCount() const {
+        return node_count_;
+    }
+
+    // has to be called again after a subtree was changed in place, as SyntaxParser::Reparse does
+    void NumberNodes();
+
+    // number of nodes in the subtree of node, node included; they have the ids [node->GetId(), node->GetId() + count)
+    static size_t CountNodes(const SyntaxNode *node);
+    // the subtree of node in preorder, so in the order of the ids
+    static std::vector<const SyntaxNode *> CollectNodes(const SyntaxNode *node);
+    // of the first token of the subtree of node in the source, none when it keeps no token
+    static std::optional<Token::Position> GetPosition(const SyntaxNode *node);
 
 private:
+    friend class SyntaxParser;
+
     std::vector<std::unique_ptr<SyntaxNode>> nodes_;
+    size_t node_count_ = 0;
+    // empty unless the tree was parsed from a token buffer without syntax errors
+    SourceMap source_map_;
 };
 
 class BreakNode final : public ExpressionNode {
@@ -108,8 +149,6 @@ public:
         return arguments;
     }
 
-    std::variant<const semantic::FuncSymbol *, const semantic::TupleStructType *> type;
-
 private:
     std::unique_ptr<ExpressionNode> identifier_;
     std::vector<std::unique_ptr<ExpressionNode>> arguments_;
@@ -285,9 +324,6 @@ public:
         return dot_dot_expression_.get();
     }
 
-    std::unordered_set<std::string> struct_identifiers;
-    std::unordered_set<uint64_t> tuple_identifiers;
-
 private:
     std::unique_ptr<ExpressionNode> identifier_;
     std::vector<std::unique_ptr<FieldInitStructExpressionNode>> fields_;
@@ -337,17 +373,50 @@ public:
         return expression_.get();
     }
 
-    const semantic::LetSymbol *let_symbol = nullptr;
-
 private:
+    // SyntaxParser::Reparse moves the token to its new position when an edit shifts it
+    friend class SyntaxParser;
+
     Token operation_;
     std::unique_ptr<ExpressionNode> identifier_;
     std::unique_ptr<ExpressionNode> expression_;
 };
 
+struct SyntaxDiagnostic {
+    Token::Position position;
+    std::string message;
+
+    std::string ToString() const {
+        std::ostringstream oss;
+        oss << position.start_line << ':' << position.start_column << ": error: " << message;
+        return oss.str();
+    }
+};
+
+class SyntaxError : public std::exception {
+public:
+    explicit SyntaxError(SyntaxDiagnostic diagnostic) : diagnostic_(std::move(diagnostic)) {}
+
+    const char *what() const noexcept override {
+        return diagnostic_.message.c_str();
+    }
+
+    const SyntaxDiagnostic &GetDiagnostic() const {
+        return diagnostic_;
+    }
+
+    // set once the error is in the diagnostics list and only unwinds to an outer recovery point
+    bool is_reported = false;
+
+private:
+    SyntaxDiagnostic diagnostic_;
+};
+
 class SyntaxParser {
 public:
     explicit SyntaxParser(Tokenizer *tokenizer);
+    // parses tokens[begin, end) of an already tokenized source
+    SyntaxParser(const std::vector<Token> *tokens, size_t begin, size_t end);
 
     template <typename T>
     struct Result {
@@ -357,15 +426,71 @@ public:
         Result(bool status, std::unique_ptr<T> &&node) : status(status), node(std::move(node)) {}
     };
 
+    // syntax errors do not stop parsing: they are collected into GetDiagnostics() and the parser
+    // resynchronizes at `;`, `}` and item keywords, the tree contains everything that could be recovered
     std::unique_ptr<SyntaxTree> ParseItems();
 
+    // a single expression, null when there is none or it has a syntax error, which then is in GetDiagnostics()
+    std::unique_ptr<ExpressionNode> ParseExpr();
+
+    const std::vector<SyntaxDiagnostic> &GetDiagnostics() const {
+        return diagnostics_;
+    }
+
+    // all tokens up to (not including) end-of-file
+    static std::vector<Token> Tokenize(Tokenizer *tokenizer);
+
+    // [begin, end) token ranges of top-level items, empty if the buffer cannot be split by bracket matching
+    static std::vector<std::pair<size_t, size_t>> FindItemBoundaries(const std::vector<Token> &tokens);
+
+    // parses the items on a thread pool, the result is identical to the sequential ParseItems
+    static std::unique_ptr<SyntaxTree> ParseItemsParallel(const std::vector<Token> &tokens, size_t thread_count, std::vector<SyntaxDiagnostic> *diagnostics);
+
+    // tokens [begin, old_end) of the previous buffer were replaced by tokens [begin, new_end) of the new one
+    struct TokenEdit {
+        size_t begin;
+        size_t old_end;
+        size_t new_end;
+    };
+
+    struct ReparseResult {
+        std::vector<size_t> replaced_items;  // indexes in SyntaxTree::GetNodes()
+        bool is_in_place;                    // the item kept its node, only a block inside it was parsed again
+        bool is_full;
+    };
+
+    // Parses only the smallest item or block that contains the edit together with its first and last token and keeps every other subtree,
+    // their tokens get the positions of the new buffer. The whole buffer is parsed again when there is no such node, when the node does not
+    // parse on its own without errors or when the tree has no SourceMap.
+    static ReparseResult Reparse(std::unique_ptr<SyntaxTree> *tree, const std::vector<Token> &tokens, const TokenEdit &edit, std::vector<SyntaxDiagnostic> *diagnostics);
+
 private:
     Token NextToken();
     Token GetToken();
+    bool HasNextToken() const;
+    Token NextBufferedToken();
+    Token NextTokenizerToken();
+    Token MakeEndOfFile() const;
+    size_t FindToken(const Token &token) const;
+    TokenSpan MakeSpan(const Token &first, const Token &last) const;
+
+    // the node keeps the token it is created with, tokens_ tells where it is
+    template <typename T, typename... Args>
+    std::unique_ptr<T> MakeTokenNode(Args &&...args) {
+        auto node = std::make_unique<T>(std::forward<Args>(args)...);
+        TrackToken(&node->token_);
+        return node;
+    }
+    void TrackToken(Token *token);
 
     bool Accept(Token::Type type, Token *out = nullptr);
     void Expect(Token::Type type, Token *out = nullptr);
 
+    [[noreturn]] void Error(const std::string &message) const;
+    void Recover(SyntaxError &error, bool is_item_level);
+    std::vector<SyntaxDiagnostic> diagnostics_;
+    std::streamoff last_recover_offset_ = -1;
+
     template <typename IterType>
     bool Accept(IterType begin, IterType end, Token *out = nullptr) {
         for (; begin != end; begin++) {
@@ -383,8 +508,16 @@ private:
     std::queue<Token> transaction_buff_;
     std::queue<Token> post_transaction_buff_;
 
-    Tokenizer *tokenizer_;
+    Tokenizer *tokenizer_ = nullptr;
+    const std::vector<Token> *tokens_ = nullptr;
+    size_t tokens_idx_ = 0;
+    size_t tokens_end_ = 0;
+    // of the last token taken from tokenizer_, the end of file is placed right after it
+    std::optional<Token::Position> last_position_;
     Token current_token_;
+    Token previous_token_;
+    // filled when parsing from tokens_, handed to the tree when there were no syntax errors
+    SourceMap source_map_;
 
     [[nodiscard]] Result<SyntaxNode> ParseStatement();
 
@@ -0,0 +1,976 @@
+#include "SyntaxTreeSerializer.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+    enum class NodeTag : uint8_t
+    {
+        kNull,
+        kIdentifier,
+        kLiteral,
+        kParamFunction,
+        kParamStruct,
+        kLet,
+        kFunction,
+        kStruct,
+        kConstantItem,
+        kParenthesizedType,
+        kTupleType,
+        kReferenceType,
+        kArrayType,
+        kIdentifierType,
+        kTupleIndexField,
+        kIdentifierField,
+        kRefMutIdentifierField,
+        kLiteralPattern,
+        kIdentifierPattern,
+        kWildcardPattern,
+        kRestPattern,
+        kReferencePattern,
+        kStructPattern,
+        kTupleStructPattern,
+        kTuplePattern,
+        kGroupedPattern,
+        kIdentifierExpression,
+        kLiteralExpression,
+        kBinaryOperation,
+        kPrefixUnaryOperation,
+        kInfiniteLoop,
+        kPredicateLoop,
+        kIteratorLoop,
+        kIf,
+        kBlock,
+        kBreak,
+        kContinue,
+        kReturn,
+        kCallOrInitTuple,
+        kIndex,
+        kMemberAccess,
+        kArrayExpression,
+        kInitStructExpression,
+        kShorthandFieldInitStructExpression,
+        kTupleIndexFieldInitStructExpression,
+        kIdentifierFieldInitStructExpression,
+        kTupleExpression,
+        kSyntaxTree,
+        kAssignment
+    };
+
+    void WriteFixed(std::vector<uint8_t> *out, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            out->push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    uint64_t ReadFixed(const uint8_t *data, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; i++) {
+            value |= static_cast<uint64_t>(data[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // FNV-1a
+    uint64_t HashBytes(uint64_t hash, const uint8_t *data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    constexpr uint64_t kHashSeed = 14695981039346656037ULL;
+
+    class Writer final : public ISyntaxTreeVisitor {
+    public:
+        explicit Writer(bool with_positions = true) : with_positions_(with_positions) {}
+
+        void Write(const SyntaxNode *node) {
+            if (node == nullptr) {
+                WriteTag(NodeTag::kNull);
+                return;
+            }
+
+            node->Visit(this);
+        }
+
+        std::vector<uint8_t> GetResult(uint64_t source_hash) const {
+            std::vector<uint8_t> result;
+            WriteFixed(&result, SyntaxTreeSerializer::kMagic, 4);
+            WriteFixed(&result, SyntaxTreeSerializer::kVersion, 4);
+            WriteFixed(&result, source_hash, 8);
+
+            std::vector<uint8_t> table;
+            WriteUnsigned(&table, strings_.size());
+            for (const auto &str : strings_) {
+                WriteUnsigned(&table, str.size());
+                table.insert(table.end(), str.begin(), str.end());
+            }
+
+            result.insert(result.end(), table.begin(), table.end());
+            result.insert(result.end(), body_.begin(), body_.end());
+            return result;
+        }
+
+    protected:
+        void PostVisit(const IdentifierNode *node) override {
+            WriteTag(NodeTag::kIdentifier);
+            WriteToken(*node->GetToken());
+        }
+
+        void PostVisit(const LiteralNode *node) override {
+            WriteTag(NodeTag::kLiteral);
+            WriteToken(*node->GetToken());
+        }
+
+        void PostVisit(const ParamFunctionNode *node) override {
+            WriteTag(NodeTag::kParamFunction);
+            Write(node->GetPattern());
+            Write(node->GetType());
+        }
+
+        void PostVisit(const ParamStructNode *node) override {
+            WriteTag(NodeTag::kParamStruct);
+            Write(node->GetIdentifier());
+            Write(node->GetType());
+        }
+
+        void PostVisit(const LetNode *node) override {
+            WriteTag(NodeTag::kLet);
+            Write(node->GetPattern());
+            Write(node->GetType());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const FunctionNode *node) override {
+            WriteTag(NodeTag::kFunction);
+            WriteBool(node->IsConst());
+            Write(node->GetIdentifier());
+            WriteList(node->GetParams());
+            Write(node->GetReturnType());
+            Write(node->GetBlock());
+        }
+
+        void PostVisit(const StructNode *node) override {
+            WriteTag(NodeTag::kStruct);
+            Write(node->GetIdentifier());
+            WriteList(node->GetParams());
+        }
+
+        void PostVisit(const ConstantItemNode *node) override {
+            WriteTag(NodeTag::kConstantItem);
+            Write(node->GetIdentifier());
+            Write(node->GetType());
+            Write(node->GetExpr());
+        }
+
+        void PostVisit(const ParenthesizedTypeNode *node) override {
+            WriteTag(NodeTag::kParenthesizedType);
+            Write(node->GetType());
+        }
+
+        void PostVisit(const TupleTypeNode *node) override {
+            WriteTag(NodeTag::kTupleType);
+            WriteList(node->GetTypes());
+        }
+
+        void PostVisit(const ReferenceTypeNode *node) override {
+            WriteTag(NodeTag::kReferenceType);
+            WriteBool(node->IsMut());
+            Write(node->GetType());
+        }
+
+        void PostVisit(const ArrayTypeNode *node) override {
+            WriteTag(NodeTag::kArrayType);
+            Write(node->GetType());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const IdentifierTypeNode *node) override {
+            WriteTag(NodeTag::kIdentifierType);
+            Write(node->GetIdentifier());
+        }
+
+        void PostVisit(const TupleIndexFieldNode *node) override {
+            WriteTag(NodeTag::kTupleIndexField);
+            Write(node->GetLiteral());
+            Write(node->GetPattern());
+        }
+
+        void PostVisit(const IdentifierFieldNode *node) override {
+            WriteTag(NodeTag::kIdentifierField);
+            Write(node->GetIdentifier());
+            Write(node->GetPattern());
+        }
+
+        void PostVisit(const RefMutIdentifierFieldNode *node) override {
+            WriteTag(NodeTag::kRefMutIdentifierField);
+            WriteBool(node->IsRef());
+            WriteBool(node->IsMut());
+            Write(node->GetIdentifier());
+        }
+
+        void PostVisit(const LiteralPatternNode *node) override {
+            WriteTag(NodeTag::kLiteralPattern);
+            Write(node->GetLiteral());
+        }
+
+        void PostVisit(const IdentifierPatternNode *node) override {
+            WriteTag(NodeTag::kIdentifierPattern);
+            WriteBool(node->IsRef());
+            WriteBool(node->IsMut());
+            Write(node->GetIdentifier());
+            Write(node->GetPattern());
+        }
+
+        void PostVisit(const WildcardPatternNode *) override {
+            WriteTag(NodeTag::kWildcardPattern);
+        }
+
+        void PostVisit(const RestPatternNode *) override {
+            WriteTag(NodeTag::kRestPattern);
+        }
+
+        void PostVisit(const ReferencePatternNode *node) override {
+            WriteTag(NodeTag::kReferencePattern);
+            WriteBool(node->IsSingleRef());
+            WriteBool(node->IsMut());
+            Write(node->GetPattern());
+        }
+
+        void PostVisit(const StructPatternNode *node) override {
+            WriteTag(NodeTag::kStructPattern);
+            WriteBool(node->IsEtc());
+            Write(node->GetIdentifier());
+            WriteList(node->GetFields());
+        }
+
+        void PostVisit(const TupleStructPatternNode *node) override {
+            WriteTag(NodeTag::kTupleStructPattern);
+            Write(node->GetIdentifier());
+            WriteList(node->GetPatterns());
+        }
+
+        void PostVisit(const TuplePatternNode *node) override {
+            WriteTag(NodeTag::kTuplePattern);
+            WriteList(node->GetPatterns());
+        }
+
+        void PostVisit(const GroupedPatternNode *node) override {
+            WriteTag(NodeTag::kGroupedPattern);
+            Write(node->GetPattern());
+        }
+
+        void PostVisit(const IdentifierExpressionNode *node) override {
+            WriteTag(NodeTag::kIdentifierExpression);
+            Write(node->GetIdentifier());
+        }
+
+        void PostVisit(const LiteralExpressionNode *node) override {
+            WriteTag(NodeTag::kLiteralExpression);
+            Write(node->GetLiteral());
+        }
+
+        void PostVisit(const BinaryOperationNode *node) override {
+            WriteTag(NodeTag::kBinaryOperation);
+            WriteToken(*node->GetToken());
+            Write(node->GetLeft());
+            Write(node->GetRight());
+        }
+
+        void PostVisit(const PrefixUnaryOperationNode *node) override {
+            WriteTag(NodeTag::kPrefixUnaryOperation);
+            WriteBool(node->IsException());
+            if (node->IsException()) {
+                WriteUnsigned(&body_, static_cast<uint64_t>(node->GetException()));
+            } else {
+                WriteToken(*node->GetToken());
+            }
+            Write(node->GetRight());
+        }
+
+        void PostVisit(const InfiniteLoopNode *node) override {
+            WriteTag(NodeTag::kInfiniteLoop);
+            Write(node->GetBlock());
+        }
+
+        void PostVisit(const PredicateLoopNode *node) override {
+            WriteTag(NodeTag::kPredicateLoop);
+            Write(node->GetExpression());
+            Write(node->GetBlock());
+        }
+
+        void PostVisit(const IteratorLoopNode *node) override {
+            WriteTag(NodeTag::kIteratorLoop);
+            Write(node->GetPattern());
+            Write(node->GetExpression());
+            Write(node->GetBlock());
+        }
+
+        void PostVisit(const IfNode *node) override {
+            WriteTag(NodeTag::kIf);
+            Write(node->GetExpression());
+            Write(node->GetIfBlock());
+            Write(node->GetElseBlock());
+            Write(node->GetElseIf());
+        }
+
+        void PostVisit(const BlockNode *node) override {
+            WriteTag(NodeTag::kBlock);
+            WriteList(node->GetStatements());
+            Write(node->GetReturnExpression());
+        }
+
+        void PostVisit(const BreakNode *node) override {
+            WriteTag(NodeTag::kBreak);
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const ContinueNode *) override {
+            WriteTag(NodeTag::kContinue);
+        }
+
+        void PostVisit(const ReturnNode *node) override {
+            WriteTag(NodeTag::kReturn);
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const CallOrInitTupleNode *node) override {
+            WriteTag(NodeTag::kCallOrInitTuple);
+            Write(node->GetIdentifier());
+            WriteList(node->GetArguments());
+        }
+
+        void PostVisit(const IndexNode *node) override {
+            WriteTag(NodeTag::kIndex);
+            Write(node->GetIdentifier());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const MemberAccessNode *node) override {
+            WriteTag(NodeTag::kMemberAccess);
+            Write(node->GetIdentifier());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const ArrayExpressionNode *node) override {
+            WriteTag(NodeTag::kArrayExpression);
+            WriteBool(node->IsSemiMode());
+            WriteList(node->GetExpressions());
+        }
+
+        void PostVisit(const InitStructExpressionNode *node) override {
+            WriteTag(NodeTag::kInitStructExpression);
+            Write(node->GetIdentifier());
+            WriteList(node->GetFields());
+            Write(node->GetDotDotExpression());
+        }
+
+        void PostVisit(const ShorthandFieldInitStructExpressionNode *node) override {
+            WriteTag(NodeTag::kShorthandFieldInitStructExpression);
+            Write(node->GetIdentifier());
+        }
+
+        void PostVisit(const TupleIndexFieldInitStructExpressionNode *node) override {
+            WriteTag(NodeTag::kTupleIndexFieldInitStructExpression);
+            Write(node->GetLiteral());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const IdentifierFieldInitStructExpressionNode *node) override {
+            WriteTag(NodeTag::kIdentifierFieldInitStructExpression);
+            Write(node->GetIdentifier());
+            Write(node->GetExpression());
+        }
+
+        void PostVisit(const TupleExpressionNode *node) override {
+            WriteTag(NodeTag::kTupleExpression);
+            WriteList(node->GetExpressions());
+        }
+
+        void PostVisit(const SyntaxTree *node) override {
+            WriteTag(NodeTag::kSyntaxTree);
+            WriteList(node->GetNodes());
+        }
+
+        void PostVisit(const AssignmentNode *node) override {
+            WriteTag(NodeTag::kAssignment);
+            WriteToken(node->GetOperation());
+            Write(node->GetIdentifier());
+            Write(node->GetExpression());
+        }
+
+    private:
+        const bool with_positions_;
+        std::vector<uint8_t> body_;
+        std::vector<std::string> strings_;
+        std::unordered_map<std::string, uint64_t> string_ids_;
+
+        static void WriteUnsigned(std::vector<uint8_t> *out, uint64_t value) {
+            do {
+                uint8_t byte = value & 0x7F;
+                value >>= 7;
+                if (value != 0) {
+                    byte |= 0x80;
+                }
+                out->push_back(byte);
+            } while (value != 0);
+        }
+
+        void WriteSigned(int64_t value) {
+            // zigzag keeps small negative numbers short
+            WriteUnsigned(&body_, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+        }
+
+        void WriteTag(NodeTag tag) {
+            body_.push_back(static_cast<uint8_t>(tag));
+        }
+
+        void WriteBool(bool value) {
+            body_.push_back(value ? 1 : 0);
+        }
+
+        void WriteString(const std::string &value) {
+            auto it = string_ids_.find(value);
+            if (it == string_ids_.end()) {
+                it = string_ids_.emplace(value, strings_.size()).first;
+                strings_.push_back(value);
+            }
+            WriteUnsigned(&body_, it->second);
+        }
+
+        template <typename T>
+        void WriteList(const std::vector<const T *> &nodes) {
+            WriteUnsigned(&body_, nodes.size());
+            for (const T *node : nodes) {
+                Write(node);
+            }
+        }
+
+        void WriteToken(const Token &token) {
+            const auto position = token.GetPosition();
+            WriteUnsigned(&body_, static_cast<uint64_t>(token.GetType()));
+            if (with_positions_) {
+                WriteUnsigned(&body_, position.start_line);
+                WriteUnsigned(&body_, position.start_column);
+                WriteUnsigned(&body_, position.end_line);
+                WriteUnsigned(&body_, position.end_column);
+                WriteSigned(static_cast<std::streamoff>(position.start_offset));
+                WriteSigned(static_cast<std::streamoff>(position.end_offset));
+            }
+
+            const auto value = token.GetTokenValue();
+            body_.push_back(static_cast<uint8_t>(value.GetType()));
+            switch (value.GetType()) {
+            case TokenValue::Type::kBool:
+                WriteBool(static_cast<bool>(value));
+                break;
+            case TokenValue::Type::kChar:
+                body_.push_back(static_cast<uint8_t>(static_cast<char>(value)));
+                break;
+            case TokenValue::Type::kU8:
+                WriteUnsigned(&body_, static_cast<uint8_t>(value));
+                break;
+            case TokenValue::Type::kU16:
+                WriteUnsigned(&body_, static_cast<uint16_t>(value));
+                break;
+            case TokenValue::Type::kU32:
+                WriteUnsigned(&body_, static_cast<uint32_t>(value));
+                break;
+            case TokenValue::Type::kU64:
+                WriteUnsigned(&body_, static_cast<uint64_t>(value));
+                break;
+            case TokenValue::Type::kI8:
+                WriteSigned(static_cast<int8_t>(value));
+                break;
+            case TokenValue::Type::kI16:
+                WriteSigned(static_cast<int16_t>(value));
+                break;
+            case TokenValue::Type::kI32:
+                WriteSigned(static_cast<int32_t>(value));
+                break;
+            case TokenValue::Type::kI64:
+                WriteSigned(static_cast<int64_t>(value));
+                break;
+            case TokenValue::Type::kF32: {
+                const float f32 = static_cast<float>(value);
+                uint32_t bits;
+                std::memcpy(&bits, &f32, sizeof(bits));
+                WriteFixed(&body_, bits, sizeof(bits));
+                break;
+            }
+            case TokenValue::Type::kF64: {
+                const double f64 = static_cast<double>(value);
+                uint64_t bits;
+                std::memcpy(&bits, &f64, sizeof(bits));
+                WriteFixed(&body_, bits, sizeof(bits));
+                break;
+            }
+            case TokenValue::Type::kText:
+                WriteString(value.ValueToString());
+                break;
+            case TokenValue::Type::kByteString: {
+                const std::vector<uint8_t> bytes = value;
+                WriteUnsigned(&body_, bytes.size());
+                body_.insert(body_.end(), bytes.begin(), bytes.end());
+                break;
+            }
+            case TokenValue::Type::kEmpty:
+                break;
+            default:
+                throw std::exception();  // todo
+            }
+        }
+    };
+
+    class Reader final {
+    public:
+        Reader(const uint8_t *begin, const uint8_t *end) : current_(begin), end_(end) {}
+
+        void ReadStringTable() {
+            const auto count = ReadUnsigned();
+            strings_.reserve(count);
+            for (uint64_t i = 0; i < count; i++) {
+                const auto size = ReadUnsigned();
+                if (static_cast<uint64_t>(end_ - current_) < size) {
+                    throw std::exception();  // todo
+                }
+                strings_.emplace_back(reinterpret_cast<const char *>(current_), size);
+                current_ += size;
+            }
+        }
+
+        std::unique_ptr<SyntaxTree> ReadTree() {
+            auto tree = Read<SyntaxTree>();
+            if (tree == nullptr || current_ != end_) {
+                throw std::exception();  // todo
+            }
+            return tree;
+        }
+
+    private:
+        const uint8_t *current_;
+        const uint8_t *end_;
+        std::vector<std::string> strings_;
+
+        uint8_t ReadByte() {
+            if (current_ == end_) {
+                throw std::exception();  // todo
+            }
+            return *current_++;
+        }
+
+        uint64_t ReadUnsigned() {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                const uint8_t byte = ReadByte();
+                value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            throw std::exception();  // todo
+        }
+
+        int64_t ReadSigned() {
+            const uint64_t value = ReadUnsigned();
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        bool ReadBool() {
+            return ReadByte() != 0;
+        }
+
+        const std::string &ReadString() {
+            return strings_.at(ReadUnsigned());
+        }
+
+        template <typename T>
+        T ReadFixed() {
+            if (static_cast<size_t>(end_ - current_) < sizeof(T)) {
+                throw std::exception();  // todo
+            }
+            const uint64_t bits = ::ReadFixed(current_, sizeof(T));
+            current_ += sizeof(T);
+
+            T value;
+            if constexpr (sizeof(T) == sizeof(uint32_t)) {
+                const auto bits32 = static_cast<uint32_t>(bits);
+                std::memcpy(&value, &bits32, sizeof(T));
+            } else {
+                std::memcpy(&value, &bits, sizeof(T));
+            }
+            return value;
+        }
+
+        TokenValue ReadTokenValue() {
+            const auto type = static_cast<TokenValue::Type>(ReadByte());
+            switch (type) {
+            case TokenValue::Type::kBool:
+                return TokenValue(ReadBool());
+            case TokenValue::Type::kChar:
+                return TokenValue(static_cast<char>(ReadByte()));
+            case TokenValue::Type::kU8:
+                return TokenValue(static_cast<uint8_t>(ReadUnsigned()));
+            case TokenValue::Type::kU16:
+                return TokenValue(static_cast<uint16_t>(ReadUnsigned()));
+            case TokenValue::Type::kU32:
+                return TokenValue(static_cast<uint32_t>(ReadUnsigned()));
+            case TokenValue::Type::kU64:
+                return TokenValue(static_cast<uint64_t>(ReadUnsigned()));
+            case TokenValue::Type::kI8:
+                return TokenValue(static_cast<int8_t>(ReadSigned()));
+            case TokenValue::Type::kI16:
+                return TokenValue(static_cast<int16_t>(ReadSigned()));
+            case TokenValue::Type::kI32:
+                return TokenValue(static_cast<int32_t>(ReadSigned()));
+            case TokenValue::Type::kI64:
+                return TokenValue(static_cast<int64_t>(ReadSigned()));
+            case TokenValue::Type::kF32:
+                return TokenValue(ReadFixed<float>());
+            case TokenValue::Type::kF64:
+                return TokenValue(ReadFixed<double>());
+            case TokenValue::Type::kText:
+                return TokenValue(ReadString());
+            case TokenValue::Type::kByteString: {
+                const auto size = ReadUnsigned();
+                if (static_cast<uint64_t>(end_ - current_) < size) {
+                    throw std::exception();  // todo
+                }
+                std::vector<uint8_t> bytes(current_, current_ + size);
+                current_ += size;
+                return TokenValue(bytes);
+            }
+            case TokenValue::Type::kEmpty:
+                return TokenValue();
+            default:
+                throw std::exception();  // todo
+            }
+        }
+
+        Token ReadToken() {
+            const auto type = static_cast<Token::Type>(ReadUnsigned());
+            const auto start_line = static_cast<uint32_t>(ReadUnsigned());
+            const auto start_column = static_cast<uint32_t>(ReadUnsigned());
+            const auto end_line = static_cast<uint32_t>(ReadUnsigned());
+            const auto end_column = static_cast<uint32_t>(ReadUnsigned());
+            const std::streampos start_offset(static_cast<std::streamoff>(ReadSigned()));
+            const std::streampos end_offset(static_cast<std::streamoff>(ReadSigned()));
+            Token::Position position(start_line, start_column, start_offset, end_line, end_column, end_offset);
+
+            return Token(ReadTokenValue(), type, position);
+        }
+
+        template <typename T>
+        std::unique_ptr<T> Read() {
+            auto node = ReadNode();
+            if (node == nullptr) {
+                return nullptr;
+            }
+
+            auto result = dynamic_cast<T *>(node.get());
+            if (result == nullptr) {
+                throw std::exception();  // todo
+            }
+            node.release();
+            return std::unique_ptr<T>(result);
+        }
+
+        template <typename T>
+        std::vector<std::unique_ptr<T>> ReadList() {
+            std::vector<std::unique_ptr<T>> nodes;
+            const auto count = ReadUnsigned();
+            for (uint64_t i = 0; i < count; i++) {
+                nodes.push_back(Read<T>());
+            }
+            return nodes;
+        }
+
+        // params are stored by value inside their owners
+        template <typename T>
+        std::vector<T> ReadParams() {
+            std::vector<T> params;
+            const auto count = ReadUnsigned();
+            params.reserve(count);
+            for (uint64_t i = 0; i < count; i++) {
+                auto param = Read<T>();
+                if (param == nullptr) {
+                    throw std::exception();  // todo
+                }
+                params.push_back(std::move(*param));
+            }
+            return params;
+        }
+
+        std::unique_ptr<SyntaxNode> ReadNode() {
+            const auto tag = static_cast<NodeTag>(ReadByte());
+            switch (tag) {
+            case NodeTag::kNull:
+                return nullptr;
+            case NodeTag::kIdentifier:
+                return std::make_unique<IdentifierNode>(ReadToken());
+            case NodeTag::kLiteral:
+                return std::make_unique<LiteralNode>(ReadToken());
+            case NodeTag::kParamFunction: {
+                auto pattern = Read<PatternNode>();
+                auto type = Read<TypeNode>();
+                return std::make_unique<ParamFunctionNode>(std::move(pattern), std::move(type));
+            }
+            case NodeTag::kParamStruct: {
+                auto identifier = Read<IdentifierNode>();
+                auto type = Read<TypeNode>();
+                return std::make_unique<ParamStructNode>(std::move(identifier), std::move(type));
+            }
+            case NodeTag::kLet: {
+                auto pattern = Read<PatternNode>();
+                auto type = Read<TypeNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<LetNode>(std::move(pattern), std::move(type), std::move(expression));
+            }
+            case NodeTag::kFunction: {
+                const bool is_const = ReadBool();
+                auto identifier = Read<IdentifierNode>();
+                auto params = ReadParams<ParamFunctionNode>();
+                auto return_type = Read<TypeNode>();
+                auto block = Read<BlockNode>();
+                return std::make_unique<FunctionNode>(std::move(identifier), std::move(params), std::move(return_type), std::move(block), is_const);
+            }
+            case NodeTag::kStruct: {
+                auto identifier = Read<IdentifierNode>();
+                auto params = ReadParams<ParamStructNode>();
+                return std::make_unique<StructNode>(std::move(identifier), std::move(params));
+            }
+            case NodeTag::kConstantItem: {
+                auto identifier = Read<IdentifierNode>();
+                auto type = Read<TypeNode>();
+                auto expr = Read<ExpressionNode>();
+                return std::make_unique<ConstantItemNode>(std::move(identifier), std::move(type), std::move(expr));
+            }
+            case NodeTag::kParenthesizedType:
+                return std::make_unique<ParenthesizedTypeNode>(Read<TypeNode>());
+            case NodeTag::kTupleType:
+                return std::make_unique<TupleTypeNode>(ReadList<TypeNode>());
+            case NodeTag::kReferenceType: {
+                const bool is_mut = ReadBool();
+                return std::make_unique<ReferenceTypeNode>(is_mut, Read<TypeNode>());
+            }
+            case NodeTag::kArrayType: {
+                auto type = Read<TypeNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<ArrayTypeNode>(std::move(type), std::move(expression));
+            }
+            case NodeTag::kIdentifierType:
+                return std::make_unique<IdentifierTypeNode>(Read<IdentifierNode>());
+            case NodeTag::kTupleIndexField: {
+                auto literal = Read<LiteralNode>();
+                auto pattern = Read<PatternNode>();
+                return std::make_unique<TupleIndexFieldNode>(std::move(literal), std::move(pattern));
+            }
+            case NodeTag::kIdentifierField: {
+                auto identifier = Read<IdentifierNode>();
+                auto pattern = Read<PatternNode>();
+                return std::make_unique<IdentifierFieldNode>(std::move(identifier), std::move(pattern));
+            }
+            case NodeTag::kRefMutIdentifierField: {
+                const bool is_ref = ReadBool();
+                const bool is_mut = ReadBool();
+                return std::make_unique<RefMutIdentifierFieldNode>(is_ref, is_mut, Read<IdentifierNode>());
+            }
+            case NodeTag::kLiteralPattern:
+                return std::make_unique<LiteralPatternNode>(Read<LiteralNode>());
+            case NodeTag::kIdentifierPattern: {
+                const bool is_ref = ReadBool();
+                const bool is_mut = ReadBool();
+                auto identifier = Read<IdentifierNode>();
+                auto subpattern = Read<PatternNode>();
+                return std::make_unique<IdentifierPatternNode>(is_ref, is_mut, std::move(identifier), std::move(subpattern));
+            }
+            case NodeTag::kWildcardPattern:
+                return std::make_unique<WildcardPatternNode>();
+            case NodeTag::kRestPattern:
+                return std::make_unique<RestPatternNode>();
+            case NodeTag::kReferencePattern: {
+                const bool is_single_ref = ReadBool();
+                const bool is_mut = ReadBool();
+                return std::make_unique<ReferencePatternNode>(is_single_ref, is_mut, Read<PatternNode>());
+            }
+            case NodeTag::kStructPattern: {
+                const bool is_etc = ReadBool();
+                auto identifier = Read<IdentifierNode>();
+                auto fields = ReadList<FieldNode>();
+                return std::make_unique<StructPatternNode>(std::move(identifier), is_etc, std::move(fields));
+            }
+            case NodeTag::kTupleStructPattern: {
+                auto identifier = Read<IdentifierNode>();
+                auto patterns = ReadList<PatternNode>();
+                return std::make_unique<TupleStructPatternNode>(std::move(identifier), std::move(patterns));
+            }
+            case NodeTag::kTuplePattern:
+                return std::make_unique<TuplePatternNode>(ReadList<PatternNode>());
+            case NodeTag::kGroupedPattern:
+                return std::make_unique<GroupedPatternNode>(Read<PatternNode>());
+            case NodeTag::kIdentifierExpression:
+                return std::make_unique<IdentifierExpressionNode>(Read<IdentifierNode>());
+            case NodeTag::kLiteralExpression:
+                return std::make_unique<LiteralExpressionNode>(Read<LiteralNode>());
+            case NodeTag::kBinaryOperation: {
+                auto token = ReadToken();
+                auto left = Read<ExpressionNode>();
+                auto right = Read<ExpressionNode>();
+                return std::make_unique<BinaryOperationNode>(std::move(token), std::move(left), std::move(right));
+            }
+            case NodeTag::kPrefixUnaryOperation: {
+                if (ReadBool()) {
+                    const auto exception = static_cast<PrefixUnaryOperationNode::Exception>(ReadUnsigned());
+                    return std::make_unique<PrefixUnaryOperationNode>(exception, Read<ExpressionNode>());
+                }
+                auto token = ReadToken();
+                return std::make_unique<PrefixUnaryOperationNode>(std::move(token), Read<ExpressionNode>());
+            }
+            case NodeTag::kInfiniteLoop:
+                return std::make_unique<InfiniteLoopNode>(Read<BlockNode>());
+            case NodeTag::kPredicateLoop: {
+                auto expression = Read<ExpressionNode>();
+                auto block = Read<BlockNode>();
+                return std::make_unique<PredicateLoopNode>(std::move(expression), std::move(block));
+            }
+            case NodeTag::kIteratorLoop: {
+                auto pattern = Read<PatternNode>();
+                auto expression = Read<ExpressionNode>();
+                auto block = Read<BlockNode>();
+                return std::make_unique<IteratorLoopNode>(std::move(pattern), std::move(expression), std::move(block));
+            }
+            case NodeTag::kIf: {
+                auto expression = Read<ExpressionNode>();
+                auto if_block = Read<BlockNode>();
+                auto else_block = Read<BlockNode>();
+                auto else_if = Read<IfNode>();
+                return std::make_unique<IfNode>(std::move(expression), std::move(if_block), std::move(else_block), std::move(else_if));
+            }
+            case NodeTag::kBlock: {
+                auto statements = ReadList<SyntaxNode>();
+                auto return_expression = Read<ExpressionNode>();
+                return std::make_unique<BlockNode>(std::move(statements), std::move(return_expression));
+            }
+            case NodeTag::kBreak:
+                return std::make_unique<BreakNode>(Read<ExpressionNode>());
+            case NodeTag::kContinue:
+                return std::make_unique<ContinueNode>();
+            case NodeTag::kReturn:
+                return std::make_unique<ReturnNode>(Read<ExpressionNode>());
+            case NodeTag::kCallOrInitTuple: {
+                auto identifier = Read<ExpressionNode>();
+                auto arguments = ReadList<ExpressionNode>();
+                return std::make_unique<CallOrInitTupleNode>(std::move(identifier), std::move(arguments));
+            }
+            case NodeTag::kIndex: {
+                auto identifier = Read<ExpressionNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<IndexNode>(std::move(identifier), std::move(expression));
+            }
+            case NodeTag::kMemberAccess: {
+                auto identifier = Read<ExpressionNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<MemberAccessNode>(std::move(identifier), std::move(expression));
+            }
+            case NodeTag::kArrayExpression: {
+                const bool is_semi_mode = ReadBool();
+                return std::make_unique<ArrayExpressionNode>(ReadList<ExpressionNode>(), is_semi_mode);
+            }
+            case NodeTag::kInitStructExpression: {
+                auto identifier = Read<ExpressionNode>();
+                auto fields = ReadList<FieldInitStructExpressionNode>();
+                auto dot_dot_expression = Read<ExpressionNode>();
+                return std::make_unique<InitStructExpressionNode>(std::move(identifier), std::move(fields), std::move(dot_dot_expression));
+            }
+            case NodeTag::kShorthandFieldInitStructExpression:
+                return std::make_unique<ShorthandFieldInitStructExpressionNode>(Read<IdentifierNode>());
+            case NodeTag::kTupleIndexFieldInitStructExpression: {
+                auto literal = Read<LiteralNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<TupleIndexFieldInitStructExpressionNode>(std::move(literal), std::move(expression));
+            }
+            case NodeTag::kIdentifierFieldInitStructExpression: {
+                auto identifier = Read<IdentifierNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<IdentifierFieldInitStructExpressionNode>(std::move(identifier), std::move(expression));
+            }
+            case NodeTag::kTupleExpression:
+                return std::make_unique<TupleExpressionNode>(ReadList<ExpressionNode>());
+            case NodeTag::kSyntaxTree:
+                return std::make_unique<SyntaxTree>(ReadList<SyntaxNode>());
+            case NodeTag::kAssignment: {
+                auto operation = ReadToken();
+                auto identifier = Read<ExpressionNode>();
+                auto expression = Read<ExpressionNode>();
+                return std::make_unique<AssignmentNode>(std::move(operation), std::move(identifier), std::move(expression));
+            }
+            default:
+                throw std::exception();  // todo
+            }
+        }
+    };
+}  // namespace
+
+uint64_t SyntaxTreeSerializer::HashSource(std::istream *is) {
+    uint64_t hash = kHashSeed;
+    char buffer[4096];
+    while (is->read(buffer, sizeof(buffer)) || is->gcount() > 0) {
+        hash = HashBytes(hash, reinterpret_cast<const uint8_t *>(buffer), static_cast<size_t>(is->gcount()));
+    }
+    return hash;
+}
+
+uint64_t SyntaxTreeSerializer::HashContent(const SyntaxNode *node) {
+    Writer writer(false);
+    writer.Write(node);
+    const auto data = writer.GetResult(0);
+    return HashBytes(kHashSeed, data.data(), data.size());
+}
+
+std::vector<uint8_t> SyntaxTreeSerializer::Serialize(const SyntaxTree *tree, uint64_t source_hash) {
+    Writer writer;
+    writer.Write(tree);
+    return writer.GetResult(source_hash);
+}
+
+std::unique_ptr<SyntaxTree> SyntaxTreeSerializer::Deserialize(const uint8_t *data, size_t size, uint64_t source_hash) {
+    constexpr size_t kHeaderSize = 16;
+    if (size < kHeaderSize || ReadFixed(data, 4) != kMagic || ReadFixed(data + 4, 4) != kVersion || ReadFixed(data + 8, 8) != source_hash) {
+        return nullptr;
+    }
+
+    Reader reader(data + kHeaderSize, data + size);
+    reader.ReadStringTable();
+    return reader.ReadTree();
+}
+
+void SyntaxTreeSerializer::Save(const std::string &filename, const SyntaxTree *tree, uint64_t source_hash) {
+    const auto data = Serialize(tree, source_hash);
+
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+std::unique_ptr<SyntaxTree> SyntaxTreeSerializer::Load(const std::string &filename, uint64_t source_hash) {
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!ifs) {
+        return nullptr;
+    }
+
+    // the whole image is pulled in with a single read and decoded in place
+    const auto size = static_cast<size_t>(ifs.tellg());
+    std::vector<uint8_t> data(size);
+    ifs.seekg(0);
+    if (!ifs.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(size))) {
+        return nullptr;
+    }
+
+    try {
+        return Deserialize(data.data(), data.size(), source_hash);
+    } catch (const std::exception &) {
+        return nullptr;
+    }
+}
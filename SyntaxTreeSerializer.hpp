@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SyntaxParser.hpp"
+
+// Binary image of a SyntaxTree, used to skip tokenizing and parsing of unchanged sources.
+//
+// Layout (integers are unsigned LEB128 unless stated otherwise):
+//   magic (4 bytes, little endian), version (4 bytes, little endian), source hash (8 bytes, little endian)
+//   string table: count, then length + bytes for every identifier/text literal
+//   root node: tag byte followed by the node fields in declaration order, children are nested nodes
+//
+// Every token is stored completely (type, position and value), so a loaded tree is indistinguishable from a parsed one.
+class SyntaxTreeSerializer final {
+public:
+    static constexpr uint32_t kMagic = 0x54534152;  // "RAST"
+    static constexpr uint32_t kVersion = 1;
+
+    static uint64_t HashSource(std::istream *is);
+    // hash of the image of a subtree without token positions, equal for the same code anywhere in any file
+    static uint64_t HashContent(const SyntaxNode *node);
+
+    static std::vector<uint8_t> Serialize(const SyntaxTree *tree, uint64_t source_hash);
+    // returns nullptr when the image was produced by another version or from another source
+    static std::unique_ptr<SyntaxTree> Deserialize(const uint8_t *data, size_t size, uint64_t source_hash);
+
+    static void Save(const std::string &filename, const SyntaxTree *tree, uint64_t source_hash);
+    // returns nullptr when the cache file is missing, stale or corrupted
+    static std::unique_ptr<SyntaxTree> Load(const std::string &filename, uint64_t source_hash);
+};
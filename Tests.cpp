@@ -1,12 +1,23 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
+#include "IRPassManager.hpp"
+#include "SemanticAnalyzer.hpp"
 #include "SyntaxParser.hpp"
 #include "SpecificSyntaxTreeVisitor.hpp"
+#include "SyntaxTreeSerializer.hpp"
 #include "Tokenizer.hpp"
+#include "WasmGenerator.hpp"
+#include "Workspace.hpp"
 
 class MyVisitor : public SpecificSyntaxTreeVisitor {
     std::ostringstream *out_;
@@ -116,6 +127,9 @@ void TestParser(const std::string &test_suit_name, const std::string &test_name)
 
     MyVisitor visitor(&oss);
     visitor.Visit(expression.get());
+    for (const SyntaxDiagnostic &diagnostic : parser.GetDiagnostics()) {
+        oss << diagnostic.ToString() << std::endl;
+    }
 
     std::string input = oss.str();
     input = input.substr(0, input.size() - 1);
@@ -133,6 +147,1300 @@ void TestParser(const std::string &test_suit_name, const std::string &test_name)
     ASSERT_STREQ(input.c_str(), output.c_str());
 }
 
+// the diagnostics of the sequential and the parallel parser must both be the ones in correct.txt
+void TestSyntaxErrors(const std::string &test_suit_name, const std::string &test_name) {
+    const std::string path = "tests/" + test_suit_name + "/" + test_name + "/";
+
+    std::ifstream ifs(path + "input.rs");
+    ASSERT_TRUE(ifs.is_open());
+    Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    SyntaxParser parser(&tokenizer);
+    parser.ParseItems();
+    const std::vector<SyntaxDiagnostic> sequential = parser.GetDiagnostics();
+    ifs.close();
+
+    ifs.open(path + "input.rs");
+    Tokenizer buffered_tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    std::vector<SyntaxDiagnostic> parallel;
+    SyntaxParser::ParseItemsParallel(SyntaxParser::Tokenize(&buffered_tokenizer), 2, &parallel);
+    ifs.close();
+
+    ifs.open(path + "correct.txt");
+    std::string output((std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>()));
+    ifs.close();
+
+    const auto to_string = [](const std::vector<SyntaxDiagnostic> &diagnostics) {
+        std::ostringstream oss;
+        for (const auto &diagnostic : diagnostics) {
+            oss << diagnostic.ToString() << std::endl;
+        }
+        return oss.str();
+    };
+    ASSERT_STREQ(to_string(sequential).c_str(), output.c_str()) << "sequential";
+    ASSERT_STREQ(to_string(parallel).c_str(), output.c_str()) << "parallel";
+}
+
+std::vector<ByteArray::Byte> Generate(const std::string &test_name, const SyntaxTree *syntax_tree, bool parallel) {
+    ImportExportTable import_export_table("tests/compilation/" + test_name + "/input.json");
+
+    semantic::SemanticAnalyzer analyzer;
+    const semantic::Annotations annotations =
+        parallel ? analyzer.AnalyzeParallel(syntax_tree, &import_export_table, 2) : analyzer.Analyze(syntax_tree, &import_export_table);
+
+    WasmGenerator generator;
+    generator.Generate(syntax_tree, &import_export_table, &annotations);
+
+    // a stream of int8_t stops at the first 0xff, the end of file of its traits
+    return generator.GetResult().GetData();
+}
+
+std::vector<ByteArray::Byte> Compile(const std::string &test_name, bool parallel) {
+    std::ifstream ifs("tests/compilation/" + test_name + "/input.rs");
+
+    Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    std::unique_ptr<SyntaxTree> syntax_tree;
+    if (parallel) {
+        std::vector<SyntaxDiagnostic> diagnostics;
+        syntax_tree = SyntaxParser::ParseItemsParallel(SyntaxParser::Tokenize(&tokenizer), 2, &diagnostics);
+    } else {
+        SyntaxParser parser(&tokenizer);
+        syntax_tree = parser.ParseItems();
+    }
+    return Generate(test_name, syntax_tree.get(), parallel);
+}
+
+// many compilations of different programs in one process must not interfere with each other
+TEST(CompilationTest, Concurrent) {
+    const std::vector<std::string> test_names = {"loops", "misc", "readme", "structs"};
+
+    std::vector<std::vector<ByteArray::Byte>> expected;
+    for (const auto &test_name : test_names) {
+        expected.push_back(Compile(test_name, false));
+        ASSERT_FALSE(expected.back().empty());
+    }
+
+    const size_t thread_count = 4 * test_names.size();
+    for (int round = 0; round < 8; round++) {
+        std::vector<std::vector<ByteArray::Byte>> results(thread_count);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([&, i]() { results[i] = Compile(test_names[i % test_names.size()], i % 2 == 1); });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+
+        for (size_t i = 0; i < thread_count; i++) {
+            ASSERT_TRUE(results[i] == expected[i % test_names.size()]) << test_names[i % test_names.size()];
+        }
+    }
+}
+
+// only the functions reachable from the exports are analyzed, an unused one does not have to type-check
+TEST(CompilationTest, Unreachable) {
+    for (bool parallel : {false, true}) {
+        std::vector<ByteArray::Byte> result;
+        ASSERT_NO_THROW(result = Compile("unreachable", parallel)) << (parallel ? "parallel" : "sequential");
+        ASSERT_FALSE(result.empty());
+    }
+}
+
+std::unique_ptr<SyntaxTree> Parse(const std::string &test_name, uint64_t *source_hash) {
+    std::ifstream ifs("tests/compilation/" + test_name + "/input.rs", std::ios::in | std::ios::binary);
+    *source_hash = SyntaxTreeSerializer::HashSource(&ifs);
+    ifs.clear();
+    ifs.seekg(0);
+
+    Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    SyntaxParser parser(&tokenizer);
+    return parser.ParseItems();
+}
+
+std::string Print(const SyntaxTree *syntax_tree) {
+    std::ostringstream oss;
+    MyVisitor visitor(&oss);
+    visitor.Visit(syntax_tree);
+    return oss.str();
+}
+
+// a loaded tree prints, serializes and compiles to the same as the freshly parsed one
+TEST(SerializerTest, RoundTrip) {
+    for (const std::string test_name : {"loops", "misc", "readme", "structs", "unreachable"}) {
+        uint64_t source_hash;
+        const std::unique_ptr<SyntaxTree> parsed = Parse(test_name, &source_hash);
+        const std::vector<uint8_t> image = SyntaxTreeSerializer::Serialize(parsed.get(), source_hash);
+
+        const std::unique_ptr<SyntaxTree> loaded = SyntaxTreeSerializer::Deserialize(image.data(), image.size(), source_hash);
+        ASSERT_NE(loaded, nullptr) << test_name;
+        EXPECT_EQ(Print(loaded.get()), Print(parsed.get())) << test_name;
+        // the image holds every token with its position, so it is the same only if nothing was lost
+        EXPECT_TRUE(SyntaxTreeSerializer::Serialize(loaded.get(), source_hash) == image) << test_name;
+        EXPECT_TRUE(Generate(test_name, loaded.get(), false) == Generate(test_name, parsed.get(), false)) << test_name;
+    }
+}
+
+// an image of another format or another source is not loaded, and neither is a cut off one
+TEST(SerializerTest, Rejection) {
+    uint64_t source_hash;
+    const std::unique_ptr<SyntaxTree> parsed = Parse("readme", &source_hash);
+    const std::vector<uint8_t> image = SyntaxTreeSerializer::Serialize(parsed.get(), source_hash);
+    ASSERT_NE(SyntaxTreeSerializer::Deserialize(image.data(), image.size(), source_hash), nullptr);
+
+    // the header is the magic, the version and the source hash, 4, 4 and 8 bytes
+    for (size_t offset : {0, 4, 8}) {
+        std::vector<uint8_t> changed = image;
+        changed[offset] ^= 1;
+        EXPECT_EQ(SyntaxTreeSerializer::Deserialize(changed.data(), changed.size(), source_hash), nullptr) << offset;
+    }
+    EXPECT_EQ(SyntaxTreeSerializer::Deserialize(image.data(), image.size(), source_hash + 1), nullptr);
+
+    const std::string filename = "tests/compilation/readme/output.ast";
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size() / 2));
+    ofs.close();
+    EXPECT_EQ(SyntaxTreeSerializer::Load(filename, source_hash), nullptr);
+}
+
+std::string ReadFile(const std::string &filename) {
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string &filename, const std::string &text) {
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    ofs << text;
+}
+
+// text with the first occurrence of from replaced by to
+std::string Replace(std::string text, const std::string &from, const std::string &to) {
+    return text.replace(text.find(from), from.size(), to);
+}
+
+// the image of a fresh parse of the file, it holds every token with its position
+std::vector<uint8_t> SerializeFile(const std::string &filename) {
+    std::ifstream ifs(filename);
+    Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    SyntaxParser parser(&tokenizer);
+    return SyntaxTreeSerializer::Serialize(parser.ParseItems().get(), 0);
+}
+
+// an edit is parsed again in the smallest block or item around it, every other node stays and all tokens get the positions of the new text
+TEST(ReparseTest, KeepsOtherSubtrees) {
+    const std::string filename = "tests/compilation/readme/output.rs";
+    const std::string source = ReadFile("tests/compilation/readme/input.rs");
+    WriteFile(filename, source);
+
+    ImportExportTable import_export_table("tests/compilation/readme/input.json");
+    Workspace workspace(filename, &import_export_table);
+    ASSERT_TRUE(workspace.Update());
+
+    // calc_fib, abs, f, int and main
+    const std::vector<const SyntaxNode *> items = workspace.GetTree()->GetNodes();
+    const auto calc_fib = static_cast<const FunctionNode *>(items[0]);
+    const SyntaxNode *loop = calc_fib->GetBlock()->GetStatements()[3];
+    const std::vector<const SyntaxNode *> int_nodes = SyntaxTree::CollectNodes(items[3]);
+
+    // a line more in the loop of calc_fib moves all tokens after it
+    std::string edited = Replace(source, "i += 1i32;", "i += 1i32;\n        b += 0i32;");
+    WriteFile(filename, edited);
+    ASSERT_TRUE(workspace.Update());
+    ASSERT_TRUE(workspace.GetLastReparse().has_value());
+    EXPECT_EQ(workspace.GetLastReparse()->replaced_items, std::vector<size_t>{0});
+    EXPECT_TRUE(workspace.GetLastReparse()->is_in_place);
+    EXPECT_FALSE(workspace.GetLastReparse()->is_full);
+    EXPECT_EQ(workspace.GetTree()->GetNodes(), items);
+    EXPECT_EQ(calc_fib->GetBlock()->GetStatements()[3], loop);
+    EXPECT_EQ(SyntaxTree::CollectNodes(items[3]), int_nodes);
+    EXPECT_TRUE(SyntaxTreeSerializer::Serialize(workspace.GetTree(), 0) == SerializeFile(filename));
+
+    // a changed parameter list replaces only the item of f
+    edited = Replace(edited, "fn f(x: f64)", "fn f(x: f64,)");
+    WriteFile(filename, edited);
+    ASSERT_TRUE(workspace.Update());
+    EXPECT_EQ(workspace.GetLastReparse()->replaced_items, std::vector<size_t>{2});
+    EXPECT_FALSE(workspace.GetLastReparse()->is_in_place);
+    EXPECT_FALSE(workspace.GetLastReparse()->is_full);
+    const std::vector<const SyntaxNode *> nodes = workspace.GetTree()->GetNodes();
+    EXPECT_NE(nodes[2], items[2]);
+    EXPECT_EQ(std::vector<const SyntaxNode *>(nodes.begin(), nodes.begin() + 2), std::vector<const SyntaxNode *>(items.begin(), items.begin() + 2));
+    EXPECT_EQ(std::vector<const SyntaxNode *>(nodes.begin() + 3, nodes.end()), std::vector<const SyntaxNode *>(items.begin() + 3, items.end()));
+    EXPECT_TRUE(SyntaxTreeSerializer::Serialize(workspace.GetTree(), 0) == SerializeFile(filename));
+
+    // an edit that does not parse on its own is parsed with the whole file, which reports the error
+    WriteFile(filename, Replace(edited, "return x * x;", "return x * x; }"));
+    EXPECT_FALSE(workspace.Update());
+    EXPECT_TRUE(workspace.GetLastReparse()->is_full);
+    EXPECT_FALSE(workspace.GetDiagnostics().empty());
+
+    WriteFile(filename, edited);
+    ASSERT_TRUE(workspace.Update());
+    EXPECT_TRUE(workspace.GetLastReparse()->is_full);
+    EXPECT_TRUE(SyntaxTreeSerializer::Serialize(workspace.GetTree(), 0) == SerializeFile(filename));
+}
+
+// the ir of the program the queries were made for
+std::string PrintLowered(const ImportExportTable *import_export_table, semantic::QueryEngine *queries) {
+    std::ostringstream oss;
+    ir::Print(oss, ir::Lowering(import_export_table, &queries->GetAnnotations(), true).Lower(queries->CheckReachable(nullptr)));
+    return oss.str();
+}
+
+// an edit inside a body type-checks only that body again, and the program lowers as if it was analyzed from scratch
+TEST(ReparseTest, ChecksOnlyEditedBody) {
+    const std::string filename = "tests/compilation/readme/output.rs";
+    std::string source = ReadFile("tests/compilation/readme/input.rs");
+    WriteFile(filename, source);
+
+    ImportExportTable import_export_table("tests/compilation/readme/input.json");
+    Workspace workspace(filename, &import_export_table);
+    ASSERT_TRUE(workspace.Update());
+    semantic::QueryEngine *queries = workspace.GetQueries();
+    EXPECT_EQ(queries->GetCheckedBodyCount(), 5u);
+
+    // the loop of calc_fib, then the body of int
+    size_t checked_body_count = 5;
+    for (const auto &[from, to] : {std::pair<std::string, std::string>{"i += 1i32;", "i += 1i32;\n        b += 0i32;"}, {"let eps = 1e-6;", "let eps = 1e-7;"}}) {
+        source = Replace(source, from, to);
+        WriteFile(filename, source);
+        ASSERT_TRUE(workspace.Update());
+        ASSERT_TRUE(workspace.GetLastReparse()->is_in_place);
+        ASSERT_EQ(workspace.GetQueries(), queries);
+        EXPECT_EQ(queries->GetCheckedBodyCount(), ++checked_body_count) << to;
+
+        Workspace fresh(filename, &import_export_table);
+        ASSERT_TRUE(fresh.Update());
+        EXPECT_EQ(PrintLowered(&import_export_table, queries), PrintLowered(&import_export_table, fresh.GetQueries())) << to;
+    }
+
+    // a changed signature needs new queries
+    WriteFile(filename, Replace(source, "fn f(x: f64)", "fn f(x: f64,)"));
+    ASSERT_TRUE(workspace.Update());
+    EXPECT_FALSE(workspace.GetLastReparse()->is_in_place);
+    EXPECT_EQ(workspace.GetQueries()->GetCheckedBodyCount(), 5u);
+}
+
+// the annotations of the nodes after a body that got more nodes move along with their ids, the ones of the body are computed again
+TEST(ReparseTest, SplicesAnnotations) {
+    const std::string filename = "tests/compilation/readme/output.rs";
+    const std::string source = ReadFile("tests/compilation/readme/input.rs");
+    WriteFile(filename, source);
+
+    ImportExportTable import_export_table("tests/compilation/readme/input.json");
+    Workspace workspace(filename, &import_export_table);
+    ASSERT_TRUE(workspace.Update());
+    const semantic::Annotations &annotations = workspace.GetQueries()->GetAnnotations();
+
+    // calc_fib comes first, the nodes of all other items are after its body
+    const std::vector<const SyntaxNode *> items = workspace.GetTree()->GetNodes();
+    const auto calc_fib = static_cast<const FunctionNode *>(items[0]);
+    std::vector<std::pair<const SyntaxNode *, const ISymbolType *>> types;
+    for (const SyntaxNode *item : std::vector<const SyntaxNode *>(items.begin() + 1, items.end())) {
+        for (const SyntaxNode *node : SyntaxTree::CollectNodes(item)) {
+            types.emplace_back(node, annotations.types[node]);
+        }
+    }
+    const uint32_t first_id = types.front().first->GetId();
+
+    WriteFile(filename, Replace(source, "i += 1i32;", "i += 1i32;\n        b += 0i32;"));
+    ASSERT_TRUE(workspace.Update());
+    EXPECT_EQ(types.front().first->GetId(), first_id + 5);
+
+    // Update checks the body of calc_fib again, the values of all other nodes are the ones from before the edit
+    EXPECT_EQ(workspace.GetQueries()->GetCheckedBodyCount(), 6u);
+    for (const auto &[node, type] : types) {
+        EXPECT_EQ(annotations.types[node], type) << node->GetId();
+    }
+    const auto loop = static_cast<const PredicateLoopNode *>(calc_fib->GetBlock()->GetStatements()[3]);
+    const auto added = static_cast<const AssignmentNode *>(loop->GetBlock()->GetStatements().back());
+    EXPECT_NE(annotations.types[loop->GetExpression()], nullptr);
+    EXPECT_NE(annotations.types[added->GetExpression()], nullptr);
+}
+
+// the unoptimized ir of a program in tests/compilation
+ir::Module Lower(const std::string &test_name, bool reorder_fields) {
+    ImportExportTable import_export_table("tests/compilation/" + test_name + "/input.json");
+    std::ifstream ifs("tests/compilation/" + test_name + "/input.rs");
+
+    Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+    SyntaxParser parser(&tokenizer);
+    const std::unique_ptr<SyntaxTree> syntax_tree = parser.ParseItems();
+
+    semantic::QueryEngine queries(syntax_tree.get(), &import_export_table);
+    return ir::Lowering(&import_export_table, &queries.GetAnnotations(), reorder_fields).Lower(queries.CheckReachable(nullptr));
+}
+
+const ir::Function *FindFunction(const ir::Module &module, const std::string &name) {
+    for (const auto &function : module.functions) {
+        if (function->name == name) {
+            return function.get();
+        }
+    }
+    return nullptr;
+}
+
+// the offsets of the loads main passes to the imported functions
+std::vector<uint32_t> GetPrintedOffsets(const ir::Module &module) {
+    std::vector<uint32_t> result;
+    for (const auto &block : FindFunction(module, "main")->blocks) {
+        for (const auto &instruction : block->instructions) {
+            if (instruction->opcode == ir::Opcode::kCall && instruction->callee->imported && instruction->operands.front()->opcode == ir::Opcode::kLoad) {
+                result.push_back(instruction->operands.front()->index);
+            }
+        }
+    }
+    return result;
+}
+
+// a chain of member accesses is one load at the sum of the field offsets from the outermost struct
+TEST(StructTest, NestedAccess) {
+    // fields by decreasing alignment: P { b, a }, Q { p, c, x } and T(f64, Q)
+    EXPECT_EQ(GetPrintedOffsets(Lower("structs", true)), (std::vector<uint32_t>{8, 0, 16, 0, 16, 8}));
+    // declaration order as with -r: P { a, b } at 0 and 8, Q { x, p, c } at 0, 8 and 24, T(f64, Q) at 0 and 8
+    EXPECT_EQ(GetPrintedOffsets(Lower("structs", false)), (std::vector<uint32_t>{8, 16, 24, 0, 16, 24}));
+}
+
+// structs are passed by address into the frame of the caller, which the callee cannot rely on
+TEST(StructTest, StructParameter) {
+    EXPECT_THROW(Lower("struct_parameter", true), semantic::SemanticError);
+}
+
+// what the lowering cannot handle is reported at the first token of the construct instead of ending the driver
+TEST(CompilationTest, Unsupported) {
+    try {
+        Lower("unsupported", true);
+        FAIL();
+    } catch (const semantic::SemanticError &error) {
+        EXPECT_EQ(error.ToString(), "3:17: error: tuples are not supported");
+    }
+}
+
+// the recursion of structs deeper than the frames of one memory page fits on the stack, and a call whose frame would not fit
+// traps in the prologue instead of storing below the memory
+TEST(StructTest, Recursion) {
+    const std::vector<ByteArray::Byte> result = Compile("structs", false);
+
+    // one memory of 16 pages without a maximum
+    const std::vector<ByteArray::Byte> memory{0x05, 0x03, 0x01, 0x00, 0x10};
+    EXPECT_NE(std::search(result.begin(), result.end(), memory.begin(), memory.end()), result.end());
+
+    // i32.const 0, i32.lt_s, if, unreachable, end after the frames of main, fields and depth are taken
+    const std::vector<ByteArray::Byte> guard{0x41, 0x00, 0x48, 0x04, 0x40, 0x00, 0x0b};
+    size_t guards = 0;
+    for (auto it = result.begin(); (it = std::search(it, result.end(), guard.begin(), guard.end())) != result.end(); it++) {
+        guards++;
+    }
+    EXPECT_EQ(guards, 3u);
+}
+
+// Runs the modules of WasmGenerator, so that a test compares what a program does rather than its bytes. Every import
+// prints its argument, and a trap or a call nested too deeply ends the run. Only the instructions of wasm::Opcode are
+// known, as nothing else is emitted.
+class WasmRunner final {
+public:
+    explicit WasmRunner(const std::vector<ByteArray::Byte> &bytes) : data_(bytes.begin(), bytes.end()) {
+        Decode();
+    }
+
+    // the output of a call of the export with the bits of the arguments, its result or the trap ending it is the last line
+    std::string Call(const std::string &field, const std::vector<uint64_t> &arguments) {
+        output_.str("");
+        memory_.assign(static_cast<size_t>(memory_pages_) * 65536, 0);
+        globals_ = initial_globals_;
+        try {
+            const uint32_t index = exports_.at(field);
+            std::vector<uint64_t> stack = arguments;
+            Invoke(index, &stack, 0);
+            for (size_t i = 0; i < stack.size(); i++) {
+                output_ << "= " << Format(types_[functions_[index].type].results[i], stack[i]) << '\n';
+            }
+        } catch (const Trap &) {
+            output_ << "trap\n";
+        }
+        return output_.str();
+    }
+
+    // the output of every export called without arguments in the order of the module
+    std::string Run() {
+        std::string result;
+        for (const std::string &field : export_order_) {
+            result += field + ":\n" + Call(field, {});
+        }
+        return result;
+    }
+
+private:
+    struct Trap {};
+
+    struct Type {
+        std::vector<uint8_t> params;
+        std::vector<uint8_t> results;
+    };
+
+    struct Function {
+        uint32_t type = 0;
+        bool imported = false;
+        std::string field;
+        std::vector<uint8_t> locals;
+        std::vector<wasm::Instruction> code;
+        // the end of every block, loop, if and else and the else of an if, SIZE_MAX without one
+        std::vector<size_t> ends;
+        std::vector<size_t> elses;
+    };
+
+    // where a branch to it continues and the values it keeps
+    struct Label {
+        size_t continuation;
+        size_t height;
+        size_t arity;
+    };
+
+    static constexpr uint8_t kI32 = 0x7f;
+    static constexpr uint8_t kI64 = 0x7e;
+    static constexpr uint8_t kF32 = 0x7d;
+    static constexpr uint8_t kF64 = 0x7c;
+    static constexpr uint32_t kMaxDepth = 2000;
+
+    std::vector<uint8_t> data_;
+    size_t position_ = 0;
+    std::vector<Type> types_;
+    std::vector<Function> functions_;
+    std::unordered_map<std::string, uint32_t> exports_;
+    std::vector<std::string> export_order_;
+    uint32_t memory_pages_ = 0;
+    std::vector<uint64_t> initial_globals_;
+
+    std::vector<uint8_t> memory_;
+    std::vector<uint64_t> globals_;
+    std::ostringstream output_;
+
+    uint8_t ReadByte() {
+        if (position_ >= data_.size()) {
+            throw std::runtime_error("unexpected end of module");
+        }
+        return data_[position_++];
+    }
+
+    uint64_t ReadUnsigned() {
+        uint64_t result = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            const uint8_t byte = ReadByte();
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return result;
+            }
+        }
+    }
+
+    int64_t ReadSigned() {
+        uint64_t result = 0;
+        uint32_t shift = 0;
+        uint8_t byte;
+        do {
+            byte = ReadByte();
+            result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while ((byte & 0x80) != 0);
+        if (shift < 64 && (byte & 0x40) != 0) {
+            result |= ~uint64_t{0} << shift;
+        }
+        return static_cast<int64_t>(result);
+    }
+
+    uint64_t ReadFixed(size_t size) {
+        uint64_t result = 0;
+        for (size_t i = 0; i < size; i++) {
+            result |= static_cast<uint64_t>(ReadByte()) << (8 * i);
+        }
+        return result;
+    }
+
+    std::string ReadName() {
+        const size_t size = ReadUnsigned();
+        std::string result(data_.begin() + position_, data_.begin() + position_ + size);
+        position_ += size;
+        return result;
+    }
+
+    void Decode() {
+        position_ = 8;
+        std::vector<uint32_t> defined_types;
+        while (position_ < data_.size()) {
+            const uint8_t section = ReadByte();
+            const size_t size = ReadUnsigned();
+            const size_t end = position_ + size;
+            switch (static_cast<wasm::SectionType>(section)) {
+            case wasm::SectionType::Type:
+                for (size_t count = ReadUnsigned(); count > 0; count--) {
+                    ReadByte();
+                    Type type;
+                    for (size_t i = ReadUnsigned(); i > 0; i--) {
+                        type.params.push_back(ReadByte());
+                    }
+                    for (size_t i = ReadUnsigned(); i > 0; i--) {
+                        type.results.push_back(ReadByte());
+                    }
+                    types_.push_back(type);
+                }
+                break;
+            case wasm::SectionType::Import:
+                for (size_t count = ReadUnsigned(); count > 0; count--) {
+                    Function function;
+                    ReadName();
+                    function.field = ReadName();
+                    ReadByte();
+                    function.type = ReadUnsigned();
+                    function.imported = true;
+                    functions_.push_back(function);
+                }
+                break;
+            case wasm::SectionType::Function:
+                for (size_t count = ReadUnsigned(); count > 0; count--) {
+                    defined_types.push_back(ReadUnsigned());
+                }
+                break;
+            case wasm::SectionType::Memory:
+                ReadUnsigned();
+                if ((ReadByte() & 1) != 0) {
+                    memory_pages_ = ReadUnsigned();
+                    ReadUnsigned();
+                } else {
+                    memory_pages_ = ReadUnsigned();
+                }
+                break;
+            case wasm::SectionType::Global:
+                for (size_t count = ReadUnsigned(); count > 0; count--) {
+                    ReadByte();
+                    ReadByte();
+                    ReadByte();
+                    initial_globals_.push_back(static_cast<uint32_t>(ReadSigned()));
+                    ReadByte();
+                }
+                break;
+            case wasm::SectionType::Export:
+                for (size_t count = ReadUnsigned(); count > 0; count--) {
+                    const std::string field = ReadName();
+                    ReadByte();
+                    exports_[field] = ReadUnsigned();
+                    export_order_.push_back(field);
+                }
+                break;
+            case wasm::SectionType::Code:
+                for (size_t count = ReadUnsigned(), i = 0; i < count; i++) {
+                    Function function;
+                    function.type = defined_types.at(i);
+                    const size_t body_end = ReadUnsigned() + position_;
+                    for (size_t runs = ReadUnsigned(); runs > 0; runs--) {
+                        const size_t run = ReadUnsigned();
+                        function.locals.insert(function.locals.end(), run, ReadByte());
+                    }
+                    while (position_ < body_end) {
+                        function.code.push_back(DecodeInstruction());
+                    }
+                    MatchBlocks(&function);
+                    functions_.push_back(std::move(function));
+                }
+                break;
+            default:
+                break;
+            }
+            position_ = end;
+        }
+    }
+
+    wasm::Instruction DecodeInstruction() {
+        wasm::Instruction instruction{static_cast<wasm::Opcode>(ReadByte())};
+        switch (instruction.opcode) {
+        case wasm::Opcode::Block:
+        case wasm::Opcode::Loop:
+        case wasm::Opcode::If:
+            instruction.immediate = ReadByte();
+            break;
+        case wasm::Opcode::Br:
+        case wasm::Opcode::BrIf:
+        case wasm::Opcode::Call:
+        case wasm::Opcode::LocalGet:
+        case wasm::Opcode::LocalSet:
+        case wasm::Opcode::LocalTee:
+        case wasm::Opcode::GlobalGet:
+        case wasm::Opcode::GlobalSet:
+            instruction.immediate = ReadUnsigned();
+            break;
+        case wasm::Opcode::I32Load:
+        case wasm::Opcode::I64Load:
+        case wasm::Opcode::F32Load:
+        case wasm::Opcode::F64Load:
+        case wasm::Opcode::I32Load8U:
+        case wasm::Opcode::I32Store:
+        case wasm::Opcode::I64Store:
+        case wasm::Opcode::F32Store:
+        case wasm::Opcode::F64Store:
+        case wasm::Opcode::I32Store8:
+            instruction.immediate = ReadUnsigned();
+            instruction.offset = ReadUnsigned();
+            break;
+        case wasm::Opcode::I32Const:
+            instruction.immediate = static_cast<uint32_t>(ReadSigned());
+            break;
+        case wasm::Opcode::I64Const:
+            instruction.immediate = static_cast<uint64_t>(ReadSigned());
+            break;
+        case wasm::Opcode::F32Const:
+            instruction.immediate = ReadFixed(4);
+            break;
+        case wasm::Opcode::F64Const:
+            instruction.immediate = ReadFixed(8);
+            break;
+        default:
+            break;
+        }
+        return instruction;
+    }
+
+    static void MatchBlocks(Function *function) {
+        const std::vector<wasm::Instruction> &code = function->code;
+        function->ends.assign(code.size(), SIZE_MAX);
+        function->elses.assign(code.size(), SIZE_MAX);
+        std::vector<size_t> openers;
+        for (size_t i = 0; i < code.size(); i++) {
+            switch (code[i].opcode) {
+            case wasm::Opcode::Block:
+            case wasm::Opcode::Loop:
+            case wasm::Opcode::If:
+                openers.push_back(i);
+                break;
+            case wasm::Opcode::Else:
+                function->elses[openers.back()] = i;
+                break;
+            case wasm::Opcode::End:
+                if (!openers.empty()) {
+                    function->ends[openers.back()] = i;
+                    if (function->elses[openers.back()] != SIZE_MAX) {
+                        function->ends[function->elses[openers.back()]] = i;
+                    }
+                    openers.pop_back();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    std::string Format(uint8_t type, uint64_t bits) const {
+        std::ostringstream oss;
+        oss << std::setprecision(17);
+        switch (type) {
+        case kI32:
+            oss << static_cast<int32_t>(bits);
+            break;
+        case kI64:
+            oss << static_cast<int64_t>(bits);
+            break;
+        case kF32:
+            oss << ToF32(bits);
+            break;
+        default:
+            oss << ToF64(bits);
+            break;
+        }
+        return oss.str();
+    }
+
+    static float ToF32(uint64_t bits) {
+        const auto value_bits = static_cast<uint32_t>(bits);
+        float value;
+        std::memcpy(&value, &value_bits, sizeof value);
+        return value;
+    }
+
+    static double ToF64(uint64_t bits) {
+        double value;
+        std::memcpy(&value, &bits, sizeof value);
+        return value;
+    }
+
+    static uint64_t FromF32(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    static uint64_t FromF64(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof bits);
+        return bits;
+    }
+
+    static uint64_t Pop(std::vector<uint64_t> *stack) {
+        const uint64_t value = stack->back();
+        stack->pop_back();
+        return value;
+    }
+
+    // the arguments are taken from the stack and the results are left on it
+    void Invoke(uint32_t index, std::vector<uint64_t> *stack, uint32_t depth) {
+        const Function &function = functions_.at(index);
+        const Type &type = types_.at(function.type);
+        std::vector<uint64_t> locals(stack->end() - type.params.size(), stack->end());
+        stack->resize(stack->size() - type.params.size());
+        if (function.imported) {
+            for (size_t i = 0; i < locals.size(); i++) {
+                output_ << function.field << ' ' << Format(type.params[i], locals[i]) << '\n';
+            }
+            return;
+        }
+        if (depth == kMaxDepth) {
+            throw Trap();
+        }
+
+        locals.resize(locals.size() + function.locals.size(), 0);
+        std::vector<uint64_t> values;
+        Execute(function, &locals, &values, depth);
+        stack->insert(stack->end(), values.end() - type.results.size(), values.end());
+    }
+
+    void Execute(const Function &function, std::vector<uint64_t> *locals, std::vector<uint64_t> *stack, uint32_t depth) {
+        using Opcode = wasm::Opcode;
+        const std::vector<wasm::Instruction> &code = function.code;
+        std::vector<Label> labels;
+
+        // a branch to the body of the function returns
+        const auto branch = [&](uint64_t label_depth, size_t *pc) {
+            if (label_depth >= labels.size()) {
+                *pc = code.size();
+                return;
+            }
+            const Label label = labels[labels.size() - 1 - label_depth];
+            stack->erase(stack->begin() + label.height, stack->end() - label.arity);
+            labels.resize(labels.size() - 1 - label_depth);
+            *pc = label.continuation;
+        };
+        const auto arity = [](uint64_t block_type) -> size_t {
+            return block_type == 0x40 ? 0 : 1;
+        };
+        const auto address = [&](const wasm::Instruction &instruction, size_t size) {
+            const uint64_t result = static_cast<uint64_t>(static_cast<uint32_t>(Pop(stack))) + instruction.offset;
+            if (result + size > memory_.size()) {
+                throw Trap();
+            }
+            return result;
+        };
+        const auto load = [&](const wasm::Instruction &instruction, size_t size) {
+            const uint64_t at = address(instruction, size);
+            uint64_t value = 0;
+            std::memcpy(&value, &memory_[at], size);
+            stack->push_back(value);
+        };
+        const auto store = [&](const wasm::Instruction &instruction, size_t size) {
+            const uint64_t value = Pop(stack);
+            const uint64_t at = address(instruction, size);
+            std::memcpy(&memory_[at], &value, size);
+        };
+
+        for (size_t pc = 0; pc < code.size();) {
+            const wasm::Instruction &instruction = code[pc];
+            const size_t next = pc + 1;
+            pc = next;
+            switch (instruction.opcode) {
+            case Opcode::Unreachable:
+                throw Trap();
+            case Opcode::Block:
+                labels.push_back(Label{function.ends[next - 1] + 1, stack->size(), arity(instruction.immediate)});
+                break;
+            case Opcode::Loop:
+                labels.push_back(Label{next - 1, stack->size(), 0});
+                break;
+            case Opcode::If:
+                if (Pop(stack) != 0) {
+                    labels.push_back(Label{function.ends[next - 1] + 1, stack->size(), arity(instruction.immediate)});
+                } else if (function.elses[next - 1] != SIZE_MAX) {
+                    labels.push_back(Label{function.ends[next - 1] + 1, stack->size(), arity(instruction.immediate)});
+                    pc = function.elses[next - 1] + 1;
+                } else {
+                    pc = function.ends[next - 1] + 1;
+                }
+                break;
+            case Opcode::Else:
+                branch(0, &pc);
+                break;
+            case Opcode::End:
+                if (labels.empty()) {
+                    return;
+                }
+                labels.pop_back();
+                break;
+            case Opcode::Br:
+                branch(instruction.immediate, &pc);
+                break;
+            case Opcode::BrIf:
+                if (Pop(stack) != 0) {
+                    branch(instruction.immediate, &pc);
+                }
+                break;
+            case Opcode::Return:
+                return;
+            case Opcode::Call:
+                Invoke(instruction.immediate, stack, depth + 1);
+                break;
+            case Opcode::Drop:
+                stack->pop_back();
+                break;
+            case Opcode::LocalGet:
+                stack->push_back(locals->at(instruction.immediate));
+                break;
+            case Opcode::LocalSet:
+                locals->at(instruction.immediate) = Pop(stack);
+                break;
+            case Opcode::LocalTee:
+                locals->at(instruction.immediate) = stack->back();
+                break;
+            case Opcode::GlobalGet:
+                stack->push_back(globals_.at(instruction.immediate));
+                break;
+            case Opcode::GlobalSet:
+                globals_.at(instruction.immediate) = Pop(stack);
+                break;
+            case Opcode::I32Load:
+            case Opcode::F32Load:
+                load(instruction, 4);
+                break;
+            case Opcode::I64Load:
+            case Opcode::F64Load:
+                load(instruction, 8);
+                break;
+            case Opcode::I32Load8U:
+                load(instruction, 1);
+                break;
+            case Opcode::I32Store:
+            case Opcode::F32Store:
+                store(instruction, 4);
+                break;
+            case Opcode::I64Store:
+            case Opcode::F64Store:
+                store(instruction, 8);
+                break;
+            case Opcode::I32Store8:
+                store(instruction, 1);
+                break;
+            case Opcode::I32Const:
+            case Opcode::I64Const:
+            case Opcode::F32Const:
+            case Opcode::F64Const:
+                stack->push_back(instruction.immediate);
+                break;
+            case Opcode::I32Eqz:
+                stack->push_back(static_cast<uint32_t>(Pop(stack)) == 0);
+                break;
+            case Opcode::I64Eqz:
+                stack->push_back(Pop(stack) == 0);
+                break;
+            default: {
+                const uint64_t rhs = Pop(stack);
+                const uint64_t lhs = Pop(stack);
+                stack->push_back(Compute(instruction.opcode, lhs, rhs));
+                break;
+            }
+            }
+        }
+    }
+
+    static uint64_t Compute(wasm::Opcode opcode, uint64_t lhs_bits, uint64_t rhs_bits) {
+        using Opcode = wasm::Opcode;
+        const auto a32 = static_cast<int32_t>(lhs_bits), b32 = static_cast<int32_t>(rhs_bits);
+        const auto u32 = static_cast<uint32_t>(lhs_bits), v32 = static_cast<uint32_t>(rhs_bits);
+        const auto a64 = static_cast<int64_t>(lhs_bits), b64 = static_cast<int64_t>(rhs_bits);
+        const float f32 = ToF32(lhs_bits), g32 = ToF32(rhs_bits);
+        const double f64 = ToF64(lhs_bits), g64 = ToF64(rhs_bits);
+        switch (opcode) {
+        case Opcode::I32Eq:
+            return a32 == b32;
+        case Opcode::I32Ne:
+            return a32 != b32;
+        case Opcode::I32LtS:
+            return a32 < b32;
+        case Opcode::I32GtS:
+            return a32 > b32;
+        case Opcode::I32LeS:
+            return a32 <= b32;
+        case Opcode::I32GeS:
+            return a32 >= b32;
+        case Opcode::I64Eq:
+            return a64 == b64;
+        case Opcode::I64Ne:
+            return a64 != b64;
+        case Opcode::I64LtS:
+            return a64 < b64;
+        case Opcode::I64GtS:
+            return a64 > b64;
+        case Opcode::I64LeS:
+            return a64 <= b64;
+        case Opcode::I64GeS:
+            return a64 >= b64;
+        case Opcode::F32Eq:
+            return f32 == g32;
+        case Opcode::F32Ne:
+            return f32 != g32;
+        case Opcode::F32Lt:
+            return f32 < g32;
+        case Opcode::F32Gt:
+            return f32 > g32;
+        case Opcode::F32Le:
+            return f32 <= g32;
+        case Opcode::F32Ge:
+            return f32 >= g32;
+        case Opcode::F64Eq:
+            return f64 == g64;
+        case Opcode::F64Ne:
+            return f64 != g64;
+        case Opcode::F64Lt:
+            return f64 < g64;
+        case Opcode::F64Gt:
+            return f64 > g64;
+        case Opcode::F64Le:
+            return f64 <= g64;
+        case Opcode::F64Ge:
+            return f64 >= g64;
+        case Opcode::I32Add:
+            return static_cast<uint32_t>(u32 + v32);
+        case Opcode::I32Sub:
+            return static_cast<uint32_t>(u32 - v32);
+        case Opcode::I32Mul:
+            return static_cast<uint32_t>(u32 * v32);
+        case Opcode::I32DivS:
+            if (b32 == 0 || (a32 == INT32_MIN && b32 == -1)) {
+                throw Trap();
+            }
+            return static_cast<uint32_t>(a32 / b32);
+        case Opcode::I32RemS:
+            if (b32 == 0) {
+                throw Trap();
+            }
+            return b32 == -1 ? 0 : static_cast<uint32_t>(a32 % b32);
+        case Opcode::I32And:
+            return u32 & v32;
+        case Opcode::I32Or:
+            return u32 | v32;
+        case Opcode::I32Xor:
+            return u32 ^ v32;
+        case Opcode::I32Shl:
+            return static_cast<uint32_t>(u32 << (v32 & 31));
+        case Opcode::I32ShrS:
+            return static_cast<uint32_t>(a32 >> (v32 & 31));
+        case Opcode::I32ShrU:
+            return u32 >> (v32 & 31);
+        case Opcode::I64Add:
+            return lhs_bits + rhs_bits;
+        case Opcode::I64Sub:
+            return lhs_bits - rhs_bits;
+        case Opcode::I64Mul:
+            return lhs_bits * rhs_bits;
+        case Opcode::I64DivS:
+            if (b64 == 0 || (a64 == INT64_MIN && b64 == -1)) {
+                throw Trap();
+            }
+            return static_cast<uint64_t>(a64 / b64);
+        case Opcode::I64RemS:
+            if (b64 == 0) {
+                throw Trap();
+            }
+            return b64 == -1 ? 0 : static_cast<uint64_t>(a64 % b64);
+        case Opcode::I64And:
+            return lhs_bits & rhs_bits;
+        case Opcode::I64Or:
+            return lhs_bits | rhs_bits;
+        case Opcode::I64Xor:
+            return lhs_bits ^ rhs_bits;
+        case Opcode::I64Shl:
+            return lhs_bits << (rhs_bits & 63);
+        case Opcode::I64ShrS:
+            return static_cast<uint64_t>(a64 >> (rhs_bits & 63));
+        case Opcode::I64ShrU:
+            return lhs_bits >> (rhs_bits & 63);
+        case Opcode::F32Add:
+            return FromF32(f32 + g32);
+        case Opcode::F32Sub:
+            return FromF32(f32 - g32);
+        case Opcode::F32Mul:
+            return FromF32(f32 * g32);
+        case Opcode::F32Div:
+            return FromF32(f32 / g32);
+        case Opcode::F64Add:
+            return FromF64(f64 + g64);
+        case Opcode::F64Sub:
+            return FromF64(f64 - g64);
+        case Opcode::F64Mul:
+            return FromF64(f64 * g64);
+        case Opcode::F64Div:
+            return FromF64(f64 / g64);
+        default:
+            throw std::runtime_error("unknown opcode " + std::to_string(static_cast<int>(opcode)));
+        }
+    }
+};
+
+ir::PassManager::Options GetOptions(int level) {
+    static const ir::PassManager::Level kLevels[] = {ir::PassManager::Level::kO0, ir::PassManager::Level::kO1, ir::PassManager::Level::kO2, ir::PassManager::Level::kO3, ir::PassManager::Level::kOs};
+    return ir::PassManager::GetOptions(kLevels[level]);
+}
+
+// the pass the flag selects on its own, without folding and dead code elimination after it unless it is one of them
+ir::PassManager::Options GetPass(bool ir::PassManager::Options::*pass) {
+    ir::PassManager::Options options;
+    options.*pass = true;
+    return options;
+}
+
+// a program in tests/compilation after the passes the options select
+std::vector<ByteArray::Byte> Optimize(const std::string &test_name, const ir::PassManager::Options &options) {
+    ir::Module module = Lower(test_name, true);
+    ir::PassManager(&module, options).Run();
+    WasmGenerator generator(true, WasmGenerator::Options{options.coalesce_locals, options.peephole});
+    generator.Generate(module);
+    return generator.GetResult().GetData();
+}
+
+struct ExportCall {
+    std::string field;
+    std::vector<uint64_t> arguments;
+};
+
+std::string Run(const std::vector<ByteArray::Byte> &module, const std::vector<ExportCall> &calls) {
+    WasmRunner runner(module);
+    std::string result;
+    for (const ExportCall &call : calls) {
+        result += call.field + ":\n" + runner.Call(call.field, call.arguments);
+    }
+    return result;
+}
+
+// The calls have the output of -O0 after the passes of every level and after each of the passes given. Returns the output
+// of -O0 for the checks of a test.
+std::string ExpectSameOutput(const std::string &test_name, const std::vector<ExportCall> &calls, const std::vector<ir::PassManager::Options> &passes) {
+    const std::string expected = Run(Optimize(test_name, GetOptions(0)), calls);
+    const char *const kLevelNames[] = {"-O0", "-O1", "-O2", "-O3", "-Os"};
+    for (int level = 1; level < 5; level++) {
+        EXPECT_EQ(Run(Optimize(test_name, GetOptions(level)), calls), expected) << test_name << ' ' << kLevelNames[level];
+    }
+    for (size_t i = 0; i < passes.size(); i++) {
+        EXPECT_EQ(Run(Optimize(test_name, passes[i]), calls), expected) << test_name << " pass " << i;
+    }
+    return expected;
+}
+
+// every level keeps what the programs print
+TEST(OptimizationTest, Levels) {
+    for (const std::string test_name : {"loops", "misc", "readme", "structs", "unreachable"}) {
+        EXPECT_NE(ExpectSameOutput(test_name, {{"exported_func", {}}}, {}), "exported_func:\n") << test_name;
+    }
+}
+
+// whatever -Os leaves out or keeps, its code is never larger than that of -O2
+TEST(OptimizationTest, SizeLevels) {
+    for (const std::string test_name : {"coalescing", "dead_code", "folding", "inlining", "licm", "loops", "misc", "numbering", "readme", "strength", "structs", "unreachable"}) {
+        EXPECT_LE(Optimize(test_name, GetOptions(4)).size(), Optimize(test_name, GetOptions(2)).size()) << test_name;
+    }
+}
+
+// fields are stored in place, and a struct bound or assigned to another variable is a copy that changes apart from it
+TEST(StructTest, FieldAssignment) {
+    EXPECT_EQ(ExpectSameOutput("structs", {{"fields", {2}}, {"fields", {1}}}, {}),
+              "fields:\nprint_i32 10\nprint_i32 20\nprint_i64 6\nprint_i32 13\nprint_i32 7\nprint_i32 1\nprint_i64 4\n= 40\n"
+              "fields:\nprint_i32 10\nprint_i32 20\nprint_i64 6\nprint_i32 13\nprint_i32 1\nprint_i64 4\n= 40\n");
+}
+
+// a division by zero or of the minimum by -1 traps, so it is not folded even where its result is not used
+TEST(OptimizationTest, FoldingNearTraps) {
+    const std::string output = ExpectSameOutput(
+        "folding",
+        {{"exported_func", {}}, {"overflow", {0}}, {"overflow", {1}}, {"zero", {0}}, {"zero", {1}}, {"unused", {0}}, {"unused", {1}}},
+        {GetPass(&ir::PassManager::Options::fold_constants), GetPass(&ir::PassManager::Options::eliminate_dead_code)});
+    EXPECT_EQ(
+        output,
+        "exported_func:\nprint_i32 -2147483648\nprint_i32 -2\nprint_i64 9223372036854775807\nprint_i32 -3\nprint_i32 -1\nprint_i32 2\nprint_i32 -4\nprint_f64 inf\n"
+        "overflow:\n= 0\noverflow:\ntrap\nzero:\n= 0\nzero:\ntrap\nunused:\nprint_i32 0\n= 0\nunused:\ntrap\n");
+}
+
+// calls and divisions stay even when their results are not used, the branches never taken go
+TEST(OptimizationTest, DeadCode) {
+    const std::string output = ExpectSameOutput(
+        "dead_code", {{"exported_func", {}}, {"effects", {7}}, {"effects", {0}}},
+        {GetPass(&ir::PassManager::Options::eliminate_dead_code), GetPass(&ir::PassManager::Options::fold_constants)});
+    EXPECT_EQ(output, "exported_func:\nprint_i32 4\nprint_i32 5\neffects:\nprint_i32 7\n= 8\neffects:\nprint_i32 0\ntrap\n");
+}
+
+// inlined bodies keep their prints and early returns, and neither recursion nor a callee with a frame is inlined
+TEST(OptimizationTest, Inlining) {
+    ir::PassManager::Options aggressive = GetPass(&ir::PassManager::Options::inline_calls);
+    aggressive.inliner.small_size = 1024;
+    aggressive.inliner.budget = 1024;
+    const std::string output =
+        ExpectSameOutput("inlining", {{"exported_func", {}}}, {GetPass(&ir::PassManager::Options::inline_calls), aggressive});
+    EXPECT_EQ(output, "exported_func:\nprint_i32 3\nprint_i32 6\nprint_i32 10\nprint_i32 55\nprint_i32 3\nprint_i32 1\nprint_i64 42\n");
+
+    ir::Module module = Lower("inlining", true);
+    ir::PassManager pass_manager(&module, aggressive);
+    pass_manager.Run();
+    const auto inlined = [&pass_manager](const std::string &callee) {
+        return std::any_of(pass_manager.GetRemarks().begin(), pass_manager.GetRemarks().end(), [&callee](const ir::Inliner::Remark &remark) {
+            return remark.inlined && remark.callee == callee;
+        });
+    };
+    for (const std::string callee : {"once", "small", "early"}) {
+        EXPECT_TRUE(inlined(callee)) << callee;
+    }
+    // a frame is taken from the stack by the callee itself
+    EXPECT_FALSE(inlined("make"));
+}
+
+// only what neither traps nor has an effect leaves a loop, a loop running no times must not trap or print
+TEST(OptimizationTest, LoopInvariants) {
+    const ir::PassManager::Options loops = GetPass(&ir::PassManager::Options::optimize_loops);
+    ir::PassManager::Options unrotated = loops;
+    unrotated.loops.rotate = false;
+    const std::string output = ExpectSameOutput(
+        "licm",
+        {{"guarded", {3, 0}}, {"guarded", {3, 5}}, {"late", {0, 0}}, {"late", {2, 0}}, {"late", {2, 5}}, {"calls", {0, 4}}, {"calls", {3, 4}}, {"loads", {4}},
+         {"invariant", {0, 2}}, {"invariant", {4, 2}}},
+        {loops, unrotated});
+    EXPECT_EQ(
+        output,
+        "guarded:\n= 0\nguarded:\n= 60\nlate:\n= 0\nlate:\nprint_i32 0\ntrap\nlate:\nprint_i32 0\nprint_i32 1\n= 40\ncalls:\n= 0\ncalls:\nprint_i32 4\nprint_i32 4\nprint_i32 "
+        "4\n= 24\nloads:\n= 24\ninvariant:\n= 0\ninvariant:\n= 30\n");
+
+    ir::Module module = Lower("licm", true);
+    ir::PassManager pass_manager(&module, loops);
+    pass_manager.Run();
+    EXPECT_EQ(pass_manager.GetStats().at("late").loops.hoisted, 0u);
+    EXPECT_EQ(pass_manager.GetStats().at("loads").loops.hoisted, 0u);
+    EXPECT_GT(pass_manager.GetStats().at("invariant").loops.hoisted, 0u);
+}
+
+// a power of two divisor becomes shifts rounding towards zero as the division does, for negative dividends, a negative
+// divisor and the minimum too
+TEST(OptimizationTest, PowerOfTwoDivisions) {
+    const std::vector<int64_t> values{INT32_MIN, -17, -16, -9, -8, -7, -1, 0, 1, 7, 8, 9, 17, INT32_MAX};
+    const std::vector<int64_t> values64{INT64_MIN, -33, -32, -17, -16, -15, -1, 0, 1, 15, 16, 17, 33, INT64_MAX};
+    std::vector<ExportCall> calls;
+    std::ostringstream expected;
+    for (int64_t value : values) {
+        const auto x = static_cast<int32_t>(value);
+        const std::pair<const char *, int32_t> results[]{
+            {"div8", x / 8}, {"rem8", x % 8}, {"div_minus4", x / -4}, {"rem_minus4", x % -4}, {"div_min", x == INT32_MIN ? 1 : 0}, {"rem_min", x == INT32_MIN ? 0 : x},
+            {"mul", static_cast<int32_t>(static_cast<uint32_t>(x) * 7)}};
+        for (const auto &[field, result] : results) {
+            calls.push_back(ExportCall{field, {static_cast<uint32_t>(x)}});
+            expected << field << ":\n= " << result << '\n';
+        }
+    }
+    for (int64_t x : values64) {
+        calls.push_back(ExportCall{"div16", {static_cast<uint64_t>(x)}});
+        expected << "div16:\n= " << x / 16 << '\n';
+        calls.push_back(ExportCall{"rem16", {static_cast<uint64_t>(x)}});
+        expected << "rem16:\n= " << x % 16 << '\n';
+    }
+
+    ir::PassManager::Options folded = GetPass(&ir::PassManager::Options::reduce_strength);
+    folded.fold_constants = true;
+    EXPECT_EQ(ExpectSameOutput("strength", calls, {GetPass(&ir::PassManager::Options::reduce_strength), folded}), expected.str());
+
+    ir::Module module = Lower("strength", true);
+    ir::PassManager(&module, GetPass(&ir::PassManager::Options::reduce_strength)).Run();
+    for (const std::string name : {"div8", "rem8", "div16", "rem16"}) {
+        for (const auto &block : FindFunction(module, name)->blocks) {
+            for (const auto &instruction : block->instructions) {
+                EXPECT_TRUE(instruction->opcode != ir::Opcode::kDiv && instruction->opcode != ir::Opcode::kRem) << name;
+            }
+        }
+    }
+}
+
+// values live at the same time never share a local, also where the phis of a loop swap or rotate them
+TEST(OptimizationTest, Coalescing) {
+    ir::PassManager::Options separate = GetOptions(2);
+    separate.coalesce_locals = false;
+    const uint64_t one_and_a_half = 0x3ff8000000000000;
+    const std::string output = ExpectSameOutput(
+        "coalescing",
+        {{"swap", {0}}, {"swap", {3}}, {"swap", {4}}, {"rotate", {0}}, {"rotate", {1}}, {"rotate", {2}}, {"rotate", {5}}, {"live", {5}}, {"fibonacci", {one_and_a_half, 0}},
+         {"fibonacci", {one_and_a_half, 6}}},
+        {GetPass(&ir::PassManager::Options::coalesce_locals), separate});
+    EXPECT_EQ(
+        output,
+        "swap:\n= 12\nswap:\n= 21\nswap:\n= 12\nrotate:\n= 10203\nrotate:\n= 20310\nrotate:\n= 31020\nrotate:\n= 310200\nlive:\nprint_i32 42\n= 111\n"
+        "fibonacci:\n= 1.5\nfibonacci:\n= 7.5\n");
+}
+
+std::string Dump(const wasm::Peephole::Code &code) {
+    std::ostringstream oss;
+    for (const wasm::Instruction &instruction : code) {
+        oss << std::hex << static_cast<int>(instruction.opcode) << ' ' << instruction.immediate << "; ";
+    }
+    return oss.str();
+}
+
+// every rule rewrites its pattern into the shorter code, also after another rule, and leaves the near misses alone
+TEST(OptimizationTest, PeepholeRules) {
+    using Opcode = wasm::Opcode;
+    using Code = wasm::Peephole::Code;
+    const uint64_t kEmpty = static_cast<uint32_t>(wasm::ValueType::empty);
+    const std::vector<std::pair<Code, Code>> cases{
+        {{{Opcode::LocalSet, 1}, {Opcode::LocalGet, 1}}, {{Opcode::LocalTee, 1}}},
+        {{{Opcode::LocalSet, 1}, {Opcode::LocalGet, 2}}, {{Opcode::LocalSet, 1}, {Opcode::LocalGet, 2}}},
+        {{{Opcode::Loop, kEmpty}, {Opcode::I32Const, 1}, {Opcode::BrIf, 0}, {Opcode::End}}, {{Opcode::Loop, kEmpty}, {Opcode::Br, 0}, {Opcode::End}}},
+        {{{Opcode::Loop, kEmpty}, {Opcode::I32Const, 0}, {Opcode::BrIf, 0}, {Opcode::Call, 0}, {Opcode::End}}, {{Opcode::Loop, kEmpty}, {Opcode::Call, 0}, {Opcode::End}}},
+        {{{Opcode::LocalGet, 0}, {Opcode::I32Eqz}, {Opcode::I32Eqz}, {Opcode::If, kEmpty}, {Opcode::End}}, {{Opcode::LocalGet, 0}, {Opcode::If, kEmpty}, {Opcode::End}}},
+        {{{Opcode::LocalGet, 0}, {Opcode::I32Eqz}, {Opcode::I32Eqz}, {Opcode::I32Eqz}}, {{Opcode::LocalGet, 0}, {Opcode::I32Eqz}, {Opcode::I32Eqz}, {Opcode::I32Eqz}}},
+        {{{Opcode::I32LtS}, {Opcode::I32Eqz}}, {{Opcode::I32GeS}}},
+        {{{Opcode::I64Ne}, {Opcode::I32Eqz}}, {{Opcode::I64Eq}}},
+        {{{Opcode::I32Eq}, {Opcode::I32Eqz}, {Opcode::I32Eqz}}, {{Opcode::I32Eq}}},
+        {{{Opcode::F64Lt}, {Opcode::I32Eqz}}, {{Opcode::F64Lt}, {Opcode::I32Eqz}}},
+        {{{Opcode::LocalGet, 0}, {Opcode::Drop}}, {}},
+        {{{Opcode::Call, 0}, {Opcode::LocalTee, 1}, {Opcode::Drop}}, {{Opcode::Call, 0}, {Opcode::LocalSet, 1}}},
+        {{{Opcode::Call, 0}, {Opcode::Drop}}, {{Opcode::Call, 0}, {Opcode::Drop}}},
+        {{{Opcode::Loop, kEmpty}, {Opcode::Br, 0}, {Opcode::Call, 0}, {Opcode::I32Add}, {Opcode::End}}, {{Opcode::Loop, kEmpty}, {Opcode::Br, 0}, {Opcode::End}}},
+        {{{Opcode::Return}, {Opcode::LocalGet, 0}, {Opcode::End}}, {{Opcode::Return}, {Opcode::End}}},
+        {{{Opcode::Block, kEmpty}, {Opcode::Block, kEmpty}, {Opcode::Call, 0}, {Opcode::Br, 1}, {Opcode::End}, {Opcode::End}},
+         {{Opcode::Block, kEmpty}, {Opcode::Block, kEmpty}, {Opcode::Call, 0}, {Opcode::End}, {Opcode::End}}},
+        {{{Opcode::Loop, kEmpty}, {Opcode::Block, kEmpty}, {Opcode::Call, 0}, {Opcode::Br, 1}, {Opcode::End}, {Opcode::End}},
+         {{Opcode::Loop, kEmpty}, {Opcode::Block, kEmpty}, {Opcode::Call, 0}, {Opcode::Br, 1}, {Opcode::End}, {Opcode::End}}},
+        {{{Opcode::If, kEmpty}, {Opcode::Br, 0}, {Opcode::Else}, {Opcode::Call, 0}, {Opcode::End}}, {{Opcode::If, kEmpty}, {Opcode::Br, 0}, {Opcode::Else}, {Opcode::Call, 0}, {Opcode::End}}},
+    };
+
+    wasm::Peephole peephole;
+    for (size_t i = 0; i < cases.size(); i++) {
+        Code code = cases[i].first;
+        peephole.Run(&code);
+        EXPECT_EQ(Dump(code), Dump(cases[i].second)) << "case " << i;
+    }
+    for (size_t i = 0; i < wasm::Peephole::GetRules().size(); i++) {
+        EXPECT_GT(peephole.GetHits()[i], 0u) << wasm::Peephole::GetRules()[i].name;
+    }
+}
+
+// the rewrites on their own keep what the programs do
+TEST(OptimizationTest, Peephole) {
+    for (const std::string test_name : {"loops", "misc", "readme", "structs"}) {
+        ExpectSameOutput(test_name, {{"exported_func", {}}}, {GetPass(&ir::PassManager::Options::peephole)});
+    }
+    ExpectSameOutput("licm", {{"guarded", {3, 5}}, {"late", {2, 0}}, {"calls", {3, 4}}, {"loads", {4}}}, {GetPass(&ir::PassManager::Options::peephole)});
+}
+
+// calls of a printing function are all made, while the second call of a pure one and equal arithmetic are reused
+TEST(OptimizationTest, ValueNumbering) {
+    const ir::PassManager::Options numbering = GetPass(&ir::PassManager::Options::number_values);
+    ir::PassManager::Options hoisted = numbering;
+    hoisted.optimize_loops = true;
+    const std::string output = ExpectSameOutput(
+        "numbering", {{"calls", {4}}, {"loads", {3}}, {"redundant", {2, 3}}, {"redundant", {static_cast<uint32_t>(-2), 3}}}, {numbering, hoisted});
+    EXPECT_EQ(output, "calls:\nprint_i32 4\nprint_i32 4\n= 36\nloads:\nprint_i32 0\nprint_i32 1\nprint_i32 2\n= 12\nredundant:\n= 20\nredundant:\n= -15\n");
+
+    ir::Module module = Lower("numbering", true);
+    ir::PassManager pass_manager(&module, numbering);
+    pass_manager.Run();
+    EXPECT_EQ(pass_manager.GetStats().at("calls").numbering.calls, 1u);
+    EXPECT_GT(pass_manager.GetStats().at("redundant").numbering.values, 0u);
+}
+
 #define TEST_TOKENIZER(test_suit_name, test_name, path, folder) \
     TEST(test_suit_name, test_name) {                    \
         TestTokenizer(path, folder);                     \
@@ -155,6 +1463,19 @@ TEST_PARSER(ExpressionTest, Test8, "expression", "test8")
 TEST_PARSER(ExpressionTest, Test9, "expression", "test9 (error)")
 TEST_PARSER(ExpressionTest, Test10, "expression", "test10 (error)")
 
+#define TEST_SYNTAX_ERRORS(test_suit_name, test_name, path, folder) \
+    TEST(test_suit_name, test_name) {                               \
+        TestSyntaxErrors(path, folder);                             \
+    }
+
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test1, "syntax errors", "test1 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test2, "syntax errors", "test2 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test3, "syntax errors", "test3 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test4, "syntax errors", "test4 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test5, "syntax errors", "test5 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test6, "syntax errors", "test6 (error)")
+TEST_SYNTAX_ERRORS(SyntaxErrorsTest, Test7, "syntax errors", "test7 (error)")
+
 TEST_TOKENIZER(WhitespaceTest, Test1, "whitespace", "test1")
 TEST_TOKENIZER(WhitespaceTest, Test2, "whitespace", "test2")
 TEST_TOKENIZER(WhitespaceTest, Test3, "whitespace", "test3")
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Every worker owns a deque of tasks. Submitted tasks are spread over the deques round-robin,
+// a worker takes its newest task first and, once its deque is empty, steals the oldest task of another worker,
+// so tasks of uneven cost still keep all workers busy.
+class ThreadPool final {
+public:
+    explicit ThreadPool(size_t thread_count) {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+
+        queues_.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; i++) {
+            queues_.push_back(std::make_unique<TaskQueue>());
+        }
+
+        workers_.reserve(thread_count);
+        for (size_t i = 0; i < thread_count; i++) {
+            workers_.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_stopped_ = true;
+        }
+        has_tasks_.notify_all();
+
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    size_t GetThreadCount() const {
+        return workers_.size();
+    }
+
+    static size_t GetDefaultThreadCount() {
+        const size_t count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+    // runs func(0) ... func(count - 1) on the pool and waits for all of them,
+    // the exception of the lowest failed index is rethrown, so errors surface in the same order as in a serial loop
+    void ParallelFor(size_t count, const std::function<void(size_t)> &func) {
+        std::vector<std::exception_ptr> errors(count);
+        size_t remaining = count;
+        std::mutex done_mutex;
+        std::condition_variable done;
+
+        for (size_t i = 0; i < count; i++) {
+            Submit([&, i]() {
+                try {
+                    func(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(done_mutex);
+                if (--remaining == 0) {
+                    done.notify_all();
+                }
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(done_mutex);
+            done.wait(lock, [&]() { return remaining == 0; });
+        }
+
+        for (const auto &error : errors) {
+            if (error != nullptr) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+private:
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    // tasks pushed to some queue and not yet claimed by a worker
+    size_t pending_ = 0;
+    size_t next_queue_ = 0;
+    bool is_stopped_ = false;
+
+    void Submit(std::function<void()> &&task) {
+        size_t idx;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idx = next_queue_;
+            next_queue_ = (next_queue_ + 1) % queues_.size();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+            queues_[idx]->tasks.push_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_++;
+        }
+        has_tasks_.notify_one();
+    }
+
+    // a claimed task is already in one of the queues, so the search always ends
+    std::function<void()> TakeTask(size_t worker_idx) {
+        while (true) {
+            for (size_t i = 0; i < queues_.size(); i++) {
+                TaskQueue &queue = *queues_[(worker_idx + i) % queues_.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) {
+                    continue;
+                }
+
+                std::function<void()> task;
+                if (i == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                return task;
+            }
+        }
+    }
+
+    void WorkerLoop(size_t worker_idx) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                has_tasks_.wait(lock, [this]() { return is_stopped_ || pending_ != 0; });
+                if (pending_ == 0) {
+                    return;
+                }
+                pending_--;
+            }
+            TakeTask(worker_idx)();
+        }
+    }
+};
@@ -136,8 +136,8 @@ public:
         Position(
             uint32_t start_line, uint32_t start_column, std::streampos start_offset, uint32_t end_line,
             uint32_t end_column, std::streampos end_offset)
-            : start_line(start_line), start_column(start_column), start_offset(start_offset), end_line(end_line),
-              end_column(end_column), end_offset(end_offset) {}
+            : start_line(start_line), start_column(start_column), end_line(end_line), end_column(end_column),
+              start_offset(start_offset), end_offset(end_offset) {}
 
         std::string ToString() const {
             std::ostringstream oss;
@@ -148,9 +148,9 @@ public:
         }
     };
 
-    Token() : type_(Token::Type::kEmpty), position_(0, 0, 0, 0, 0, 0) {}
-    Token(Type type, Position position) : type_(type), position_(position) {}
-    Token(TokenValue value, Type type, Position position) : type_(type), value_(value), position_(position) {}
+    Token() : position_(0, 0, 0, 0, 0, 0), type_(Token::Type::kEmpty) {}
+    Token(Type type, Position position) : position_(position), type_(type) {}
+    Token(TokenValue value, Type type, Position position) : position_(position), type_(type), value_(value) {}
 
     Position GetPosition() const {
         return position_;
@@ -28,26 +28,26 @@ public:
 
     TokenValue() : type_(Type::kEmpty) {}
 
-    TokenValue(bool val) : bool_(val), type_(Type::kBool) {}
+    TokenValue(bool val) : type_(Type::kBool), bool_(val) {}
 
-    TokenValue(char val) : char_(val), type_(Type::kChar) {}
+    TokenValue(char val) : type_(Type::kChar), char_(val) {}
 
-    TokenValue(uint8_t val) : u8_(val), type_(Type::kU8) {}
-    TokenValue(uint16_t val) : u16_(val), type_(Type::kU16) {}
-    TokenValue(uint32_t val) : u32_(val), type_(Type::kU32) {}
-    TokenValue(uint64_t val) : u64_(val), type_(Type::kU64) {}
+    TokenValue(uint8_t val) : type_(Type::kU8), u8_(val) {}
+    TokenValue(uint16_t val) : type_(Type::kU16), u16_(val) {}
+    TokenValue(uint32_t val) : type_(Type::kU32), u32_(val) {}
+    TokenValue(uint64_t val) : type_(Type::kU64), u64_(val) {}
 
-    TokenValue(int8_t val) : i8_(val), type_(Type::kI8) {}
-    TokenValue(int16_t val) : i16_(val), type_(Type::kI16) {}
-    TokenValue(int32_t val) : i32_(val), type_(Type::kI32) {}
-    TokenValue(int64_t val) : i64_(val), type_(Type::kI64) {}
+    TokenValue(int8_t val) : type_(Type::kI8), i8_(val) {}
+    TokenValue(int16_t val) : type_(Type::kI16), i16_(val) {}
+    TokenValue(int32_t val) : type_(Type::kI32), i32_(val) {}
+    TokenValue(int64_t val) : type_(Type::kI64), i64_(val) {}
 
-    TokenValue(float val) : f32_(val), type_(Type::kF32) {}
-    TokenValue(double val) : f64_(val), type_(Type::kF64) {}
+    TokenValue(float val) : type_(Type::kF32), f32_(val) {}
+    TokenValue(double val) : type_(Type::kF64), f64_(val) {}
 
-    TokenValue(std::string val) : text_(val), type_(Type::kText) {}
+    TokenValue(std::string val) : type_(Type::kText), text_(val) {}
 
-    TokenValue(const std::vector<uint8_t> &val) : byte_string_(val), type_(Type::kByteString) {}
+    TokenValue(const std::vector<uint8_t> &val) : type_(Type::kByteString), byte_string_(val) {}
 
     operator bool() const {
         return bool_;
@@ -27,11 +27,11 @@ Token Tokenizer::Next() {
     if (TokenizerHelper::IsDecDigit(c0)) {
         return TokenizeNumber();
     } else if (
-        c0 == '_' && TokenizerHelper::IsAlphanumeric(c1) || c0 >= 'a' && c0 <= 'z' && c0 != 'r' && c0 != 'b' ||
-        c0 >= 'A' && c0 <= 'Z' ||
-        c0 == 'r' && (c1 != '"' && (c1 != '#' || c2 != '"' && c2 != '#')) || //! raw string literals
-        c0 == 'b' && c1 != '\'' && c1 != '"' && (c1 != 'r' || c2 != '"' && c2 != '#') || //! byte and byte string literals
-        c0 == '\'' && ((c1 == '_' || c1 >= 'a' && c1 <= 'z' || c1 >= 'A' && c1 <= 'Z') && c2 != '\'')) { //! lifetimes and loop labels
+        (c0 == '_' && TokenizerHelper::IsAlphanumeric(c1)) || (c0 >= 'a' && c0 <= 'z' && c0 != 'r' && c0 != 'b') ||
+        (c0 >= 'A' && c0 <= 'Z') ||
+        (c0 == 'r' && (c1 != '"' && (c1 != '#' || (c2 != '"' && c2 != '#')))) || //! raw string literals
+        (c0 == 'b' && c1 != '\'' && c1 != '"' && (c1 != 'r' || (c2 != '"' && c2 != '#'))) || //! byte and byte string literals
+        (c0 == '\'' && (c1 == '_' || (c1 >= 'a' && c1 <= 'z') || (c1 >= 'A' && c1 <= 'Z')) && c2 != '\'')) { //! lifetimes and loop labels
         return TokenizeIdentifierOrKeyword();
     }
 
@@ -121,7 +121,7 @@ Token Tokenizer::TokenizeIdentifierOrKeyword() {
         if (!TokenizerHelper::IsAlphanumeric(c)) {
             return MakeError("expected alphanumeric symbol");
         }
-    } else if (c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z') {
+    } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
         stream_.SkipChar(1);
         c = stream_.PeekChar(0);
     } else {
@@ -139,9 +139,9 @@ Token Tokenizer::TokenizeIdentifierOrKeyword() {
             identifier_buf != "Self") {
             return MakeIdentifier(identifier_buf);
         }
-    } else if (!KeywordManager::GetInstance().IsStrictOrReservedKeyword(identifier_buf)) {
+    } else if (!keyword_manager_.IsStrictOrReservedKeyword(identifier_buf)) {
         return MakeIdentifier(identifier_buf);
-    } else if (const Keyword *keyword = KeywordManager::GetInstance().Find(identifier_buf)) {
+    } else if (const Keyword *keyword = keyword_manager_.Find(identifier_buf)) {
         if (keyword->GetTokenType() == Token::Type::kTrue) {
             return MakeLiteral(true);
         } else if (keyword->GetTokenType() == Token::Type::kFalse) {
@@ -282,7 +282,7 @@ Token Tokenizer::TokenizeByte() {
         if (!TokenizerHelper::TryGetByteEscape(&stream_, &result)) {
             return MakeError("unknown character escape");
         }
-    } else if (c >= 0x00 && c <= 0x7f) {
+    } else if (static_cast<unsigned char>(c) <= 0x7f) {
         stream_.SkipChar(1);
         result = c;
     } else {
@@ -332,7 +332,7 @@ Token Tokenizer::TokenizeByteString() {
             } else if (!TokenizerHelper::TryGetByteEscape(&stream_, &result)) {
                 return MakeError("unknown character escape");
             }
-        } else if (c >= 0x00 && c <= 0x7f) {
+        } else if (static_cast<unsigned char>(c) <= 0x7f) {
             stream_.SkipChar(1);
             result = c;
         } else {
@@ -381,7 +381,7 @@ Token Tokenizer::TokenizeRawByteString() {
             hash_count = 0;
         }
 
-        if (c >= 0x00 && c <= 0x7f) {
+        if (static_cast<unsigned char>(c) <= 0x7f) {
             raw_byte_string_buf.push_back(c);
         } else {
             return MakeError("invalid sequence of characters");
@@ -430,8 +430,8 @@ Token Tokenizer::TokenizeNumber() {
     digits.push_back(0);
 
     do {
-        if (system == 2 && TokenizerHelper::IsBinDigit(c) || system == 8 && TokenizerHelper::IsOctDigit(c) ||
-            system == 10 && TokenizerHelper::IsDecDigit(c))
+        if ((system == 2 && TokenizerHelper::IsBinDigit(c)) || (system == 8 && TokenizerHelper::IsOctDigit(c)) ||
+            (system == 10 && TokenizerHelper::IsDecDigit(c)))
         {
             digits.push_back(c - '0');
             is_digit_found = true;
@@ -31,6 +31,7 @@ public:
 private:
     InputStream stream_;
     TargetType target_type_;
+    const KeywordManager keyword_manager_;
 
     bool next_buffered_ = false;
     Token next_;
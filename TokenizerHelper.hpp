@@ -9,7 +9,7 @@ public:
     }
 
     static bool IsAlphanumeric(char it) {
-        return it >= 'a' && it <= 'z' || it >= 'A' && it <= 'Z' || it >= '0' && it <= '9' || it == '_';
+        return (it >= 'a' && it <= 'z') || (it >= 'A' && it <= 'Z') || (it >= '0' && it <= '9') || it == '_';
     }
 
     static bool IsBinDigit(char it) {
@@ -25,7 +25,7 @@ public:
     }
 
     static bool IsHexDigit(char it) {
-        return IsDecDigit(it) || it >= 'a' && it <= 'f' || it >= 'A' && it <= 'F';
+        return IsDecDigit(it) || (it >= 'a' && it <= 'f') || (it >= 'A' && it <= 'F');
     }
 
     static char BinToInt(char it) {
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Symbol.hpp"
+#include "TypesHelper.hpp"
+
+namespace semantic {
+    // Owns every type created by one analysis and hands out its id.
+    // References, tuples and arrays are hash-consed: asking twice for the same structure returns the same object,
+    // structs and functions are nominal and get a fresh id each. The default types are owned by the root pool
+    // and have the ids below DefaultType::kIdCount, one per TokenValue::Type followed by usize and isize.
+    //
+    // A pool created on top of a parent first looks the structure up in the parent and only creates the missing types,
+    // it never changes the parent, so several of them can be filled concurrently while the parent is read-only.
+    // Their ids continue after the parent's ones and may repeat between siblings, hence types of two sibling pools must not be compared.
+    class TypePool final {
+    public:
+        TypePool() : parent_(nullptr), first_id_(DefaultType::kIdCount) {
+            default_types_.reserve(DefaultType::kIdCount);
+            for (uint32_t id = 0; id < DefaultType::kUSizeId; id++) {
+                default_types_.emplace_back(static_cast<TokenValue::Type>(id));
+            }
+            default_types_.emplace_back(TokenValue::Type::kU64, DefaultType::kUSizeId);
+            default_types_.emplace_back(TokenValue::Type::kI64, DefaultType::kISizeId);
+        }
+
+        explicit TypePool(const TypePool *parent) : parent_(parent), first_id_(parent->GetNextId()) {}
+
+        const DefaultType *GetDefaultType(TokenValue::Type type) const {
+            return GetDefaultType(static_cast<uint32_t>(type));
+        }
+
+        const DefaultType *GetUSizeType() const {
+            return GetDefaultType(DefaultType::kUSizeId);
+        }
+
+        // nullptr when there is no default type with this name
+        const DefaultType *FindDefaultType(const std::string &name) const {
+            const uint32_t id = TypesHelper::FindDefaultTypeId(name);
+            return id != DefaultType::kIdCount ? GetDefaultType(id) : nullptr;
+        }
+
+        // nullptr when no default type has this id
+        const DefaultType *FindDefaultType(uint32_t id) const {
+            return id < DefaultType::kIdCount ? GetDefaultType(id) : nullptr;
+        }
+
+        template <typename T>
+        T *Add(std::unique_ptr<T> &&type) {
+            T *result = type.get();
+            result->id_ = GetNextId();
+            types_.push_back(std::move(type));
+            return result;
+        }
+
+        const ReferenceType *GetReferenceType(bool is_mut, const ISymbolType *type) {
+            if (type == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            const uint64_t key = static_cast<uint64_t>(type->GetId()) << 1 | (is_mut ? 1 : 0);
+            if (auto result = Find(&TypePool::reference_types_, key); result != nullptr) {
+                return result;
+            }
+            return reference_types_[key] = Add(std::make_unique<ReferenceType>(is_mut, type));
+        }
+
+        const ArrayType *GetArrayType(const ISymbolType *type) {
+            if (type == nullptr) {
+                throw std::exception();  // todo
+            }
+
+            if (auto result = Find(&TypePool::array_types_, type->GetId()); result != nullptr) {
+                return result;
+            }
+            return array_types_[type->GetId()] = Add(std::make_unique<ArrayType>(type));
+        }
+
+        const TupleType *GetTupleType(const std::vector<const ISymbolType *> &types) {
+            std::vector<uint32_t> key;
+            key.reserve(types.size());
+            for (const ISymbolType *type : types) {
+                if (type == nullptr) {
+                    throw std::exception();  // todo
+                }
+                key.push_back(type->GetId());
+            }
+
+            if (auto result = Find(&TypePool::tuple_types_, key); result != nullptr) {
+                return result;
+            }
+            return tuple_types_[key] = Add(std::make_unique<TupleType>(types));
+        }
+
+    private:
+        struct KeyHash {
+            size_t operator()(const std::vector<uint32_t> &key) const {
+                uint64_t hash = 14695981039346656037ull;
+                for (uint32_t id : key) {
+                    hash = (hash ^ id) * 1099511628211ull;
+                }
+                return static_cast<size_t>(hash);
+            }
+        };
+
+        const TypePool *parent_;
+        uint32_t first_id_;
+
+        // indexed by id, empty in every pool but the root
+        std::vector<DefaultType> default_types_;
+        std::vector<std::unique_ptr<ISymbolType>> types_;
+        std::unordered_map<uint64_t, const ReferenceType *> reference_types_;
+        std::unordered_map<uint32_t, const ArrayType *> array_types_;
+        std::unordered_map<std::vector<uint32_t>, const TupleType *, KeyHash> tuple_types_;
+
+        const DefaultType *GetDefaultType(uint32_t id) const {
+            return parent_ != nullptr ? parent_->GetDefaultType(id) : &default_types_[id];
+        }
+
+        uint32_t GetNextId() const {
+            return first_id_ + static_cast<uint32_t>(types_.size());
+        }
+
+        // looks the key up in this pool and then in its parents
+        template <typename Map, typename Key>
+        typename Map::mapped_type Find(Map TypePool::*map, const Key &key) const {
+            for (auto current = this; current != nullptr; current = current->parent_) {
+                const auto it = (current->*map).find(key);
+                if (it != (current->*map).end()) {
+                    return it->second;
+                }
+            }
+            return nullptr;
+        }
+    };
+}
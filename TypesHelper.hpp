@@ -7,19 +7,17 @@
 
 class TypesHelper {
 public:
-    static const semantic::DefaultType &ConvertToDefaultType(const std::string &type) {
-        return kDefaultTypes.at(type);
+    // id of the default type with this name, DefaultType::kIdCount when there is none
+    static uint32_t FindDefaultTypeId(const std::string &type) {
+        const auto it = kDefaultTypeIds.find(type);
+        return it != kDefaultTypeIds.end() ? it->second : semantic::DefaultType::kIdCount;
     }
 
     static std::string ConvertToString(TokenValue::Type type) {
         return kRawTypeToStr.at(type);
     }
 
-    static const semantic::DefaultType &ConvertToDefaultType(TokenValue::Type type) {
-        return ConvertToDefaultType(ConvertToString(type));
-    }
-
-    static const TokenValue::Type ConvertToRawType(const std::string &type) {
+    static TokenValue::Type ConvertToRawType(const std::string &type) {
         return kStrToRawType.at(type);
     }
 
@@ -32,6 +30,29 @@ public:
         return result;
     }
 
+    // value type of a local holding the type, ValueType::empty when there is none;
+    // a struct lives in linear memory and the local holds its address
+    static wasm::ValueType ToLocalType(const ISymbolType *type) {
+        if (dynamic_cast<const semantic::SubsetStructType *>(type) != nullptr) {
+            return wasm::ValueType::i32;
+        }
+
+        const auto default_type = dynamic_cast<const semantic::DefaultType *>(type);
+        if (default_type == nullptr) {
+            return wasm::ValueType::empty;
+        }
+
+        switch (default_type->type) {
+        case TokenValue::Type::kI32:
+        case TokenValue::Type::kI64:
+        case TokenValue::Type::kF32:
+        case TokenValue::Type::kF64:
+            return ConvertToWasm(default_type->type);
+        default:
+            return wasm::ValueType::empty;
+        }
+    }
+
     static wasm::ValueType ConvertToWasm(TokenValue::Type type) {
         switch (type) {
         case TokenValue::Type::kI32:
@@ -47,18 +68,20 @@ public:
         }
     }
 
-    const static std::map<std::string, semantic::DefaultType> kDefaultTypes;
+    const static std::map<std::string, uint32_t> kDefaultTypeIds;
     const static std::map<TokenValue::Type, std::string> kRawTypeToStr;
     const static std::map<std::string, TokenValue::Type> kStrToRawType;
 };
 
-const std::map<std::string, semantic::DefaultType> TypesHelper::kDefaultTypes{
-    {"bool", semantic::DefaultType(TokenValue::Type::kBool)}, {"char", semantic::DefaultType(TokenValue::Type::kChar)}, {"u8", semantic::DefaultType(TokenValue::Type::kU8)},
-    {"u16", semantic::DefaultType(TokenValue::Type::kU16)},   {"u32", semantic::DefaultType(TokenValue::Type::kU32)},   {"u64", semantic::DefaultType(TokenValue::Type::kU64)},
-    {"i8", semantic::DefaultType(TokenValue::Type::kI8)},     {"i16", semantic::DefaultType(TokenValue::Type::kI16)},   {"i32", semantic::DefaultType(TokenValue::Type::kI32)},
-    {"i64", semantic::DefaultType(TokenValue::Type::kI64)},   {"f32", semantic::DefaultType(TokenValue::Type::kF32)},   {"f64", semantic::DefaultType(TokenValue::Type::kF64)},
-    {"str", semantic::DefaultType(TokenValue::Type::kText)},  {"usize", semantic::DefaultType(TokenValue::Type::kU64)}, {"isize", semantic::DefaultType(TokenValue::Type::kI64)},
-    {"void", semantic::DefaultType(TokenValue::Type::kVoid)}};
+const std::map<std::string, uint32_t> TypesHelper::kDefaultTypeIds{
+    {"bool", static_cast<uint32_t>(TokenValue::Type::kBool)}, {"char", static_cast<uint32_t>(TokenValue::Type::kChar)},
+    {"u8", static_cast<uint32_t>(TokenValue::Type::kU8)},     {"u16", static_cast<uint32_t>(TokenValue::Type::kU16)},
+    {"u32", static_cast<uint32_t>(TokenValue::Type::kU32)},   {"u64", static_cast<uint32_t>(TokenValue::Type::kU64)},
+    {"i8", static_cast<uint32_t>(TokenValue::Type::kI8)},     {"i16", static_cast<uint32_t>(TokenValue::Type::kI16)},
+    {"i32", static_cast<uint32_t>(TokenValue::Type::kI32)},   {"i64", static_cast<uint32_t>(TokenValue::Type::kI64)},
+    {"f32", static_cast<uint32_t>(TokenValue::Type::kF32)},   {"f64", static_cast<uint32_t>(TokenValue::Type::kF64)},
+    {"str", static_cast<uint32_t>(TokenValue::Type::kText)},  {"void", static_cast<uint32_t>(TokenValue::Type::kVoid)},
+    {"usize", semantic::DefaultType::kUSizeId},                {"isize", semantic::DefaultType::kISizeId}};
 
 const std::map<TokenValue::Type, std::string> TypesHelper::kRawTypeToStr{
     {TokenValue::Type::kBool, "bool"}, {TokenValue::Type::kU16, "u16"}, {TokenValue::Type::kI8, "i8"},     {TokenValue::Type::kI64, "i64"}, {TokenValue::Type::kChar, "char"},
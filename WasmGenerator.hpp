@@ -1,20 +1,19 @@
 #pragma once
 
+#include <array>
+#include <cassert>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <ostream>
-#include <stack>
 #include <unordered_map>
+#include <unordered_set>
 
-#include "SemanticAnalyzer.hpp"
+#include "IRAnalysis.hpp"
+#include "IRLowering.hpp"
+#include "WasmPeephole.hpp"
 #include "WasmTypes.hpp"
 
-#define UNUSED(type) \
-    void PostVisit(const type *) override {}
-#define NOT_IMPLEMENTED(type)               \
-    void PostVisit(const type *) override { \
-        throw std::exception();             \
-    }
-
 class ByteArray final {
     using ValueType = wasm::ValueType;
     using SectionType = wasm::SectionType;
@@ -54,6 +53,10 @@ public:
         }
     }
 
+    const std::vector<Byte> &GetData() const {
+        return data_;
+    }
+
     // todo implement << ?
 
     uint32_t GetSize() const {
@@ -80,442 +83,798 @@ private:
     std::vector<Byte> data_;
 };
 
-class WasmGenerator final : private ISyntaxTreeVisitor {
+class WasmGenerator final {
     using ValueType = wasm::ValueType;
     using SectionType = wasm::SectionType;
+    using Opcode = wasm::Opcode;
+    using Code = std::vector<wasm::Instruction>;
+    // runs of locals of one value type as they are declared in the code section
+    using Locals = std::vector<std::pair<ValueType, uint32_t>>;
 
 public:
+    struct Options {
+        // values not live at the same time share a local, otherwise every value has one
+        bool coalesce_locals = true;
+        // see wasm::Peephole
+        bool peephole = true;
+    };
+
+    // without reordering struct fields keep their declaration order, see semantic::LayoutEngine
+    explicit WasmGenerator(bool reorder_fields = true) : WasmGenerator(reorder_fields, Options()) {}
+
+    WasmGenerator(bool reorder_fields, Options options) : reorder_fields_(reorder_fields), options_(options) {}
+
     ByteArray GetResult() const {
         return result_;
     }
 
-    void Generate(const SyntaxTree *node, const ImportExportTable *import_export_table) {
-        iet_ = import_export_table;
-        Visit(node);
+    // the rewrites of the emitted code, see wasm::Peephole::GetRules
+    const wasm::Peephole &GetPeephole() const {
+        return peephole_;
     }
 
-protected:
-    void PostVisit(const ReturnNode *node) override {
-        Visit(node->GetExpression());
-        current_result_.Push(0x0f);
+    // the time spent on assigning the locals of the functions and on their peephole rewrites
+    std::chrono::steady_clock::duration GetLocalsTime() const {
+        return locals_time_;
+    }
 
-        stack_length_--;
+    std::chrono::steady_clock::duration GetPeepholeTime() const {
+        return peephole_time_;
     }
 
-    void PostVisit(const FunctionNode *node) override {
-        if (nested_func_) {
-            throw std::exception();  // todo
+    void Generate(const SyntaxTree *, const ImportExportTable *import_export_table, const semantic::Annotations *annotations) {
+        Generate(ir::Lowering(import_export_table, annotations, reorder_fields_).Lower(annotations->reachable_functions));
+    }
+
+    // only the functions reachable from the exports are analyzed and emitted
+    void Generate(const SyntaxTree *, const ImportExportTable *import_export_table, semantic::QueryEngine *queries) {
+        const std::vector<const FunctionNode *> &functions = queries->CheckReachable(nullptr);
+        Generate(ir::Lowering(import_export_table, &queries->GetAnnotations(), reorder_fields_).Lower(functions));
+    }
+
+    // a function is the one at its position in the module, the imports come first
+    void Generate(const ir::Module &module) {
+        function_indexes_.clear();
+        for (const auto &function : module.functions) {
+            const auto index = static_cast<uint32_t>(function_indexes_.size());
+            function_indexes_[function.get()] = index;
         }
 
-        current_result_ = ByteArray();
+        uint32_t import_count = 0;
+        for (const auto &function : module.functions) {
+            if (function->imported) {
+                AddImportFunc(function->import_module, function->import_field, AddType(function->params, GetResults(function.get())));
+                import_count++;
+            }
+        }
 
-        const auto saved_nested_func = nested_func_;
-        nested_func_ = true;
+        if (module.UsesMemory()) {
+            AddMemory();
+            AddStackPointer();
+        }
 
-        std::vector<semantic::LetSymbol *> let_symbols;
-        node->GetBlock()->symbol_table->GetAllSymbols(let_symbols);
+        for (const auto &function : module.functions) {
+            if (function->imported) {
+                continue;
+            }
 
-        std::map<ValueType, std::vector<semantic::LetSymbol *>> grouped_symbols;
+            const uint32_t type = AddType(function->params, GetResults(function.get()));
+            Locals locals;
+            Code code = EmitFunction(function.get(), &locals);
+            if (options_.peephole) {
+                const auto start = std::chrono::steady_clock::now();
+                peephole_.Run(&code);
+                peephole_time_ += std::chrono::steady_clock::now() - start;
+            }
+            const uint32_t index = AddFunc(type, locals, Encode(code));
 
-        for (semantic::LetSymbol *let_symbol : let_symbols) {
-            auto default_type = dynamic_cast<const semantic::DefaultType *>(UnrefType(let_symbol->type));
-            grouped_symbols[TypesHelper::ConvertToWasm(default_type->type)].push_back(let_symbol);
+            if (!function->export_field.empty()) {
+                AddExportFunc(function->export_field, import_count + index);
+            }
         }
 
-        std::map<ValueType, uint32_t> locals;
+        Finalize();
+    }
+
+private:
+    // a wasm block, loop or if the code is in, block is the one a br to the label goes to and nullptr for an if
+    struct Label {
+        const ir::Block *block;
+        bool is_loop;
+    };
 
-        std::map<const semantic::LetSymbol *, uint32_t> func_args;
-        for (uint32_t i = 0; i < node->GetParams().size(); i++) {
-            auto identifier = BrutalCast<const IdentifierPatternNode *>(node->GetParams()[i]->GetPattern());
-            func_args[identifier->let_node] = i;
+    ByteArray result_;
+    bool reorder_fields_;
+    Options options_;
+    wasm::Peephole peephole_;
+    std::chrono::steady_clock::duration locals_time_{};
+    std::chrono::steady_clock::duration peephole_time_{};
+    std::unordered_map<const ir::Function *, uint32_t> function_indexes_;
+
+    // the state of the function being emitted
+    const ir::Function *function_ = nullptr;
+    const ir::DominatorTree *tree_ = nullptr;
+    const ir::LoopInfo *loops_ = nullptr;
+    Code code_;
+    std::vector<Label> labels_;
+    // the blocks placed after the end of a wasm block rather than where they are branched to
+    std::unordered_set<const ir::Block *> followers_;
+    // uses of a value in the reachable blocks and its last user
+    std::unordered_map<const ir::Instruction *, uint32_t> uses_;
+    std::unordered_map<const ir::Instruction *, const ir::Instruction *> users_;
+    // the values left on the operand stack for their user
+    std::unordered_set<const ir::Instruction *> stackified_;
+    std::unordered_map<const ir::Instruction *, uint32_t> locals_;
+    uint32_t frame_local_ = 0;
+
+    // the stack pointer is global 0, the stack grows down from the end of the memory, 1 MiB as the stack of a rust thread
+    static constexpr uint32_t kStackPointerGlobal = 0;
+    static constexpr uint32_t kPageSize = 65536;
+    static constexpr uint32_t kStackPages = 16;
+    static constexpr int32_t kStackTop = kPageSize * kStackPages;
+
+    static constexpr std::array<ValueType, 4> kLocalTypes{ValueType::f64, ValueType::f32, ValueType::i64, ValueType::i32};
+
+    static size_t GetLocalTypeIndex(ValueType type) {
+        switch (type) {
+        case ValueType::f64:
+            return 0;
+        case ValueType::f32:
+            return 1;
+        case ValueType::i64:
+            return 2;
+        default:
+            // the ir has no other value types
+            assert(type == ValueType::i32);
+            return 3;
         }
+    }
 
-        ByteArray header_func;
-
-        uint32_t local_index = node->GetParams().size();
-        for (auto &it : grouped_symbols) {
-            locals[it.first] = it.second.size();
-            for (semantic::LetSymbol *symbol : it.second) {
-                symbol->local_indexes.push_back(local_index++);
+    static std::vector<ValueType> GetResults(const ir::Function *function) {
+        return function->result != ValueType::empty ? std::vector<ValueType>{function->result} : std::vector<ValueType>();
+    }
 
-                auto it = func_args.find(symbol);
-                if (it != func_args.end()) {
-                    header_func.Push(0x20);
-                    header_func.Push(ToUnsignedLeb128(it->second));
-                    header_func.Push(0x21);
-                    header_func.Push(ToUnsignedLeb128(symbol->local_indexes.front()));
+    // Emits the body with the block structure recovered from the dominator tree as in "Beyond Relooper" by Ramsey: a block
+    // reached along several forward edges or leaving a loop follows the end of a wasm block wrapped around the code of its
+    // immediate dominator, a loop header starts a wasm loop, and any other block is emitted where it is branched to.
+    Code EmitFunction(const ir::Function *function, Locals *locals) {
+        const ir::DominatorTree tree(function);
+        const ir::LoopInfo loops(tree);
+        function_ = function;
+        tree_ = &tree;
+        loops_ = &loops;
+        code_.clear();
+        labels_.clear();
+
+        followers_.clear();
+        for (const ir::Block *block : tree.GetOrder()) {
+            if (tree.GetForwardPredecessorCount(block) > 1) {
+                followers_.insert(block);
+            }
+        }
+        for (const ir::Block *header : loops.GetHeaders()) {
+            for (const ir::Block *child : tree.GetChildren(header)) {
+                if (!loops.Contains(header, child)) {
+                    followers_.insert(child);
                 }
             }
         }
 
-        Visit(node->GetBlock());
-
-        for (uint32_t i = 0; i < stack_length_; i++) {
-            current_result_.Push(0x1a);
+        CountUses();
+        Stackify();
+        const auto start = std::chrono::steady_clock::now();
+        AssignLocals(locals);
+        locals_time_ += std::chrono::steady_clock::now() - start;
+
+        // the frame is taken from the stack for the whole call, a stack pointer below the memory traps before the frame is
+        // used rather than at a store wrapping around to the end of the address space
+        if (function->frame_size != 0) {
+            Push(Opcode::GlobalGet, kStackPointerGlobal);
+            Push(Opcode::I32Const, function->frame_size);
+            Push(Opcode::I32Sub);
+            Push(Opcode::LocalTee, frame_local_);
+            Push(Opcode::GlobalSet, kStackPointerGlobal);
+            Push(Opcode::LocalGet, frame_local_);
+            Push(Opcode::I32Const, 0);
+            Push(Opcode::I32LtS);
+            Push(Opcode::If, static_cast<uint32_t>(ValueType::empty));
+            Push(Opcode::Unreachable);
+            Push(Opcode::End);
         }
-        stack_length_ = 0;
 
-        nested_func_ = saved_nested_func;
+        EmitTree(function->GetEntry());
 
-        header_func.Push(current_result_);
+        // the end of the body returns too
+        if (!code_.empty() && code_.back().opcode == Opcode::Return) {
+            code_.pop_back();
+        } else if (function->result != ValueType::empty && (code_.empty() || !IsUnconditional(code_.back().opcode))) {
+            Push(Opcode::Unreachable);
+        }
 
-        function_byte_arrays_.emplace_back(node, std::make_pair(header_func, locals));
+        function_ = nullptr;
+        tree_ = nullptr;
+        loops_ = nullptr;
+        return std::move(code_);
     }
 
-    void PostVisit(const BlockNode *node) override {
-        for (const SyntaxNode *statement : node->GetStatements()) {
-            Visit(statement);
+    static bool IsUnconditional(Opcode opcode) {
+        return opcode == Opcode::Br || opcode == Opcode::Return || opcode == Opcode::Unreachable;
+    }
+
+    // a phi is used along the edges from the reachable predecessors only
+    void CountUses() {
+        uses_.clear();
+        users_.clear();
+        for (const ir::Block *block : tree_->GetOrder()) {
+            for (const auto &instruction : block->instructions) {
+                for (size_t i = 0; i < instruction->operands.size(); i++) {
+                    if (instruction->opcode == ir::Opcode::kPhi && !tree_->IsReachable(block->predecessors[i])) {
+                        continue;
+                    }
+                    uses_[instruction->operands[i]]++;
+                    users_[instruction->operands[i]] = instruction.get();
+                }
+            }
         }
+    }
 
-        Visit(node->GetReturnExpression());
+    // whether the instruction is emitted in its block, a const is pushed at every use and the others live in locals
+    static bool IsEmitted(const ir::Instruction *instruction) {
+        switch (instruction->opcode) {
+        case ir::Opcode::kConst:
+        case ir::Opcode::kParam:
+        case ir::Opcode::kFrame:
+        case ir::Opcode::kPhi:
+            return false;
+        default:
+            return true;
+        }
     }
 
-    void PostVisit(const SyntaxTree *node) override {
-        for (size_t i = 0; i < iet_->imports.size(); i++) {
-            const auto &it = iet_->imports[i];
+    uint32_t GetUses(const ir::Instruction *instruction) const {
+        const auto it = uses_.find(instruction);
+        return it != uses_.end() ? it->second : 0;
+    }
 
-            const uint32_t type_imported_func = AddType(it.type.GetWasmParams(), it.type.GetWasmReturn());
-            AddImportFunc(it.module, it.field, type_imported_func);
+    // A value used once later in its block can stay on the operand stack when the values emitted in between leave it
+    // below the operands of its user, so that those are taken in order from the top. Values breaking this for a user
+    // go to locals instead until every user finds its stack operands on top.
+    void Stackify() {
+        stackified_.clear();
+        for (const ir::Block *block : tree_->GetOrder()) {
+            for (const auto &instruction : block->instructions) {
+                if (instruction->type != ValueType::empty && IsEmitted(instruction.get()) && GetUses(instruction.get()) == 1) {
+                    const ir::Instruction *user = users_.at(instruction.get());
+                    if (user->block == block && user->opcode != ir::Opcode::kPhi) {
+                        stackified_.insert(instruction.get());
+                    }
+                }
+            }
         }
 
-        for (const SyntaxNode *child : node->GetNodes()) {
-            Visit(child);
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const ir::Block *block : tree_->GetOrder()) {
+                std::vector<const ir::Instruction *> stack;
+                for (const auto &instruction : block->instructions) {
+                    if (!IsEmitted(instruction.get())) {
+                        continue;
+                    }
+
+                    const std::vector<ir::Instruction *> &operands = instruction->operands;
+                    size_t count = 0;
+                    while (count < operands.size() && stackified_.count(operands[count]) != 0) {
+                        count++;
+                    }
+                    bool valid = count <= stack.size() && std::equal(operands.begin(), operands.begin() + count, stack.end() - count);
+                    for (size_t i = count; i < operands.size(); i++) {
+                        valid = valid && stackified_.count(operands[i]) == 0;
+                    }
+
+                    if (!valid) {
+                        for (const ir::Instruction *operand : operands) {
+                            stackified_.erase(operand);
+                        }
+                        changed = true;
+                        break;
+                    }
+
+                    stack.resize(stack.size() - count);
+                    if (stackified_.count(instruction.get()) != 0) {
+                        stack.push_back(instruction.get());
+                    }
+                }
+            }
         }
+    }
 
-        using simplify_type = std::pair<const FunctionNode *, std::pair<ByteArray, std::map<ValueType, uint32_t>>>;
-        std::sort(function_byte_arrays_.begin(), function_byte_arrays_.end(), [](simplify_type &lhs, simplify_type &rhs) {
-            return lhs.first->symbol->func_iet < rhs.first->symbol->func_iet;
-        });
-
-        uint32_t found_exports = 0;
-        for (size_t i = 0; i < function_byte_arrays_.size(); i++) {
-            if (function_byte_arrays_[i].first->symbol->func_iet >= iet_->imports.size() && function_byte_arrays_[i].first->symbol->func_iet < iet_->imports.size() + iet_->exports.size()) {
-                found_exports++;
+    // Values never live at the same time share a local. The interference graph of the values in locals is colored with
+    // the locals of their type in the order of their definitions, where each one dominates the ones after it, so as in
+    // "Register Allocation for Programs in SSA-Form" by Hack et al. a type takes no more locals than it has values live at
+    // once. A phi and its operands prefer the same local, leaving no copy along the edge, and the local of a parameter is
+    // taken by a value too, so a reassigned parameter stays where it is. Without Options::coalesce_locals every value
+    // has a local of its own.
+    // The parameters are the first locals, the values follow them grouped by value type in the order of kLocalTypes
+    // and the frame address is the last one.
+    void AssignLocals(Locals *locals) {
+        locals_.clear();
+        const auto is_in_local = [this](const ir::Instruction *value) {
+            return value->opcode == ir::Opcode::kParam || (value->type != ValueType::empty && value->opcode != ir::Opcode::kConst && value->opcode != ir::Opcode::kFrame &&
+                                                               GetUses(value) != 0 && stackified_.count(value) == 0);
+        };
+
+        const std::unordered_map<const ir::Instruction *, std::unordered_set<const ir::Instruction *>> interferences =
+            options_.coalesce_locals ? GetInterferences(is_in_local) : std::unordered_map<const ir::Instruction *, std::unordered_set<const ir::Instruction *>>();
+        std::unordered_map<const ir::Instruction *, std::vector<const ir::Instruction *>> related;
+        for (const ir::Block *block : tree_->GetOrder()) {
+            for (size_t i = 0; i < block->GetPhiCount(); i++) {
+                const ir::Instruction *phi = block->instructions[i].get();
+                for (size_t j = 0; j < phi->operands.size(); j++) {
+                    if (is_in_local(phi) && is_in_local(phi->operands[j]) && tree_->IsReachable(block->predecessors[j])) {
+                        related[phi].push_back(phi->operands[j]);
+                        related[phi->operands[j]].push_back(phi);
+                    }
+                }
             }
         }
 
-        if (found_exports != iet_->exports.size()) {
-            throw std::exception();
+        // the parameters of a type are its first colors
+        std::array<std::vector<uint32_t>, kLocalTypes.size()> parameters;
+        for (uint32_t i = 0; i < function_->params.size(); i++) {
+            parameters[GetLocalTypeIndex(function_->params[i])].push_back(i);
+        }
+        std::array<uint32_t, kLocalTypes.size()> counts{};
+        for (size_t i = 0; i < kLocalTypes.size(); i++) {
+            counts[i] = parameters[i].size();
         }
 
-        size_t export_idx = 0;
-        size_t i = 0;
+        std::unordered_map<const ir::Instruction *, uint32_t> colors;
+        for (const ir::Block *block : tree_->GetOrder()) {
+            for (const auto &instruction : block->instructions) {
+                const ir::Instruction *value = instruction.get();
+                if (!is_in_local(value)) {
+                    continue;
+                }
+                if (value->opcode == ir::Opcode::kParam) {
+                    const std::vector<uint32_t> &type_parameters = parameters[GetLocalTypeIndex(value->type)];
+                    colors[value] = std::find(type_parameters.begin(), type_parameters.end(), value->index) - type_parameters.begin();
+                    continue;
+                }
 
-        for (const auto &[node, bytes] : function_byte_arrays_) {
-            auto func_type = BrutalCast<const semantic::FuncType *>(node->symbol->type);
+                if (!options_.coalesce_locals) {
+                    colors[value] = counts[GetLocalTypeIndex(value->type)]++;
+                    continue;
+                }
 
-            std::vector<TokenValue::Type> params, ret;
+                std::unordered_set<uint32_t> taken;
+                if (const auto it = interferences.find(value); it != interferences.end()) {
+                    for (const ir::Instruction *other : it->second) {
+                        if (const auto color = colors.find(other); color != colors.end()) {
+                            taken.insert(color->second);
+                        }
+                    }
+                }
 
-            for (const auto &[identifier, type] : func_type->argument_types) {
-                const auto default_type = BrutalCast<const semantic::DefaultType *>(UnrefType(type));
-                params.push_back(default_type->type);
+                uint32_t color = 0;
+                while (taken.count(color) != 0) {
+                    color++;
+                }
+                for (const ir::Instruction *other : related[value]) {
+                    if (const auto it = colors.find(other); it != colors.end() && taken.count(it->second) == 0) {
+                        color = it->second;
+                        break;
+                    }
+                }
+                colors[value] = color;
+                counts[GetLocalTypeIndex(value->type)] = std::max(counts[GetLocalTypeIndex(value->type)], color + 1);
             }
+        }
 
-            if (func_type->return_type != nullptr) {
-                const auto default_type = BrutalCast<const semantic::DefaultType *>(UnrefType(func_type->return_type));
-                ret.push_back(default_type->type);
+        std::array<uint32_t, kLocalTypes.size()> first_indexes{};
+        auto local_index = static_cast<uint32_t>(function_->params.size());
+        for (size_t i = 0; i < kLocalTypes.size(); i++) {
+            const uint32_t count = counts[i] - parameters[i].size();
+            if (count != 0) {
+                locals->emplace_back(kLocalTypes[i], count);
             }
+            first_indexes[i] = local_index;
+            local_index += count;
+        }
 
-            const uint32_t type_exported_func = AddType(TypesHelper::ToWasmTypes(params), TypesHelper::ToWasmTypes(ret));
-            const uint32_t exported_func = AddFunc(type_exported_func, bytes.second, bytes.first);
-
-            if (function_byte_arrays_[i].first->symbol->func_iet >= iet_->imports.size() && function_byte_arrays_[i].first->symbol->func_iet < iet_->imports.size() + iet_->exports.size()) {
-                AddExportFunc(iet_->exports[export_idx].field, iet_->imports.size() + exported_func);
+        for (const auto &[value, color] : colors) {
+            const size_t type_index = GetLocalTypeIndex(value->type);
+            locals_[value] = color < parameters[type_index].size() ? parameters[type_index][color] : first_indexes[type_index] + color - parameters[type_index].size();
+        }
 
-                export_idx++;
+        if (function_->frame_size != 0) {
+            frame_local_ = local_index;
+            locals->emplace_back(ValueType::i32, 1);
+            for (const auto &instruction : function_->GetEntry()->instructions) {
+                if (instruction->opcode == ir::Opcode::kFrame) {
+                    locals_[instruction.get()] = frame_local_;
+                }
             }
-            i++;
         }
+    }
 
-        Finalize();
+    // two values of a type interfere when one is live where the other is defined, the phis of a block are defined together
+    std::unordered_map<const ir::Instruction *, std::unordered_set<const ir::Instruction *>> GetInterferences(const std::function<bool(const ir::Instruction *)> &is_in_local) const {
+        std::unordered_map<const ir::Instruction *, std::unordered_set<const ir::Instruction *>> result;
+        const auto interfere = [&result](const ir::Instruction *value, const std::unordered_set<const ir::Instruction *> &live) {
+            for (const ir::Instruction *other : live) {
+                if (other != value && other->type == value->type) {
+                    result[value].insert(other);
+                    result[other].insert(value);
+                }
+            }
+        };
+
+        const ir::Liveness liveness(*tree_, is_in_local);
+        for (const ir::Block *block : tree_->GetOrder()) {
+            std::unordered_set<const ir::Instruction *> live = liveness.GetLiveOut(block);
+            for (size_t i = block->instructions.size(); i > block->GetPhiCount(); i--) {
+                const ir::Instruction *instruction = block->instructions[i - 1].get();
+                if (is_in_local(instruction)) {
+                    interfere(instruction, live);
+                    live.erase(instruction);
+                }
+                for (const ir::Instruction *operand : instruction->operands) {
+                    if (is_in_local(operand)) {
+                        live.insert(operand);
+                    }
+                }
+            }
+            for (size_t i = 0; i < block->GetPhiCount(); i++) {
+                if (is_in_local(block->instructions[i].get())) {
+                    interfere(block->instructions[i].get(), live);
+                }
+            }
+        }
+        return result;
     }
 
-    void PostVisit(const LetNode *node) override {
-        Visit(node->GetExpression());
+    // the code of the block and of the blocks it dominates, each follower after the end of a wasm block around the code
+    // that branches to it, the last one in the order outermost; the followers outside a loop come after the end of it
+    void EmitTree(const ir::Block *block) {
+        const bool is_loop = tree_->IsLoopHeader(block);
+        std::vector<const ir::Block *> inner;
+        std::vector<const ir::Block *> outer;
+        for (const ir::Block *child : tree_->GetChildren(block)) {
+            if (followers_.count(child) != 0) {
+                (is_loop && !loops_->Contains(block, child) ? outer : inner).push_back(child);
+            }
+        }
+
+        EmitWithin(outer, outer.size(), [&] {
+            if (is_loop) {
+                Push(Opcode::Loop, static_cast<uint32_t>(ValueType::empty));
+                labels_.push_back(Label{block, true});
+            }
+            EmitWithin(inner, inner.size(), [&] { EmitBlock(block); });
+            if (is_loop) {
+                labels_.pop_back();
+                Push(Opcode::End);
+            }
+        });
+    }
 
-        const auto identifier = BrutalCast<const IdentifierPatternNode *>(node->GetPattern());
+    void EmitWithin(const std::vector<const ir::Block *> &followers, size_t count, const std::function<void()> &emit_code) {
+        if (count == 0) {
+            emit_code();
+            return;
+        }
 
-        current_result_.Push(0x21);
-        current_result_.Push(ToUnsignedLeb128(identifier->let_node->local_indexes.front()));
+        const ir::Block *follower = followers[count - 1];
+        Push(Opcode::Block, static_cast<uint32_t>(ValueType::empty));
+        labels_.push_back(Label{follower, false});
+        EmitWithin(followers, count - 1, emit_code);
+        labels_.pop_back();
+        Push(Opcode::End);
 
-        stack_length_--;
+        EmitTree(follower);
     }
 
-    void PostVisit(const IdentifierExpressionNode *node) override {
-        if (auto p = dynamic_cast<semantic::LetSymbol *>(node->symbol); p != nullptr) {
-            current_result_.Push(0x20);
-            current_result_.Push(ToUnsignedLeb128(p->local_indexes.front()));
-            stack_length_++;
-        } else {
-            throw std::exception();  // todo
+    void EmitBlock(const ir::Block *block) {
+        for (const auto &instruction : block->instructions) {
+            if (!instruction->IsTerminator()) {
+                EmitInstruction(instruction.get());
+            }
+        }
+
+        // the lowering ends every block, the unreachable ones too
+        const ir::Instruction *terminator = block->GetTerminator();
+        assert(terminator != nullptr);
+        EmitOperands(terminator);
+
+        switch (terminator->opcode) {
+        case ir::Opcode::kJump:
+            EmitEdge(block, terminator->targets[0]);
+            break;
+        case ir::Opcode::kBranch: {
+            const ir::Block *if_true = terminator->targets[0];
+            const ir::Block *if_false = terminator->targets[1];
+            if (if_true == if_false) {
+                Push(Opcode::Drop);
+                EmitEdge(block, if_true);
+            } else if (IsPlainEdge(block, if_true)) {
+                Push(Opcode::BrIf, GetDepth(block, if_true));
+                EmitEdge(block, if_false);
+            } else if (IsPlainEdge(block, if_false)) {
+                Push(Opcode::I32Eqz);
+                Push(Opcode::BrIf, GetDepth(block, if_false));
+                EmitEdge(block, if_true);
+            } else {
+                Push(Opcode::If, static_cast<uint32_t>(ValueType::empty));
+                labels_.push_back(Label{nullptr, false});
+                EmitEdge(block, if_true);
+                Push(Opcode::Else);
+                EmitEdge(block, if_false);
+                labels_.pop_back();
+                Push(Opcode::End);
+            }
+            break;
+        }
+        case ir::Opcode::kReturn:
+            // the frame is given back to the stack
+            if (function_->frame_size != 0) {
+                Push(Opcode::LocalGet, frame_local_);
+                Push(Opcode::I32Const, function_->frame_size);
+                Push(Opcode::I32Add);
+                Push(Opcode::GlobalSet, kStackPointerGlobal);
+            }
+            Push(Opcode::Return);
+            break;
+        default:
+            Push(Opcode::Unreachable);
+            break;
         }
     }
 
-    void PostVisit(const LiteralExpressionNode *node) override {
-        const auto type = dynamic_cast<const semantic::DefaultType *>(node->type_of_expression);
-        const auto value = node->GetLiteral()->GetToken()->GetTokenValue();
-        switch (type->type) {
-        case TokenValue::Type::kI32:
-            current_result_.Push(0x41);
-            current_result_.Push(ToSignedLeb128(static_cast<int32_t>(value)));
+    void EmitInstruction(const ir::Instruction *instruction) {
+        if (!IsEmitted(instruction)) {
+            return;
+        }
+        EmitOperands(instruction);
+
+        switch (instruction->opcode) {
+        case ir::Opcode::kCall:
+            Push(Opcode::Call, function_indexes_.at(instruction->callee));
             break;
-        case TokenValue::Type::kI64:
-            current_result_.Push(0x42);
-            current_result_.Push(ToSignedLeb128(static_cast<int64_t>(value)));  // todo
+        case ir::Opcode::kLoad:
+            PushMemoryAccess(GetLoadOpcode(instruction->type, instruction->size), instruction);
             break;
-        case TokenValue::Type::kF32:
-            current_result_.Push(0x43);
-            current_result_.PushUInt(static_cast<uint32_t>(value));  // todo ?
+        case ir::Opcode::kStore:
+            PushMemoryAccess(GetStoreOpcode(instruction->operands[1]->type, instruction->size), instruction);
             break;
-        case TokenValue::Type::kF64:
-            current_result_.Push(0x44);
-            current_result_.PushUInt(static_cast<uint64_t>(value));  // todo ?
+        case ir::Opcode::kEqz:
+            Push(Opcode::I32Eqz);
             break;
-        case TokenValue::Type::kBool:
-            if (static_cast<bool>(value)) {
-                current_result_.Push(0x41);
-                current_result_.Push(ToSignedLeb128(1));
-            } else {
-                current_result_.Push(0x41);
-                current_result_.Push(ToSignedLeb128(0));
+        default:
+            Push(GetBinaryOpcode(instruction->opcode, instruction->operands[0]->type));
+            break;
+        }
+
+        if (instruction->type == ValueType::empty || stackified_.count(instruction) != 0) {
+            return;
+        }
+        if (const auto it = locals_.find(instruction); it != locals_.end()) {
+            Push(Opcode::LocalSet, it->second);
+        } else {
+            Push(Opcode::Drop);
+        }
+    }
+
+    // the operands already on the stack are the leading ones, see Stackify
+    void EmitOperands(const ir::Instruction *instruction) {
+        for (const ir::Instruction *operand : instruction->operands) {
+            if (stackified_.count(operand) == 0) {
+                EmitValue(operand);
             }
+        }
+    }
+
+    void EmitValue(const ir::Instruction *value) {
+        if (value->opcode != ir::Opcode::kConst) {
+            Push(Opcode::LocalGet, locals_.at(value));
+            return;
+        }
+
+        switch (value->type) {
+        case ValueType::i32:
+            Push(Opcode::I32Const, value->bits);
+            break;
+        case ValueType::i64:
+            Push(Opcode::I64Const, value->bits);
+            break;
+        case ValueType::f32:
+            Push(Opcode::F32Const, value->bits);
+            break;
+        case ValueType::f64:
+            Push(Opcode::F64Const, value->bits);
             break;
         default:
             throw std::exception();  // todo
         }
-
-        stack_length_++;
     }
 
-    void PostVisit(const BinaryOperationNode *node) override {
-        Visit(node->GetLeft());
-        Visit(node->GetRight());
+    // the phis of the target take their values along the edge, all of them are read before any is written
+    void EmitCopies(const ir::Block *from, const ir::Block *to) {
+        std::vector<const ir::Instruction *> phis = GetCopies(from, to);
+        const size_t index = to->GetPredecessorIndex(from);
+        for (const ir::Instruction *phi : phis) {
+            EmitValue(phi->operands[index]);
+        }
+        for (auto it = phis.rbegin(); it != phis.rend(); ++it) {
+            Push(Opcode::LocalSet, locals_.at(*it));
+        }
+    }
 
-        const auto left_type = dynamic_cast<const semantic::DefaultType *>(UnrefType(node->GetLeft()->type_of_expression));
+    std::vector<const ir::Instruction *> GetCopies(const ir::Block *from, const ir::Block *to) const {
+        std::vector<const ir::Instruction *> result;
+        const size_t index = to->GetPredecessorIndex(from);
+        for (size_t i = 0; i < to->GetPhiCount(); i++) {
+            const ir::Instruction *phi = to->instructions[i].get();
+            const auto value = locals_.find(phi->operands[index]);
+            if (GetUses(phi) != 0 && (value == locals_.end() || value->second != locals_.at(phi))) {
+                result.push_back(phi);
+            }
+        }
+        return result;
+    }
 
-        current_result_.Push(GetOperationOpcode(node->GetToken()->GetType(), left_type->type));
+    // a back edge continues the loop and an edge to a follower leaves the wasm block before it
+    bool IsBranchTarget(const ir::Block *from, const ir::Block *to) const {
+        return tree_->IsBackEdge(from, to) || followers_.count(to) != 0;
+    }
 
-        stack_length_--;
+    // an edge taken by a single br_if
+    bool IsPlainEdge(const ir::Block *from, const ir::Block *to) const {
+        return IsBranchTarget(from, to) && GetCopies(from, to).empty();
     }
 
-    void PostVisit(const CallOrInitTupleNode *node) override {
-        // clang-format off
-        std::visit(overloaded{
-            [this, node](const semantic::FuncSymbol *symbol) {
-                for (const ExpressionNode *argument : node->GetArguments()) {
-                    Visit(argument);
-                    stack_length_--;
-                }
+    void EmitEdge(const ir::Block *from, const ir::Block *to) {
+        EmitCopies(from, to);
+        if (IsBranchTarget(from, to)) {
+            Push(Opcode::Br, GetDepth(from, to));
+        } else {
+            EmitTree(to);
+        }
+    }
 
-                current_result_.Push(0x10);
-                current_result_.Push(ToUnsignedLeb128(symbol->func_iet));
+    uint32_t GetDepth(const ir::Block *from, const ir::Block *to) const {
+        // a branch always targets an enclosing block or loop
+        const bool is_loop = tree_->IsBackEdge(from, to);
+        size_t i = labels_.size();
+        while (i > 0 && (labels_[i - 1].block != to || labels_[i - 1].is_loop != is_loop)) {
+            i--;
+        }
+        assert(i > 0);
+        return labels_.size() - i;
+    }
 
-                auto type = BrutalCast<const semantic::FuncType *>(symbol->type);
-                if (type->return_type != nullptr) {
-                    stack_length_++;
-                }
-            },
-            [](const semantic::TupleStructType *) {
-                throw std::exception(); // todo
-            }
-        }, node->type);
-        // clang-format on
+    void Push(Opcode opcode, uint64_t immediate = 0) {
+        code_.push_back(wasm::Instruction{opcode, immediate, 0});
     }
 
-    void PostVisit(const AssignmentNode *node) override {
-        Visit(node->GetExpression());
+    // the alignment is the size of the access
+    void PushMemoryAccess(Opcode opcode, const ir::Instruction *instruction) {
+        uint64_t alignment = 0;
+        while ((1u << alignment) < instruction->size) {
+            alignment++;
+        }
+        code_.push_back(wasm::Instruction{opcode, alignment, instruction->index});
+    }
 
-        if (node->GetOperation().GetType() != Token::Type::kEq) {
-            current_result_.Push(0x20);
-            current_result_.Push(ToUnsignedLeb128(node->let_symbol->local_indexes.front()));
+    static Opcode GetLoadOpcode(ValueType type, uint32_t size) {
+        switch (type) {
+        case ValueType::i32:
+            return size == 1 ? Opcode::I32Load8U : Opcode::I32Load;
+        case ValueType::i64:
+            return Opcode::I64Load;
+        case ValueType::f32:
+            return Opcode::F32Load;
+        case ValueType::f64:
+            return Opcode::F64Load;
+        default:
+            throw std::exception();  // todo
         }
+    }
 
-        const auto type = BrutalCast<const semantic::DefaultType *>(UnrefType(node->GetExpression()->type_of_expression));
-        switch (node->GetOperation().GetType()) {
-        case Token::Type::kEq:
-            break;
-        case Token::Type::kPlusEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kPlus, type->type));
-            break;
-        case Token::Type::kMinusEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kMinus, type->type));
-            break;
-        case Token::Type::kStarEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kStar, type->type));
-            break;
-        case Token::Type::kSlashEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kSlash, type->type));
-            break;
-        case Token::Type::kPercentEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kPercent, type->type));
-            break;
-        case Token::Type::kCaretEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kCaret, type->type));
-            break;
-        case Token::Type::kAndEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kAnd, type->type));
-            break;
-        case Token::Type::kOrEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kOr, type->type));
-            break;
-        case Token::Type::kShlEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kShl, type->type));
-            break;
-        case Token::Type::kShrEq:
-            current_result_.Push(GetOperationOpcode(Token::Type::kShr, type->type));
-            break;
+    static Opcode GetStoreOpcode(ValueType type, uint32_t size) {
+        switch (type) {
+        case ValueType::i32:
+            return size == 1 ? Opcode::I32Store8 : Opcode::I32Store;
+        case ValueType::i64:
+            return Opcode::I64Store;
+        case ValueType::f32:
+            return Opcode::F32Store;
+        case ValueType::f64:
+            return Opcode::F64Store;
         default:
-            abort();
-        }
-
-        current_result_.Push(0x21);
-        current_result_.Push(ToUnsignedLeb128(node->let_symbol->local_indexes.front()));
-
-        stack_length_--;
-    }
-
-    void PostVisit(const PredicateLoopNode *node) override {
-        current_result_.Push(0x02);
-        current_result_.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::empty)));
-        current_result_.Push(0x03);
-        current_result_.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::empty)));
-        Visit(node->GetExpression());
-        current_result_.Push({0x45, 0x0d});
-        current_result_.Push(ToUnsignedLeb128(1));
-        Visit(node->GetBlock());
-        current_result_.Push(0x0c);
-        current_result_.Push(ToUnsignedLeb128(0));
-        current_result_.Push({0x0b, 0x0b});
-
-        stack_length_--;
-    }
-
-    void PostVisit(const InfiniteLoopNode *node) override {
-        current_result_.Push(0x02);
-        current_result_.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::empty)));
-        current_result_.Push(0x03);
-        current_result_.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::empty)));
-        current_result_.Push(0x41);
-        current_result_.Push(ToSignedLeb128(1));
-        current_result_.Push({0x45, 0x0d});
-        current_result_.Push(ToUnsignedLeb128(1));
-        Visit(node->GetBlock());
-        current_result_.Push(0x0c);
-        current_result_.Push(ToUnsignedLeb128(0));
-        current_result_.Push({0x0b, 0x0b});
-    }
-
-    void PostVisit(const IfNode *node) override {
-        Visit(node->GetExpression());
-        current_result_.Push(0x04);
-        current_result_.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::empty)));
-        Visit(node->GetIfBlock());
-        if (node->GetElseBlock() != nullptr || node->GetElseIf() != nullptr) {
-            current_result_.Push(0x05);
-            Visit(node->GetElseBlock());
-            Visit(node->GetElseIf());
-        }
-        current_result_.Push(0x0b);
-
-        stack_length_--;
-    }
-
-    void PostVisit(const PrefixUnaryOperationNode *node) override {
-        auto tokenType = node->GetToken()->GetType();
-        if (tokenType == Token::Type::kMinus) {
-            const auto type = dynamic_cast<const semantic::DefaultType *>(UnrefType(node->type_of_expression));
-            switch (type->type) {
-            case TokenValue::Type::kI32:
-                current_result_.Push(0x41);
-                current_result_.Push(ToSignedLeb128(static_cast<int32_t>(0)));
+            throw std::exception();  // todo
+        }
+    }
+
+    // the rows follow ir::Opcode from kAdd to kGe and the columns are i32, i64, f32, f64, Unreachable marks a missing one
+    static Opcode GetBinaryOpcode(ir::Opcode opcode, ValueType type) {
+        static const std::array<std::array<Opcode, 4>, 17> kOpcodes{{
+            {Opcode::I32Add, Opcode::I64Add, Opcode::F32Add, Opcode::F64Add},
+            {Opcode::I32Sub, Opcode::I64Sub, Opcode::F32Sub, Opcode::F64Sub},
+            {Opcode::I32Mul, Opcode::I64Mul, Opcode::F32Mul, Opcode::F64Mul},
+            {Opcode::I32DivS, Opcode::I64DivS, Opcode::F32Div, Opcode::F64Div},
+            {Opcode::I32RemS, Opcode::I64RemS, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32And, Opcode::I64And, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32Or, Opcode::I64Or, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32Xor, Opcode::I64Xor, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32Shl, Opcode::I64Shl, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32ShrS, Opcode::I64ShrS, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32ShrU, Opcode::I64ShrU, Opcode::Unreachable, Opcode::Unreachable},
+            {Opcode::I32Eq, Opcode::I64Eq, Opcode::F32Eq, Opcode::F64Eq},
+            {Opcode::I32Ne, Opcode::I64Ne, Opcode::F32Ne, Opcode::F64Ne},
+            {Opcode::I32LtS, Opcode::I64LtS, Opcode::F32Lt, Opcode::F64Lt},
+            {Opcode::I32GtS, Opcode::I64GtS, Opcode::F32Gt, Opcode::F64Gt},
+            {Opcode::I32LeS, Opcode::I64LeS, Opcode::F32Le, Opcode::F64Le},
+            {Opcode::I32GeS, Opcode::I64GeS, Opcode::F32Ge, Opcode::F64Ge},
+        }};
+
+        const auto row = static_cast<size_t>(opcode) - static_cast<size_t>(ir::Opcode::kAdd);
+        const Opcode result = row < kOpcodes.size() ? kOpcodes[row][3 - GetLocalTypeIndex(type)] : Opcode::Unreachable;
+        // the lowering only emits the operations wasm has for the type
+        assert(result != Opcode::Unreachable);
+        return result;
+    }
+
+    static ByteArray Encode(const Code &code) {
+        ByteArray result;
+        for (const wasm::Instruction &instruction : code) {
+            result.Push(static_cast<ByteArray::Byte>(instruction.opcode));
+
+            switch (instruction.opcode) {
+            case Opcode::Block:
+            case Opcode::Loop:
+            case Opcode::If:
+                result.Push(ToSignedLeb128(static_cast<int32_t>(instruction.immediate)));
+                break;
+            case Opcode::Br:
+            case Opcode::BrIf:
+            case Opcode::Call:
+            case Opcode::LocalGet:
+            case Opcode::LocalSet:
+            case Opcode::LocalTee:
+            case Opcode::GlobalGet:
+            case Opcode::GlobalSet:
+                result.Push(ToUnsignedLeb128(static_cast<uint32_t>(instruction.immediate)));
+                break;
+            case Opcode::I32Const:
+                result.Push(ToSignedLeb128(static_cast<int32_t>(instruction.immediate)));
+                break;
+            case Opcode::I64Const:
+                result.Push(ToSignedLeb128(static_cast<int64_t>(instruction.immediate)));
                 break;
-            case TokenValue::Type::kI64:
-                current_result_.Push(0x42);
-                current_result_.Push(ToSignedLeb128(static_cast<int64_t>(0)));
+            case Opcode::F32Const:
+                result.PushUInt(static_cast<uint32_t>(instruction.immediate));
                 break;
-            case TokenValue::Type::kF32:
-                current_result_.Push(0x43);
-                current_result_.PushUInt(static_cast<uint32_t>(0));
+            case Opcode::F64Const:
+                result.PushUInt(instruction.immediate);
                 break;
-            case TokenValue::Type::kF64:
-                current_result_.Push(0x44);
-                current_result_.PushUInt(static_cast<uint64_t>(0));
+            case Opcode::I32Load:
+            case Opcode::I64Load:
+            case Opcode::F32Load:
+            case Opcode::F64Load:
+            case Opcode::I32Load8U:
+            case Opcode::I32Store:
+            case Opcode::I64Store:
+            case Opcode::F32Store:
+            case Opcode::F64Store:
+            case Opcode::I32Store8:
+                result.Push(ToUnsignedLeb128(static_cast<uint32_t>(instruction.immediate)));
+                result.Push(ToUnsignedLeb128(instruction.offset));
                 break;
             default:
-                throw std::exception();  // todo
+                break;
             }
-
-            Visit(node->GetRight());
-            current_result_.Push(GetOperationOpcode(node->GetToken()->GetType(), type->type));
-        } else if (tokenType == Token::Type::kNot) {
-            Visit(node->GetRight());
-            current_result_.Push(0x45);
-        } else {
-            throw std::exception(); // todo
-        }
-    }
-
-    UNUSED(IdentifierTypeNode)
-    UNUSED(IdentifierPatternNode)
-
-    NOT_IMPLEMENTED(TupleExpressionNode)
-    NOT_IMPLEMENTED(ArrayExpressionNode)
-    NOT_IMPLEMENTED(MemberAccessNode)
-    NOT_IMPLEMENTED(GroupedPatternNode)
-    NOT_IMPLEMENTED(IndexNode)
-    NOT_IMPLEMENTED(TuplePatternNode)
-    NOT_IMPLEMENTED(TupleStructPatternNode)
-    NOT_IMPLEMENTED(StructPatternNode)
-    NOT_IMPLEMENTED(ReferencePatternNode)
-    NOT_IMPLEMENTED(RestPatternNode)
-    NOT_IMPLEMENTED(WildcardPatternNode)
-    NOT_IMPLEMENTED(LiteralPatternNode)
-    NOT_IMPLEMENTED(IdentifierFieldInitStructExpressionNode)
-    NOT_IMPLEMENTED(TupleIndexFieldInitStructExpressionNode)
-    NOT_IMPLEMENTED(ShorthandFieldInitStructExpressionNode)
-    NOT_IMPLEMENTED(InitStructExpressionNode)
-    NOT_IMPLEMENTED(RefMutIdentifierFieldNode)
-    NOT_IMPLEMENTED(IdentifierFieldNode)
-    NOT_IMPLEMENTED(TupleIndexFieldNode)
-    NOT_IMPLEMENTED(ArrayTypeNode)
-    NOT_IMPLEMENTED(ReferenceTypeNode)
-    NOT_IMPLEMENTED(TupleTypeNode)
-    NOT_IMPLEMENTED(ParenthesizedTypeNode)
-    NOT_IMPLEMENTED(ConstantItemNode)
-    NOT_IMPLEMENTED(StructNode)
-    NOT_IMPLEMENTED(ParamStructNode)
-    NOT_IMPLEMENTED(ParamFunctionNode)
-    NOT_IMPLEMENTED(LiteralNode)
-    NOT_IMPLEMENTED(IdentifierNode)
-    NOT_IMPLEMENTED(IteratorLoopNode)
-    NOT_IMPLEMENTED(BreakNode)
-    NOT_IMPLEMENTED(ContinueNode)
-
-private:
-    ByteArray result_;
-    ByteArray current_result_;
-    bool nested_func_ = false;
-    const ImportExportTable *iet_ = nullptr;
-    uint32_t stack_length_ = 0;
-
-    std::vector<std::pair<const FunctionNode *, std::pair<ByteArray, std::map<ValueType, uint32_t>>>> function_byte_arrays_;
-
-    static const ISymbolType *UnrefType(const ISymbolType *raw_type) {
-        if (auto p = dynamic_cast<const IdentifierTypeNode *>(raw_type); p != nullptr) {
-            // clang-format off
-            std::visit(overloaded{
-                [&raw_type](const semantic::SubsetStructType *node)
-                {
-                    raw_type = node;
-                },
-                [&raw_type](const semantic::DefaultType *node)
-                {
-                    raw_type = node;
-                }
-            }, p->type);
-            // clang-format on
         }
-        return raw_type;
+        return result;
     }
 
     static ByteArray ToUnsignedLeb128(uint32_t value) {
@@ -541,7 +900,21 @@ private:
         while (true) {
             ByteArray::Byte byte = value & 0x7f;
             value >>= 7;
-            if (value == 0 && (byte & 0x40) == 0 || value == -1 && (byte & 0x40) != 0) {
+            if ((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0)) {
+                result.Push(byte);
+                return result;
+            }
+            result.Push(byte | 0x80);
+        }
+    }
+
+    static ByteArray ToSignedLeb128(int64_t value) {
+        ByteArray result;
+
+        while (true) {
+            ByteArray::Byte byte = value & 0x7f;
+            value >>= 7;
+            if ((value == 0 && (byte & 0x40) == 0) || (value == -1 && (byte & 0x40) != 0)) {
                 result.Push(byte);
                 return result;
             }
@@ -609,7 +982,7 @@ private:
         return import_index;
     }
 
-    uint32_t AddFunc(uint32_t type_index, const std::map<ValueType, uint32_t> &locals, const ByteArray &code) {
+    uint32_t AddFunc(uint32_t type_index, const Locals &locals, const ByteArray &code) {
         const uint32_t func_index = section_count_entry_[SectionType::Function];
         section_count_entry_[SectionType::Function] = func_index + 1;
 
@@ -635,6 +1008,23 @@ private:
         return func_index;
     }
 
+    // the stack is all of it
+    void AddMemory() {
+        section_count_entry_[SectionType::Memory]++;
+        section_entries_[SectionType::Memory].Push(0x00);  // no maximum
+        section_entries_[SectionType::Memory].Push(ToUnsignedLeb128(kStackPages));
+    }
+
+    void AddStackPointer() {
+        section_count_entry_[SectionType::Global]++;
+        ByteArray &section = section_entries_[SectionType::Global];
+        section.Push(ToSignedLeb128(static_cast<int32_t>(ValueType::i32)));
+        section.Push(0x01);  // mutable
+        section.Push(0x41);
+        section.Push(ToSignedLeb128(kStackTop));
+        section.Push(0x0b);
+    }
+
     void AddExportFunc(const std::string &field_str, uint32_t function_index) {
         const ByteArray field_str_bytes = ByteArray::FromString(field_str);
 
@@ -663,209 +1053,7 @@ private:
             }
         }
     }
-
-    static ByteArray::Byte GetOperationOpcode(Token::Type operation, TokenValue::Type type) {
-        switch (operation) {
-        case Token::Type::kPlus: {
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x6a;
-            case TokenValue::Type::kI64:
-                return 0x7c;
-            case TokenValue::Type::kF32:
-                return 0x92;
-            case TokenValue::Type::kF64:
-                return 0xa0;
-            default:
-                throw std::exception();
-            }
-        }
-        case Token::Type::kMinus: {
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x6b;
-            case TokenValue::Type::kI64:
-                return 0x7d;
-            case TokenValue::Type::kF32:
-                return 0x93;
-            case TokenValue::Type::kF64:
-                return 0xa1;
-            default:
-                throw std::exception();
-            }
-        }
-        case Token::Type::kStar: {
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x6c;
-            case TokenValue::Type::kI64:
-                return 0x7e;
-            case TokenValue::Type::kF32:
-                return 0x94;
-            case TokenValue::Type::kF64:
-                return 0xa2;
-            default:
-                throw std::exception();
-            }
-        }
-        case Token::Type::kSlash: {
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x6d;
-            case TokenValue::Type::kI64:
-                return 0x7f;
-            case TokenValue::Type::kF32:
-                return 0x95;
-            case TokenValue::Type::kF64:
-                return 0xa3;
-            default:
-                throw std::exception();
-            }
-        }
-        case Token::Type::kOr:
-        case Token::Type::kOrOr:
-            switch (type) {
-            case TokenValue::Type::kBool:
-            case TokenValue::Type::kI32:
-                return 0x72;
-            case TokenValue::Type::kI64:
-                return 0x84;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kAnd:
-        case Token::Type::kAndAnd:
-            switch (type) {
-            case TokenValue::Type::kBool:
-            case TokenValue::Type::kI32:
-                return 0x71;
-            case TokenValue::Type::kI64:
-                return 0x83;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kShl:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x74;
-            case TokenValue::Type::kI64:
-                return 0x86;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kShr:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x75;
-            case TokenValue::Type::kI64:
-                return 0x87;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kCaret:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x73;
-            case TokenValue::Type::kI64:
-                return 0x85;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kPercent:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x6f;
-            case TokenValue::Type::kI64:
-                return 0x81;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kEqEq:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x46;
-            case TokenValue::Type::kI64:
-                return 0x51;
-            case TokenValue::Type::kF32:
-                return 0x5b;
-            case TokenValue::Type::kF64:
-                return 0x61;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kNe:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x47;
-            case TokenValue::Type::kI64:
-                return 0x52;
-            case TokenValue::Type::kF32:
-                return 0x5c;
-            case TokenValue::Type::kF64:
-                return 0x62;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kLt:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x48;
-            case TokenValue::Type::kI64:
-                return 0x53;
-            case TokenValue::Type::kF32:
-                return 0x5d;
-            case TokenValue::Type::kF64:
-                return 0x63;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kGt:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x4a;
-            case TokenValue::Type::kI64:
-                return 0x55;
-            case TokenValue::Type::kF32:
-                return 0x5e;
-            case TokenValue::Type::kF64:
-                return 0x64;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kLe:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x4c;
-            case TokenValue::Type::kI64:
-                return 0x57;
-            case TokenValue::Type::kF32:
-                return 0x5f;
-            case TokenValue::Type::kF64:
-                return 0x65;
-            default:
-                throw std::exception();
-            }
-        case Token::Type::kGe:
-            switch (type) {
-            case TokenValue::Type::kI32:
-                return 0x4e;
-            case TokenValue::Type::kI64:
-                return 0x59;
-            case TokenValue::Type::kF32:
-                return 0x60;
-            case TokenValue::Type::kF64:
-                return 0x66;
-            default:
-                throw std::exception();
-            }
-        default:
-            throw std::exception();  // todo
-        }
-    }
 };
 
 const std::array<WasmGenerator::SectionType, 11> WasmGenerator::kSections{SectionType::Type,   SectionType::Import, SectionType::Function, SectionType::Table, SectionType::Memory, SectionType::Global,
                                                                           SectionType::Export, SectionType::Start,  SectionType::Element,  SectionType::Code,  SectionType::Data};
-
-#undef NOT_IMPLEMENTED
-#undef UNUSED
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "WasmTypes.hpp"
+
+namespace wasm {
+    // Rewrites short sequences of instructions in a function body into shorter ones with the same effect. A rule looks at
+    // the instructions from a position on and changes them in place when they match. After a match the rules are tried
+    // again a few instructions earlier, so what one rule leaves behind may match another one: an integer comparison
+    // followed by two eqz is inverted twice and becomes the comparison itself.
+    class Peephole final {
+    public:
+        using Code = std::vector<Instruction>;
+
+        struct Rule {
+            const char *name;
+            // whether the instructions at the position matched and were rewritten
+            bool (*apply)(Code *code, size_t position);
+        };
+
+        static const std::vector<Rule> &GetRules() {
+            static const std::vector<Rule> kRules{
+                {"set-get-to-tee", &SetGetToTee},
+                {"constant-br-if", &ConstantBranch},
+                {"eqz-eqz-branch", &DoubleEqzBranch},
+                {"invert-comparison", &InvertComparison},
+                {"drop-value", &DropValue},
+                {"dead-code", &RemoveDeadCode},
+                {"br-to-end", &BranchToEnd},
+            };
+            return kRules;
+        }
+
+        Peephole() : hits_(GetRules().size()) {}
+
+        void Run(Code *code) {
+            const std::vector<Rule> &rules = GetRules();
+
+            for (size_t position = 0; position < code->size();) {
+                bool matched = false;
+                for (size_t i = 0; i < rules.size() && !matched; i++) {
+                    if (rules[i].apply(code, position)) {
+                        hits_[i]++;
+                        matched = true;
+                    }
+                }
+                position = !matched ? position + 1 : position > kLookBehind ? position - kLookBehind : 0;
+            }
+        }
+
+        // the matches of every rule of GetRules over all runs
+        const std::vector<uint32_t> &GetHits() const {
+            return hits_;
+        }
+
+    private:
+        // the longest rule minus one, the instructions before a rewrite it may now match with
+        static constexpr size_t kLookBehind = 2;
+
+        std::vector<uint32_t> hits_;
+
+        static bool Is(const Code &code, size_t position, Opcode opcode) {
+            return position < code.size() && code[position].opcode == opcode;
+        }
+
+        static bool IsUnconditional(Opcode opcode) {
+            return opcode == Opcode::Br || opcode == Opcode::Return || opcode == Opcode::Unreachable;
+        }
+
+        static bool IsStructure(Opcode opcode) {
+            return opcode == Opcode::Block || opcode == Opcode::Loop || opcode == Opcode::If || opcode == Opcode::Else || opcode == Opcode::End;
+        }
+
+        // local.set x; local.get x -> local.tee x
+        static bool SetGetToTee(Code *code, size_t position) {
+            if (!Is(*code, position, Opcode::LocalSet) || !Is(*code, position + 1, Opcode::LocalGet) || (*code)[position].immediate != (*code)[position + 1].immediate) {
+                return false;
+            }
+            (*code)[position].opcode = Opcode::LocalTee;
+            code->erase(code->begin() + position + 1);
+            return true;
+        }
+
+        // i32.const c; br_if l -> br l when c is not zero and nothing when it is
+        static bool ConstantBranch(Code *code, size_t position) {
+            if (!Is(*code, position, Opcode::I32Const) || !Is(*code, position + 1, Opcode::BrIf)) {
+                return false;
+            }
+            if (static_cast<uint32_t>((*code)[position].immediate) != 0) {
+                (*code)[position] = Instruction{Opcode::Br, (*code)[position + 1].immediate};
+                code->erase(code->begin() + position + 1);
+            } else {
+                code->erase(code->begin() + position, code->begin() + position + 2);
+            }
+            return true;
+        }
+
+        // i32.eqz; i32.eqz; br_if l -> br_if l and the same before an if, both only tell zero from the rest
+        static bool DoubleEqzBranch(Code *code, size_t position) {
+            if (!Is(*code, position, Opcode::I32Eqz) || !Is(*code, position + 1, Opcode::I32Eqz) || (!Is(*code, position + 2, Opcode::BrIf) && !Is(*code, position + 2, Opcode::If))) {
+                return false;
+            }
+            code->erase(code->begin() + position, code->begin() + position + 2);
+            return true;
+        }
+
+        // an integer comparison; i32.eqz -> the inverse comparison, a float one has none as it is false for a NaN
+        static bool InvertComparison(Code *code, size_t position) {
+            static const Opcode kInverses[][2]{
+                {Opcode::I32Eq, Opcode::I32Ne}, {Opcode::I32LtS, Opcode::I32GeS}, {Opcode::I32GtS, Opcode::I32LeS},
+                {Opcode::I64Eq, Opcode::I64Ne}, {Opcode::I64LtS, Opcode::I64GeS}, {Opcode::I64GtS, Opcode::I64LeS},
+            };
+
+            if (position >= code->size() || !Is(*code, position + 1, Opcode::I32Eqz)) {
+                return false;
+            }
+            Opcode &opcode = (*code)[position].opcode;
+            for (const auto &[comparison, inverse] : kInverses) {
+                if (opcode == comparison || opcode == inverse) {
+                    opcode = opcode == comparison ? inverse : comparison;
+                    code->erase(code->begin() + position + 1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // a value without effects; drop -> nothing and local.tee x; drop -> local.set x
+        static bool DropValue(Code *code, size_t position) {
+            if (!Is(*code, position + 1, Opcode::Drop)) {
+                return false;
+            }
+            switch ((*code)[position].opcode) {
+            case Opcode::LocalGet:
+            case Opcode::GlobalGet:
+            case Opcode::I32Const:
+            case Opcode::I64Const:
+            case Opcode::F32Const:
+            case Opcode::F64Const:
+                code->erase(code->begin() + position, code->begin() + position + 2);
+                return true;
+            case Opcode::LocalTee:
+                (*code)[position].opcode = Opcode::LocalSet;
+                code->erase(code->begin() + position + 1);
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // the instructions after a br, return or unreachable up to the end of the block never run
+        static bool RemoveDeadCode(Code *code, size_t position) {
+            if (position >= code->size() || !IsUnconditional((*code)[position].opcode)) {
+                return false;
+            }
+            size_t end = position + 1;
+            while (end < code->size() && !IsStructure((*code)[end].opcode)) {
+                end++;
+            }
+            if (end == position + 1) {
+                return false;
+            }
+            code->erase(code->begin() + position + 1, code->begin() + end);
+            return true;
+        }
+
+        // br l right before the ends of the blocks up to l continues where falling through them does, unless one is a loop
+        static bool BranchToEnd(Code *code, size_t position) {
+            if (!Is(*code, position, Opcode::Br)) {
+                return false;
+            }
+            for (size_t i = 0; i <= (*code)[position].immediate; i++) {
+                if (!Is(*code, position + 1 + i, Opcode::End) || GetOpener(*code, position + 1 + i) == Opcode::Loop) {
+                    return false;
+                }
+            }
+            code->erase(code->begin() + position);
+            return true;
+        }
+
+        // the block, loop or if the end at the position closes
+        static Opcode GetOpener(const Code &code, size_t end) {
+            size_t depth = 0;
+            size_t i = end;
+            while (true) {
+                // the generator closes every block it opens, and the function body is not one of them
+                assert(i > 0);
+                const Opcode opcode = code[--i].opcode;
+                if (opcode == Opcode::End) {
+                    depth++;
+                } else if (opcode == Opcode::Block || opcode == Opcode::Loop || opcode == Opcode::If) {
+                    if (depth == 0) {
+                        return opcode;
+                    }
+                    depth--;
+                }
+            }
+        }
+    };
+}
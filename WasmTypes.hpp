@@ -26,4 +26,104 @@ namespace wasm {
         Code = 10,
         Data = 11
     };
+
+    enum class Opcode : uint8_t
+    {
+        Unreachable = 0x00,
+        Block = 0x02,
+        Loop = 0x03,
+        If = 0x04,
+        Else = 0x05,
+        End = 0x0b,
+        Br = 0x0c,
+        BrIf = 0x0d,
+        Return = 0x0f,
+        Call = 0x10,
+        Drop = 0x1a,
+        LocalGet = 0x20,
+        LocalSet = 0x21,
+        LocalTee = 0x22,
+        GlobalGet = 0x23,
+        GlobalSet = 0x24,
+        I32Load = 0x28,
+        I64Load = 0x29,
+        F32Load = 0x2a,
+        F64Load = 0x2b,
+        I32Load8U = 0x2d,
+        I32Store = 0x36,
+        I64Store = 0x37,
+        F32Store = 0x38,
+        F64Store = 0x39,
+        I32Store8 = 0x3a,
+        I32Const = 0x41,
+        I64Const = 0x42,
+        F32Const = 0x43,
+        F64Const = 0x44,
+        I32Eqz = 0x45,
+        I32Eq = 0x46,
+        I32Ne = 0x47,
+        I32LtS = 0x48,
+        I32GtS = 0x4a,
+        I32LeS = 0x4c,
+        I32GeS = 0x4e,
+        I64Eqz = 0x50,
+        I64Eq = 0x51,
+        I64Ne = 0x52,
+        I64LtS = 0x53,
+        I64GtS = 0x55,
+        I64LeS = 0x57,
+        I64GeS = 0x59,
+        F32Eq = 0x5b,
+        F32Ne = 0x5c,
+        F32Lt = 0x5d,
+        F32Gt = 0x5e,
+        F32Le = 0x5f,
+        F32Ge = 0x60,
+        F64Eq = 0x61,
+        F64Ne = 0x62,
+        F64Lt = 0x63,
+        F64Gt = 0x64,
+        F64Le = 0x65,
+        F64Ge = 0x66,
+        I32Add = 0x6a,
+        I32Sub = 0x6b,
+        I32Mul = 0x6c,
+        I32DivS = 0x6d,
+        I32RemS = 0x6f,
+        I32And = 0x71,
+        I32Or = 0x72,
+        I32Xor = 0x73,
+        I32Shl = 0x74,
+        I32ShrS = 0x75,
+        I32ShrU = 0x76,
+        I64Add = 0x7c,
+        I64Sub = 0x7d,
+        I64Mul = 0x7e,
+        I64DivS = 0x7f,
+        I64RemS = 0x81,
+        I64And = 0x83,
+        I64Or = 0x84,
+        I64Xor = 0x85,
+        I64Shl = 0x86,
+        I64ShrS = 0x87,
+        I64ShrU = 0x88,
+        F32Add = 0x92,
+        F32Sub = 0x93,
+        F32Mul = 0x94,
+        F32Div = 0x95,
+        F64Add = 0xa0,
+        F64Sub = 0xa1,
+        F64Mul = 0xa2,
+        F64Div = 0xa3
+    };
+
+    // an instruction of a function body before it is encoded
+    struct Instruction {
+        Opcode opcode;
+        // the bits of a constant, the block type, the index of a local, global, function or label
+        // or the alignment of a memory access as a power of two
+        uint64_t immediate = 0;
+        // added to the address of a memory access
+        uint32_t offset = 0;
+    };
 };
\ No newline at end of file
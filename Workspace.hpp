@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "SemanticAnalyzer.hpp"
+#include "SyntaxParser.hpp"
+#include "Tokenizer.hpp"
+
+// Keeps a source file parsed and type-checked between its edits, as the watch mode of the driver does.
+// The edit is found by comparing the tokens with the ones of the previous version, SyntaxParser::Reparse parses only the item or block containing it.
+// When that is a block inside a top-level function only its body is checked again, see QueryEngine::InvalidateBody.
+class Workspace final {
+public:
+    Workspace(std::string filename, const ImportExportTable *import_export_table) : filename_(std::move(filename)), iet_(import_export_table) {}
+
+    // reads the file again, false when it has errors, which then are in GetDiagnostics()
+    bool Update() {
+        std::ifstream ifs(filename_);
+        Tokenizer tokenizer(&ifs, Tokenizer::TargetType::kX64);
+        std::vector<Token> tokens = SyntaxParser::Tokenize(&tokenizer);
+
+        std::ifstream source_ifs(filename_, std::ios::in | std::ios::binary);
+        std::string source{std::istreambuf_iterator<char>(source_ifs), std::istreambuf_iterator<char>()};
+
+        last_reparse_.reset();
+        std::vector<SyntaxDiagnostic> syntax_diagnostics;
+        if (tree_ == nullptr) {
+            SyntaxParser parser(&tokens, 0, tokens.size());
+            tree_ = parser.ParseItems();
+            syntax_diagnostics = parser.GetDiagnostics();
+        } else {
+            const SyntaxParser::TokenEdit edit = FindEdit(tokens_, source_, tokens, source);
+            if (edit.begin == tokens_.size() && edit.begin == tokens.size()) {
+                return diagnostics_.empty();
+            }
+            last_reparse_ = SyntaxParser::Reparse(&tree_, tokens, edit, &syntax_diagnostics);
+        }
+
+        // an edit inside a body keeps the queries about all other bodies, anything else starts over
+        const FunctionNode *edited_function = nullptr;
+        if (last_reparse_.has_value() && last_reparse_->is_in_place) {
+            edited_function = dynamic_cast<const FunctionNode *>(tree_->GetNodes()[last_reparse_->replaced_items.front()]);
+        }
+        if (edited_function == nullptr) {
+            queries_.reset();
+        }
+
+        tokens_ = std::move(tokens);
+        source_ = std::move(source);
+
+        diagnostics_.clear();
+        for (const SyntaxDiagnostic &diagnostic : syntax_diagnostics) {
+            diagnostics_.push_back(diagnostic.ToString());
+        }
+        if (!diagnostics_.empty()) {
+            queries_.reset();
+            return false;
+        }
+
+        try {
+            if (queries_ != nullptr) {
+                queries_->InvalidateBody(edited_function);
+            } else {
+                queries_ = std::make_unique<semantic::QueryEngine>(tree_.get(), iet_);
+            }
+            queries_->CheckReachable(nullptr);
+        } catch (const semantic::SemanticError &error) {
+            // the queries may have stopped halfway, the next update starts over
+            diagnostics_.push_back(error.ToString());
+            queries_.reset();
+            return false;
+        } catch (const std::exception &) {
+            // parts of the analysis still throw without a position, a watching driver has to survive them
+            diagnostics_.push_back("error: the semantic analysis failed");
+            queries_.reset();
+            return false;
+        }
+        return true;
+    }
+
+    // positioned as "line:column: error: message" where the error has a position
+    const std::vector<std::string> &GetDiagnostics() const {
+        return diagnostics_;
+    }
+
+    const SyntaxTree *GetTree() const {
+        return tree_.get();
+    }
+
+    // null while there are errors
+    semantic::QueryEngine *GetQueries() const {
+        return queries_.get();
+    }
+
+    // of the last update that changed the tokens, none after the first one
+    const std::optional<SyntaxParser::ReparseResult> &GetLastReparse() const {
+        return last_reparse_;
+    }
+
+    // a token is kept when its type and its text are the same, a kept token before the edit also has the same position
+    static SyntaxParser::TokenEdit FindEdit(const std::vector<Token> &old_tokens, const std::string &old_source, const std::vector<Token> &new_tokens, const std::string &new_source) {
+        const auto get_text = [](const Token &token, const std::string &source) {
+            const auto begin = static_cast<size_t>(static_cast<std::streamoff>(token.GetPosition().start_offset));
+            const auto end = static_cast<size_t>(static_cast<std::streamoff>(token.GetPosition().end_offset));
+            return source.substr(begin, end - begin);
+        };
+        const auto is_same = [&](const Token &old_token, const Token &new_token) {
+            return old_token.GetType() == new_token.GetType() && get_text(old_token, old_source) == get_text(new_token, new_source);
+        };
+        const auto is_same_position = [](const Token &old_token, const Token &new_token) {
+            const Token::Position old_position = old_token.GetPosition();
+            const Token::Position new_position = new_token.GetPosition();
+            return old_position.start_offset == new_position.start_offset && old_position.start_line == new_position.start_line &&
+                   old_position.start_column == new_position.start_column;
+        };
+
+        const size_t size = std::min(old_tokens.size(), new_tokens.size());
+        size_t prefix = 0;
+        while (prefix < size && is_same(old_tokens[prefix], new_tokens[prefix]) && is_same_position(old_tokens[prefix], new_tokens[prefix])) {
+            prefix++;
+        }
+
+        size_t suffix = 0;
+        while (suffix < size - prefix && is_same(old_tokens[old_tokens.size() - suffix - 1], new_tokens[new_tokens.size() - suffix - 1])) {
+            suffix++;
+        }
+
+        return SyntaxParser::TokenEdit{prefix, old_tokens.size() - suffix, new_tokens.size() - suffix};
+    }
+
+private:
+    std::string filename_;
+    const ImportExportTable *iet_;
+
+    std::vector<Token> tokens_;
+    std::string source_;
+    std::unique_ptr<SyntaxTree> tree_;
+    std::unique_ptr<semantic::QueryEngine> queries_;
+    std::vector<std::string> diagnostics_;
+    std::optional<SyntaxParser::ReparseResult> last_reparse_;
+};
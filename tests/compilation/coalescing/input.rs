@@ -0,0 +1,50 @@
+fn swap(n: i32) -> i32 {
+    let mut a = 1i32;
+    let mut b = 2i32;
+    let mut i = 0i32;
+    while i < n {
+        let t = a;
+        a = b;
+        b = t;
+        i += 1i32;
+    }
+    return a * 10i32 + b;
+}
+
+fn rotate(n: i32) -> i64 {
+    let mut a = 1i64;
+    let mut b = 2i64;
+    let mut c = 3i64;
+    let mut i = 0i32;
+    while i < n {
+        let t = a;
+        a = b;
+        b = c;
+        c = t * 10i64;
+        i += 1i32;
+    }
+    return a * 10000i64 + b * 100i64 + c;
+}
+
+fn live(x: i32) -> i32 {
+    let a = x + 1i32;
+    let b = x + 2i32;
+    let c = x * 3i32;
+    let d = a * b;
+    let e = c - a;
+    print_i32(d);
+    return d + e * b + a;
+}
+
+fn fibonacci(x: f64, n: i32) -> f64 {
+    let mut s = x;
+    let mut t = 0f64;
+    let mut i = 0i32;
+    while i < n {
+        let u = s + t;
+        t = s;
+        s = u;
+        i += 1i32;
+    }
+    return s - t;
+}
@@ -0,0 +1,27 @@
+fn square(x: i32) -> i32 {
+    return x * x;
+}
+
+fn effects(x: i32) -> i32 {
+    let a = x * 2i32;
+    print_i32(x);
+    let b = square(x);
+    let c = 10i32 / x;
+    if false {
+        print_i32(-1i32);
+    }
+    let mut n = 0i32;
+    while n < 0i32 {
+        print_i32(-2i32);
+        n += 1i32;
+    }
+    if x > 100i32 {
+        return a;
+    } else {
+        return x + 1i32;
+    }
+}
+
+fn main() {
+    print_i32(effects(4i32));
+}
@@ -0,0 +1,35 @@
+fn overflow(x: i32) -> i32 {
+    let min = -2147483647i32 - 1i32;
+    if x > 0i32 {
+        return min / -1i32;
+    }
+    return min % -1i32;
+}
+
+fn zero(x: i64) -> i64 {
+    let d = 0i64;
+    if x > 0i64 {
+        return 7i64 / d;
+    }
+    return 7i64 % (d + 1i64);
+}
+
+fn unused(x: i32) -> i32 {
+    if x > 0i32 {
+        let q = 1i32 / 0i32;
+    }
+    print_i32(x);
+    return x;
+}
+
+fn main() {
+    let max = 2147483647i32;
+    print_i32(max + 1i32);
+    print_i32(max * 2i32);
+    print_i64(-9223372036854775807i64 - 2i64);
+    print_i32(-7i32 / 2i32);
+    print_i32(-7i32 % 2i32);
+    print_i32(1i32 << 33i32);
+    print_i32(-16i32 >> 2i32);
+    print_f64(1f64 / 0f64);
+}
@@ -0,0 +1,41 @@
+struct P {
+    a: i32,
+    b: i64,
+}
+
+fn once(x: i32) -> i32 {
+    print_i32(x);
+    return x * 2i32;
+}
+
+fn small(x: i32) -> i32 {
+    return x + 1i32;
+}
+
+fn fib(n: i32) -> i32 {
+    if n < 2i32 {
+        return n;
+    }
+    return fib(n - 1i32) + fib(n - 2i32);
+}
+
+fn early(x: i32) -> i32 {
+    if x > 5i32 {
+        return 1i32;
+    }
+    print_i32(x);
+    return 0i32;
+}
+
+fn make(n: i32) -> i64 {
+    let p = P { a: n, b: 2i64 };
+    return p.b * 10i64 + 1i64;
+}
+
+fn main() {
+    print_i32(once(3i32));
+    print_i32(small(1i32) + small(2i32) + small(small(3i32)));
+    print_i32(fib(10i32));
+    print_i32(early(3i32) + early(9i32));
+    print_i64(make(1i32) + make(2i32));
+}
@@ -0,0 +1,63 @@
+struct P {
+    a: i32,
+    b: i32,
+}
+
+fn guarded(n: i32, d: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        if d != 0i32 {
+            s += 100i32 / d;
+        }
+        i += 1i32;
+    }
+    return s;
+}
+
+fn late(n: i32, d: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        print_i32(i);
+        s += 100i32 / d;
+        i += 1i32;
+    }
+    return s;
+}
+
+fn side(x: i32) -> i32 {
+    print_i32(x);
+    return x * 2i32;
+}
+
+fn calls(n: i32, x: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        s += side(x);
+        i += 1i32;
+    }
+    return s;
+}
+
+fn loads(n: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        let p = P { a: i, b: n };
+        s += p.a * p.b;
+        i += 1i32;
+    }
+    return s;
+}
+
+fn invariant(n: i32, x: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        s += x * 3i32 + i;
+        i += 1i32;
+    }
+    return s;
+}
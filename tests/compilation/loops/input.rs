@@ -0,0 +1,42 @@
+fn sum_to(n: i64) -> i64 {
+    let mut s = 0i64;
+    let mut i = 0i64;
+    while i < n {
+        s += i * 3i64;
+        i += 1i64;
+    }
+    return s;
+}
+
+fn sq(x: f32) -> f32 {
+    return x * x;
+}
+
+fn pick(a: i32, b: i32) -> i32 {
+    let mut r = 0i32;
+    if a > b {
+        r = a - b;
+    } else if a == b {
+        r = 0i32;
+    } else {
+        r = b % 7i32;
+    }
+    return r;
+}
+
+fn main() {
+    let mut k = 0i32;
+    let mut acc = 0i32;
+    while k < 10i32 {
+        acc += pick(k, 5i32) * 2i32;
+        acc += 0i32;
+        k += 1i32;
+    }
+    print_i32(acc);
+    print_i64(sum_to(100i64));
+    print_f32(sq(1.5f32));
+    if !(k == 10i32) {
+        print_i32(-1i32);
+    }
+    print_i32(-k);
+}
@@ -0,0 +1,40 @@
+fn fact(n: i64) -> i64 {
+    let mut r = 1i64;
+    if n > 1i64 {
+        r = n * fact(n - 1i64);
+    }
+    return r;
+}
+
+fn mix(a: f64, b: f64) -> f64 {
+    let t = a * 2f64 + b / 4f64;
+    {
+        let u = t - 1f64;
+        let w = u * u;
+        print_f64(w);
+    }
+    let v = 3f64 * 2f64 - 1f64;
+    return t + v;
+}
+
+fn bits(x: i32) -> i32 {
+    let a = x * 8i32;
+    let b = x / 4i32;
+    let c = x % 16i32;
+    let d = x + 0i32;
+    let e = x * 1i32;
+    let f = x - x;
+    return a + b + c + d + e + f + (x << 2i32) + (x >> 1i32) + (x ^ 5i32) + (x & 12i32) + (x | 3i32);
+}
+
+fn main() {
+    print_i64(fact(10i64));
+    print_f64(mix(1.5f64, 8f64));
+    print_i32(bits(37i32));
+    print_i32(bits(-37i32));
+    let mut n = 0i32;
+    while n < 5i32 {
+        n += 1i32;
+    }
+    print_i32(n);
+}
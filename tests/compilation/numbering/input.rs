@@ -0,0 +1,45 @@
+struct P {
+    a: i32,
+    b: i32,
+}
+
+fn next(x: i32) -> i32 {
+    print_i32(x);
+    return x + 1i32;
+}
+
+fn triple(x: i32) -> i32 {
+    return x * 3i32 + 1i32;
+}
+
+fn calls(x: i32) -> i32 {
+    let a = next(x);
+    let b = next(x);
+    let c = triple(x) + triple(x);
+    return a + b + c;
+}
+
+fn loads(n: i32) -> i32 {
+    let mut i = 0i32;
+    let mut s = 0i32;
+    while i < n {
+        let p = P { a: i, b: n };
+        s += p.a;
+        print_i32(p.a);
+        s += p.a * p.b;
+        i += 1i32;
+    }
+    return s;
+}
+
+fn redundant(x: i32, y: i32) -> i32 {
+    let a = x * y + 1i32;
+    let b = y * x + 1i32;
+    let mut s = 0i32;
+    if x > 0i32 {
+        s = x * y;
+    } else {
+        s = x * y + 1i32;
+    }
+    return a + b + s;
+}
@@ -0,0 +1,42 @@
+fn calc_fib() -> i32 {
+    let mut a = 1i32;
+    let mut b = 1i32;
+    let mut i = 2i32;
+
+    while i != 22i32 {
+        a += b;
+        b = a - b;
+        i += 1i32;
+    }
+
+    return a;
+}
+
+fn abs(x: f64) -> f64 {
+    if x < 0f64 {
+        return -x;
+    }
+    return x;
+}
+
+fn f(x: f64) -> f64 {
+    return x * x;
+}
+
+fn int(mut from: f64, to: f64, frags: f64) -> f64 {
+    let eps = 1e-6;
+
+    let h = (to - from) / frags;
+    let mut result = 0f64;
+    while abs(from - to) >= eps {
+        result += f(from) * h;
+        from += h;
+    }
+
+    return result;
+}
+
+fn main() {
+    print_f64(int(0f64, 2f64, 5000f64));
+    print_i32(calc_fib());
+}
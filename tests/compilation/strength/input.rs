@@ -0,0 +1,35 @@
+fn div8(x: i32) -> i32 {
+    return x / 8i32;
+}
+
+fn rem8(x: i32) -> i32 {
+    return x % 8i32;
+}
+
+fn div_minus4(x: i32) -> i32 {
+    return x / -4i32;
+}
+
+fn rem_minus4(x: i32) -> i32 {
+    return x % -4i32;
+}
+
+fn div_min(x: i32) -> i32 {
+    return x / (-2147483647i32 - 1i32);
+}
+
+fn rem_min(x: i32) -> i32 {
+    return x % (-2147483647i32 - 1i32);
+}
+
+fn div16(x: i64) -> i64 {
+    return x / 16i64;
+}
+
+fn rem16(x: i64) -> i64 {
+    return x % 16i64;
+}
+
+fn mul(x: i32) -> i32 {
+    return x * 8i32 + x * -2i32 + x * 1i32 + x * 0i32;
+}
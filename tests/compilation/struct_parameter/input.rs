@@ -0,0 +1,13 @@
+struct P {
+    a: i32,
+    b: i64,
+}
+
+fn get(p: P) -> i32 {
+    return p.a;
+}
+
+fn main() {
+    let p = P { a: 7i32, b: 9i64 };
+    print_i32(get(p));
+}
@@ -0,0 +1,66 @@
+struct P {
+    a: i32,
+    b: i64,
+}
+
+struct Q {
+    x: bool,
+    p: P,
+    c: i32,
+}
+
+struct T(f64, Q);
+
+fn depth(n: i32) -> i32 {
+    let p = P { a: n, b: 1i64 };
+    if p.a == 0i32 {
+        return 0i32;
+    }
+    return depth(p.a - 1i32) + 1i32;
+}
+
+// fields are assigned in place, a struct bound or assigned to another variable is copied
+fn fields(n: i32) -> i32 {
+    let mut q = Q { x: false, p: P { a: n, b: 2i64 }, c: 1i32 };
+    q.c = 10i32;
+    q.p.a += 5i32;
+    q.p.b *= 3i64;
+    q.x = q.p.a > 6i32;
+
+    let mut r = q;
+    r.c = 20i32;
+    r.p = P { a: 1i32, b: 4i64 };
+    print_i32(q.c);
+    print_i32(r.c);
+    print_i64(q.p.b);
+
+    let mut i = 0i32;
+    while i < 3i32 {
+        q.c += i;
+        i += 1i32;
+    }
+    print_i32(q.c);
+
+    if q.x {
+        print_i32(q.p.a);
+    }
+    q = r;
+    print_i32(q.p.a);
+    print_i64(q.p.b);
+    return q.c + r.c;
+}
+
+fn main() {
+    let q = Q { x: true, p: P { a: 7i32, b: 9i64 }, c: 3i32 };
+    print_i32(q.p.a);
+    print_i64(q.p.b);
+    print_i32(q.c);
+
+    let t = T(2.5, q);
+    print_f64(t.0);
+    print_i32((t.1).p.a);
+    print_i64((t.1).p.b);
+
+    print_i32(depth(5000i32));
+    print_i32(fields(2i32));
+}
@@ -0,0 +1,12 @@
+fn unused(x: i32) -> i32 {
+    let y: f64 = x;
+    return y;
+}
+
+fn square(x: i32) -> i32 {
+    return x * x;
+}
+
+fn main() {
+    print_i32(square(12i32));
+}
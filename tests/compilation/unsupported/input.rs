@@ -0,0 +1,5 @@
+fn main() {
+    let x = 1i32;
+    let pair = (x, 2i32);
+    print_i32(x);
+}
@@ -0,0 +1,3 @@
+fn main() {
+    [1i32; ];
+}
@@ -0,0 +1,3 @@
+const C: i32 = ;
+fn main() {
+}
@@ -0,0 +1,5 @@
+fn main() {
+    1i32 +;
+    let x = -;
+    let y = (1i32 * );
+}
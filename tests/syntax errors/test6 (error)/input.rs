@@ -0,0 +1,7 @@
+fn f() {
+    let = 3;
+}
+const C: i32 = ;
+fn main() {
+    return !;
+}